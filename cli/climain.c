@@ -24,19 +24,25 @@ typedef struct deen_cli_args deen_cli_args;
 struct deen_cli_args {
 	deen_bool version;
 	deen_bool index;
+	deen_bool merge;
+	deen_bool stats;
 	deen_bool trace_enabled;
 	uint32_t result_count;
 	uint8_t *search_expression;
 	char *ding_filename;
+	char *local_filename;
 };
 
 static void deen_cli_init_args(deen_cli_args *args) {
 	args->version = DEEN_FALSE;
 	args->index = DEEN_FALSE;
+	args->merge = DEEN_FALSE;
+	args->stats = DEEN_FALSE;
 	args->trace_enabled = DEEN_FALSE;
 	args->result_count = DEEN_RESULT_SIZE_DEFAULT;
 	args->search_expression = NULL;
 	args->ding_filename = NULL;
+	args->local_filename = NULL;
 }
 
 static void deen_cli_syntax(char *binary_name) {
@@ -44,7 +50,9 @@ static void deen_cli_syntax(char *binary_name) {
 	printf("version %s\n",DEEN_VERSION);
 	printf("%s [-h]\n", binary_name_basename);
 	printf("%s [-v]\n", binary_name_basename);
-	printf("%s [-t] [-i] <ding-file>\n", binary_name_basename);
+	printf("%s [-t] [-s] [-i] <ding-file>\n", binary_name_basename);
+	printf("%s [-t] [-a] <entries-file>\n", binary_name_basename);
+	printf("%s [-t] [-m]\n", binary_name_basename);
 	printf("%s [-t] [-c <result-count>] <search-term>\n", binary_name_basename);
 	exit(1);
 }
@@ -76,6 +84,23 @@ static void deen_cli_capture_args(deen_cli_args *args, int argc, char** argv) {
 					i++;
 					break;
 
+				case 'a':
+					if (i == argc - 1) {
+						deen_log_error_and_exit("expected a file of entries to be specified");
+					}
+
+					args->local_filename = argv[i + 1];
+					i++;
+					break;
+
+				case 'm':
+					args->merge = DEEN_TRUE;
+					break;
+
+				case 's':
+					args->stats = DEEN_TRUE;
+					break;
+
 				case 'v':
 					args->version = DEEN_TRUE;
 					break;
@@ -115,10 +140,18 @@ static void deen_cli_capture_args(deen_cli_args *args, int argc, char** argv) {
 }
 
 static void deen_cli_validate_args(deen_cli_args *args) {
-	if (args->index) {
+	if (args->index || args->merge || NULL != args->local_filename) {
 		if (NULL != args->search_expression) {
 			deen_log_error_and_exit("when indexing, search arguments are not allowed");
 		}
+
+		if ((args->index ? 1 : 0) + (args->merge ? 1 : 0) + (NULL != args->local_filename ? 1 : 0) > 1) {
+			deen_log_error_and_exit("only one of installing, adding entries or merging is allowed");
+		}
+
+		if (args->stats && !args->index) {
+			deen_log_error_and_exit("statistics are only available when installing");
+		}
 	}
 	else {
 		if (
@@ -138,10 +171,62 @@ static deen_bool deen_cli_install_progress_cb(
 	return DEEN_TRUE; // keep going
 }
 
-static void deen_cli_index(const char *filename) {
+static double deen_cli_per_second(uint64_t count, deen_millis millis) {
+	if (0 == millis) {
+		return 0.0;
+	}
+
+	return ((double) count * 1000.0) / (double) millis;
+}
+
+static void deen_cli_print_stats(const deen_install_stats *stats) {
+	printf("elapsed ............... %llu ms\n", stats->elapsed_millis);
+	printf("read .................. %llu bytes; %.0f bytes/s\n",
+		(unsigned long long) stats->bytes_read,
+		deen_cli_per_second(stats->bytes_read, stats->elapsed_millis));
+	printf("tokenized ............. %llu lines; %.0f lines/s\n",
+		(unsigned long long) stats->lines_count,
+		deen_cli_per_second(stats->lines_count, stats->elapsed_millis));
+	printf("emitted ............... %llu prefixes; %.0f prefixes/s\n",
+		(unsigned long long) stats->prefixes_count,
+		deen_cli_per_second(stats->prefixes_count, stats->elapsed_millis));
+	printf("time reading .......... %llu ms\n", stats->read_millis);
+	printf("time tokenizing ....... %llu ms (over all workers)\n", stats->tokenize_millis);
+	printf("time deduplicating .... %llu ms (sort %llu, spill %llu, merge %llu)\n",
+		stats->sort_millis + stats->spill_millis + stats->merge_millis,
+		stats->sort_millis, stats->spill_millis, stats->merge_millis);
+	printf("time writing database . %llu ms (load %llu, create indexes %llu)\n",
+		stats->load_millis + stats->create_indexes_millis,
+		stats->load_millis, stats->create_indexes_millis);
+	printf("peak resident memory .. %llu bytes\n", (unsigned long long) stats->peak_rss);
+	printf("index rows ............ %llu\n", (unsigned long long) stats->index_rows_count);
+	printf("data size ............. %llu bytes\n", (unsigned long long) stats->data_size);
+	printf("index size ............ %llu bytes\n", (unsigned long long) stats->index_size);
+	printf("map index size ........ %llu bytes\n", (unsigned long long) stats->map_index_size);
+}
+
+static void deen_cli_index(const char *filename, deen_bool is_stats) {
+	char *root_dir = deen_root_dir();
+	deen_install_stats stats;
+
+	if (deen_install_from_path(
+		root_dir,
+		filename,
+		NULL,
+		deen_cli_install_progress_cb,
+		NULL, // no is cancelled function
+		is_stats ? &stats : NULL
+	) && is_stats) {
+		deen_cli_print_stats(&stats);
+	}
+
+	free((void *) root_dir);
+}
+
+static void deen_cli_index_local(const char *filename) {
 	char *root_dir = deen_root_dir();
 
-	deen_install_from_path(
+	deen_install_local_from_path(
 		root_dir,
 		filename,
 		NULL,
@@ -152,16 +237,25 @@ static void deen_cli_index(const char *filename) {
 	free((void *) root_dir);
 }
 
-static void deen_cli_check_and_index(const char *filename) {
+static void deen_cli_merge() {
+	char *root_dir = deen_root_dir();
+
+	deen_install_merge(
+		root_dir,
+		NULL,
+		deen_cli_install_progress_cb,
+		NULL // no is cancelled function
+	);
+
+	free((void *) root_dir);
+}
+
+static void deen_cli_check_and_index(const char *filename, deen_bool is_stats) {
 	switch (deen_install_check_for_ding_format(filename)) {
 
 		case DEEN_INSTALL_CHECK_OK:
 			DEEN_LOG_INFO0("the ding input file looks like valid data");
-			deen_cli_index(filename);
-			break;
-
-		case DEEN_INSTALL_CHECK_IS_COMPRESSED:
-			DEEN_LOG_ERROR0("the ding input file looks compressed; decompress it first");
+			deen_cli_index(filename, is_stats);
 			break;
 
 		case DEEN_INSTALL_CHECK_IO_PROBLEM:
@@ -260,7 +354,11 @@ int main(int argc, char** argv) {
 	// now action the indexing.
 
 	if (args.index) {
-		deen_cli_check_and_index(args.ding_filename);
+		deen_cli_check_and_index(args.ding_filename, args.stats);
+	} else if (NULL != args.local_filename) {
+		deen_cli_index_local(args.local_filename);
+	} else if (args.merge) {
+		deen_cli_merge();
 	} else {
 		if (NULL != args.search_expression) {
 			deen_cli_query(&args);
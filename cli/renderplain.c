@@ -16,6 +16,7 @@
 #include <windows.h>
 #endif
 
+#include "core/common.h"
 #include "core/constants.h"
 #include "core/keyword.h"
 #include "rendercommon.h"
@@ -98,8 +99,7 @@ static void deen_render_plain_text_highlights(
 
 				is_valid_keyword_found =
 					0 == first_keyword.offset ||
-					isspace(text[first_keyword.offset-1]) ||
-					ispunct(text[first_keyword.offset-1]);
+					!DEEN_IS_WORD_BYTE(text[first_keyword.offset-1]);
 
 				if(is_valid_keyword_found) {
 					fputs(TTYRED, stdout);
@@ -253,6 +253,82 @@ static void test_for_each_word_from_file() {
 }
 
 
+/*
+This test reads the same input file into memory and checks the words against
+the same reference output as the test above.
+*/
+
+static void test_for_each_word_from_buffer() {
+	int fd = open("core-test/input_for_each_word_from_file_a.txt", O_RDONLY);
+	FILE *reference_file;
+	uint8_t buffer[4096];
+	ssize_t buffer_len;
+
+	if (-1 == fd) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_buffer' -- unable to open test data");
+	}
+
+	buffer_len = read(fd, buffer, sizeof(buffer));
+	close(fd);
+
+	if (buffer_len <= 0 || buffer_len == sizeof(buffer)) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_buffer' -- unable to read test data");
+	}
+
+	reference_file = fopen("core-test/output_for_each_word_from_file_a.txt", "r");
+
+	if (NULL == reference_file) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_buffer' -- unable to open reference data");
+	}
+
+	if (!deen_for_each_word_from_buffer(
+		buffer,
+		(size_t) buffer_len,
+		0,
+		&test_for_each_word_from_file_check_callback,
+		(void *) reference_file)) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_buffer' -- unable to process the buffer");
+	}
+
+	fclose(reference_file);
+
+	DEEN_LOG_INFO0("passed test 'test_for_each_word_from_buffer'");
+}
+
+
+/*
+This test maps the same input file and checks the words against the same
+reference output.
+*/
+
+static void test_for_each_word_from_mapped_file() {
+	int fd = open("core-test/input_for_each_word_from_file_a.txt", O_RDONLY);
+	FILE *reference_file;
+
+	if (-1 == fd) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_mapped_file' -- unable to open test data");
+	}
+
+	reference_file = fopen("core-test/output_for_each_word_from_file_a.txt", "r");
+
+	if (NULL == reference_file) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_mapped_file' -- unable to open reference data");
+	}
+
+	if (!deen_for_each_word_from_mapped_file(
+		fd,
+		&test_for_each_word_from_file_check_callback,
+		(void *) reference_file)) {
+		deen_log_error_and_exit("failed test 'test_for_each_word_from_mapped_file' -- unable to process the file");
+	}
+
+	close(fd);
+	fclose(reference_file);
+
+	DEEN_LOG_INFO0("passed test 'test_for_each_word_from_mapped_file'");
+}
+
+
 // ---------------------------------------------------------------
 // FOR EACH WORD FROM MEMORY
 // ---------------------------------------------------------------
@@ -312,6 +388,155 @@ static void test_for_each_word() {
 	DEEN_LOG_INFO0("passed test 'test_for_each_word'");
 }
 
+
+/*
+Words that are longer than a vector's width are scanned in blocks so this
+checks that the word boundaries are still found in the right places.
+*/
+
+static deen_bool test_for_each_word__long_words_callback(
+	const uint8_t *s,
+	size_t offset,
+	size_t len,
+	void *context) {
+	size_t *lens = (size_t *) context;
+	lens[++lens[0]] = len;
+	return DEEN_TRUE;
+}
+
+static void test_for_each_word__long_words() {
+	uint8_t *sample = (uint8_t *) "Donaudampfschifffahrtsgesellschaft,"
+		"Kapit\xc3\xa4nsm\xc3\xbctze abcdefghijklmnop qrstuvwxyz0123456789ABCDEF";
+	size_t expected[] = { 34, 15, 16, 26 };
+	size_t lens[8] = { 0 };
+
+	deen_for_each_word(
+		sample,
+		0,
+		&test_for_each_word__long_words_callback,
+		lens);
+
+	if (4 != lens[0] || 0 != memcmp(&lens[1], expected, sizeof(expected))) {
+		deen_log_error_and_exit("failed test 'test_for_each_word__long_words'");
+	}
+
+	for (int i = 0; i < 256; i++) {
+		deen_bool expected_is_word = i >= 0x80 || !(isspace(i) || ispunct(i));
+
+		if (expected_is_word != DEEN_IS_WORD_BYTE(i)) {
+			deen_log_error_and_exit("failed test 'test_for_each_word__long_words'"
+				" -- byte class of %d", i);
+		}
+	}
+
+	DEEN_LOG_INFO0("passed test 'test_for_each_word__long_words'");
+}
+
+/*
+Finds the words in two lines with a batch that is smaller than the number of
+words so that the scan has to be resumed.
+*/
+
+static void test_word_scan_spans() {
+	const uint8_t *sample = (uint8_t *) "Es ist\nmir K\xc3\xa4se";
+	deen_word_span expected[] = {
+		{ 0, 2, 100 },
+		{ 3, 3, 100 },
+		{ 7, 3, 107 },
+		{ 11, 5, 107 }
+	};
+	deen_word_span spans[3];
+	deen_word_scan scan;
+	size_t span_count;
+	size_t upto = 0;
+	size_t i;
+
+	deen_word_scan_init(&scan, sample, strlen((char *) sample), 100, DEEN_TRUE);
+
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, 3))) {
+		for (i = 0; i < span_count; i++, upto++) {
+			if (upto >= 4
+				|| expected[upto].offset != spans[i].offset
+				|| expected[upto].len != spans[i].len
+				|| expected[upto].ref != spans[i].ref) {
+				deen_log_error_and_exit("failed test 'test_word_scan_spans' -- span %u", upto);
+			}
+		}
+	}
+
+	if (4 != upto || DEEN_SEQUENCE_OK != scan.sequence_result) {
+		deen_log_error_and_exit("failed test 'test_word_scan_spans'");
+	}
+
+	DEEN_LOG_INFO0("passed test 'test_word_scan_spans'");
+}
+
+/*
+The hash is checked against published FNV-1a values and hashing in pieces
+should give the same result as hashing in one go.
+*/
+
+static void test_hash() {
+	const uint8_t *sample = (uint8_t *) "foobar";
+	uint64_t hash_pieces = deen_hash(deen_hash(DEEN_HASH_INITIAL, sample, 2), &sample[2], 4);
+
+	// - - - - - - - - - -
+	if (DEEN_HASH_INITIAL != deen_hash(DEEN_HASH_INITIAL, sample, 0)
+		|| 0xaf63dc4c8601ec8cULL != deen_hash(DEEN_HASH_INITIAL, (uint8_t *) "a", 1)
+		|| 0x85944171f73967e8ULL != deen_hash(DEEN_HASH_INITIAL, sample, 6)
+		|| 0x85944171f73967e8ULL != hash_pieces) {
+		deen_log_error_and_exit("failed test 'test_hash'");
+	}
+	// - - - - - - - - - -
+
+	DEEN_LOG_INFO0("passed test 'test_hash'");
+}
+
+/*
+Memory from the arena should be aligned and should not overlap; an allocation
+larger than a chunk should still be served.
+*/
+
+static void test_arena() {
+	deen_arena arena;
+	uint8_t *small1;
+	uint8_t *small2;
+	uint8_t *large;
+	uint8_t *small3;
+
+	deen_arena_init(&arena);
+
+	// - - - - - - - - - -
+	small1 = (uint8_t *) deen_arena_alloc(&arena, 3);
+	large = (uint8_t *) deen_arena_alloc(&arena, DEEN_ARENA_CHUNK_SIZE * 2);
+	small2 = (uint8_t *) deen_arena_alloc(&arena, 5);
+	small3 = (uint8_t *) deen_arena_alloc(&arena, 0);
+	// - - - - - - - - - -
+
+	memset(small1, 1, 3);
+	memset(large, 2, DEEN_ARENA_CHUNK_SIZE * 2);
+	memset(small2, 3, 5);
+
+	if (0 != ((uintptr_t) small1) % 16
+		|| 0 != ((uintptr_t) small2) % 16
+		|| 0 != ((uintptr_t) large) % 16
+		|| small2 < small1 + 3
+		|| small3 < small2 + 5
+		|| 1 != small1[2]
+		|| 2 != large[(DEEN_ARENA_CHUNK_SIZE * 2) - 1]
+		|| 3 != small2[0]) {
+		deen_log_error_and_exit("failed test 'test_arena'");
+	}
+
+	deen_arena_free(&arena);
+
+	if (NULL != arena.chunks) {
+		deen_log_error_and_exit("failed test 'test_arena'; chunks remain");
+	}
+
+	DEEN_LOG_INFO0("passed test 'test_arena'");
+}
+
 // ---------------------------------------------------------------
 
 static void test_to_upper() {
@@ -431,7 +656,13 @@ int main(int argc, char** argv) {
 	test_utf8_sequence_len__accented();
 	test_utf8_sequence_len__non_accented();
 	test_for_each_word_from_file();
+	test_for_each_word_from_buffer();
+	test_for_each_word_from_mapped_file();
 	test_for_each_word();
+	test_for_each_word__long_words();
+	test_word_scan_spans();
+	test_hash();
+	test_arena();
 	test_to_upper();
 	test_imatches_at__positive();
 	test_imatches_at__negative();
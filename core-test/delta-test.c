@@ -0,0 +1,165 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/common.h"
+#include "core/delta.h"
+#include "core/types.h"
+
+/*
+Adds each of the lines in the installed data to the delta.
+*/
+
+static deen_delta *test_delta_create(const char *installed) {
+	size_t installed_len = strlen(installed);
+	deen_delta *delta = deen_delta_create((const uint8_t *) installed, installed_len);
+	size_t start = 0;
+	size_t i;
+
+	for (i = 0; i < installed_len; i++) {
+		if ('\n' == installed[i]) {
+			deen_delta_add_installed_line(delta, (off_t) start, i - start);
+			start = i + 1;
+		}
+	}
+
+	return delta;
+}
+
+
+static deen_bool test_delta_match(deen_delta *delta, const char *line) {
+	return deen_delta_match_line(delta, (const uint8_t *) line, strlen(line));
+}
+
+
+static void test_delta_added_and_deleted() {
+	const char *installed = "Haus :: house\nBaum :: tree\nHund :: dog\n";
+	deen_delta *delta = test_delta_create(installed);
+	off_t *refs;
+	size_t refs_count;
+
+	// - - - - - - - - - -
+	if (!test_delta_match(delta, "Hund :: dog")) {
+		deen_log_error_and_exit("failed test 'test_delta_added_and_deleted' -- moved line not matched");
+	}
+
+	if (test_delta_match(delta, "Baum :: trees")) {
+		deen_log_error_and_exit("failed test 'test_delta_added_and_deleted' -- changed line matched");
+	}
+
+	if (!test_delta_match(delta, "Haus :: house")) {
+		deen_log_error_and_exit("failed test 'test_delta_added_and_deleted' -- line not matched");
+	}
+
+	refs = deen_delta_unmatched_refs(delta, &refs_count);
+	// - - - - - - - - - -
+
+	if (1 != refs_count || 14 != refs[0]) {
+		deen_log_error_and_exit("failed test 'test_delta_added_and_deleted' -- unexpected deleted refs");
+	}
+
+	free((void *) refs);
+	deen_delta_free(delta);
+
+	DEEN_LOG_INFO0("passed test 'test_delta_added_and_deleted'");
+}
+
+
+/*
+A line that appears twice in the new version only matches twice if it was
+installed twice.
+*/
+
+static void test_delta_repeated_line() {
+	const char *installed = "Haus :: house\nHaus :: house\nBaum :: tree\n";
+	deen_delta *delta = test_delta_create(installed);
+	off_t *refs;
+	size_t refs_count;
+
+	// - - - - - - - - - -
+	if (!test_delta_match(delta, "Haus :: house") || !test_delta_match(delta, "Haus :: house")) {
+		deen_log_error_and_exit("failed test 'test_delta_repeated_line' -- repeated line not matched");
+	}
+
+	if (test_delta_match(delta, "Haus :: house")) {
+		deen_log_error_and_exit("failed test 'test_delta_repeated_line' -- line matched too often");
+	}
+
+	refs = deen_delta_unmatched_refs(delta, &refs_count);
+	// - - - - - - - - - -
+
+	if (1 != refs_count || 28 != refs[0]) {
+		deen_log_error_and_exit("failed test 'test_delta_repeated_line' -- unexpected deleted refs");
+	}
+
+	free((void *) refs);
+	deen_delta_free(delta);
+
+	DEEN_LOG_INFO0("passed test 'test_delta_repeated_line'");
+}
+
+
+/*
+Enough lines are added that the table of lines has to grow.
+*/
+
+static void test_delta_many_lines() {
+	size_t lines_count = 5000;
+	char *installed = (char *) deen_emalloc(lines_count * 16 + 1);
+	char line[16];
+	off_t *refs;
+	size_t refs_count;
+	size_t len = 0;
+	size_t i;
+	deen_delta *delta;
+
+	for (i = 0; i < lines_count; i++) {
+		len += (size_t) sprintf(&installed[len], "Wort%06u\n", (unsigned) i);
+	}
+
+	delta = test_delta_create(installed);
+
+	// - - - - - - - - - -
+	for (i = 1; i < lines_count; i++) {
+		sprintf(line, "Wort%06u", (unsigned) i);
+
+		if (!test_delta_match(delta, line)) {
+			deen_log_error_and_exit("failed test 'test_delta_many_lines' -- line %u not matched", (unsigned) i);
+		}
+	}
+
+	refs = deen_delta_unmatched_refs(delta, &refs_count);
+	// - - - - - - - - - -
+
+	if (1 != refs_count || 0 != refs[0]) {
+		deen_log_error_and_exit("failed test 'test_delta_many_lines' -- unexpected deleted refs");
+	}
+
+	free((void *) refs);
+	free((void *) installed);
+	deen_delta_free(delta);
+
+	DEEN_LOG_INFO0("passed test 'test_delta_many_lines'");
+}
+
+
+// ---------------------------------------------------------------
+// DRIVING THE TESTS
+// ---------------------------------------------------------------
+
+
+int main(int argc, char** argv) {
+
+	test_delta_added_and_deleted();
+	test_delta_repeated_line();
+	test_delta_many_lines();
+
+	return 0;
+}
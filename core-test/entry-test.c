@@ -14,10 +14,13 @@
 #include "core/keyword.h"
 
 
+#define EXAMPLE_1_GERMAN "W\xc3\xbcsst {m} [zool.] | Regensburg [geol.]; Donnau {f} {pl} [geol.]"
+#define EXAMPLE_1_ENGLISH "Chop [sport]; Peanutbutter Sauce | Toe [Br.]"
+
 static deen_entry deen_create_example_1() {
 	return deen_entry_create(
-		(const uint8_t *) "W\xc3\xbcsst {m} [zool.] | Regensburg [geol.]; Donnau {f} {pl} [geol.]",
-		(const uint8_t *) "Chop [sport]; Peanutbutter Sauce | Toe [Br.]");
+		(const uint8_t *) EXAMPLE_1_GERMAN,
+		(const uint8_t *) EXAMPLE_1_ENGLISH);
 }
 
 /*
@@ -88,6 +91,55 @@ static void test_create() {
 	DEEN_LOG_INFO0("passed test 'test_create'");
 }
 
+/*
+ A parser is reused on the parts of a line that are not terminated and the
+ entry is created in an arena.  The parts of the line are kept in place so that
+ the atoms must have been copied out of the line into the entry.
+ */
+
+static void test_parser_reused() {
+	const char *line = "Hund {m} :: hound [zool.]; dog\nKatze {f} | Mieze :: cat";
+	deen_entry_parser parser;
+	deen_arena arena;
+	deen_entry entry1;
+	deen_entry entry2;
+
+	deen_entry_parser_init(&parser);
+	deen_arena_init(&arena);
+
+	// - - - - - - - - - -
+	deen_entry_parser_parse(&parser, (const uint8_t *) line, 9, (const uint8_t *) &line[12], 18);
+	entry1 = deen_entry_parser_create_entry(&parser, &arena);
+	deen_entry_parser_parse(&parser, (const uint8_t *) &line[31], 18, (const uint8_t *) &line[52], 3);
+	entry2 = deen_entry_parser_create_entry(&parser, &arena);
+	// - - - - - - - - - -
+
+	if (1 != entry1.german_sub_count
+		|| 1 != entry1.english_sub_count
+		|| 2 != entry1.english_subs[0].sub_sub_count
+		|| 2 != entry1.english_subs[0].sub_subs[0].atom_count
+		|| 0 != strcmp((char *) entry1.german_subs[0].sub_subs[0].atoms[1].text, "m")
+		|| 0 != strcmp((char *) entry1.english_subs[0].sub_subs[0].atoms[0].text, "hound")
+		|| ATOM_CONTEXT != entry1.english_subs[0].sub_subs[0].atoms[1].type
+		|| 0 != strcmp((char *) entry1.english_subs[0].sub_subs[0].atoms[1].text, "zool.")
+		|| 0 != strcmp((char *) entry1.english_subs[0].sub_subs[1].atoms[0].text, "dog")
+		|| NULL != entry1.block) {
+		deen_log_error_and_exit("failed test 'test_parser_reused' -- bad first entry");
+	}
+
+	if (2 != entry2.german_sub_count
+		|| 1 != entry2.english_sub_count
+		|| 0 != strcmp((char *) entry2.german_subs[1].sub_subs[0].atoms[0].text, "Mieze")
+		|| 0 != strcmp((char *) entry2.english_subs[0].sub_subs[0].atoms[0].text, "cat")) {
+		deen_log_error_and_exit("failed test 'test_parser_reused' -- bad second entry");
+	}
+
+	deen_arena_free(&arena);
+	deen_entry_parser_free(&parser);
+
+	DEEN_LOG_INFO0("passed test 'test_parser_reused'");
+}
+
 /*
  The expected found bitmap is a 32bit number each bit of which indicates
  if the keyword should have been found or not.
@@ -104,9 +156,18 @@ static void test_entry_calculate_distance_from_keywords__generic(
 	deen_bool *keyword_use_map = (deen_bool *) deen_emalloc(
 		sizeof(deen_bool) * keywords->count);
 
+	// the line is not terminated between the german and the english.
+	const uint8_t *line = (const uint8_t *) EXAMPLE_1_GERMAN " :: " EXAMPLE_1_ENGLISH;
+	size_t german_len = strlen(EXAMPLE_1_GERMAN);
+	uint32_t german_sub_count;
+
 	// - - - - - - - - - -
 	uint32_t actual_distance = deen_entry_calculate_distance_from_keywords(
 		&entry, keywords, keyword_use_map);
+	uint32_t actual_line_distance = deen_entry_calculate_line_distance_from_keywords(
+		line, german_len,
+		&line[german_len + 4], strlen(EXAMPLE_1_ENGLISH),
+		keywords, keyword_use_map, &german_sub_count);
 	// - - - - - - - - - -
 
 
@@ -119,6 +180,12 @@ static void test_entry_calculate_distance_from_keywords__generic(
 			test_name, expected_distance, actual_distance);
 	}
 
+	if (expected_distance != actual_line_distance || entry.german_sub_count != german_sub_count) {
+		deen_log_error_and_exit(
+			"failed test '%s' -- expected %d from the line, was %d",
+			test_name, expected_distance, actual_line_distance);
+	}
+
 	DEEN_LOG_INFO1("passed test '%s'", test_name);
 }
 
@@ -148,6 +215,7 @@ static void test_entry_calculate_distance_from_keywords__two_keywords() {
 
 int main(int argc, char** argv) {
 	test_create();
+	test_parser_reused();
 	test_entry_calculate_distance_from_keywords__ok();
 	test_entry_calculate_distance_from_keywords__full_match();
 	test_entry_calculate_distance_from_keywords__not_found();
@@ -14,54 +14,124 @@ results come out.
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <sqlite3.h>
 
 #include "core/index.h"
 #include "core/common.h"
+#include "core/mapindex.h"
 #include "core/types.h"
 
 #define OUTPUT_DATABASE_FILE "tmp_index_e2e.sqlite"
+#define OUTPUT_MAP_INDEX_FILE "tmp_index_e2e.map"
 
-static void test_index_e2e_setup(sqlite3 *db) {
-	DEEN_LOG_TRACE0("will init database...");
-	deen_index_init(db);
+#define OUTPUT_RUNS_DIR "."
+
+static void test_index_e2e_add_line(deen_index_add_context *add_context, size_t line_i) {
+	static uint8_t *prefixes[3][3] = {
+		{ (uint8_t *) "ERT", (uint8_t *) "RAT", (uint8_t *) "DAT" },
+		{ (uint8_t *) "ZEE", (uint8_t *) "RAT", (uint8_t *) "PIN" },
+		{ (uint8_t *) "PIG", (uint8_t *) "ZIG", (uint8_t *) "DIG" }
+	};
+	static off_t refs[3] = { 123, 456, 789 };
+
+	deen_index_add(add_context, refs[line_i], prefixes[line_i], 3);
+}
 
+static deen_index_add_context *test_index_e2e_create_add_context(
+	sqlite3 *db,
+	size_t pairs_budget,
+	size_t shards_count,
+	deen_map_index_writer *map_index_writer) {
 	DEEN_LOG_TRACE0("will create add context...");
 	deen_index_add_context *add_context = deen_index_add_context_create(db);
 
-	DEEN_LOG_TRACE0("add to index...");
-	{
-		uint8_t *prefixes[3] = {
-			(uint8_t *) "ERT",
-			(uint8_t *) "RAT",
-			(uint8_t *) "DAT"
-		};
-
-		deen_index_add(add_context, 123, prefixes, 3);
+	if (0 != pairs_budget) {
+		add_context->pairs_budget = pairs_budget;
 	}
 
-	{
-		uint8_t *prefixes[3] = {
-			(uint8_t *) "ZEE",
-			(uint8_t *) "RAT",
-			(uint8_t *) "PIN"
-		};
+	deen_index_add_set_shards(add_context, shards_count);
 
-		deen_index_add(add_context, 456, prefixes, 3);
-	}
+	deen_index_add_set_map_index_writer(add_context, map_index_writer);
 
-	{
-		uint8_t *prefixes[3] = {
-			(uint8_t *) "PIG",
-			(uint8_t *) "ZIG",
-			(uint8_t *) "DIG"
-		};
+	return add_context;
+}
+
+/*
+If the indexing is resumed then the first lines are added to a context that is
+checkpointed and then freed as if the install had stopped.  The rest are added
+to a second context that carries on from the checkpoint.  The second context
+should plan its shards from the same counts of the pairs' first bytes as the
+first had.
+*/
+
+static void test_index_e2e_setup(
+	sqlite3 *db,
+	size_t pairs_budget,
+	size_t shards_count,
+	deen_bool is_resumed,
+	deen_map_index_writer *map_index_writer) {
+	size_t line_i = 0;
+
+	DEEN_LOG_TRACE0("will init database...");
+	deen_index_init(db);
+
+	if (is_resumed) {
+		size_t first_byte_counts[256];
+		uint32_t runs_count;
+		deen_index_add_context *stopped_add_context =
+			test_index_e2e_create_add_context(db, pairs_budget, shards_count, NULL);
 
-		deen_index_add(add_context, 789, prefixes, 3);
+		deen_index_add_set_runs_dir(stopped_add_context, OUTPUT_RUNS_DIR);
+
+		for (; line_i < 2; line_i++) {
+			test_index_e2e_add_line(stopped_add_context, line_i);
+		}
+
+		DEEN_LOG_TRACE0("checkpoint and stop...");
+		runs_count = deen_index_add_checkpoint(stopped_add_context);
+		memcpy(first_byte_counts, stopped_add_context->first_byte_counts, sizeof(first_byte_counts));
+		deen_index_add_context_free(stopped_add_context);
+
+		deen_index_add_context *add_context =
+			test_index_e2e_create_add_context(db, pairs_budget, shards_count, map_index_writer);
+
+		deen_index_add_set_runs_dir(add_context, OUTPUT_RUNS_DIR);
+
+		DEEN_LOG_TRACE0("resume...");
+		if (!deen_index_add_resume(add_context, runs_count)) {
+			deen_log_error_and_exit("unable to resume the indexing");
+		}
+
+		if (0 != memcmp(first_byte_counts, add_context->first_byte_counts, sizeof(first_byte_counts))) {
+			deen_log_error_and_exit("the first byte counts differ after the indexing was resumed");
+		}
+
+		for (; line_i < 3; line_i++) {
+			test_index_e2e_add_line(add_context, line_i);
+		}
+
+		DEEN_LOG_TRACE0("finish adding to index...");
+		deen_index_add_finish(add_context);
+
+		DEEN_LOG_TRACE0("close add context...");
+		deen_index_add_context_free(add_context);
 	}
+	else {
+		deen_index_add_context *add_context =
+			test_index_e2e_create_add_context(db, pairs_budget, shards_count, map_index_writer);
 
-	DEEN_LOG_TRACE0("close add context...");
-	deen_index_add_context_free(add_context);
+		DEEN_LOG_TRACE0("add to index...");
+		for (; line_i < 3; line_i++) {
+			test_index_e2e_add_line(add_context, line_i);
+		}
+
+		DEEN_LOG_TRACE0("finish adding to index...");
+		deen_index_add_finish(add_context);
+
+		DEEN_LOG_TRACE0("close add context...");
+		deen_index_add_context_free(add_context);
+	}
 }
 
 static deen_bool test_index_e2e_find_ref(deen_index_lookup_result *result, off_t expected) {
@@ -74,14 +144,12 @@ static deen_bool test_index_e2e_find_ref(deen_index_lookup_result *result, off_t
 	return DEEN_FALSE;
 }
 
-static deen_bool test_index_e2e_lookup(sqlite3 *db) {
-
-	DEEN_LOG_TRACE0("perform lookup...");
-	deen_index_lookup_result *lookup_result = deen_index_lookup(db, (uint8_t *) "RAT");
+static deen_bool test_index_e2e_check(deen_index_lookup_result *lookup_result) {
 	deen_bool result = DEEN_TRUE;
 
 	if (2 != lookup_result->refs_count) {
 		DEEN_LOG_ERROR0("not able to find the expected references");
+		result = DEEN_FALSE;
 	}
 
 	if (DEEN_TRUE != test_index_e2e_find_ref(lookup_result, 123)) {
@@ -100,18 +168,107 @@ static deen_bool test_index_e2e_lookup(sqlite3 *db) {
 	return result;
 }
 
+static deen_bool test_index_e2e_lookup(sqlite3 *db) {
+	deen_bool result = DEEN_TRUE;
+	deen_index_reader *reader = deen_index_reader_open(db, DEEN_TRUE);
+
+	if (NULL == reader) {
+		DEEN_LOG_ERROR0("not able to open a reader of the index");
+		return DEEN_FALSE;
+	}
+
+	DEEN_LOG_TRACE0("perform lookup...");
+
+	if (2 != deen_index_lookup_count(reader, (uint8_t *) "RAT")) {
+		DEEN_LOG_ERROR0("not able to count the expected references");
+		result = DEEN_FALSE;
+	}
+
+	if (0 != deen_index_lookup_count(reader, (uint8_t *) "QQQ")) {
+		DEEN_LOG_ERROR0("counted references for a prefix that was not indexed");
+		result = DEEN_FALSE;
+	}
+
+	result = test_index_e2e_check(deen_index_lookup(reader, (uint8_t *) "RAT")) && result;
+
+	// the prepared statement is used again for a second lookup.
+
+	result = test_index_e2e_check(deen_index_lookup(reader, (uint8_t *) "RAT")) && result;
+
+	{
+		deen_index_lookup_result *lookup_result = deen_index_lookup(reader, (uint8_t *) "QQQ");
+
+		if (0 != lookup_result->refs_count) {
+			DEEN_LOG_ERROR0("found references for a prefix that was not indexed");
+			result = DEEN_FALSE;
+		}
+
+		deen_index_lookup_result_free(lookup_result);
+	}
+
+	deen_index_reader_free(reader);
+
+	return result;
+}
+
+static deen_bool test_index_e2e_map_index_lookup() {
+	deen_bool result = DEEN_TRUE;
+	deen_map_index *map_index = deen_map_index_open(OUTPUT_MAP_INDEX_FILE);
+
+	if (NULL == map_index) {
+		DEEN_LOG_ERROR0("not able to open the map index");
+		return DEEN_FALSE;
+	}
+
+	DEEN_LOG_TRACE0("perform map index lookup...");
+	result = test_index_e2e_check(deen_map_index_lookup(map_index, (uint8_t *) "RAT"));
+
+	if (2 != deen_map_index_lookup_count(map_index, (uint8_t *) "RAT")) {
+		DEEN_LOG_ERROR0("not able to count the expected references in the map index");
+		result = DEEN_FALSE;
+	}
+
+	if (0 != deen_map_index_lookup_count(map_index, (uint8_t *) "QQQ")) {
+		DEEN_LOG_ERROR0("counted references in the map index for a prefix that was not indexed");
+		result = DEEN_FALSE;
+	}
+
+	{
+		deen_index_lookup_result *lookup_result = deen_map_index_lookup(map_index, (uint8_t *) "QQQ");
+
+		if (0 != lookup_result->refs_count) {
+			DEEN_LOG_ERROR0("found references for a prefix that was not indexed");
+			result = DEEN_FALSE;
+		}
+
+		deen_index_lookup_result_free(lookup_result);
+	}
+
+	deen_map_index_close(map_index);
+
+	return result;
+}
+
  /*
  This is an end-to-end test of the indexing.  So it will create an index data
  set, it will load some index data and it will then query that data to make
- sure that it generates sensible, expected results.
+ sure that it generates sensible, expected results.  A non-zero pairs budget
+ forces the builder to spill sorted runs to disk and merge them.  With more than
+ one shard, the runs are merged in parts at the same time.
  */
 
- static void test_index_e2e() {
+ static void test_index_e2e_generic(
+	const char *test_name,
+	size_t pairs_budget,
+	size_t shards_count,
+	deen_bool is_resumed,
+	deen_bool with_map_index) {
 
 	 sqlite3 *db = NULL;
+	deen_map_index_writer *map_index_writer = NULL;
 	deen_bool result = DEEN_TRUE;
 
-	 DEEN_LOG_TRACE0("running test 'test_index_e2e'");
+	 DEEN_LOG_TRACE1("running test '%s'", test_name);
 
 	 DEEN_LOG_TRACE0("will open database...");
 	 if (SQLITE_OK != sqlite3_open_v2(
@@ -122,12 +279,33 @@ static deen_bool test_index_e2e_lookup(sqlite3 *db) {
 			 DEEN_LOG_ERROR0("not able to create database");
 	 }
 
+	 if (DEEN_TRUE == result && with_map_index) {
+		 map_index_writer = deen_map_index_writer_create(OUTPUT_MAP_INDEX_FILE);
+
+		 if (NULL == map_index_writer) {
+			 result = DEEN_FALSE;
+			 DEEN_LOG_ERROR0("not able to create map index");
+		 }
+	 }
+
 	 if (DEEN_TRUE == result) {
-		 test_index_e2e_setup(db);
+		 test_index_e2e_setup(db, pairs_budget, shards_count, is_resumed, map_index_writer);
 	}
 
 	 result = result && test_index_e2e_lookup(db);
 
+	 if (NULL != map_index_writer) {
+		 result = deen_map_index_writer_finish(map_index_writer) && result;
+		 deen_map_index_writer_free(map_index_writer);
+
+		 result = result && test_index_e2e_map_index_lookup();
+
+		 if (0 != remove(OUTPUT_MAP_INDEX_FILE)) {
+			 result = DEEN_FALSE;
+			 DEEN_LOG_ERROR0("unable to delete the temporary map index file.");
+		 }
+	 }
+
 	 if(NULL != db) {
 		DEEN_LOG_TRACE0("will close database...");
 		sqlite3_close_v2(db);
@@ -140,11 +318,111 @@ static deen_bool test_index_e2e_lookup(sqlite3 *db) {
  	}
 
 	if (DEEN_TRUE == result) {
-		DEEN_LOG_INFO0("passed test 'test_index_e2e'");
+		DEEN_LOG_INFO1("passed test '%s'", test_name);
 	} else {
-		deen_log_error_and_exit("failed test 'test_index_e2e'");
+		deen_log_error_and_exit("failed test '%s'", test_name);
+	}
+
+ }
+
+ /*
+ The metadata should read back as it was written and an index without any
+ metadata should be noticed.
+ */
+
+ static void test_index_metadata() {
+	sqlite3 *db = NULL;
+	deen_index_metadata metadata = { 0xfedcba9876543210ULL, 30609731, DEEN_INDEXING_DEPTH, DEEN_INDEX_FORMAT_VERSION };
+	deen_index_metadata read_metadata;
+
+	if (SQLITE_OK != sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL)) {
+		deen_log_error_and_exit("failed test 'test_index_metadata' -- unable to open database");
+	}
+
+	// - - - - - - - - - -
+	if (deen_index_read_metadata(db, &read_metadata)) {
+		deen_log_error_and_exit("failed test 'test_index_metadata' -- read metadata before init");
 	}
 
+	deen_index_init(db);
+	deen_index_write_metadata(db, &metadata);
+
+	if (!deen_index_read_metadata(db, &read_metadata)
+		|| 0 != memcmp(&metadata, &read_metadata, sizeof(deen_index_metadata))
+		|| !deen_index_metadata_is_current(&read_metadata)) {
+		deen_log_error_and_exit("failed test 'test_index_metadata' -- metadata differs");
+	}
+
+	read_metadata.indexing_depth++;
+
+	if (deen_index_metadata_is_current(&read_metadata)) {
+		deen_log_error_and_exit("failed test 'test_index_metadata' -- different depth is current");
+	}
+	// - - - - - - - - - -
+
+	sqlite3_close_v2(db);
+
+	DEEN_LOG_INFO0("passed test 'test_index_metadata'");
+ }
+
+ static void test_index_checkpoint() {
+	sqlite3 *db = NULL;
+	deen_index_metadata metadata = { 0xfedcba9876543210ULL, 30609731, DEEN_INDEXING_DEPTH, DEEN_INDEX_FORMAT_VERSION };
+	deen_index_checkpoint checkpoint = { 8388621, 0x0123456789abcdefULL, 3, DEEN_INDEX_FORMAT_VERSION };
+	deen_index_checkpoint read_checkpoint;
+
+	if (SQLITE_OK != sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL)) {
+		deen_log_error_and_exit("failed test 'test_index_checkpoint' -- unable to open database");
+	}
+
+	deen_index_init(db);
+	deen_index_write_metadata(db, &metadata);
+
+	// - - - - - - - - - -
+	if (deen_index_read_checkpoint(db, &read_checkpoint)) {
+		deen_log_error_and_exit("failed test 'test_index_checkpoint' -- read checkpoint before written");
+	}
+
+	deen_index_write_checkpoint(db, &checkpoint);
+
+	if (!deen_index_read_checkpoint(db, &read_checkpoint)
+		|| 0 != memcmp(&checkpoint, &read_checkpoint, sizeof(deen_index_checkpoint))) {
+		deen_log_error_and_exit("failed test 'test_index_checkpoint' -- checkpoint differs");
+	}
+
+	deen_index_delete_checkpoint(db);
+
+	if (deen_index_read_checkpoint(db, &read_checkpoint)) {
+		deen_log_error_and_exit("failed test 'test_index_checkpoint' -- read checkpoint after deleted");
+	}
+
+	// the metadata should not go with the checkpoint.
+
+	if (!deen_index_read_metadata(db, &metadata)) {
+		deen_log_error_and_exit("failed test 'test_index_checkpoint' -- metadata deleted");
+	}
+	// - - - - - - - - - -
+
+	sqlite3_close_v2(db);
+
+	DEEN_LOG_INFO0("passed test 'test_index_checkpoint'");
+ }
+
+ static void test_index_e2e() {
+	 test_index_e2e_generic("test_index_e2e", 0, 1, DEEN_FALSE, DEEN_FALSE);
+ }
+
+ static void test_index_e2e__spilled_runs() {
+	 test_index_e2e_generic("test_index_e2e__spilled_runs", 2, 1, DEEN_FALSE, DEEN_FALSE);
+ }
+
+ static void test_index_e2e__map_index() {
+	 test_index_e2e_generic("test_index_e2e__map_index", 2, 1, DEEN_FALSE, DEEN_TRUE);
+ }
+
+ static void test_index_e2e__shards() {
+	 test_index_e2e_generic("test_index_e2e__shards", 2, 3, DEEN_FALSE, DEEN_TRUE);
+	 test_index_e2e_generic("test_index_e2e__shards_resumed", 2, 3, DEEN_TRUE, DEEN_TRUE);
  }
 
  // ---------------------------------------------------------------
@@ -155,6 +433,11 @@ static deen_bool test_index_e2e_lookup(sqlite3 *db) {
  int main(int argc, char** argv) {
 
  	test_index_e2e();
+ 	test_index_e2e__spilled_runs();
+ 	test_index_e2e__map_index();
+ 	test_index_e2e__shards();
+ 	test_index_metadata();
+ 	test_index_checkpoint();
 
  	return 0;
  }
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+/*
+These tests install a little data into a directory of their own and then work
+on that install.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __MINGW32__
+#include <io.h>
+#include <sys/locking.h>
+#else
+#include <sys/file.h>
+#endif
+
+#include "core/common.h"
+#include "core/constants.h"
+#include "core/install.h"
+#include "core/types.h"
+
+#define OUTPUT_ROOT_DIR "tmp_install_test"
+
+static char *test_install_path(const char *leaf) {
+	char *path = (char *) deen_emalloc(strlen(OUTPUT_ROOT_DIR) + strlen(leaf) + 2);
+	sprintf(path, "%s%s%s", OUTPUT_ROOT_DIR, DEEN_FILE_SEP, leaf);
+	return path;
+}
+
+
+static void test_install_write_file(const char *leaf, const char *content) {
+	char *path = test_install_path(leaf);
+	FILE *f = fopen(path, "wb");
+
+	if (NULL == f || strlen(content) != fwrite(content, 1, strlen(content), f) || 0 != fclose(f)) {
+		deen_log_error_and_exit("unable to write the test file; %s", path);
+	}
+
+	free((void *) path);
+}
+
+
+static void test_install_remove_file(const char *leaf) {
+	char *path = test_install_path(leaf);
+	remove(path);
+	free((void *) path);
+}
+
+
+static off_t test_install_file_size(const char *leaf) {
+	char *path = test_install_path(leaf);
+	struct stat path_stat;
+	off_t result = 0 == stat(path, &path_stat) ? path_stat.st_size : -1;
+	free((void *) path);
+	return result;
+}
+
+
+/*
+Holds the install lock in the same way that another install would.  Returns
+the file that is to be closed to let go of the lock.
+*/
+
+static int test_install_hold_lock() {
+	char *path = test_install_path(DEEN_LEAF_INSTALL_LOCK);
+	int fd_lock = open(path, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+
+#ifdef __MINGW32__
+	if (-1 == fd_lock || 0 != _locking(fd_lock, _LK_NBLCK, 1)) {
+#else
+	if (-1 == fd_lock || 0 != flock(fd_lock, LOCK_EX|LOCK_NB)) {
+#endif
+		deen_log_error_and_exit("unable to hold the install lock; %s", path);
+	}
+
+	free((void *) path);
+
+	return fd_lock;
+}
+
+
+/*
+While another install holds the lock, adding entries and merging should both
+fail without touching what is installed.  Once the lock is let go of, adding
+entries should work again.
+*/
+
+static void test_install_locked() {
+	off_t data_size;
+	int fd_lock;
+	deen_bool local_result;
+	deen_bool merge_result;
+
+#ifdef __MINGW32__
+	mkdir(OUTPUT_ROOT_DIR);
+#else
+	mkdir(OUTPUT_ROOT_DIR, 0777);
+#endif
+
+	test_install_write_file("source.txt", "# test data\nHaus :: house\nBaum :: tree\nHund :: dog\n");
+	test_install_write_file("local.txt", "Katze :: cat\n");
+
+	if (!deen_install_from_path(OUTPUT_ROOT_DIR, OUTPUT_ROOT_DIR DEEN_FILE_SEP "source.txt", NULL, NULL, NULL, NULL)) {
+		deen_log_error_and_exit("failed test 'test_install_locked' -- unable to install");
+	}
+
+	data_size = test_install_file_size(DEEN_LEAF_DING_DATA);
+
+	// - - - - - - - - - -
+	fd_lock = test_install_hold_lock();
+	local_result = deen_install_local_from_path(
+		OUTPUT_ROOT_DIR, OUTPUT_ROOT_DIR DEEN_FILE_SEP "local.txt", NULL, NULL, NULL);
+	merge_result = deen_install_merge(OUTPUT_ROOT_DIR, NULL, NULL, NULL);
+	close(fd_lock);
+	// - - - - - - - - - -
+
+	if (local_result || merge_result) {
+		deen_log_error_and_exit("failed test 'test_install_locked' -- worked while locked");
+	}
+
+	if (data_size != test_install_file_size(DEEN_LEAF_DING_DATA)) {
+		deen_log_error_and_exit("failed test 'test_install_locked' -- installed data changed while locked");
+	}
+
+	if (!deen_install_local_from_path(
+		OUTPUT_ROOT_DIR, OUTPUT_ROOT_DIR DEEN_FILE_SEP "local.txt", NULL, NULL, NULL)
+		|| data_size == test_install_file_size(DEEN_LEAF_DING_DATA)) {
+		deen_log_error_and_exit("failed test 'test_install_locked' -- unable to add entries once unlocked");
+	}
+
+	test_install_remove_file("source.txt");
+	test_install_remove_file("local.txt");
+	test_install_remove_file(DEEN_LEAF_DING_DATA);
+	test_install_remove_file(DEEN_LEAF_INDEX);
+	test_install_remove_file(DEEN_LEAF_MAP_INDEX);
+	test_install_remove_file(DEEN_LEAF_INSTALL_LOCK);
+
+	if (0 != rmdir(OUTPUT_ROOT_DIR)) {
+		deen_log_error_and_exit("failed test 'test_install_locked' -- files were left behind");
+	}
+
+	DEEN_LOG_INFO0("passed test 'test_install_locked'");
+}
+
+
+// ---------------------------------------------------------------
+// DRIVING THE TESTS
+// ---------------------------------------------------------------
+
+
+int main(int argc, char** argv) {
+
+	test_install_locked();
+
+	return 0;
+}
@@ -6,6 +6,7 @@
  *		Andrew Lindesay, apl@lindesay.co.nz
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "core/common.h"
@@ -30,6 +31,77 @@ static void test_keywords_all_present() {
 }
 
 
+/*
+The input here has more words than are found in one batch so the keywords have
+to be looked for beyond the first batch.
+*/
+
+static void test_keywords_all_present__many_words() {
+	deen_keywords *keywords = deen_keywords_create();
+	size_t words = DEEN_WORD_SPANS_BATCH * 2;
+	uint8_t *input = (uint8_t *) deen_emalloc(sizeof(uint8_t) * (words * 5 + 16));
+	size_t i;
+
+	for (i = 0; i < words; i++) {
+		memcpy(&input[i * 5], "Zing ", 5);
+	}
+
+	strcpy((char *) &input[words * 5], "Yert");
+
+	deen_keywords_add_from_string(keywords, (uint8_t *) "YERT ZING");
+
+	// - - - - - - - - - -
+	if(DEEN_TRUE != deen_keywords_all_present(keywords, input)) {
+		deen_log_error_and_exit("failed test 'test_keywords_all_present__many_words'");
+	}
+	// - - - - - - - - - -
+
+	input[words * 5] = 0;
+
+	if(DEEN_FALSE != deen_keywords_all_present(keywords, input)) {
+		deen_log_error_and_exit("failed test 'test_keywords_all_present__many_words' -- absent");
+	}
+
+	free((void *) input);
+	deen_keywords_free(keywords);
+
+	DEEN_LOG_INFO0("passed test 'test_keywords_all_present__many_words'");
+}
+
+
+/*
+Only the given length of the input is looked at; here the input carries on with
+the rest of the line as it would in the mapped data.
+*/
+
+static void test_keywords_all_present_len() {
+	deen_keywords *keywords = deen_keywords_create();
+	const uint8_t *input = (const uint8_t *) "Zing Zong :: Yert Zing";
+
+	deen_keywords_add_from_string(keywords, (uint8_t *) "ZING");
+
+	// - - - - - - - - - -
+	if(DEEN_TRUE != deen_keywords_all_present_len(keywords, input, 9)) {
+		deen_log_error_and_exit("failed test 'test_keywords_all_present_len'");
+	}
+	// - - - - - - - - - -
+
+	deen_keywords_add_from_string(keywords, (uint8_t *) "YERT");
+
+	if(DEEN_FALSE != deen_keywords_all_present_len(keywords, input, 9)) {
+		deen_log_error_and_exit("failed test 'test_keywords_all_present_len' -- beyond the length");
+	}
+
+	if(DEEN_TRUE != deen_keywords_all_present_len(keywords, &input[13], 9)) {
+		deen_log_error_and_exit("failed test 'test_keywords_all_present_len' -- second part");
+	}
+
+	deen_keywords_free(keywords);
+
+	DEEN_LOG_INFO0("passed test 'test_keywords_all_present_len'");
+}
+
+
 static void test_keywords_longest_keyword() {
 	deen_keywords *keywords = deen_keywords_create();
 
@@ -72,6 +144,8 @@ static void test_keywords_adjust() {
 
 int main(int argc, char** argv) {
 	test_keywords_all_present();
+	test_keywords_all_present__many_words();
+	test_keywords_all_present_len();
 	test_keywords_longest_keyword();
 	test_keywords_adjust();
 	return 0;
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+/*
+This is a benchmark of the intersection of posting lists rather than a test.
+It needs the data to have been installed.  Words are taken from random lines
+of the installed data and their posting lists are looked up in the installed
+index so that the lengths of the lists are the same as a search would find.
+The lists for pairs of the words are then intersected in the way that a search
+of two words would do it.  The intersection that searches for each ref with
+'bsearch' and removes misses with 'memmove' is also timed to compare with.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "core/common.h"
+#include "core/index.h"
+#include "core/mapindex.h"
+#include "core/posting.h"
+#include "core/types.h"
+
+#define BENCH_WORDS_COUNT 1000
+
+// the intersection with 'bsearch' is slow on long lists so it is only run once.
+
+#define BENCH_REPEATS_GALLOP 20
+#define BENCH_REPEATS_BSEARCH 1
+
+typedef struct bench_posting bench_posting;
+struct bench_posting {
+	off_t *refs;
+	size_t refs_count;
+};
+
+
+static int bench_compare_refs(const void *item1, const void *item2) {
+	off_t int1 = ((off_t *)item1)[0];
+	off_t int2 = ((off_t *)item2)[0];
+	if (int1 == int2) return 0;
+	if (int1 < int2) return -1;
+	return 1;
+}
+
+
+static size_t bench_intersect_bsearch(
+	off_t *refs,
+	size_t refs_count,
+	const off_t *other_refs,
+	size_t other_refs_count) {
+
+	size_t i;
+
+	for (i = 0; i < refs_count;) {
+		if (NULL == bsearch(&refs[i], other_refs, other_refs_count, sizeof(off_t), &bench_compare_refs)) {
+			memmove(&refs[i], &refs[i + 1], sizeof(off_t) * ((refs_count - i) - 1));
+			refs_count--;
+		}
+		else {
+			i++;
+		}
+	}
+
+	return refs_count;
+}
+
+
+/*
+Takes a word of at least the indexing length from the line that follows the
+random offset in the data and looks up its posting list.  Returns false if no
+such word was found.
+*/
+
+static deen_bool bench_sample_posting(
+	const uint8_t *data,
+	size_t data_len,
+	deen_map_index *map_index,
+	bench_posting *posting) {
+
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t spans_count;
+	size_t words_count = 0;
+	size_t offset = (size_t) (((double) rand() / ((double) RAND_MAX + 1.0)) * (double) data_len);
+	size_t line_end;
+	size_t i;
+	uint8_t prefix[DEEN_INDEX_PREFIX_WIDTH + 1];
+	deen_index_lookup_result *lookup_result;
+
+	while (offset < data_len && '\n' != data[offset]) {
+		offset++;
+	}
+
+	offset++;
+	line_end = offset;
+
+	while (line_end < data_len && '\n' != data[line_end]) {
+		line_end++;
+	}
+
+	if (offset >= data_len || '#' == data[offset]) {
+		return DEEN_FALSE;
+	}
+
+	deen_word_scan_init(&scan, &data[offset], line_end - offset, (off_t) offset, DEEN_FALSE);
+	spans_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH);
+
+	// keep only the spans of words that are indexed.
+
+	for (i = 0; i < spans_count; i++) {
+		if (spans[i].len >= DEEN_INDEXING_MIN && spans[i].len < sizeof(prefix)) {
+			spans[words_count++] = spans[i];
+		}
+	}
+
+	if (0 == words_count) {
+		return DEEN_FALSE;
+	}
+
+	i = (size_t) rand() % words_count;
+	memcpy(prefix, &data[offset + spans[i].offset], spans[i].len);
+	prefix[spans[i].len] = 0;
+	deen_to_upper(prefix);
+	deen_utf8_crop_to_unicode_len(prefix, strlen((char *) prefix), DEEN_INDEXING_DEPTH);
+
+	lookup_result = deen_map_index_lookup(map_index, prefix);
+	posting->refs_count = lookup_result->refs_count;
+	posting->refs = (off_t *) deen_emalloc(sizeof(off_t) * (posting->refs_count + 1));
+	memcpy(posting->refs, lookup_result->refs, sizeof(off_t) * posting->refs_count);
+	deen_index_lookup_result_free(lookup_result);
+
+	return 0 != posting->refs_count;
+}
+
+
+static int bench_compare_postings(const void *item1, const void *item2) {
+	size_t count1 = ((const bench_posting *) item1)->refs_count;
+	size_t count2 = ((const bench_posting *) item2)->refs_count;
+	if (count1 == count2) return 0;
+	if (count1 < count2) return -1;
+	return 1;
+}
+
+
+/*
+Intersects each pair of the postings a number of times and returns the average
+time for each intersection in microseconds.  The number of refs found in one
+round of the pairs is returned so that the methods can be checked against each
+other.
+*/
+
+static double bench_run(
+	size_t (*intersect)(off_t *, size_t, const off_t *, size_t),
+	const bench_posting *postings,
+	size_t postings_count,
+	size_t repeats,
+	off_t *buffer,
+	uint64_t *found_count) {
+
+	deen_millis start_ms = deen_millis_since_epoc();
+	size_t r;
+	size_t i;
+
+	*found_count = 0;
+
+	for (r = 0; r < repeats; r++) {
+		for (i = 0; i + 1 < postings_count; i += 2) {
+			const bench_posting *a = &postings[i];
+			const bench_posting *b = &postings[i + 1];
+			memcpy(buffer, a->refs, sizeof(off_t) * a->refs_count);
+			*found_count += intersect(buffer, a->refs_count, b->refs, b->refs_count);
+		}
+	}
+
+	*found_count /= repeats;
+
+	return ((double) (deen_millis_since_epoc() - start_ms) * 1000.0) / (double) ((postings_count / 2) * repeats);
+}
+
+
+int main(int argc, char** argv) {
+	char *root_dir = deen_root_dir();
+	char *data_path = deen_data_path(root_dir);
+	char *map_index_path = deen_map_index_path(root_dir);
+	deen_map_index *map_index = deen_map_index_open(map_index_path);
+	bench_posting *postings = (bench_posting *) deen_emalloc(sizeof(bench_posting) * BENCH_WORDS_COUNT);
+	bench_posting *sorted_postings;
+	size_t postings_count = 0;
+	size_t longest = 0;
+	size_t attempts = 0;
+	const uint8_t *data;
+	size_t data_len = 0;
+	off_t *buffer;
+	uint64_t found_gallop;
+	uint64_t found_bsearch;
+	double gallop_us;
+	double bsearch_us;
+	int fd_data;
+	size_t i;
+
+	if (NULL == map_index) {
+		deen_log_error_and_exit("the data needs to be installed first; no map index at %s", map_index_path);
+	}
+
+	fd_data = open(data_path, O_RDONLY);
+	data = -1 == fd_data ? NULL : deen_map_file(fd_data, &data_len, DEEN_FALSE);
+
+	if (NULL == data) {
+		deen_log_error_and_exit("unable to map the installed data at %s", data_path);
+	}
+
+	srand(42);
+
+	while (postings_count < BENCH_WORDS_COUNT && attempts < BENCH_WORDS_COUNT * 100) {
+		if (bench_sample_posting(data, data_len, map_index, &postings[postings_count])) {
+			if (postings[postings_count].refs_count > longest) {
+				longest = postings[postings_count].refs_count;
+			}
+
+			postings_count++;
+		}
+		attempts++;
+	}
+
+	if (0 == postings_count) {
+		deen_log_error_and_exit("no words were found in the installed data");
+	}
+
+	// the pairs are of words in the order that they were sampled.
+
+	sorted_postings = (bench_posting *) deen_emalloc(sizeof(bench_posting) * (postings_count + 1));
+	memcpy(sorted_postings, postings, sizeof(bench_posting) * postings_count);
+	qsort(sorted_postings, postings_count, sizeof(bench_posting), &bench_compare_postings);
+
+	printf("posting lists ...... %u\n", (unsigned) postings_count);
+	printf("refs; median ....... %u\n", (unsigned) sorted_postings[postings_count / 2].refs_count);
+	printf("refs; 90th ......... %u\n", (unsigned) sorted_postings[(postings_count * 9) / 10].refs_count);
+	printf("refs; 99th ......... %u\n", (unsigned) sorted_postings[(postings_count * 99) / 100].refs_count);
+	printf("refs; longest ...... %u\n", (unsigned) longest);
+
+	buffer = (off_t *) deen_emalloc(sizeof(off_t) * (longest + 1));
+
+	gallop_us = bench_run(
+		&deen_posting_intersect, postings, postings_count, BENCH_REPEATS_GALLOP, buffer, &found_gallop);
+	bsearch_us = bench_run(
+		&bench_intersect_bsearch, postings, postings_count, BENCH_REPEATS_BSEARCH, buffer, &found_bsearch);
+
+	if (found_gallop != found_bsearch) {
+		deen_log_error_and_exit("the intersections differ; %llu and %llu refs found",
+			(unsigned long long) found_gallop, (unsigned long long) found_bsearch);
+	}
+
+	printf("pairs intersected .. %u\n", (unsigned) (postings_count / 2));
+	printf("galloping .......... %.1f us per pair\n", gallop_us);
+	printf("bsearch/memmove .... %.1f us per pair\n", bsearch_us);
+
+	for (i = 0; i < postings_count; i++) {
+		free((void *) postings[i].refs);
+	}
+
+	free((void *) buffer);
+	free((void *) sorted_postings);
+	free((void *) postings);
+	deen_unmap_file(data, data_len);
+	close(fd_data);
+	deen_map_index_close(map_index);
+	free((void *) map_index_path);
+	free((void *) data_path);
+	free((void *) root_dir);
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/common.h"
+#include "core/posting.h"
+#include "core/types.h"
+
+/*
+Encodes the refs, checks that the expected encoding was chosen and then
+checks that the refs decode back again.
+*/
+
+static void test_posting_roundtrip(
+	const char *test_name,
+	const off_t *refs,
+	size_t refs_count,
+	uint8_t expected_encoding) {
+
+	uint8_t *buffer = NULL;
+	size_t buffer_allocated = 0;
+	off_t *decoded = (off_t *) deen_emalloc(sizeof(off_t) * (refs_count + 1));
+	size_t encoded_len = deen_posting_encode(refs, refs_count, &buffer, &buffer_allocated);
+
+	if (expected_encoding != buffer[0]) {
+		deen_log_error_and_exit("failed test '%s' -- unexpected encoding %u", test_name, buffer[0]);
+	}
+
+	if (!deen_posting_decode(buffer, encoded_len, decoded, refs_count)) {
+		deen_log_error_and_exit("failed test '%s' -- unable to decode", test_name);
+	}
+
+	if (0 != memcmp(refs, decoded, sizeof(off_t) * refs_count)) {
+		deen_log_error_and_exit("failed test '%s' -- decoded refs differ", test_name);
+	}
+
+	// the decoding should notice if the count does not match the block.
+
+	if (0 != refs_count && deen_posting_decode(buffer, encoded_len, decoded, refs_count - 1)) {
+		deen_log_error_and_exit("failed test '%s' -- decoded with the wrong count", test_name);
+	}
+
+	free((void *) buffer);
+	free((void *) decoded);
+
+	DEEN_LOG_INFO1("passed test '%s'", test_name);
+}
+
+
+static void test_posting_roundtrip__delta() {
+	off_t refs[] = { 0, 94, 310, 311, 70000, 3000000000LL };
+	test_posting_roundtrip("test_posting_roundtrip__delta", refs, 6, DEEN_POSTING_ENCODING_DELTA);
+}
+
+
+static void test_posting_roundtrip__bitmap() {
+	off_t refs[64];
+	size_t i;
+
+	for (i = 0; i < 64; i++) {
+		refs[i] = 1000000 + (i * 3);
+	}
+
+	test_posting_roundtrip("test_posting_roundtrip__bitmap", refs, 64, DEEN_POSTING_ENCODING_BITMAP);
+}
+
+
+static void test_posting_roundtrip__empty() {
+	test_posting_roundtrip("test_posting_roundtrip__empty", NULL, 0, DEEN_POSTING_ENCODING_DELTA);
+}
+
+
+static void test_posting_decode__corrupt() {
+	uint8_t truncated[] = { DEEN_POSTING_ENCODING_DELTA, 0x80 };
+	uint8_t unknown[] = { 99, 0x01 };
+	off_t refs[2];
+
+	// - - - - - - - - - -
+	if (deen_posting_decode(truncated, 2, refs, 1)) {
+		deen_log_error_and_exit("failed test 'test_posting_decode__corrupt' -- truncated");
+	}
+
+	if (deen_posting_decode(unknown, 2, refs, 1)) {
+		deen_log_error_and_exit("failed test 'test_posting_decode__corrupt' -- unknown");
+	}
+	// - - - - - - - - - -
+
+	DEEN_LOG_INFO0("passed test 'test_posting_decode__corrupt'");
+}
+
+
+/*
+Makes ordered and unique refs by stepping forward by a random amount up to
+'max_step' from the last ref.
+*/
+
+static off_t *test_posting_random_refs(size_t refs_count, uint32_t max_step) {
+	off_t *refs = (off_t *) deen_emalloc(sizeof(off_t) * (refs_count + 1));
+	off_t ref = 0;
+	size_t i;
+
+	for (i = 0; i < refs_count; i++) {
+		ref += 1 + (off_t) (rand() % max_step);
+		refs[i] = ref;
+	}
+
+	return refs;
+}
+
+
+/*
+Intersects the refs both ways around and checks the result against a simple
+intersection.
+*/
+
+static void test_posting_intersect_check(
+	const char *test_name,
+	const off_t *refs_a,
+	size_t refs_a_count,
+	const off_t *refs_b,
+	size_t refs_b_count) {
+
+	off_t *expected = (off_t *) deen_emalloc(sizeof(off_t) * (refs_a_count + 1));
+	off_t *intersected_a = (off_t *) deen_emalloc(sizeof(off_t) * (refs_a_count + 1));
+	off_t *intersected_b = (off_t *) deen_emalloc(sizeof(off_t) * (refs_b_count + 1));
+	size_t expected_count = 0;
+	size_t count_a;
+	size_t count_b;
+	size_t i;
+	size_t j = 0;
+
+	for (i = 0; i < refs_a_count; i++) {
+		while (j < refs_b_count && refs_b[j] < refs_a[i]) {
+			j++;
+		}
+
+		if (j < refs_b_count && refs_b[j] == refs_a[i]) {
+			expected[expected_count++] = refs_a[i];
+		}
+	}
+
+	memcpy(intersected_a, refs_a, sizeof(off_t) * refs_a_count);
+	memcpy(intersected_b, refs_b, sizeof(off_t) * refs_b_count);
+	count_a = deen_posting_intersect(intersected_a, refs_a_count, refs_b, refs_b_count);
+	count_b = deen_posting_intersect(intersected_b, refs_b_count, refs_a, refs_a_count);
+
+	if (expected_count != count_a || 0 != memcmp(expected, intersected_a, sizeof(off_t) * expected_count)) {
+		deen_log_error_and_exit("failed test '%s' -- intersection differs", test_name);
+	}
+
+	if (expected_count != count_b || 0 != memcmp(expected, intersected_b, sizeof(off_t) * expected_count)) {
+		deen_log_error_and_exit("failed test '%s' -- reversed intersection differs", test_name);
+	}
+
+	free((void *) expected);
+	free((void *) intersected_a);
+	free((void *) intersected_b);
+}
+
+
+static void test_posting_intersect() {
+	size_t sizes[] = { 0, 1, 2, 7, 100, 1000, 20000 };
+	size_t sizes_count = sizeof(sizes) / sizeof(sizes[0]);
+	size_t a;
+	size_t b;
+
+	srand(42);
+
+	// - - - - - - - - - -
+	for (a = 0; a < sizes_count; a++) {
+		for (b = 0; b < sizes_count; b++) {
+			off_t *refs_a = test_posting_random_refs(sizes[a], 4);
+			off_t *refs_b = test_posting_random_refs(sizes[b], 40);
+			test_posting_intersect_check("test_posting_intersect", refs_a, sizes[a], refs_b, sizes[b]);
+			free((void *) refs_a);
+			free((void *) refs_b);
+		}
+	}
+
+	{
+		off_t refs_a[] = { 5, 10, 15, 20 };
+		off_t refs_b[] = { 1, 5, 6, 20, 21 };
+		off_t refs_c[] = { 21, 22 };
+		test_posting_intersect_check("test_posting_intersect", refs_a, 4, refs_b, 5);
+		test_posting_intersect_check("test_posting_intersect", refs_a, 4, refs_a, 4);
+		test_posting_intersect_check("test_posting_intersect", refs_a, 4, refs_c, 2);
+	}
+	// - - - - - - - - - -
+
+	DEEN_LOG_INFO0("passed test 'test_posting_intersect'");
+}
+
+
+// ---------------------------------------------------------------
+// DRIVING THE TESTS
+// ---------------------------------------------------------------
+
+
+int main(int argc, char** argv) {
+
+	test_posting_roundtrip__delta();
+	test_posting_roundtrip__bitmap();
+	test_posting_roundtrip__empty();
+	test_posting_decode__corrupt();
+	test_posting_intersect();
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 
 #include "common.h"
 
+#include <fcntl.h>
 #include <limits.h>
 #ifndef __MINGW32__
 #include <pwd.h>
@@ -17,12 +18,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "constants.h"
 
-#define ISWORDCHAR(C) (!isspace(C) && !ispunct(C))
-
 // ---------------------------------------------------------------
 // FILE SYSTEM
 // ---------------------------------------------------------------
@@ -64,6 +70,75 @@ char *deen_index_path(const char *root_dir) {
 	return deen_leaf_path(root_dir, DEEN_LEAF_INDEX);
 }
 
+char *deen_map_index_path(const char *root_dir) {
+	return deen_leaf_path(root_dir, DEEN_LEAF_MAP_INDEX);
+}
+
+const uint8_t *deen_map_file(int fd, size_t *len, deen_bool is_sequential) {
+#ifdef __MINGW32__
+	return NULL;
+#else
+	struct stat fd_stat;
+	void *c;
+
+	if (0 != fstat(fd, &fd_stat) || fd_stat.st_size <= 0) {
+		return NULL;
+	}
+
+	c = mmap(NULL, (size_t) fd_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (MAP_FAILED == c) {
+		DEEN_LOG_INFO0("unable to map file; will read it instead");
+		return NULL;
+	}
+
+	if (is_sequential) {
+		posix_madvise(c, (size_t) fd_stat.st_size, POSIX_MADV_SEQUENTIAL);
+	}
+
+	*len = (size_t) fd_stat.st_size;
+	return (const uint8_t *) c;
+#endif
+}
+
+void deen_unmap_file(const uint8_t *c, size_t len) {
+#ifndef __MINGW32__
+	if (NULL != c) {
+		munmap((void *) c, len);
+	}
+#endif
+}
+
+void deen_map_file_will_need(const uint8_t *c, size_t c_len, size_t offset, size_t len) {
+#ifndef __MINGW32__
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	size_t start = offset - (offset % page_size);
+
+	if (NULL == c || offset >= c_len) {
+		return;
+	}
+
+	if (len > c_len - offset) {
+		len = c_len - offset;
+	}
+
+	posix_madvise((void *) &c[start], (offset - start) + len, POSIX_MADV_WILLNEED);
+#endif
+}
+
+void deen_file_will_need(int fd, off_t offset, size_t len) {
+#if defined(__MINGW32__)
+	// there is no equivalent.
+#elif defined(__APPLE__)
+	struct radvisory advisory;
+	advisory.ra_offset = offset;
+	advisory.ra_count = (int) len;
+	fcntl(fd, F_RDADVISE, &advisory);
+#else
+	posix_fadvise(fd, offset, (off_t) len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 // ---------------------------------------------------------------
 // UTILITY
 // ---------------------------------------------------------------
@@ -84,6 +159,22 @@ deen_millis deen_millis_since_epoc() {
 	return (deen_millis) (te.tv_sec * 1000LL) + (te.tv_usec / 1000);
 }
 
+/*
+This is the 64 bit FNV-1a hash; it works a byte at a time so the result does
+not depend on how the data was split into pieces.
+*/
+
+uint64_t deen_hash(uint64_t hash, const uint8_t *c, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint64_t) c[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 // ------------------------------------------------
 // STRINGS
 // ------------------------------------------------
@@ -191,9 +282,12 @@ deen_bool deen_is_common_upper_word(const uint8_t *s, size_t len) {
 }
 
 deen_bool deen_imatches_at(const uint8_t *s, const uint8_t *f, size_t at) {
+	return deen_imatches_at_len(s, f, strlen((const char *) f), at);
+}
+
+deen_bool deen_imatches_at_len(const uint8_t *s, const uint8_t *f, size_t f_len, size_t at) {
 	// assume that the first char does match.
 	size_t o = 0;
-	size_t f_len = strlen((const char *)f);
 
 	while (o<f_len) {
 
@@ -362,12 +456,17 @@ deen_bool deen_utf8_is_usascii_clean(
 	const uint8_t *c,
 	size_t c_length) {
 
-	uint32_t *c_asint = (uint32_t *) c;
 	size_t asints_len = (c_length / 4);
 	size_t i;
 
+	// the text need not be aligned so each group of four bytes is copied out
+	// rather than being read through a cast pointer.
+
 	for (i = 0; i < asints_len; i++) {
-		if (0 != (c_asint[i] & 0x80808080)) {
+		uint32_t c_asint;
+		memcpy(&c_asint, &c[i * 4], sizeof(uint32_t));
+
+		if (0 != (c_asint & 0x80808080)) {
 			return DEEN_FALSE;
 		}
 	}
@@ -499,161 +598,345 @@ deen_utf8_sequence_result deen_utf8_sequence_len(
 }
 
 
-deen_bool deen_for_each_word_from_file(
-	size_t read_buffer_size,
-	int fd,
-	deen_bool (*process_callback)(
-		const uint8_t *s,
-		size_t len,
-		off_t ref, // index in file to after last newline
-		float progress,
-		void *context),
-	void *context) {
+// ---------------------------------------------------------------
+// WORDS
+// ---------------------------------------------------------------
 
-	deen_bool result = DEEN_TRUE;
+/*
+This table classifies each byte as being part of a word (1) or separating
+words (0).  Whitespace and ASCII punctuation separate words.  All bytes of
+multi-byte UTF-8 sequences are part of a word.
+*/
 
-	uint8_t *c_buffer = (uint8_t *) deen_emalloc(sizeof(unsigned char) * read_buffer_size);
-	size_t c_buffer_len = read_buffer_size;
-	size_t c_buffer_loadedlen = 0;
+const uint8_t deen_word_byte_class[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 1, 1, // 0x00
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x10
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x20
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, // 0x30
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, // 0x50
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1, // 0x70
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xa0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xb0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xc0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xd0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xe0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1  // 0xf0
+};
 
-	// find out the length of the file.
 
-	off_t file_last_line_offset = 0;
-	off_t file_lastread = 0;
-	off_t file_read = 0;
-	off_t file_len = lseek(fd,0,SEEK_END);
+/*
+Returns the number of ASCII letters and digits at the start of the text.  Most
+of the bytes in words are these so they are checked sixteen at a time where the
+processor supports it.
+*/
 
-	if (-1 == file_len) {
-		DEEN_LOG_ERROR0("unable to obtain the length of the file to be processed");
-		result = DEEN_FALSE;
+static size_t deen_word_alnum_run_len(const uint8_t *c, size_t c_len) {
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	const __m128i before_a = _mm_set1_epi8('a' - 1);
+	const __m128i after_z = _mm_set1_epi8('z' + 1);
+	const __m128i before_0 = _mm_set1_epi8('0' - 1);
+	const __m128i after_9 = _mm_set1_epi8('9' + 1);
+
+	// the comparisons are signed so bytes from 0x80 are never in range.
+
+	while (i + 16 <= c_len) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &c[i]);
+		__m128i v_lower = _mm_or_si128(v, case_bit);
+		__m128i is_alpha = _mm_and_si128(
+			_mm_cmpgt_epi8(v_lower, before_a),
+			_mm_cmplt_epi8(v_lower, after_z));
+		__m128i is_digit = _mm_and_si128(
+			_mm_cmpgt_epi8(v, before_0),
+			_mm_cmplt_epi8(v, after_9));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(is_alpha, is_digit));
+
+		if (0xffff != mask) {
+			unsigned int not_mask = ~mask & 0xffff;
+
+			while (0 == (not_mask & 1)) {
+				not_mask >>= 1;
+				i++;
+			}
+
+			return i;
+		}
+
+		i += 16;
 	}
+#endif
 
-	if (result) {
+	while (i < c_len && isalnum(c[i]) && c[i] < 0x80) {
+		i++;
+	}
 
-		if (-1 == lseek(fd,0,SEEK_SET)) {
-			DEEN_LOG_ERROR0("unable to return the file pointer back to the start of the file to be processed");
-			result = DEEN_FALSE;
+	return i;
+}
+
+
+/*
+Finds the next word in the text at or after the offset.  The start of the line
+is moved past any newlines that are passed over.  If the UTF-8 is checked then
+a bad or incomplete sequence is an error and the end of the word is the offset
+at which the error was found.  If there are no more words then the start and
+end of the word are both the length of the text.
+*/
+
+static deen_utf8_sequence_result deen_find_word(
+	const uint8_t *c,
+	size_t c_len,
+	size_t offset,
+	size_t *word_start,
+	size_t *word_end,
+	size_t *line_start,
+	deen_bool is_utf8_checked) {
+
+	size_t end;
+
+	while (offset < c_len && !DEEN_IS_WORD_BYTE(c[offset])) {
+		if ('\n' == c[offset]) {
+			// want the index to the next line not the newline character itself.
+			*line_start = offset + 1;
 		}
 
-		// feed in more data
+		offset++;
+	}
 
-		while (
-			result &&
-			((file_lastread = read(fd, &c_buffer[c_buffer_loadedlen], c_buffer_len-c_buffer_loadedlen)) > 0) )
-		{
-			float progress;
-                        deen_bool need_more_data;
-                        uint32_t c_buffer_word_start;
-                        uint32_t c_buffer_word_end; 
+	end = offset;
 
-			DEEN_LOG_TRACE1("did read %u additional bytes", file_lastread);
+	while (end < c_len) {
+		end += deen_word_alnum_run_len(&c[end], c_len - end);
 
-			file_read += file_lastread;
-			progress = (float) file_read / (float) file_len;
-			c_buffer_loadedlen += (size_t) file_lastread;
+		if (end == c_len || !DEEN_IS_WORD_BYTE(c[end])) {
+			break;
+		}
 
-			// find the next non-whitespace.
+		if (c[end] < 0x80 || !is_utf8_checked) {
+			end++;
+		}
+		else {
+			size_t utf8_sequence_len;
+			deen_utf8_sequence_result result = deen_utf8_sequence_len(&c[end], c_len - end, &utf8_sequence_len);
 
-			need_more_data = DEEN_FALSE;
-			c_buffer_word_start = 0;
-			c_buffer_word_end = 0;
+			if (DEEN_SEQUENCE_OK != result) {
+				*word_start = offset;
+				*word_end = end;
+				return result;
+			}
 
-			while (!need_more_data && result) {
+			end += utf8_sequence_len;
+		}
+	}
 
-				while (c_buffer_word_start < c_buffer_loadedlen && !ISWORDCHAR(c_buffer[c_buffer_word_start])) {
-					if ('\n' == c_buffer[c_buffer_word_start]) {
-						// want the index to the next line not the newline character itself.
-						file_last_line_offset = (file_read - (c_buffer_loadedlen - c_buffer_word_start)) + 1;
-					}
+	*word_start = offset;
+	*word_end = end;
+	return DEEN_SEQUENCE_OK;
+}
 
-					c_buffer_word_start++;
-				}
 
-				if (c_buffer_word_start < c_buffer_loadedlen) {
+void deen_word_scan_init(
+	deen_word_scan *scan,
+	const uint8_t *c,
+	size_t c_len,
+	off_t ref,
+	deen_bool is_utf8_checked) {
+	scan->c = c;
+	scan->c_len = c_len;
+	scan->ref = ref;
+	scan->offset = 0;
+	scan->line_start = 0;
+	scan->is_utf8_checked = is_utf8_checked;
+	scan->sequence_result = DEEN_SEQUENCE_OK;
+}
 
-					c_buffer_word_end = c_buffer_word_start;
 
-					while (
-						result &&
-						!need_more_data &&
-						c_buffer_word_end < c_buffer_loadedlen &&
-						ISWORDCHAR(c_buffer[c_buffer_word_end])) {
+size_t deen_word_scan_spans(
+	deen_word_scan *scan,
+	deen_word_span *spans,
+	size_t spans_max) {
 
-						size_t utf8_sequence_len;
+	size_t span_count = 0;
+	size_t offset = scan->offset;
+	size_t line_start = scan->line_start;
 
-						switch (deen_utf8_sequence_len(
-							&c_buffer[c_buffer_word_end],
-							c_buffer_loadedlen - c_buffer_word_end,
-							&utf8_sequence_len)) {
+	while (DEEN_SEQUENCE_OK == scan->sequence_result && span_count < spans_max) {
+		size_t word_start;
+		size_t word_end;
 
-								case DEEN_SEQUENCE_OK:
-									c_buffer_word_end += utf8_sequence_len;
-									break;
+		scan->sequence_result = deen_find_word(
+			scan->c, scan->c_len, offset,
+			&word_start, &word_end, &line_start,
+			scan->is_utf8_checked);
 
-								case DEEN_BAD_SEQUENCE:
-									DEEN_LOG_ERROR1("bad utf8 sequence at %u", file_read - (c_buffer_loadedlen - c_buffer_word_end));
-									result = DEEN_FALSE;
-									break;
+		// if there was a bad sequence then this is the offset of the problem.
 
-								case DEEN_INCOMPLETE_SEQUENCE:
-									need_more_data = DEEN_TRUE;
-									break;
+		offset = word_end;
 
-						}
-					}
+		if (DEEN_SEQUENCE_OK != scan->sequence_result || word_start == word_end) {
+			break;
+		}
 
-					// if the end of the buffer was reached trying to find the
-					// end of a word then more data needs to be loaded in.
+		spans[span_count].offset = word_start;
+		spans[span_count].len = word_end - word_start;
+		spans[span_count].ref = scan->ref + (off_t) line_start;
+		span_count++;
+	}
 
-					if (c_buffer_word_end == c_buffer_loadedlen) {
-						need_more_data = DEEN_TRUE;
-					}
+	scan->offset = offset;
+	scan->line_start = line_start;
 
-					// if the end of a word was found then it should be reported
-					// back to the client using the callback function.
+	return span_count;
+}
 
-					if (result && !need_more_data && c_buffer_word_end < c_buffer_loadedlen) {
 
-						if (!process_callback(
-							&c_buffer[c_buffer_word_start],
-							c_buffer_word_end - c_buffer_word_start,
-							file_last_line_offset,
-							progress,
-							context)) {
+/*
+Supplies the words in the text to the callback.  The text starts at the start
+of a line which is at 'text_ref' in the file.  The progress is reported as the
+offset through 'progress_len' bytes with the text starting at 'progress_ref'.
+*/
 
-							DEEN_LOG_INFO0("user initiated cancel of word extraction from file");
-							result = DEEN_FALSE;
-						}
+static deen_bool deen_for_each_word_in_text(
+	const uint8_t *c,
+	size_t c_len,
+	off_t text_ref,
+	off_t progress_ref,
+	off_t progress_len,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref,
+		float progress,
+		void *context),
+	void *context) {
 
-						// move onto the next word.  Not +1 because it might be a
-						// newline which needs to be processed.
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
 
-						c_buffer_word_start = c_buffer_word_end;
-					}
+	deen_word_scan_init(&scan, c, c_len, text_ref, DEEN_TRUE);
 
-				}
-				else {
-					need_more_data = DEEN_TRUE;
-				}
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		size_t i;
+
+		for (i = 0; i < span_count; i++) {
+			if (!process_callback(
+				&c[spans[i].offset],
+				spans[i].len,
+				spans[i].ref,
+				(float) (progress_ref + (off_t) (spans[i].offset + spans[i].len)) / (float) progress_len,
+				context)) {
+				DEEN_LOG_INFO0("user initiated cancel of word extraction");
+				return DEEN_FALSE;
 			}
+		}
+	}
 
-			// if a single word filled the entire buffer then it is
-			// necessary that a larger buffer is sought.
+	switch (scan.sequence_result) {
 
-			if (result) {
-				if (0 == c_buffer_word_end) {
-					c_buffer_len += sizeof(unsigned char) * read_buffer_size;
-					c_buffer = (uint8_t *) deen_erealloc(c_buffer, c_buffer_len);
-					DEEN_LOG_ERROR1("requiring a larger buffer for reading words from file; %u bytes", c_buffer_len);
-				}
-				else {
+		case DEEN_SEQUENCE_OK:
+			break;
+
+		case DEEN_BAD_SEQUENCE:
+			DEEN_LOG_ERROR1("bad utf8 sequence at %llu", (unsigned long long) (text_ref + scan.offset));
+			return DEEN_FALSE;
+
+		case DEEN_INCOMPLETE_SEQUENCE:
+			DEEN_LOG_ERROR1("incomplete utf8 sequence at %llu", (unsigned long long) (text_ref + scan.offset));
+			return DEEN_FALSE;
+
+	}
+
+	return DEEN_TRUE;
+}
+
+
+deen_bool deen_for_each_word_from_file(
+	size_t read_buffer_size,
+	int fd,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref, // index in file to after last newline
+		float progress,
+		void *context),
+	void *context) {
+
+	deen_bool result = DEEN_TRUE;
+
+	uint8_t *c_buffer = (uint8_t *) deen_emalloc(sizeof(unsigned char) * read_buffer_size);
+	size_t c_buffer_len = read_buffer_size;
+	size_t c_buffer_loadedlen = 0;
+
+	// the offset in the file of the start of the buffer; this is always the
+	// start of a line.
+
+	off_t c_buffer_ref = 0;
+	off_t file_len = lseek(fd,0,SEEK_END);
+
+	if (-1 == file_len) {
+		DEEN_LOG_ERROR0("unable to obtain the length of the file to be processed");
+		result = DEEN_FALSE;
+	}
+
+	if (result && -1 == lseek(fd,0,SEEK_SET)) {
+		DEEN_LOG_ERROR0("unable to return the file pointer back to the start of the file to be processed");
+		result = DEEN_FALSE;
+	}
+
+	while (result) {
+		ssize_t file_lastread;
+		size_t i;
+
+		// if a single line filled the entire buffer then it is necessary
+		// that a larger buffer is sought.
+
+		if (c_buffer_loadedlen == c_buffer_len) {
+			c_buffer_len += sizeof(unsigned char) * read_buffer_size;
+			c_buffer = (uint8_t *) deen_erealloc(c_buffer, c_buffer_len);
+			DEEN_LOG_TRACE1("requiring a larger buffer for reading words from file; %u bytes", c_buffer_len);
+		}
+
+		file_lastread = read(fd, &c_buffer[c_buffer_loadedlen], c_buffer_len - c_buffer_loadedlen);
+
+		if (-1 == file_lastread) {
+			DEEN_LOG_ERROR0("unable to read the file to be processed");
+			result = DEEN_FALSE;
+		}
+		else {
+			if (0 == file_lastread) {
+
+				// the remaining data is the last line.
+
+				result = deen_for_each_word_in_text(
+					c_buffer, c_buffer_loadedlen,
+					c_buffer_ref, c_buffer_ref, file_len,
+					process_callback, context);
+				break;
+			}
+
+			DEEN_LOG_TRACE1("did read %u additional bytes", file_lastread);
+
+			c_buffer_loadedlen += (size_t) file_lastread;
 
-					// now need to move any unprocessed data back to the start of
-					// the buffer and read in some more material to complete the
-					// current word.
-					size_t c_buffer_loadedlen_remaining = c_buffer_loadedlen - c_buffer_word_start;
-					memmove(c_buffer, &c_buffer[c_buffer_word_start], c_buffer_loadedlen_remaining);
-					c_buffer_loadedlen = c_buffer_loadedlen_remaining;
+			// process the complete lines and then move the partial line at
+			// the end of the buffer back to the start.
+
+			for (i = c_buffer_loadedlen; i > c_buffer_loadedlen - (size_t) file_lastread; i--) {
+				if ('\n' == c_buffer[i - 1]) {
+					result = deen_for_each_word_in_text(
+						c_buffer, i,
+						c_buffer_ref, c_buffer_ref, file_len,
+						process_callback, context);
+					memmove(c_buffer, &c_buffer[i], c_buffer_loadedlen - i);
+					c_buffer_loadedlen -= i;
+					c_buffer_ref += (off_t) i;
+					break;
 				}
 			}
 		}
@@ -667,34 +950,73 @@ deen_bool deen_for_each_word_from_file(
 }
 
 
+deen_bool deen_for_each_word_from_mapped_file(
+	int fd,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref, // index in file to after last newline
+		float progress,
+		void *context),
+	void *context) {
+
+	size_t c_len = 0;
+	const uint8_t *c = deen_map_file(fd, &c_len, DEEN_TRUE);
+	deen_bool result;
+
+	if (NULL == c) {
+		return deen_for_each_word_from_file(
+			DEEN_BUFFER_SIZE_EACH_WORD_FROM_FILE,
+			fd,
+			process_callback,
+			context);
+	}
+
+	result = deen_for_each_word_from_buffer(c, c_len, 0, process_callback, context);
+	deen_unmap_file(c, c_len);
+
+	return result;
+}
+
+
+deen_bool deen_for_each_word_from_buffer(
+	const uint8_t *c,
+	size_t c_len,
+	off_t buffer_ref,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref, // index in file to after last newline
+		float progress,
+		void *context),
+	void *context) {
+
+	return deen_for_each_word_in_text(
+		c, c_len,
+		buffer_ref, 0, (off_t) c_len,
+		process_callback, context);
+}
+
+
 void deen_for_each_word(
 	const uint8_t *s, size_t offset,
 	deen_bool (*eachword_callback)(const uint8_t *s, size_t offset, size_t len, void *context),
 	void *context
 ) {
 
-	size_t len = strlen((char *) &s[offset]);
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
 
-	while (offset < len) {
-		size_t end;
+	deen_word_scan_init(&scan, s, offset + strlen((char *) &s[offset]), 0, DEEN_FALSE);
+	scan.offset = offset;
 
-		// skip whitespace
-		while (offset < len && (isspace(s[offset]) || ispunct(s[offset]))) {
-			offset++;
-		}
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		size_t i;
 
-		end = offset;
-
-		while (end < len && !isspace(s[end]) && !ispunct(s[end])) {
-			end++;
-		}
-
-		if (end != offset) {
-			if (DEEN_TRUE != eachword_callback(s, offset, end-offset, context)) {
-				offset = len;
-			}
-			else {
-				offset = end;
+		for (i = 0; i < span_count; i++) {
+			if (DEEN_TRUE != eachword_callback(s, spans[i].offset, spans[i].len, context)) {
+				return;
 			}
 		}
 	}
@@ -723,6 +1045,61 @@ void *deen_erealloc(void *ptr, size_t size) {
 	return r;
 }
 
+// ---------------------------------------------------------------
+// ARENA
+// ---------------------------------------------------------------
+
+/*
+The chunk header is padded so that the memory after it stays aligned; all of
+the memory handed out is aligned in the same way.
+*/
+
+#define DEEN_ARENA_ALIGN 16
+#define DEEN_ARENA_ALIGN_UP(S) (((S) + (DEEN_ARENA_ALIGN - 1)) & ~((size_t) (DEEN_ARENA_ALIGN - 1)))
+#define DEEN_ARENA_CHUNK_HEADER DEEN_ARENA_ALIGN_UP(sizeof(deen_arena_chunk))
+
+void deen_arena_init(deen_arena *arena) {
+	arena->chunks = NULL;
+}
+
+void *deen_arena_alloc(deen_arena *arena, size_t size) {
+	deen_arena_chunk *chunk = arena->chunks;
+
+	size = DEEN_ARENA_ALIGN_UP(size);
+
+	if (NULL == chunk || chunk->size - chunk->used < size) {
+		size_t chunk_size = size > DEEN_ARENA_CHUNK_SIZE ? size : DEEN_ARENA_CHUNK_SIZE;
+
+		chunk = (deen_arena_chunk *) deen_emalloc(DEEN_ARENA_CHUNK_HEADER + chunk_size);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+
+		// a chunk that is just for a large allocation goes behind the current
+		// chunk so that the rest of the current chunk is still used.
+
+		if (NULL != arena->chunks && chunk_size > DEEN_ARENA_CHUNK_SIZE) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+
+	chunk->used += size;
+
+	return &(((uint8_t *) chunk)[DEEN_ARENA_CHUNK_HEADER + chunk->used - size]);
+}
+
+void deen_arena_free(deen_arena *arena) {
+	while (NULL != arena->chunks) {
+		deen_arena_chunk *next = arena->chunks->next;
+		free((void *) arena->chunks);
+		arena->chunks = next;
+	}
+}
+
 // ---------------------------------------------------------------
 // LOGGING
 // ---------------------------------------------------------------
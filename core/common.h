@@ -27,6 +27,65 @@ The caller maintains ownership of this data and should free it.
 char *deen_root_dir();
 char *deen_data_path(const char *root_dir);
 char *deen_index_path(const char *root_dir);
+char *deen_map_index_path(const char *root_dir);
+
+/*
+Maps the whole of the open file into memory read-only.  If the file is going to
+be read from start to end then the operating system can be advised of this so
+that it reads ahead.  Returns NULL if the file could not be mapped; for example
+because it is empty or because mapping files is not supported.
+*/
+
+const uint8_t *deen_map_file(int fd, size_t *len, deen_bool is_sequential);
+
+void deen_unmap_file(const uint8_t *c, size_t len);
+
+/*
+These tell the operating system that a range of a file will be needed soon so
+that it can start to read the range in without waiting.  The first is for a file
+that is mapped at 'c' and the second is for a file that is read.  Neither waits
+for the read to happen.
+*/
+
+void deen_map_file_will_need(const uint8_t *c, size_t c_len, size_t offset, size_t len);
+
+void deen_file_will_need(int fd, off_t offset, size_t len);
+
+// ---------------------------------------------------------------
+// WORDS
+// ---------------------------------------------------------------
+
+/*
+All of the splitting of text into words uses this table to decide if a byte is
+part of a word.
+*/
+
+extern const uint8_t deen_word_byte_class[256];
+
+#define DEEN_IS_WORD_BYTE(C) (0 != deen_word_byte_class[(uint8_t) (C)])
+
+/*
+Starts a scan for the words in the text 'c'.  The text starts at the start of a
+line which is at 'ref' in the file.
+*/
+
+void deen_word_scan_init(
+	deen_word_scan *scan,
+	const uint8_t *c,
+	size_t c_len,
+	off_t ref,
+	deen_bool is_utf8_checked);
+
+/*
+Fills up to 'spans_max' spans with the next words from the scan and returns the
+number of spans filled.  Returns zero when there are no more words or when a
+bad UTF-8 sequence has stopped the scan.
+*/
+
+size_t deen_word_scan_spans(
+	deen_word_scan *scan,
+	deen_word_span *spans,
+	size_t spans_max);
 
 // ---------------------------------------------------------------
 // UTILITY
@@ -36,6 +95,17 @@ time_t deen_seconds_since_epoc();
 
 deen_millis deen_millis_since_epoc();
 
+/*
+A fast hash of some data that is used to find out if data has changed; it is
+not suitable for security purposes.  Data that arrives in pieces can be hashed
+by passing the hash of the earlier pieces back in; the first piece is hashed
+from DEEN_HASH_INITIAL.
+*/
+
+#define DEEN_HASH_INITIAL 0xcbf29ce484222325ULL
+
+uint64_t deen_hash(uint64_t hash, const uint8_t *c, size_t len);
+
 // ---------------------------------------------------------------
 // STRINGS
 // ---------------------------------------------------------------
@@ -100,6 +170,42 @@ deen_bool deen_for_each_word_from_file(
 		void *context),
 	void *context);
 
+/*
+As deen_for_each_word_from_file, but the file is mapped into memory and the
+words are supplied to the callback as pointers into the mapping.  If the file
+is not able to be mapped then it is read through a buffer instead.
+*/
+
+deen_bool deen_for_each_word_from_mapped_file(
+	int fd,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref, // offset after last newline.
+		float progress,
+		void *context),
+	void *context);
+
+/*
+Processes the words in a buffer of text that has been taken from a file and
+which starts at the beginning of a line.  The 'ref' supplied to the callback is
+the offset of the start of the word's line in the file given that the buffer
+starts at 'buffer_ref'.  The progress is through the buffer.  Returns true if
+successful.
+*/
+
+deen_bool deen_for_each_word_from_buffer(
+	const uint8_t *c,
+	size_t c_len,
+	off_t buffer_ref,
+	deen_bool (*process_callback)(
+		const uint8_t *s,
+		size_t len,
+		off_t ref, // offset after last newline.
+		float progress,
+		void *context),
+	void *context);
+
 /*
 For each non-trivial word in the source text, call the callback function.
 */
@@ -126,6 +232,12 @@ comparison is done case insensitvely.
 
 deen_bool deen_imatches_at(const uint8_t *s, const uint8_t *f, size_t at);
 
+/*
+As deen_imatches_at, but the length of 'f' in bytes is already known.
+*/
+
+deen_bool deen_imatches_at_len(const uint8_t *s, const uint8_t *f, size_t f_len, size_t at);
+
 /*
 Find the offset into the string 's' at which the string 'f' can be found.  The
 search is performed between the offsets 'from' -> 'to'.  The search is case
@@ -159,6 +271,20 @@ will cause the program to exit if the memory was not able to allocated.
 void *deen_emalloc(size_t size);
 void *deen_erealloc(void *ptr, size_t size);
 
+// ---------------------------------------------------------------
+// ARENA
+// ---------------------------------------------------------------
+
+/*
+Memory from an arena is not freed piece by piece; it is all freed together
+when the arena is freed.  The memory is aligned so that it can hold any of the
+structures here.
+*/
+
+void deen_arena_init(deen_arena *arena);
+void *deen_arena_alloc(deen_arena *arena, size_t size);
+void deen_arena_free(deen_arena *arena);
+
 // ---------------------------------------------------------------
 // LOGGING
 // ---------------------------------------------------------------
@@ -19,6 +19,21 @@ buffers of text to be tokenized into words.
 // 10k
 #define DEEN_BUFFER_SIZE_EACH_WORD_FROM_FILE (1024 * 10)
 
+/*
+Words are found in text in batches of spans; this is the number of spans in a
+batch when the caller holds the batch on the stack.
+*/
+
+#define DEEN_WORD_SPANS_BATCH 256
+
+/*
+An arena allocates its memory in chunks of this size; larger allocations get a
+chunk of their own.
+*/
+
+// 64k
+#define DEEN_ARENA_CHUNK_SIZE (1024 * 64)
+
 /*
 This set of constants define the prefix used to log at different levels.
 */
@@ -45,6 +60,36 @@ pushed into the tree.
 
 #define DEEN_INDEXING_DEPTH 4
 
+/*
+A prefix is DEEN_INDEXING_DEPTH unicode characters long and each of those
+characters may be up to four bytes in UTF-8.
+*/
+
+#define DEEN_INDEX_PREFIX_WIDTH (DEEN_INDEXING_DEPTH * 4)
+
+/*
+This is recorded in the index and should be incremented whenever a change means
+that the index built from the same data would be different.  An index with a
+different version is not used by a search and is rebuilt by an install even if
+the data has not changed.
+*/
+
+#define DEEN_INDEX_FORMAT_VERSION 2
+
+/*
+While indexing, the (prefix, ref) pairs are gathered in memory.  Once this
+many bytes of pairs have been gathered, they are sorted and spilled to disk.
+*/
+
+// 64M
+#define DEEN_INDEX_BULK_MEMORY_BUDGET (1024 * 1024 * 64)
+
+/*
+The pairs are sorted and merged in up to this many shards at the same time.
+*/
+
+#define DEEN_INDEX_SHARDS_MAX 16
+
 /*
 A word must have at least this many characters to be
 worth indexing.
@@ -68,17 +113,37 @@ worth indexing.
 #define DEEN_NOT_FOUND SIZE_MAX
 
 #define DEEN_LEAF_INDEX "deen.idx.sqllite3"
+#define DEEN_LEAF_MAP_INDEX "deen.idx.map"
 #define DEEN_LEAF_DING_DATA "de-en.txt"
 
 #define DIR_DEEN ".deen"
 
 /*
- This constant is a leafname for a temporary file that gets produced first when
- an index is made.  The index is then optimized into the right place.
+ This constant is a template for the leafname of a temporary directory in which
+ a new install is built.  Once it is complete, its files are renamed into place
+ so that the prior install is usable until then.
  */
 
 #define DEEN_LEAF_TMPINDEX "deen_idx_tmp.XXXXXX"
 
+/*
+ A new install that indexes the data from the start is built in this directory
+ instead.  If the install stops before it is complete then its files are left
+ in the directory so that the next install is able to carry on from the last
+ checkpoint.  The runs of index pairs are kept in files with this leafname
+ followed by the number of the run.
+ */
+
+#define DEEN_LEAF_RESUME_INDEX "deen_idx_resume"
+#define DEEN_LEAF_INDEX_RUN "deen.idx.run"
+
+/*
+ An install holds a lock on this file in the deen data directory for as long
+ as it is working so that only one install works on the data at a time.
+ */
+
+#define DEEN_LEAF_INSTALL_LOCK "deen_install.lock"
+
 #define DEEN_TRUE 1
 #define DEEN_FALSE 0
 
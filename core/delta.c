@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#include "delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+This is the initial number of buckets in the hash table of installed lines.  It
+must be a power of two.
+*/
+
+#define DEEN_DELTA_HASH_SIZE 1024
+
+
+deen_delta *deen_delta_create(const uint8_t *installed, size_t installed_len) {
+	deen_delta *delta = (deen_delta *) deen_emalloc(sizeof(deen_delta));
+	memset(delta, 0, sizeof(deen_delta));
+	delta->installed = installed;
+	delta->installed_len = installed_len;
+	delta->lines_size = DEEN_DELTA_HASH_SIZE;
+	delta->lines = (deen_delta_line *) deen_emalloc(sizeof(deen_delta_line) * delta->lines_size);
+	memset(delta->lines, 0, sizeof(deen_delta_line) * delta->lines_size);
+	return delta;
+}
+
+
+void deen_delta_free(deen_delta *delta) {
+	if (NULL != delta) {
+		free((void *) delta->lines);
+		free((void *) delta);
+	}
+}
+
+
+/*
+Places the line into the buckets with open addressing.  A bucket with a zero
+length is empty; empty lines are never added.
+*/
+
+static void deen_delta_place_line(
+	deen_delta_line *lines,
+	size_t lines_size,
+	const deen_delta_line *line) {
+
+	size_t i = (size_t) line->hash & (lines_size - 1);
+
+	while (0 != lines[i].len) {
+		i = (i + 1) & (lines_size - 1);
+	}
+
+	lines[i] = *line;
+}
+
+
+static void deen_delta_grow(deen_delta *delta) {
+	size_t lines_size = delta->lines_size * 2;
+	deen_delta_line *lines = (deen_delta_line *) deen_emalloc(sizeof(deen_delta_line) * lines_size);
+	size_t i;
+
+	memset(lines, 0, sizeof(deen_delta_line) * lines_size);
+
+	for (i = 0; i < delta->lines_size; i++) {
+		if (0 != delta->lines[i].len) {
+			deen_delta_place_line(lines, lines_size, &(delta->lines[i]));
+		}
+	}
+
+	free((void *) delta->lines);
+	delta->lines = lines;
+	delta->lines_size = lines_size;
+}
+
+
+void deen_delta_add_installed_line(deen_delta *delta, off_t ref, size_t len) {
+	deen_delta_line line;
+
+	if (0 == len || (size_t) ref + len > delta->installed_len) {
+		return;
+	}
+
+	// the table is kept at most half full.
+
+	if ((delta->lines_count + 1) * 2 > delta->lines_size) {
+		deen_delta_grow(delta);
+	}
+
+	line.hash = deen_hash(DEEN_HASH_INITIAL, &(delta->installed[ref]), len);
+	line.ref = ref;
+	line.len = len;
+	line.is_matched = DEEN_FALSE;
+
+	deen_delta_place_line(delta->lines, delta->lines_size, &line);
+	delta->lines_count++;
+}
+
+
+deen_bool deen_delta_match_line(deen_delta *delta, const uint8_t *line, size_t len) {
+	uint64_t hash;
+	size_t i;
+
+	if (0 == len) {
+		return DEEN_FALSE;
+	}
+
+	hash = deen_hash(DEEN_HASH_INITIAL, line, len);
+	i = (size_t) hash & (delta->lines_size - 1);
+
+	while (0 != delta->lines[i].len) {
+		deen_delta_line *installed_line = &(delta->lines[i]);
+
+		if (!installed_line->is_matched
+			&& hash == installed_line->hash
+			&& len == installed_line->len
+			&& 0 == memcmp(&(delta->installed[installed_line->ref]), line, len)) {
+			installed_line->is_matched = DEEN_TRUE;
+			return DEEN_TRUE;
+		}
+
+		i = (i + 1) & (delta->lines_size - 1);
+	}
+
+	return DEEN_FALSE;
+}
+
+
+static int deen_delta_compare_refs(const void *item1, const void *item2) {
+	off_t ref1 = ((const off_t *) item1)[0];
+	off_t ref2 = ((const off_t *) item2)[0];
+	if (ref1 == ref2) return 0;
+	return ref1 > ref2 ? 1 : -1;
+}
+
+
+off_t *deen_delta_unmatched_refs(deen_delta *delta, size_t *refs_count) {
+	off_t *refs = (off_t *) deen_emalloc(sizeof(off_t) * (delta->lines_count + 1));
+	size_t i;
+
+	*refs_count = 0;
+
+	for (i = 0; i < delta->lines_size; i++) {
+		if (0 != delta->lines[i].len && !delta->lines[i].is_matched) {
+			refs[*refs_count] = delta->lines[i].ref;
+			(*refs_count)++;
+		}
+	}
+
+	qsort(refs, *refs_count, sizeof(off_t), &deen_delta_compare_refs);
+
+	return refs;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#ifndef __DELTA_H
+#define __DELTA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+
+/*
+A delta works out how the lines of a new version of the data differ from the
+lines that are installed.  The installed lines are added first and then each
+line of the new version is matched against them.  A line of the new version
+that does not match is an added line and an installed line that was not
+matched by the end is a deleted line.  The order of the lines is not taken
+into account; a line that has moved is still matched.
+*/
+
+/*
+The installed data must stay in memory for as long as the delta is used.
+*/
+
+deen_delta *deen_delta_create(const uint8_t *installed, size_t installed_len);
+
+void deen_delta_free(deen_delta *delta);
+
+/*
+Adds the installed line at 'ref' which is 'len' bytes long; not including the
+newline.
+*/
+
+void deen_delta_add_installed_line(deen_delta *delta, off_t ref, size_t len);
+
+/*
+Returns true if the line matches an installed line that was not already
+matched.  The installed line is then matched so that a line that appears twice
+in the new version only matches twice if it was installed twice.
+*/
+
+deen_bool deen_delta_match_line(deen_delta *delta, const uint8_t *line, size_t len);
+
+/*
+Returns the refs of the installed lines that have not been matched in order.
+The caller owns the refs and should free them.
+*/
+
+off_t *deen_delta_unmatched_refs(deen_delta *delta, size_t *refs_count);
+
+#endif /* __DELTA_H */
@@ -14,115 +14,429 @@
 #include "constants.h"
 
 // ---------------------------------------------------------------
-// CREATION
+// SCANNING
 // ---------------------------------------------------------------
 
+/*
+The text of one language of a line is split into tokens by the scanner here
+without it needing to be terminated or copied.  The tokens are the same as
+used both to score lines and to parse them into entries; a '|' starts a new
+sub, a ';' starts a new sub sub and the atoms are the text and the grammar and
+context in '{...}' and '[...]'.  Where the rules can match in more than one way,
+the longest match is taken.
+*/
 
-extern void deen_entry_create_yy(
-	const uint8_t *data,
-	deen_entry_sub **subs,
-	uint32_t *sub_count);
+typedef enum deen_entry_token_type deen_entry_token_type;
+enum deen_entry_token_type {
+	DEEN_ENTRY_TOKEN_SUB,
+	DEEN_ENTRY_TOKEN_SUB_SUB,
+	DEEN_ENTRY_TOKEN_ATOM
+};
 
 
-deen_entry deen_entry_create(
-	const uint8_t *german,
-	const uint8_t *english) {
+typedef struct deen_entry_token deen_entry_token;
+struct deen_entry_token {
+	deen_entry_token_type type;
+	enum deen_entry_atom_type atom_type;
+	size_t offset;
+	size_t len;
+};
 
-	deen_entry result;
 
-	deen_entry_create_yy(
-		german,
-		&(result.german_subs),
-		&(result.german_sub_count));
+typedef struct deen_entry_scan deen_entry_scan;
+struct deen_entry_scan {
+	const uint8_t *c;
+	size_t c_len;
+	size_t i;
+	enum deen_entry_atom_type state; // text outside of any '{...}' or '[...]'
+};
 
-	deen_entry_create_yy(
-		english,
-		&(result.english_subs),
-		&(result.english_sub_count));
 
-	return result;
+#define DEEN_ENTRY_IS_MARK(C) ('{' == (C) || '[' == (C) || '|' == (C) || ';' == (C))
+#define DEEN_ENTRY_IS_TEXT_END(C) ('{' == (C) || '[' == (C) || '|' == (C))
+
+
+static void deen_entry_scan_init(deen_entry_scan *scan, const uint8_t *c, size_t c_len) {
+	scan->c = c;
+	scan->c_len = c_len;
+	scan->i = 0;
+	scan->state = ATOM_TEXT;
+}
+
+
+static size_t deen_entry_scan_skip_spaces(const deen_entry_scan *scan, size_t i) {
+	while (i < scan->c_len && ' ' == scan->c[i]) {
+		i++;
+	}
+
+	return i;
+}
+
+
+static void deen_entry_scan_atom(
+	deen_entry_scan *scan,
+	deen_entry_token *token,
+	enum deen_entry_atom_type atom_type,
+	size_t end) {
+
+	token->type = DEEN_ENTRY_TOKEN_ATOM;
+	token->atom_type = atom_type;
+	token->offset = scan->i;
+	token->len = end - scan->i;
+	scan->i = end;
+}
+
+
+/*
+Returns false when there are no more tokens.
+*/
+
+static deen_bool deen_entry_scan_next(deen_entry_scan *scan, deen_entry_token *token) {
+	const uint8_t *c = scan->c;
+
+	while (scan->i < scan->c_len) {
+		size_t i = scan->i;
+		size_t s = deen_entry_scan_skip_spaces(scan, i);
+
+		if (ATOM_TEXT == scan->state) {
+
+			// a mark with the spaces around it.
+
+			if (s < scan->c_len && DEEN_ENTRY_IS_MARK(c[s])) {
+				uint8_t mark = c[s];
+
+				scan->i = deen_entry_scan_skip_spaces(scan, s + 1);
+
+				switch (mark) {
+					case '{':
+						scan->state = ATOM_GRAMMAR;
+						break;
+
+					case '[':
+						scan->state = ATOM_CONTEXT;
+						break;
+
+					case '|':
+						token->type = DEEN_ENTRY_TOKEN_SUB;
+						return DEEN_TRUE;
+
+					default:
+						token->type = DEEN_ENTRY_TOKEN_SUB_SUB;
+						return DEEN_TRUE;
+				}
+			}
+			else {
+				if (' ' == c[i]) {
+					scan->i++;
+				}
+				else {
+
+					// text of three or more characters runs to the next mark
+					// other than ';' and does not end with a space or a ';'.
+
+					size_t end = i + 1;
+					size_t last;
+
+					while (end < scan->c_len && !DEEN_ENTRY_IS_TEXT_END(c[end])) {
+						end++;
+					}
+
+					last = end - 1;
+
+					while (last >= i + 2 && (' ' == c[last] || ';' == c[last])) {
+						last--;
+					}
+
+					if (last >= i + 2) {
+						deen_entry_scan_atom(scan, token, ATOM_TEXT, last + 1);
+						return DEEN_TRUE;
+					}
+
+					if ('\t' == c[i] || '\n' == c[i] || '\r' == c[i]) {
+						scan->i++;
+					}
+					else {
+						deen_entry_scan_atom(scan, token, ATOM_TEXT, i + 1);
+						return DEEN_TRUE;
+					}
+				}
+			}
+		}
+		else {
+			uint8_t close = ATOM_GRAMMAR == scan->state ? '}' : ']';
+
+			if (s < scan->c_len && close == c[s]) {
+				scan->i = deen_entry_scan_skip_spaces(scan, s + 1);
+				scan->state = ATOM_TEXT;
+			}
+			else {
+				size_t end = i;
+
+				while (end < scan->c_len && close != c[end]) {
+					end++;
+				}
+
+				deen_entry_scan_atom(scan, token, scan->state, end);
+				return DEEN_TRUE;
+			}
+		}
+	}
+
+	return DEEN_FALSE;
 }
 
 
 // ---------------------------------------------------------------
-// FREEING DATA
+// PARSING
 // ---------------------------------------------------------------
 
 
-static void deen_entry_atom_free(deen_entry_atom *atom) {
-	if (NULL!=atom) {
-		if (NULL!=atom->text) {
-			free((void *) atom->text);
-		}
+void deen_entry_parser_init(deen_entry_parser *parser) {
+	memset(parser, 0, sizeof(deen_entry_parser));
+}
+
+
+void deen_entry_parser_free(deen_entry_parser *parser) {
+	if (NULL != parser) {
+		free((void *) parser->sub_firsts);
+		free((void *) parser->sub_sub_firsts);
+		free((void *) parser->spans);
+		deen_entry_parser_init(parser);
 	}
 }
 
 
-static void deen_entry_sub_sub_free(deen_entry_sub_sub *sub_sub) {
-	if (NULL != sub_sub) {
-		uint32_t i;
+/*
+Makes sure that there is space for the needed number of items; the space is
+doubled as it is needed so that it is not grown for each item.
+*/
+
+static void *deen_entry_parser_ensure(
+	void *items,
+	size_t *allocated,
+	size_t needed,
+	size_t item_size) {
+
+	if (needed > *allocated) {
+		size_t allocated_new = 0 == *allocated ? 16 : *allocated;
 
-		for (i=0;i<sub_sub->atom_count;i++) {
-			deen_entry_atom_free(&(sub_sub->atoms[i]));
+		while (allocated_new < needed) {
+			allocated_new *= 2;
 		}
 
-		free((void *) sub_sub->atoms);
+		items = deen_erealloc(items, allocated_new * item_size);
+		*allocated = allocated_new;
 	}
+
+	return items;
 }
 
 
-static void deen_entry_sub_free(deen_entry_sub *sub) {
-	if (NULL!=sub) {
-		uint32_t i;
+static void deen_entry_parser_push_sub_sub(deen_entry_parser *parser) {
+	parser->sub_sub_firsts = (uint32_t *) deen_entry_parser_ensure(
+		parser->sub_sub_firsts, &(parser->sub_subs_allocated), parser->sub_subs_count + 1, sizeof(uint32_t));
+	parser->sub_sub_firsts[parser->sub_subs_count] = (uint32_t) parser->spans_count;
+	parser->sub_subs_count++;
+}
 
-		for (i=0;i<sub->sub_sub_count;i++) {
-			deen_entry_sub_sub_free(&(sub->sub_subs[i]));
-		}
 
-		free((void *) sub->sub_subs);
+static void deen_entry_parser_push_sub(deen_entry_parser *parser) {
+	parser->sub_firsts = (uint32_t *) deen_entry_parser_ensure(
+		parser->sub_firsts, &(parser->subs_allocated), parser->subs_count + 1, sizeof(uint32_t));
+	parser->sub_firsts[parser->subs_count] = (uint32_t) parser->sub_subs_count;
+	parser->subs_count++;
+	deen_entry_parser_push_sub_sub(parser);
+}
+
+
+static void deen_entry_parser_push_span(deen_entry_parser *parser, const deen_entry_token *token) {
+	deen_entry_span *span;
+
+	parser->spans = (deen_entry_span *) deen_entry_parser_ensure(
+		parser->spans, &(parser->spans_allocated), parser->spans_count + 1, sizeof(deen_entry_span));
+	span = &(parser->spans[parser->spans_count]);
+	parser->spans_count++;
+
+	span->type = token->atom_type;
+	span->offset = token->offset;
+	span->len = token->len;
+
+	if (0 != span->len) {
+		parser->text_len += span->len + 1;
 	}
 }
 
 
-void deen_entry_free(deen_entry *entry) {
-	if (NULL!=entry) {
-		uint32_t i;
+static void deen_entry_parser_parse_language(
+	deen_entry_parser *parser,
+	const uint8_t *c,
+	size_t c_len) {
+
+	deen_entry_scan scan;
+	deen_entry_token token;
+
+	deen_entry_parser_push_sub(parser);
+	deen_entry_scan_init(&scan, c, c_len);
+
+	while (deen_entry_scan_next(&scan, &token)) {
+		switch (token.type) {
+			case DEEN_ENTRY_TOKEN_SUB:
+				deen_entry_parser_push_sub(parser);
+				break;
+
+			case DEEN_ENTRY_TOKEN_SUB_SUB:
+				deen_entry_parser_push_sub_sub(parser);
+				break;
 
-		for (i=0;i<entry->english_sub_count;i++) {
-			deen_entry_sub_free(&(entry->english_subs[i]));
+			case DEEN_ENTRY_TOKEN_ATOM:
+				DEEN_LOG_TRACE3("atom; %d : >%.*s<", token.atom_type, (int) token.len, &c[token.offset]);
+				deen_entry_parser_push_span(parser, &token);
+				break;
 		}
+	}
+}
+
+
+void deen_entry_parser_parse(
+	deen_entry_parser *parser,
+	const uint8_t *german,
+	size_t german_len,
+	const uint8_t *english,
+	size_t english_len) {
+
+	parser->german = german;
+	parser->english = english;
+	parser->subs_count = 0;
+	parser->sub_subs_count = 0;
+	parser->spans_count = 0;
+	parser->text_len = 0;
+
+	deen_entry_parser_parse_language(parser, german, german_len);
+	parser->english_first_sub = parser->subs_count;
+	parser->english_first_atom = parser->spans_count;
+	deen_entry_parser_parse_language(parser, english, english_len);
+}
+
+
+/*
+The entry is one block of memory laid out as the subs, the sub subs, the atoms
+and then the text of the atoms.  This is the only place where the text of the
+atoms is copied out of the line.
+*/
 
-		for (i=0;i<entry->german_sub_count;i++) {
-			deen_entry_sub_free(&(entry->german_subs[i]));
+deen_entry deen_entry_parser_create_entry(
+	const deen_entry_parser *parser,
+	deen_arena *arena) {
+
+	deen_entry result;
+	size_t subs_size = sizeof(deen_entry_sub) * parser->subs_count;
+	size_t sub_subs_size = sizeof(deen_entry_sub_sub) * parser->sub_subs_count;
+	size_t atoms_size = sizeof(deen_entry_atom) * parser->spans_count;
+	size_t block_size = subs_size + sub_subs_size + atoms_size + parser->text_len;
+	uint8_t *block = (uint8_t *) (NULL == arena ? deen_emalloc(block_size) : deen_arena_alloc(arena, block_size));
+	deen_entry_sub *subs = (deen_entry_sub *) block;
+	deen_entry_sub_sub *sub_subs = (deen_entry_sub_sub *) &block[subs_size];
+	deen_entry_atom *atoms = (deen_entry_atom *) &block[subs_size + sub_subs_size];
+	uint8_t *text = &block[subs_size + sub_subs_size + atoms_size];
+	size_t i;
+
+	for (i = 0; i < parser->subs_count; i++) {
+		size_t sub_subs_end = i + 1 < parser->subs_count ? parser->sub_firsts[i + 1] : parser->sub_subs_count;
+		subs[i].sub_subs = &sub_subs[parser->sub_firsts[i]];
+		subs[i].sub_sub_count = (uint32_t) (sub_subs_end - parser->sub_firsts[i]);
+	}
+
+	for (i = 0; i < parser->sub_subs_count; i++) {
+		size_t atoms_end = i + 1 < parser->sub_subs_count ? parser->sub_sub_firsts[i + 1] : parser->spans_count;
+		sub_subs[i].atoms = &atoms[parser->sub_sub_firsts[i]];
+		sub_subs[i].atom_count = (uint32_t) (atoms_end - parser->sub_sub_firsts[i]);
+	}
+
+	for (i = 0; i < parser->spans_count; i++) {
+		const deen_entry_span *span = &(parser->spans[i]);
+		const uint8_t *c = i < parser->english_first_atom ? parser->german : parser->english;
+
+		atoms[i].type = span->type;
+
+		if (0 == span->len) {
+			atoms[i].text = NULL;
+		}
+		else {
+			memcpy(text, &c[span->offset], span->len);
+			text[span->len] = 0;
+			atoms[i].text = text;
+			text += span->len + 1;
 		}
 	}
+
+	result.german_subs = subs;
+	result.german_sub_count = (uint32_t) parser->english_first_sub;
+	result.english_subs = &subs[parser->english_first_sub];
+	result.english_sub_count = (uint32_t) (parser->subs_count - parser->english_first_sub);
+	result.distance_from_keywords = 0;
+	result.block = NULL == arena ? (void *) block : NULL;
+
+	return result;
 }
 
 
 // ---------------------------------------------------------------
-// SCORING
+// CREATION
 // ---------------------------------------------------------------
 
 
-typedef struct
-	deen_entry_calculate_distance_from_keywords_foreachword_callback_state
-	deen_entry_calculate_distance_from_keywords_foreachword_callback_state;
-struct deen_entry_calculate_distance_from_keywords_foreachword_callback_state
-{
-	uint32_t accumulated_distance_from_keyword;
-	deen_keywords *keywords;
-	deen_bool *keyword_use_map; // boolean
-};
+deen_entry deen_entry_create(
+	const uint8_t *german,
+	const uint8_t *english) {
+
+	deen_entry result;
+	deen_entry_parser parser;
+
+	deen_entry_parser_init(&parser);
+	deen_entry_parser_parse(
+		&parser,
+		german, strlen((const char *) german),
+		english, strlen((const char *) english));
+	result = deen_entry_parser_create_entry(&parser, NULL);
+	deen_entry_parser_free(&parser);
+
+	return result;
+}
+
+
+// ---------------------------------------------------------------
+// FREEING DATA
+// ---------------------------------------------------------------
+
+
+void deen_entry_free(deen_entry *entry) {
+	if (NULL != entry && NULL != entry->block) {
+		free(entry->block);
+		entry->block = NULL;
+	}
+}
+
+
+// ---------------------------------------------------------------
+// SCORING
+// ---------------------------------------------------------------
 
 
-size_t deen_entry_find_first_keyword(
+/*
+Finds the first keyword that is at the offset in the text.  A keyword that
+would run past the end of the text does not match.
+*/
+
+static size_t deen_entry_find_first_keyword(
 	const uint8_t *s,
+	size_t s_len,
 	deen_keywords *keywords,
-	uint32_t offset) {
+	size_t offset) {
 	uint32_t i;
 
 	for (i=0;i<keywords->count;i++) {
-		if (deen_imatches_at(s, keywords->keywords[i], offset)) {
+		if (keywords->keyword_lens[i] <= s_len - offset
+			&& deen_imatches_at_len(s, keywords->keywords[i], keywords->keyword_lens[i], offset)) {
 			return i;
 		}
 	}
@@ -131,42 +445,79 @@ size_t deen_entry_find_first_keyword(
 }
 
 
-deen_bool deen_entry_calculate_distance_from_keywords_foreachword_callback(
-	const uint8_t *s, size_t offset, size_t len, void *context) {
+/*
+For each word in the text, adds up the characters that are not part of a
+keyword at the start of the word.  The keywords that are found are marked in
+the use map.
+*/
 
-	deen_entry_calculate_distance_from_keywords_foreachword_callback_state *state =
-		(deen_entry_calculate_distance_from_keywords_foreachword_callback_state *) context;
+static uint32_t deen_entry_text_calculate_distance_from_keywords(
+	const uint8_t *s,
+	size_t s_len,
+	deen_keywords *keywords,
+	deen_bool *keyword_use_map) {
 
-		// find the first keyword at the start of this string.
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
+	uint32_t accumulated_distance_from_keyword = 0;
 
-	size_t keyword_offset = deen_entry_find_first_keyword(s, state->keywords, offset);
+	deen_word_scan_init(&scan, s, s_len, 0, DEEN_FALSE);
 
-	if (DEEN_NOT_FOUND == keyword_offset) {
-		state->accumulated_distance_from_keyword += (uint32_t) len;
-	}
-	else {
-		size_t keyword_len;
-		size_t sequence_count;
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		size_t i;
 
-		state->keyword_use_map[keyword_offset] = DEEN_TRUE;
+		for (i = 0; i < span_count; i++) {
+			size_t offset = spans[i].offset;
+			size_t len = spans[i].len;
 
-		// how many letters (decoded from UTF-8) remain in the rest of the word?
-		keyword_len = strlen((char *) state->keywords->keywords[keyword_offset]);
+			// find the first keyword at the start of this string.
 
-		switch (deen_utf8_sequences_count(&s[offset + keyword_len], len-keyword_len, &sequence_count)) {
+			size_t keyword_offset = deen_entry_find_first_keyword(s, s_len, keywords, offset);
 
-			case DEEN_SEQUENCE_OK:
-				state->accumulated_distance_from_keyword += sequence_count;
-				break;
+			if (DEEN_NOT_FOUND == keyword_offset) {
+				accumulated_distance_from_keyword += (uint32_t) len;
+			}
+			else {
+				size_t keyword_len = keywords->keyword_lens[keyword_offset];
+				size_t sequence_count;
 
-			case DEEN_BAD_SEQUENCE:
-				deen_log_error_and_exit("encountered bad utf-8 sequence");
-				break;
+				keyword_use_map[keyword_offset] = DEEN_TRUE;
 
-			case DEEN_INCOMPLETE_SEQUENCE:
-				deen_log_error_and_exit("encountered incomplete utf-8 sequence");
-				break;
+				// how many letters (decoded from UTF-8) remain in the rest of the word?
+
+				switch (deen_utf8_sequences_count(&s[offset + keyword_len], len-keyword_len, &sequence_count)) {
+
+					case DEEN_SEQUENCE_OK:
+						accumulated_distance_from_keyword += sequence_count;
+						break;
+
+					case DEEN_BAD_SEQUENCE:
+						deen_log_error_and_exit("encountered bad utf-8 sequence");
+						break;
 
+					case DEEN_INCOMPLETE_SEQUENCE:
+						deen_log_error_and_exit("encountered incomplete utf-8 sequence");
+						break;
+
+				}
+			}
+		}
+	}
+
+	return accumulated_distance_from_keyword;
+}
+
+
+static deen_bool deen_entry_keywords_all_used(
+	deen_keywords *keywords,
+	const deen_bool *keyword_use_map) {
+
+	uint32_t i;
+
+	for (i=0;i<keywords->count;i++) {
+		if (!keyword_use_map[i]) {
+			return DEEN_FALSE;
 		}
 	}
 
@@ -184,34 +535,26 @@ static uint32_t deen_entry_sub_sub_calculate_distance_from_keywords(
 	deen_entry_sub_sub *sub_sub,
 	deen_keywords *keywords,
 	deen_bool *keyword_use_map) {
-	
-	deen_entry_calculate_distance_from_keywords_foreachword_callback_state state;
+
+	uint32_t accumulated_distance_from_keyword = 0;
 	uint32_t i;
 
 	memset(keyword_use_map, 0, (sizeof(deen_bool) * keywords->count));
 
-	state.keywords = keywords;
-	state.keyword_use_map = keyword_use_map;
-	state.accumulated_distance_from_keyword = 0;
-
 	for (i=0;i<sub_sub->atom_count;i++) {
 
 		if (ATOM_TEXT == sub_sub->atoms[i].type) {
-
-			deen_for_each_word(
-				sub_sub->atoms[i].text, 0,
-				&deen_entry_calculate_distance_from_keywords_foreachword_callback,
-				&state);
+			accumulated_distance_from_keyword += deen_entry_text_calculate_distance_from_keywords(
+				sub_sub->atoms[i].text, strlen((const char *) sub_sub->atoms[i].text),
+				keywords, keyword_use_map);
 		}
 	}
 
-	for (i=0;i<keywords->count;i++) {
-		if (!keyword_use_map[i]) {
-			return DEEN_MAX_SORT_DISTANCE_FROM_KEYWORDS;
-		}
+	if (!deen_entry_keywords_all_used(keywords, keyword_use_map)) {
+		return DEEN_MAX_SORT_DISTANCE_FROM_KEYWORDS;
 	}
 
-	return state.accumulated_distance_from_keyword;
+	return accumulated_distance_from_keyword;
 }
 
 
@@ -280,3 +623,80 @@ uint32_t deen_entry_calculate_distance_from_keywords(
 
 	return english_result;
 }
+
+
+/*
+Works the distance out for one language of a line in the same way as for the
+subs of an entry.  The distance of the language is the least distance of any
+of its sub subs.
+*/
+
+static uint32_t deen_entry_line_language_calculate_distance_from_keywords(
+	const uint8_t *c,
+	size_t c_len,
+	deen_keywords *keywords,
+	deen_bool *keyword_use_map,
+	uint32_t *sub_count) {
+
+	deen_entry_scan scan;
+	deen_entry_token token;
+	deen_bool is_token;
+	uint32_t result = DEEN_MAX_SORT_DISTANCE_FROM_KEYWORDS;
+	uint32_t accumulated_distance_from_keyword = 0;
+
+	*sub_count = 1;
+	memset(keyword_use_map, 0, (sizeof(deen_bool) * keywords->count));
+	deen_entry_scan_init(&scan, c, c_len);
+
+	do {
+		is_token = deen_entry_scan_next(&scan, &token);
+
+		if (!is_token || DEEN_ENTRY_TOKEN_ATOM != token.type) {
+			if (deen_entry_keywords_all_used(keywords, keyword_use_map)
+				&& accumulated_distance_from_keyword < result) {
+				result = accumulated_distance_from_keyword;
+			}
+
+			if (is_token && DEEN_ENTRY_TOKEN_SUB == token.type) {
+				(*sub_count)++;
+			}
+
+			accumulated_distance_from_keyword = 0;
+			memset(keyword_use_map, 0, (sizeof(deen_bool) * keywords->count));
+		}
+		else {
+			if (ATOM_TEXT == token.atom_type) {
+				accumulated_distance_from_keyword += deen_entry_text_calculate_distance_from_keywords(
+					&c[token.offset], token.len, keywords, keyword_use_map);
+			}
+		}
+	}
+	while (is_token);
+
+	return result;
+}
+
+
+uint32_t deen_entry_calculate_line_distance_from_keywords(
+	const uint8_t *german,
+	size_t german_len,
+	const uint8_t *english,
+	size_t english_len,
+	deen_keywords *keywords,
+	deen_bool *keyword_use_map,
+	uint32_t *german_sub_count) {
+
+	uint32_t english_sub_count;
+
+	uint32_t german_result = deen_entry_line_language_calculate_distance_from_keywords(
+		german, german_len, keywords, keyword_use_map, german_sub_count);
+
+	uint32_t english_result = deen_entry_line_language_calculate_distance_from_keywords(
+		english, english_len, keywords, keyword_use_map, &english_sub_count);
+
+	if (german_result < english_result) {
+		return german_result;
+	}
+
+	return english_result;
+}
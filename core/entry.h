@@ -15,6 +15,28 @@ deen_entry deen_entry_create(const uint8_t *german, const uint8_t *english);
 
 void deen_entry_free(deen_entry *entry);
 
+/*
+A parser is initialized once and then used to parse any number of lines before
+it is freed.  Parsing a line does not copy its text so the text has to stay in
+place until the entry has been created from the parser.  The entry is created
+in the arena if one is supplied; in which case it is freed with the arena
+rather than with deen_entry_free.
+*/
+
+void deen_entry_parser_init(deen_entry_parser *parser);
+void deen_entry_parser_free(deen_entry_parser *parser);
+
+void deen_entry_parser_parse(
+	deen_entry_parser *parser,
+	const uint8_t *german,
+	size_t german_len,
+	const uint8_t *english,
+	size_t english_len);
+
+deen_entry deen_entry_parser_create_entry(
+	const deen_entry_parser *parser,
+	deen_arena *arena);
+
 /*
  The 'keyword_use_map' parameter here is a buffer that can be re-used between
  invocations.  The output of this buffer is not meaningful.  This just avoids
@@ -26,4 +48,21 @@ int deen_entry_calculate_distance_from_keywords(
 	deen_keywords *keywords,
 	deen_bool *keyword_use_map);
 
+/*
+As deen_entry_calculate_distance_from_keywords but this works from the german
+and the english text of a line without creating the entry.  The text need not be
+terminated.  The number of german subs that the entry would have is also
+returned because it is used to order entries that are the same distance from
+the keywords.
+*/
+
+uint32_t deen_entry_calculate_line_distance_from_keywords(
+	const uint8_t *german,
+	size_t german_len,
+	const uint8_t *english,
+	size_t english_len,
+	deen_keywords *keywords,
+	deen_bool *keyword_use_map,
+	uint32_t *german_sub_count);
+
 #endif /* __ENTRY_H */
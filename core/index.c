@@ -8,29 +8,70 @@
 
 #include "index.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
 #include "common.h"
+#include "mapindex.h"
+#include "posting.h"
 
 // transaction
 #define SQL_TRANSACTION_BEGIN "BEGIN"
 #define SQL_TRANSACTION_COMMIT "COMMIT"
 
 // init
-#define SQL_TABLE_PREFIX_CREATE "CREATE TABLE deen_prefix(id INTEGER PRIMARY KEY, prefix VARCHAR(4) UNIQUE NOT NULL)"
+#define SQL_TABLE_PREFIX_CREATE "CREATE TABLE deen_prefix(id INTEGER PRIMARY KEY, prefix VARCHAR(4) NOT NULL)"
 #define SQL_TABLE_PREFIX_INDEX_CREATE "CREATE UNIQUE INDEX deen_prefix_idx01 ON deen_prefix(prefix)"
-#define SQL_TABLE_REF_CREATE "CREATE TABLE deen_ref(id INTEGER PRIMARY KEY, deen_prefix_id INTEGER NOT NULL, ref NUMBER NOT NULL, FOREIGN KEY (deen_prefix_id) REFERENCES deen_prefix(id))"
-#define SQL_TABLE_REF_INDEX_CREATE "CREATE UNIQUE INDEX deen_ref_idx01 ON deen_ref(deen_prefix_id, ref)"
+#define SQL_TABLE_REF_CREATE "CREATE TABLE deen_ref(deen_prefix_id INTEGER PRIMARY KEY, ref_count INTEGER NOT NULL, refs BLOB NOT NULL, FOREIGN KEY (deen_prefix_id) REFERENCES deen_prefix(id))"
+#define SQL_TABLE_META_CREATE "CREATE TABLE deen_meta(name VARCHAR(32) PRIMARY KEY, value INTEGER NOT NULL)"
+#define SQL_TABLE_SEGMENT_CREATE "CREATE TABLE deen_segment(id INTEGER PRIMARY KEY, kind INTEGER NOT NULL, ref_start INTEGER NOT NULL, ref_end INTEGER NOT NULL)"
+#define SQL_TABLE_SEGMENT_REF_CREATE "CREATE TABLE deen_segment_ref(prefix VARCHAR(4) NOT NULL, deen_segment_id INTEGER NOT NULL, ref_count INTEGER NOT NULL, refs BLOB NOT NULL, PRIMARY KEY (prefix, deen_segment_id), FOREIGN KEY (deen_segment_id) REFERENCES deen_segment(id)) WITHOUT ROWID"
+#define SQL_TABLE_TOMBSTONE_CREATE "CREATE TABLE deen_tombstone(ref INTEGER PRIMARY KEY)"
 
 // adding
-#define SQL_PREFIX_BULK_FETCH "SELECT id, prefix FROM deen_prefix WHERE prefix IN "
-#define SQL_PREFIX_INSERT "INSERT INTO deen_prefix(prefix) VALUES (?)"
-#define SQL_PREFIX_REF_INSERT "INSERT INTO deen_ref (deen_prefix_id, ref) VALUES "
+#define SQL_PREFIX_INSERT "INSERT INTO deen_prefix(id, prefix) VALUES (?, ?)"
+#define SQL_PREFIX_REF_INSERT "INSERT INTO deen_ref(deen_prefix_id, ref_count, refs) VALUES (?, ?, ?)"
+#define SQL_META_INSERT "INSERT OR REPLACE INTO deen_meta(name, value) VALUES (?, ?)"
+#define SQL_SEGMENT_INSERT "INSERT INTO deen_segment(kind, ref_start, ref_end) VALUES (?, ?, ?)"
+#define SQL_SEGMENT_REF_INSERT "INSERT INTO deen_segment_ref(prefix, deen_segment_id, ref_count, refs) VALUES (?, ?, ?, ?)"
+#define SQL_TOMBSTONE_INSERT "INSERT OR IGNORE INTO deen_tombstone(ref) VALUES (?)"
 
 // searching
-#define SQL_REF_LOOKUP "SELECT r.ref FROM deen_ref r JOIN deen_prefix p ON p.id = r.deen_prefix_id WHERE p.prefix = ?"
+#define SQL_PREFIX_COUNT "SELECT COUNT(*) FROM deen_prefix"
+#define SQL_PREFIX_LOOKUP "SELECT p.prefix, p.id, r.ref_count FROM deen_prefix p JOIN deen_ref r ON r.deen_prefix_id = p.id"
+#define SQL_REF_LOOKUP "SELECT refs FROM deen_ref WHERE deen_prefix_id = ?"
+#define SQL_META_LOOKUP "SELECT name, value FROM deen_meta"
+#define SQL_SEGMENT_LOOKUP "SELECT s.id, s.kind, s.ref_start, s.ref_end, EXISTS (SELECT 1 FROM deen_segment_ref sr WHERE sr.deen_segment_id = s.id) FROM deen_segment s ORDER BY s.id"
+#define SQL_TOMBSTONE_LOOKUP "SELECT ref FROM deen_tombstone ORDER BY ref"
+#define SQL_SEGMENT_REF_LOOKUP "SELECT ref_count, refs FROM deen_segment_ref WHERE prefix = ? ORDER BY deen_segment_id"
+#define SQL_SEGMENT_REF_COUNT_LOOKUP "SELECT SUM(ref_count) FROM deen_segment_ref WHERE prefix = ?"
+
+// metadata
+#define DEEN_META_SOURCE_HASH "source_hash"
+#define DEEN_META_SOURCE_SIZE "source_size"
+#define DEEN_META_INDEXING_DEPTH "indexing_depth"
+#define DEEN_META_FORMAT_VERSION "format_version"
+#define DEEN_META_CHECKPOINT_REF "checkpoint_ref"
+#define DEEN_META_CHECKPOINT_SOURCE_HASH "checkpoint_source_hash"
+#define DEEN_META_CHECKPOINT_RUNS_COUNT "checkpoint_runs_count"
+#define DEEN_META_CHECKPOINT_FORMAT_VERSION "checkpoint_format_version"
+
+/*
+The runs are read back during the merge through a buffer of this many pairs.
+*/
+
+#define DEEN_INDEX_MERGE_BUFFER_PAIRS 1024
+
+#define SQL_META_CHECKPOINT_DELETE "DELETE FROM deen_meta WHERE name IN ('" \
+	DEEN_META_CHECKPOINT_REF "', '" DEEN_META_CHECKPOINT_SOURCE_HASH "', '" \
+	DEEN_META_CHECKPOINT_RUNS_COUNT "', '" DEEN_META_CHECKPOINT_FORMAT_VERSION "')"
 
 
 static void deen_index_run_sql(sqlite3 *db, char *sql) {
@@ -50,11 +91,43 @@ static void deen_index_run_sql(sqlite3 *db, char *sql) {
 }
 
 
+static sqlite3_stmt *deen_index_prepare(sqlite3 *db, const char *sql) {
+	sqlite3_stmt *stmt = NULL;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+		deen_log_error_and_exit("sqllite error preparing statement for [%s]; %s", sql, sqlite3_errmsg(db));
+	}
+
+	return stmt;
+}
+
+
+static void deen_index_finalize(sqlite3 *db, sqlite3_stmt *stmt, const char *sql) {
+	if (SQLITE_OK != sqlite3_finalize(stmt)) {
+		deen_log_error_and_exit("sqllite error finalizing statement for [%s]; %s", sql, sqlite3_errmsg(db));
+	}
+}
+
+
+static void deen_index_reset(sqlite3 *db, sqlite3_stmt *stmt, const char *sql) {
+	if (SQLITE_OK != sqlite3_reset(stmt)) {
+		deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", sql, sqlite3_errmsg(db));
+	}
+}
+
+
+/*
+The secondary indexes are not created here; they are created once all of the
+data has been loaded because it is much faster to build them in one go.
+*/
+
 void deen_index_init(sqlite3 *db) {
 	deen_index_run_sql(db, SQL_TABLE_PREFIX_CREATE);
-	deen_index_run_sql(db, SQL_TABLE_PREFIX_INDEX_CREATE);
 	deen_index_run_sql(db, SQL_TABLE_REF_CREATE);
-	deen_index_run_sql(db, SQL_TABLE_REF_INDEX_CREATE);
+	deen_index_run_sql(db, SQL_TABLE_META_CREATE);
+	deen_index_run_sql(db, SQL_TABLE_SEGMENT_CREATE);
+	deen_index_run_sql(db, SQL_TABLE_SEGMENT_REF_CREATE);
+	deen_index_run_sql(db, SQL_TABLE_TOMBSTONE_CREATE);
 }
 
 
@@ -72,431 +145,1697 @@ deen_index_add_context *deen_index_add_context_create(sqlite3 *db) {
 	deen_index_add_context *result = (deen_index_add_context *) deen_emalloc(sizeof(deen_index_add_context));
 	memset(result, 0, sizeof(deen_index_add_context));
 	result->db = db;
+	result->pairs_budget = DEEN_INDEX_BULK_MEMORY_BUDGET / sizeof(deen_index_pair);
+	result->shards_count = 1;
 	return result;
 }
 
 
 void deen_index_add_context_free(deen_index_add_context *context) {
 	if (NULL!=context) {
+		size_t i;
 
-		if (NULL!= context->prefix_insert_stmt) {
-			if (SQLITE_OK != sqlite3_finalize(context->prefix_insert_stmt)) {
-				deen_log_error_and_exit("sqllite error finalizing prefix insert stmt; %s", sqlite3_errmsg(context->db));
-			}
+		for (i = 0; i < context->runs_count; i++) {
+			fclose(context->runs[i]);
 		}
 
-		if (0 != context->find_existing_prefixes_stmts_count) {
-			int i;
+		if (NULL != context->runs) {
+			free((void *) context->runs);
+		}
 
-			for (i=0; i<context->find_existing_prefixes_stmts_count; i++) {
-				if (NULL != context->find_existing_prefixes_stmts[i]) {
-					if (SQLITE_OK != sqlite3_finalize(context->find_existing_prefixes_stmts[i])) {
-						deen_log_error_and_exit("sqllite error finalizing find existing prefixes stmt; %s", sqlite3_errmsg(context->db));
-					}
-				}
-			}
+		if (NULL != context->runs_dir) {
+			free((void *) context->runs_dir);
+		}
 
-			free((void *) context->find_existing_prefixes_stmts);
+		if (NULL != context->pairs) {
+			free((void *) context->pairs);
 		}
 
-		if (0 != context->ref_insert_stmts_count) {
-			int i;
+		if (NULL != context->prefix_refs) {
+			free((void *) context->prefix_refs);
+		}
 
-			for (i=0; i<context->ref_insert_stmts_count; i++) {
-				if (NULL != context->ref_insert_stmts[i]) {
-					if (SQLITE_OK != sqlite3_finalize(context->ref_insert_stmts[i])) {
-						deen_log_error_and_exit("sqllite error finalizing find existing prefixes stmt; %s", sqlite3_errmsg(context->db));
-					}
-				}
-			}
+		free((void *) context);
+	}
+}
+
+
+static int deen_index_pair_compare(const void *a, const void *b) {
+	const deen_index_pair *pair_a = (const deen_index_pair *) a;
+	const deen_index_pair *pair_b = (const deen_index_pair *) b;
+	int result = memcmp(pair_a->prefix, pair_b->prefix, DEEN_INDEX_PREFIX_WIDTH);
+
+	if (0 == result) {
+		if (pair_a->ref < pair_b->ref) {
+			return -1;
+		}
 
-			free((void *) context->ref_insert_stmts);
+		if (pair_a->ref > pair_b->ref) {
+			return 1;
 		}
 	}
+
+	return result;
 }
 
 
-static sqlite3_stmt *deen_index_get_or_create_find_existing_prefixes_stmt(
-	deen_index_add_context *index_add_context,
-	size_t prefix_count
-) {
-	if (prefix_count > 1000) {
-		deen_log_error_and_exit("proposterous quantity of prefixes to search for; %u", prefix_count);
+/*
+Rearranges the pairs so that they are grouped by the first byte of their
+prefix.  On return, the pairs with the first byte 'b' are between
+'bucket_starts[b]' and 'bucket_starts[b + 1]'.
+*/
+
+static void deen_index_bucket_pairs(
+	deen_index_pair *pairs,
+	size_t pairs_count,
+	size_t *bucket_starts) {
+
+	size_t next[256];
+	size_t i;
+	uint32_t b;
+
+	memset(bucket_starts, 0, sizeof(size_t) * 257);
+
+	for (i = 0; i < pairs_count; i++) {
+		bucket_starts[pairs[i].prefix[0] + 1]++;
 	}
 
-	if (prefix_count >= index_add_context->find_existing_prefixes_stmts_count) {
-		size_t i;
+	for (b = 0; b < 256; b++) {
+		bucket_starts[b + 1] += bucket_starts[b];
+		next[b] = bucket_starts[b];
+	}
 
-		index_add_context->find_existing_prefixes_stmts = deen_erealloc(
-			index_add_context->find_existing_prefixes_stmts,
-			sizeof(sqlite3_stmt *) * prefix_count
-		);
+	// each pair is swapped into the next free place in its bucket until the
+	// pair that is swapped back belongs in the bucket being filled.
 
-		for (
-			i=index_add_context->find_existing_prefixes_stmts_count;
-			i < prefix_count;
-			i++) {
-			index_add_context->find_existing_prefixes_stmts[i] = NULL;
+	for (b = 0; b < 256; b++) {
+		while (next[b] < bucket_starts[b + 1]) {
+			uint8_t target = pairs[next[b]].prefix[0];
+
+			if (target == b) {
+				next[b]++;
+			}
+			else {
+				deen_index_pair swap;
+				memcpy(&swap, &pairs[next[target]], sizeof(deen_index_pair));
+				memcpy(&pairs[next[target]], &pairs[next[b]], sizeof(deen_index_pair));
+				memcpy(&pairs[next[b]], &swap, sizeof(deen_index_pair));
+				next[target]++;
+			}
 		}
 	}
+}
 
-	if(NULL == index_add_context->find_existing_prefixes_stmts[prefix_count - 1]) {
-		uint32_t i;
-		size_t len = strlen(SQL_PREFIX_BULK_FETCH) + (size_t) (3 + ((prefix_count-1) * 2));
-		char *sql = deen_emalloc(len + 1); // +1 for the NULL at the end
-		strcpy(sql, SQL_PREFIX_BULK_FETCH);
-		strcat(sql, "(");
 
-		for (i = 0; i < prefix_count; i++) {
-			if (0 != i) {
-				strcat(sql, ",");
-			}
+/*
+Splits the first bytes of the prefixes into no more than 'shards_max' ranges
+which have about the same number of pairs in each.  Taken together, the ranges
+cover all of the bytes in order.  The last byte of each range is stored into
+'range_ends' and the number of ranges is returned.
+*/
 
-			strcat(sql, "?");
-		}
+static size_t deen_index_plan_shards(
+	const size_t *first_byte_counts,
+	size_t shards_max,
+	uint8_t *range_ends) {
 
-		strcat(sql, ")");
+	uint64_t total = 0;
+	uint64_t upto = 0;
+	size_t shards_count = 0;
+	uint32_t b;
 
-		if (SQLITE_OK != sqlite3_prepare_v2(
-			index_add_context->db,
-			sql, len,
-			&(index_add_context->find_existing_prefixes_stmts[prefix_count - 1]),
-			NULL)) {
-			deen_log_error_and_exit("sqllite error preparing statement for [%s]; %s", sql, sqlite3_errmsg(index_add_context->db));
-		}
+	for (b = 0; b < 256; b++) {
+		total += first_byte_counts[b];
+	}
 
-		free((void *) sql);
+	for (b = 0; b < 255 && shards_count + 1 < shards_max; b++) {
+		upto += first_byte_counts[b];
+
+		if (0 != first_byte_counts[b] && upto * shards_max >= total * (shards_count + 1)) {
+			range_ends[shards_count] = (uint8_t) b;
+			shards_count++;
+		}
 	}
 
-	return index_add_context->find_existing_prefixes_stmts[prefix_count - 1];
+	range_ends[shards_count] = 255;
+
+	return shards_count + 1;
 }
 
 
-static sqlite3_stmt *deen_index_get_or_create_ref_insert_stmt(
-	deen_index_add_context *index_add_context,
-	size_t tuple_count) {
+/*
+Runs each of the tasks on its own thread and waits for them all to finish.  The
+first task is run on the calling thread as is any task for which a thread could
+not be started.
+*/
 
-	if (tuple_count > 1000) {
-		deen_log_error_and_exit("proposterous quantity of tupls to insert; %u", tuple_count);
+static void deen_index_run_tasks(
+	void *(*run)(void *),
+	void *tasks,
+	size_t task_size,
+	size_t tasks_count) {
+
+	size_t i;
+
+#ifdef __MINGW32__
+	for (i = 0; i < tasks_count; i++) {
+		run((uint8_t *) tasks + (i * task_size));
 	}
+#else
+	pthread_t threads[DEEN_INDEX_SHARDS_MAX];
+	deen_bool is_started[DEEN_INDEX_SHARDS_MAX];
 
-	if (tuple_count >= index_add_context->ref_insert_stmts_count) {
-		size_t i;
+	for (i = 1; i < tasks_count; i++) {
+		is_started[i] = 0 == pthread_create(&threads[i], NULL, run, (uint8_t *) tasks + (i * task_size));
+	}
 
-		index_add_context->ref_insert_stmts = deen_erealloc(
-			index_add_context->ref_insert_stmts,
-			sizeof(sqlite3_stmt *) * tuple_count
-		);
+	run(tasks);
 
-		for (
-			i=index_add_context->ref_insert_stmts_count;
-			i < tuple_count;
-			i++) {
-			index_add_context->ref_insert_stmts[i] = NULL;
+	for (i = 1; i < tasks_count; i++) {
+		if (is_started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+		else {
+			run((uint8_t *) tasks + (i * task_size));
 		}
 	}
+#endif
+}
 
-	if(NULL == index_add_context->ref_insert_stmts[tuple_count - 1]) {
-		uint32_t i;
-		size_t len = strlen(SQL_PREFIX_REF_INSERT) + (size_t) (tuple_count * 6);
-		char *sql = deen_emalloc(len + 1); // +1 for the NULL at the end
-		strcpy(sql, SQL_PREFIX_REF_INSERT);
 
-		for (i = 0; i < tuple_count; i++) {
-			if (0 != i) {
-				strcat(sql, ",");
-			}
+/*
+Once the pairs are grouped by the first byte of their prefix, the groups are
+able to be sorted independently; each task sorts a range of the groups.
+*/
 
-			strcat(sql, "(?,?)");
-		}
+typedef struct deen_index_sort_task deen_index_sort_task;
+struct deen_index_sort_task {
+	deen_index_pair *pairs;
+	const size_t *bucket_starts;
+	uint32_t first_byte_min;
+	uint32_t first_byte_max;
+};
 
-		if (SQLITE_OK != sqlite3_prepare_v2(
-			index_add_context->db,
-			sql, len,
-			&(index_add_context->ref_insert_stmts[tuple_count - 1]),
-			NULL)) {
-			deen_log_error_and_exit("sqllite error preparing statement for [%s]; %s", sql, sqlite3_errmsg(index_add_context->db));
-		}
 
-		free((void *) sql);
+static void *deen_index_sort_task_run(void *data) {
+	deen_index_sort_task *task = (deen_index_sort_task *) data;
+	uint32_t b;
+
+	for (b = task->first_byte_min; b <= task->first_byte_max; b++) {
+		qsort(
+			&(task->pairs[task->bucket_starts[b]]),
+			task->bucket_starts[b + 1] - task->bucket_starts[b],
+			sizeof(deen_index_pair), &deen_index_pair_compare);
+	}
+
+	return NULL;
+}
+
+
+static void deen_index_sort_pairs(deen_index_add_context *context) {
+	size_t bucket_starts[257];
+	size_t bucket_counts[256];
+	uint8_t range_ends[DEEN_INDEX_SHARDS_MAX];
+	deen_index_sort_task tasks[DEEN_INDEX_SHARDS_MAX];
+	size_t tasks_count;
+	size_t i;
+	uint32_t b;
+
+	deen_millis start_ms = deen_millis_since_epoc();
+
+	deen_index_bucket_pairs(context->pairs, context->pairs_count, bucket_starts);
+
+	for (b = 0; b < 256; b++) {
+		bucket_counts[b] = bucket_starts[b + 1] - bucket_starts[b];
+		context->first_byte_counts[b] += bucket_counts[b];
+	}
+
+	tasks_count = deen_index_plan_shards(bucket_counts, context->shards_count, range_ends);
+
+	for (i = 0; i < tasks_count; i++) {
+		tasks[i].pairs = context->pairs;
+		tasks[i].bucket_starts = bucket_starts;
+		tasks[i].first_byte_min = 0 == i ? 0 : range_ends[i - 1] + 1;
+		tasks[i].first_byte_max = range_ends[i];
 	}
 
-	return index_add_context->ref_insert_stmts[tuple_count - 1];
+	deen_index_run_tasks(&deen_index_sort_task_run, tasks, sizeof(deen_index_sort_task), tasks_count);
+
+	context->sort_millis += (deen_millis_since_epoc() - start_ms);
+}
+
+
+static char *deen_index_run_path(const char *runs_dir, size_t run_i) {
+	char *path = (char *) deen_emalloc(
+		strlen(runs_dir) + strlen(DEEN_FILE_SEP) + strlen(DEEN_LEAF_INDEX_RUN) + 22);
+	sprintf(path, "%s%s%s.%u", runs_dir, DEEN_FILE_SEP, DEEN_LEAF_INDEX_RUN, (unsigned) run_i);
+	return path;
 }
 
 
 /*
-Goes through the 'prefix_and_refs' and finds the corresponding primary keys.
-The primary keys are copied into the 'prefix_ids' at the same locations.
+Sorts the pairs that are presently in memory and writes them out to a
+temporary file as a run.  The memory is then available to gather more pairs.
 */
 
-static void deen_index_find_existing_prefixes(
+static void deen_index_spill_pairs(deen_index_add_context *context) {
+	FILE *run;
+
+	deen_index_sort_pairs(context);
+
+	deen_millis start_ms = deen_millis_since_epoc();
+
+	if (NULL == context->runs_dir) {
+		run = tmpfile();
+	}
+	else {
+		char *run_path = deen_index_run_path(context->runs_dir, context->runs_count);
+		run = fopen(run_path, "w+b");
+		free((void *) run_path);
+	}
+
+	if (NULL == run) {
+		deen_log_error_and_exit("unable to create a file for index run %u", context->runs_count);
+	}
+
+	if (context->pairs_count != fwrite(context->pairs, sizeof(deen_index_pair), context->pairs_count, run)) {
+		deen_log_error_and_exit("unable to write the index run %u", context->runs_count);
+	}
+
+	if (0 != fflush(run)) {
+		deen_log_error_and_exit("unable to write the index run %u", context->runs_count);
+	}
+
+	context->runs = (FILE **) deen_erealloc(context->runs, sizeof(FILE *) * (context->runs_count + 1));
+	context->runs[context->runs_count] = run;
+	context->runs_count++;
+
+	DEEN_LOG_TRACE2("spilled index run %u with %u pairs", context->runs_count, context->pairs_count);
+
+	context->pairs_count = 0;
+
+	context->spill_millis += (deen_millis_since_epoc() - start_ms);
+}
+
+
+void deen_index_add(
 	deen_index_add_context *index_add_context,
+	off_t ref,
 	uint8_t **prefixes,
-	uint32_t prefix_count,
-	uint32_t *prefix_ids) {
+	uint32_t prefix_count) {
 
 	uint32_t i;
-	sqlite3_stmt *stmt = deen_index_get_or_create_find_existing_prefixes_stmt(index_add_context, prefix_count);
-	deen_bool processed_all_rows;
+
+	if (0==prefix_count) {
+		DEEN_LOG_INFO0("requested zero indexes added");
+		return;
+	}
 
 	for (i = 0; i < prefix_count; i++) {
-		if (SQLITE_OK != sqlite3_bind_text(
-			stmt,
-			i + 1, // first parameter is at index 1
-			(const char *) prefixes[i],
-			-1,
-			SQLITE_TRANSIENT // means that sql-lite won't try to free the string.
-		)) {
-			deen_log_error_and_exit("sqllite error setting parameter %d; %s", i + 1, sqlite3_errmsg(index_add_context->db));
+		deen_index_pair *pair;
+		size_t prefix_len = strlen((const char *) prefixes[i]);
+
+		if (prefix_len > DEEN_INDEX_PREFIX_WIDTH) {
+			deen_log_error_and_exit("the prefix [%s] is too long to index", prefixes[i]);
 		}
-	}
 
-	processed_all_rows = DEEN_FALSE;
+		if (index_add_context->pairs_count == index_add_context->pairs_budget) {
+			deen_index_spill_pairs(index_add_context);
+		}
 
-	while (!processed_all_rows) {
-		switch (sqlite3_step(stmt)) {
+		if (index_add_context->pairs_count == index_add_context->pairs_allocated) {
+			index_add_context->pairs_allocated = 0 == index_add_context->pairs_allocated
+				? 1024 : index_add_context->pairs_allocated * 2;
 
-			case SQLITE_ROW:
-			{
-				uint32_t j;
-				off_t row_id = (off_t) sqlite3_column_int64(stmt, 0);
-				const unsigned char *row_prefix = sqlite3_column_text(stmt, 1);
-
-				for (j=0;j<prefix_count;j++) {
-					if (0 == strcmp((const char *) prefixes[j], (const char *) row_prefix)) {
-						prefix_ids[j] = row_id;
-					}
-				}
+			if (index_add_context->pairs_allocated > index_add_context->pairs_budget) {
+				index_add_context->pairs_allocated = index_add_context->pairs_budget;
 			}
-			break;
 
-			case SQLITE_DONE:
-				processed_all_rows = DEEN_TRUE;
-				break;
+			index_add_context->pairs = (deen_index_pair *) deen_erealloc(
+				index_add_context->pairs,
+				sizeof(deen_index_pair) * index_add_context->pairs_allocated);
+		}
 
-			default:
-				deen_log_error_and_exit("sqllite error getting row from; %s", sqlite3_errmsg(index_add_context->db));
-				break;
+		pair = &(index_add_context->pairs[index_add_context->pairs_count]);
+		memset(pair->prefix, 0, DEEN_INDEX_PREFIX_WIDTH);
+		memcpy(pair->prefix, prefixes[i], prefix_len);
+		pair->ref = ref;
+		index_add_context->pairs_count++;
+	}
+
+}
 
+
+/*
+This is one of the sorted inputs to the merge; either a run on disk or the
+pairs that remain in memory.  A run is read through the buffer from
+'run_offset' up to 'run_end' so that a number of shards are able to read from
+different parts of the same run at the same time.
+*/
+
+typedef struct deen_index_merge_source deen_index_merge_source;
+struct deen_index_merge_source {
+	int run_fd;
+	off_t run_offset;
+	off_t run_end;
+	deen_index_pair *buffer;
+	const deen_index_pair *pairs;
+	size_t pairs_count;
+	size_t upto;
+	deen_index_pair current;
+	deen_bool exhausted;
+};
+
+
+static deen_bool deen_index_read_run(
+	int fd,
+	deen_index_pair *pairs,
+	size_t pairs_count,
+	off_t offset) {
+
+	uint8_t *c = (uint8_t *) pairs;
+	size_t len = pairs_count * sizeof(deen_index_pair);
+
+	while (len > 0) {
+#ifdef __MINGW32__
+		ssize_t actuallyread = offset != lseek(fd, offset, SEEK_SET) ? -1 : read(fd, c, len);
+#else
+		ssize_t actuallyread = pread(fd, c, len, offset);
+#endif
+
+		if (actuallyread <= 0) {
+			return DEEN_FALSE;
 		}
-	}
 
-	if (SQLITE_OK != sqlite3_reset(stmt)) {
-		deen_log_error_and_exit("sqllite error resetting stmt; %s", sqlite3_errmsg(index_add_context->db));
+		c += actuallyread;
+		len -= (size_t) actuallyread;
+		offset += (off_t) actuallyread;
 	}
 
+	return DEEN_TRUE;
 }
 
 
 /*
-Goes through the list of 'prefix_and_refs' and finds any that do not have a
-prefix_id.  If they don't have a prefix_id then it creates one and adds it in.
+Finds the first of the sorted pairs between 'from' and 'to' with a prefix that
+starts with a byte that is no less than 'first_byte'.  The pairs are either in
+memory or, if 'pairs' is NULL, in the run.
 */
 
-static void deen_index_add_missing_prefixes(
-	deen_index_add_context *index_add_context,
-	uint8_t **prefixes,
-	uint32_t prefix_count,
-	uint32_t *prefix_ids) {
+static size_t deen_index_pairs_lower_bound(
+	const deen_index_pair *pairs,
+	int run_fd,
+	size_t from,
+	size_t to,
+	uint32_t first_byte) {
 
-	uint32_t i;
+	while (from < to) {
+		size_t mid = from + ((to - from) / 2);
+		deen_index_pair pair;
 
-	for (i = 0;i < prefix_count; i++) {
-		if (0==prefix_ids[i]) {
-			
-			uint32_t j;
-
-			if (NULL == index_add_context->prefix_insert_stmt) {
-				if (SQLITE_OK != sqlite3_prepare_v2(
-					index_add_context->db,
-					SQL_PREFIX_INSERT,
-					-1,
-					&(index_add_context->prefix_insert_stmt),
-					NULL)
-				) {
-					deen_log_error_and_exit("sqllite error preparing statement for [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(index_add_context->db));
-				}
+		if (NULL != pairs) {
+			pair.prefix[0] = pairs[mid].prefix[0];
+		}
+		else {
+			if (!deen_index_read_run(run_fd, &pair, 1, (off_t) (mid * sizeof(deen_index_pair)))) {
+				deen_log_error_and_exit("unable to read back an index run");
 			}
+		}
 
-			if (SQLITE_OK != sqlite3_bind_text(index_add_context->prefix_insert_stmt, 1, (const char *) prefixes[i], -1, SQLITE_TRANSIENT)) {
-				deen_log_error_and_exit("sqllite error setting parameter in [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(index_add_context->db));
-			}
+		if (pair.prefix[0] < first_byte) {
+			from = mid + 1;
+		}
+		else {
+			to = mid;
+		}
+	}
 
-			if (SQLITE_DONE != sqlite3_step(index_add_context->prefix_insert_stmt)) {
-				deen_log_error_and_exit("sqllite error executing insert for \"%s\" [%s]; %s", prefixes[i], SQL_PREFIX_INSERT, sqlite3_errmsg(index_add_context->db));
-			}
+	return from;
+}
 
-			prefix_ids[i] = (uint32_t) sqlite3_last_insert_rowid(index_add_context->db);
 
-			if (0 == prefix_ids[i]) {
-				deen_log_error_and_exit("last insert failed to add a row from [%s]", SQL_PREFIX_INSERT);
-			}
+static void deen_index_merge_source_advance(deen_index_merge_source *source) {
+	if (source->upto == source->pairs_count && -1 != source->run_fd && source->run_offset < source->run_end) {
+		size_t pairs_count = (size_t) ((source->run_end - source->run_offset) / sizeof(deen_index_pair));
 
-			if (SQLITE_OK != sqlite3_reset(index_add_context->prefix_insert_stmt)) {
-				deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(index_add_context->db));
-			}
+		if (pairs_count > DEEN_INDEX_MERGE_BUFFER_PAIRS) {
+			pairs_count = DEEN_INDEX_MERGE_BUFFER_PAIRS;
+		}
 
-			// maybe this prefix is used again further down the list?  If so,
-			// then swap those in as well in order to avoid trying another
-			// insert which will fail because the column must be unique.
+		if (!deen_index_read_run(source->run_fd, source->buffer, pairs_count, source->run_offset)) {
+			deen_log_error_and_exit("unable to read back an index run");
+		}
 
-			for (j = i;j < prefix_count; j++) {
-				if (0 == strcmp((const char *) prefixes[i], (const char *) prefixes[j])) {
-					prefix_ids[j] = prefix_ids[i];
-				}
-			}
+		source->run_offset += (off_t) (pairs_count * sizeof(deen_index_pair));
+		source->pairs = source->buffer;
+		source->pairs_count = pairs_count;
+		source->upto = 0;
+	}
 
-		}
+	if (source->upto < source->pairs_count) {
+		memcpy(&(source->current), &(source->pairs[source->upto]), sizeof(deen_index_pair));
+		source->upto++;
+	}
+	else {
+		source->exhausted = DEEN_TRUE;
 	}
 }
 
 
-static void deen_index_add_refs(
-	deen_index_add_context *index_add_context,
-	off_t ref,
-	uint32_t *prefix_ids,
-	uint32_t prefix_count) {
+/*
+A shard merges the pairs with prefixes that start with a range of bytes.  The
+shards are merged on their own threads and, because only the thread that
+started the merge uses the database, each shard writes each prefix and its
+compressed refs to its output as a record of the prefix, the number of refs,
+the length of the compressed refs and the compressed refs.
+*/
 
-	uint32_t i;
+typedef struct deen_index_shard deen_index_shard;
+struct deen_index_shard {
+	deen_index_merge_source *sources;
+	size_t sources_count;
 
-	sqlite3_stmt *stmt = deen_index_get_or_create_ref_insert_stmt(
-		index_add_context,
-		prefix_count);
+	off_t *prefix_refs;
+	size_t prefix_refs_count;
+	size_t prefix_refs_allocated;
+	uint8_t *encoded;
+	size_t encoded_allocated;
 
-	for (i = 0;i<prefix_count;i++) {
+	uint8_t *output;
+	size_t output_len;
+	size_t output_allocated;
+};
 
-		if (SQLITE_OK != sqlite3_bind_int(stmt, 1 + (2 * i), prefix_ids[i])) {
-			deen_log_error_and_exit("sqllite error binding into statement for add indexes; %s", sqlite3_errmsg(index_add_context->db));
-		}
+#define DEEN_INDEX_SHARD_RECORD_HEADER_LEN (DEEN_INDEX_PREFIX_WIDTH + (2 * sizeof(uint64_t)))
 
-		if (SQLITE_OK != sqlite3_bind_int(stmt, 2 + (2 * i), (int) ref)) {
-			deen_log_error_and_exit("sqllite error binding into statement for add indexes; %s", sqlite3_errmsg(index_add_context->db));
-		}
 
+static void deen_index_load_prefix(
+	deen_index_add_context *context,
+	sqlite3_stmt *stmt,
+	uint32_t prefix_id,
+	const uint8_t *prefix) {
+
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 1, prefix_id)
+		|| SQLITE_OK != sqlite3_bind_text(stmt, 2, (const char *) prefix,
+			strnlen((const char *) prefix, DEEN_INDEX_PREFIX_WIDTH), SQLITE_TRANSIENT)) {
+		deen_log_error_and_exit("sqllite error binding into [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(context->db));
 	}
 
 	if (SQLITE_DONE != sqlite3_step(stmt)) {
-		deen_log_error_and_exit("sqllite error executing add indexes; %s", sqlite3_errmsg(index_add_context->db));
+		deen_log_error_and_exit("sqllite error executing [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(context->db));
 	}
 
 	if (SQLITE_OK != sqlite3_reset(stmt)) {
-		deen_log_error_and_exit("sqllite error resetting stmt for add indexes; %s", sqlite3_errmsg(index_add_context->db));
+		deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", SQL_PREFIX_INSERT, sqlite3_errmsg(context->db));
 	}
 }
 
 
-void deen_index_add(
-	deen_index_add_context *index_add_context,
-	off_t ref,
-	uint8_t **prefixes,
-	uint32_t prefix_count) {
+/*
+The refs for a prefix are gathered as they come out of the merge and are then
+written to the shard's output as a single compressed record once the prefix
+changes.
+*/
 
-	uint32_t *prefix_ids;
+static void deen_index_gather_ref(
+	deen_index_shard *shard,
+	off_t ref) {
 
-	if (0==prefix_count) {
-		DEEN_LOG_INFO0("requested zero indexes added");
+	if (shard->prefix_refs_count == shard->prefix_refs_allocated) {
+		shard->prefix_refs_allocated = 0 == shard->prefix_refs_allocated
+			? 1024 : shard->prefix_refs_allocated * 2;
+		shard->prefix_refs = (off_t *) deen_erealloc(
+			shard->prefix_refs,
+			sizeof(off_t) * shard->prefix_refs_allocated);
+	}
+
+	shard->prefix_refs[shard->prefix_refs_count] = ref;
+	shard->prefix_refs_count++;
+}
+
+
+static void deen_index_output_refs(
+	deen_index_shard *shard,
+	const uint8_t *prefix) {
+
+	uint64_t refs_count = (uint64_t) shard->prefix_refs_count;
+	uint64_t encoded_len;
+	uint8_t *record;
+
+	if (0 == refs_count) {
 		return;
 	}
 
-	prefix_ids = deen_emalloc(prefix_count * sizeof(uint32_t));
-	memset(prefix_ids, 0, sizeof(uint32_t) * prefix_count);
+	encoded_len = (uint64_t) deen_posting_encode(
+		shard->prefix_refs,
+		shard->prefix_refs_count,
+		&(shard->encoded),
+		&(shard->encoded_allocated));
 
-#ifdef DEBUG
-	deen_millis start_ms = deen_millis_since_epoc();
-#endif
+	while (shard->output_len + DEEN_INDEX_SHARD_RECORD_HEADER_LEN + encoded_len > shard->output_allocated) {
+		shard->output_allocated = 0 == shard->output_allocated
+			? 64 * 1024 : shard->output_allocated * 2;
+		shard->output = (uint8_t *) deen_erealloc(shard->output, shard->output_allocated);
+	}
 
-	deen_index_find_existing_prefixes(index_add_context, prefixes, prefix_count, prefix_ids);
+	record = &(shard->output[shard->output_len]);
+	memcpy(record, prefix, DEEN_INDEX_PREFIX_WIDTH);
+	memcpy(&record[DEEN_INDEX_PREFIX_WIDTH], &refs_count, sizeof(uint64_t));
+	memcpy(&record[DEEN_INDEX_PREFIX_WIDTH + sizeof(uint64_t)], &encoded_len, sizeof(uint64_t));
+	memcpy(&record[DEEN_INDEX_SHARD_RECORD_HEADER_LEN], shard->encoded, (size_t) encoded_len);
+	shard->output_len += DEEN_INDEX_SHARD_RECORD_HEADER_LEN + (size_t) encoded_len;
 
-#ifdef DEBUG
-	deen_millis after_find_existing_prefixes_ms = deen_millis_since_epoc();
-	index_add_context->find_existing_prefixes_millis += (after_find_existing_prefixes_ms - start_ms);
-#endif
+	shard->prefix_refs_count = 0;
+}
 
-	deen_index_add_missing_prefixes(index_add_context, prefixes, prefix_count, prefix_ids);
 
-#ifdef DEBUG
-	deen_millis after_add_missing_prefixes_ms = deen_millis_since_epoc();
-	index_add_context->add_missing_prefixes_millis += (after_add_missing_prefixes_ms - after_find_existing_prefixes_ms);
-#endif
+/*
+Merges the shard's sources into its output.  The number of sources is small
+so a linear scan for the least pair is sufficient.
+*/
 
-	deen_index_add_refs(index_add_context, ref, prefix_ids, prefix_count);
+static void *deen_index_shard_merge(void *data) {
+	deen_index_shard *shard = (deen_index_shard *) data;
+	deen_index_pair last;
+	size_t i;
 
-#ifdef DEBUG
-	deen_millis after_add_refs_ms = deen_millis_since_epoc();
-	index_add_context->add_refs_millis += (after_add_refs_ms - after_add_missing_prefixes_ms);
-#endif
+	for (i = 0; i < shard->sources_count; i++) {
+		deen_index_merge_source_advance(&(shard->sources[i]));
+	}
 
-	free(prefix_ids);
+	memset(&last, 0, sizeof(deen_index_pair));
 
-}
+	while (DEEN_TRUE) {
+		deen_index_merge_source *least = NULL;
 
+		for (i = 0; i < shard->sources_count; i++) {
+			if (!shard->sources[i].exhausted) {
+				if (NULL == least || deen_index_pair_compare(&(shard->sources[i].current), &(least->current)) < 0) {
+					least = &(shard->sources[i]);
+				}
+			}
+		}
 
-deen_index_lookup_result *deen_index_lookup(
-	sqlite3 *db,
-	uint8_t *prefix) {
+		if (NULL == least) {
+			break;
+		}
 
-	deen_bool processed_all_rows;
-	sqlite3_stmt *stmt;
-	uint32_t allocted_refs_count = 10;
-	deen_index_lookup_result *result = (deen_index_lookup_result *) deen_emalloc(sizeof(deen_index_lookup_result));
+		if (0 == shard->prefix_refs_count || 0 != memcmp(least->current.prefix, last.prefix, DEEN_INDEX_PREFIX_WIDTH)) {
+			deen_index_output_refs(shard, last.prefix);
+			deen_index_gather_ref(shard, least->current.ref);
+		}
+		else {
+			if (least->current.ref != last.ref) {
+				deen_index_gather_ref(shard, least->current.ref);
+			}
+		}
+
+		memcpy(&last, &(least->current), sizeof(deen_index_pair));
+		deen_index_merge_source_advance(least);
+	}
+
+	deen_index_output_refs(shard, last.prefix);
+
+	return NULL;
+}
 
-	result->refs = (off_t *) deen_emalloc(sizeof(off_t) * allocted_refs_count);
-	result->refs_count = 0;
 
-	stmt = NULL;
+/*
+The refs are loaded against the prefix's identifier in the base of the index
+or against the prefix itself in a delta segment.
+*/
 
-	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_REF_LOOKUP, -1, &stmt, NULL)) {
-		deen_log_error_and_exit("sqllite error preparing statement for [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+static void deen_index_load_refs(
+	deen_index_add_context *context,
+	sqlite3_stmt *stmt,
+	uint32_t prefix_id,
+	const uint8_t *prefix,
+	uint64_t refs_count,
+	const uint8_t *encoded,
+	size_t encoded_len) {
+
+	const char *sql = 0 == context->segment_id ? SQL_PREFIX_REF_INSERT : SQL_SEGMENT_REF_INSERT;
+	int refs_parameter = 0 == context->segment_id ? 2 : 3;
+	int bind_result;
+
+	if (0 == context->segment_id) {
+		bind_result = sqlite3_bind_int(stmt, 1, prefix_id);
 	}
+	else {
+		bind_result = sqlite3_bind_text(stmt, 1, (const char *) prefix,
+			strnlen((const char *) prefix, DEEN_INDEX_PREFIX_WIDTH), SQLITE_TRANSIENT);
 
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, (const char *) prefix, -1, SQLITE_TRANSIENT)) {
-		deen_log_error_and_exit("sqllite error setting parameter in [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+		if (SQLITE_OK == bind_result) {
+			bind_result = sqlite3_bind_int(stmt, 2, context->segment_id);
+		}
 	}
 
-	processed_all_rows = DEEN_FALSE;
+	if (SQLITE_OK != bind_result
+		|| SQLITE_OK != sqlite3_bind_int64(stmt, refs_parameter, (sqlite3_int64) refs_count)
+		|| SQLITE_OK != sqlite3_bind_blob(stmt, refs_parameter + 1, encoded, (int) encoded_len, SQLITE_STATIC)) {
+		deen_log_error_and_exit("sqllite error binding into [%s]; %s", sql, sqlite3_errmsg(context->db));
+	}
 
-	while (!processed_all_rows) {
-		switch (sqlite3_step(stmt)) {
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		deen_log_error_and_exit("sqllite error executing [%s]; %s", sql, sqlite3_errmsg(context->db));
+	}
 
-			case SQLITE_ROW:
+	if (SQLITE_OK != sqlite3_reset(stmt)) {
+		deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", sql, sqlite3_errmsg(context->db));
+	}
+}
 
-				if (result->refs_count >= allocted_refs_count) {
-					allocted_refs_count += 10;
-					result->refs = (off_t *) deen_erealloc(result->refs, sizeof(off_t) * allocted_refs_count);
-				}
 
-				result->refs[result->refs_count] = (off_t) sqlite3_column_int(stmt, 0);
-				result->refs_count++;
+/*
+The map index is written from the records so the refs are decoded again.
+*/
 
-				break;
+static void deen_index_load_map_index(
+	deen_index_add_context *context,
+	const uint8_t *prefix,
+	uint64_t refs_count,
+	const uint8_t *encoded,
+	size_t encoded_len) {
 
-			case SQLITE_DONE:
-				processed_all_rows = DEEN_TRUE;
-				break;
+	size_t i;
 
-			default:
-				deen_log_error_and_exit("sqllite error getting row from [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
-				break;
+	if (NULL == context->map_index_writer) {
+		return;
+	}
 
-		}
+	if (refs_count > context->prefix_refs_allocated) {
+		context->prefix_refs_allocated = (size_t) refs_count;
+		context->prefix_refs = (off_t *) deen_erealloc(
+			context->prefix_refs,
+			sizeof(off_t) * context->prefix_refs_allocated);
 	}
 
-	if (SQLITE_OK != sqlite3_reset(stmt)) {
-		deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+	if (!deen_posting_decode(encoded, encoded_len, context->prefix_refs, (size_t) refs_count)) {
+		deen_log_error_and_exit("unable to decode the refs for the map index");
 	}
 
-	if (SQLITE_OK != sqlite3_finalize(stmt)) {
-		deen_log_error_and_exit("sqllite error finalizing statement for [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+	for (i = 0; i < refs_count; i++) {
+		deen_map_index_writer_add(context->map_index_writer, prefix, context->prefix_refs[i]);
 	}
+}
 
-	return result;
+
+void deen_index_add_set_map_index_writer(
+	deen_index_add_context *context,
+	deen_map_index_writer *map_index_writer) {
+	context->map_index_writer = map_index_writer;
 }
 
 
-void deen_index_lookup_result_free(deen_index_lookup_result *result) {
-	if (NULL != result) {
+void deen_index_add_set_segment(
+	deen_index_add_context *context,
+	uint32_t segment_id) {
+	context->segment_id = segment_id;
+}
+
+
+void deen_index_add_set_shards(
+	deen_index_add_context *context,
+	size_t shards_count) {
+
+	if (shards_count < 1) {
+		shards_count = 1;
+	}
+
+	if (shards_count > DEEN_INDEX_SHARDS_MAX) {
+		shards_count = DEEN_INDEX_SHARDS_MAX;
+	}
+
+	context->shards_count = shards_count;
+}
+
+
+void deen_index_add_set_runs_dir(
+	deen_index_add_context *context,
+	const char *runs_dir) {
+
+	if (NULL != context->runs_dir) {
+		free((void *) context->runs_dir);
+	}
+
+	context->runs_dir = (char *) deen_emalloc(strlen(runs_dir) + 1);
+	strcpy(context->runs_dir, runs_dir);
+}
+
+
+uint32_t deen_index_add_checkpoint(deen_index_add_context *context) {
+	if (0 != context->pairs_count) {
+		deen_index_spill_pairs(context);
+	}
+
+	while (context->runs_synced_count < context->runs_count) {
+		FILE *run = context->runs[context->runs_synced_count];
+
+		if (0 != fflush(run)
+#ifndef __MINGW32__
+			|| 0 != fsync(fileno(run))
+#endif
+			) {
+			deen_log_error_and_exit("unable to write the index run %u to storage", context->runs_synced_count);
+		}
+
+		context->runs_synced_count++;
+	}
+
+	return (uint32_t) context->runs_count;
+}
+
+
+/*
+Adds the number of pairs in a run that have prefixes starting with each byte to
+the counts that the shards are planned from.  The run is sorted so the pairs for
+each byte are found with a search rather than by reading the whole run.
+*/
+
+static void deen_index_count_run_first_bytes(
+	deen_index_add_context *context,
+	int run_fd) {
+
+	struct stat run_stat;
+	size_t run_pairs_count;
+	size_t from = 0;
+	uint32_t b;
+
+	if (0 != fstat(run_fd, &run_stat)) {
+		deen_log_error_and_exit("unable to stat an index run");
+	}
+
+	run_pairs_count = (size_t) (run_stat.st_size / sizeof(deen_index_pair));
+
+	for (b = 0; b < 256 && from < run_pairs_count; b++) {
+		size_t to = deen_index_pairs_lower_bound(NULL, run_fd, from, run_pairs_count, b + 1);
+		context->first_byte_counts[b] += to - from;
+		from = to;
+	}
+}
+
+
+deen_bool deen_index_add_resume(
+	deen_index_add_context *context,
+	uint32_t runs_count) {
+
+	uint32_t i;
+
+	// runs that were spilled after the checkpoint may have pairs for lines
+	// that will be added again.
+
+	deen_index_remove_runs(context->runs_dir, runs_count);
+
+	for (i = 0; i < runs_count; i++) {
+		char *run_path = deen_index_run_path(context->runs_dir, i);
+		FILE *run = fopen(run_path, "r+b");
+
+		if (NULL == run) {
+			DEEN_LOG_ERROR1("unable to open the index run; %s", run_path);
+			free((void *) run_path);
+			return DEEN_FALSE;
+		}
+
+		free((void *) run_path);
+		context->runs = (FILE **) deen_erealloc(context->runs, sizeof(FILE *) * (context->runs_count + 1));
+		context->runs[context->runs_count] = run;
+		context->runs_count++;
+
+		// the pairs in the run were counted by the install that spilled it so
+		// they are counted again here for the shards to be planned from.
+
+		deen_index_count_run_first_bytes(context, fileno(run));
+	}
+
+	context->runs_synced_count = context->runs_count;
+	DEEN_LOG_TRACE1("resumed with %u index runs", runs_count);
+
+	return DEEN_TRUE;
+}
+
+
+void deen_index_remove_runs(const char *runs_dir, uint32_t runs_from) {
+	uint32_t i;
+
+	for (i = runs_from; DEEN_TRUE; i++) {
+		char *run_path = deen_index_run_path(runs_dir, i);
+		int remove_result = remove(run_path);
+		free((void *) run_path);
+
+		if (0 != remove_result) {
+			break;
+		}
+	}
+}
+
+
+/*
+Sets up the sources for a shard from the parts of the runs and of the pairs in
+memory that have prefixes starting with a byte in the shard's range.
+*/
+
+static void deen_index_shard_init(
+	deen_index_add_context *context,
+	deen_index_shard *shard,
+	uint32_t first_byte_min,
+	uint32_t first_byte_max) {
+
+	size_t i;
+
+	memset(shard, 0, sizeof(deen_index_shard));
+	shard->sources_count = context->runs_count + 1;
+	shard->sources = (deen_index_merge_source *) deen_emalloc(sizeof(deen_index_merge_source) * shard->sources_count);
+	memset(shard->sources, 0, sizeof(deen_index_merge_source) * shard->sources_count);
+
+	for (i = 0; i < context->runs_count; i++) {
+		deen_index_merge_source *source = &(shard->sources[i]);
+		int run_fd = fileno(context->runs[i]);
+		struct stat run_stat;
+		size_t run_pairs_count;
+		size_t from;
+		size_t to;
+
+		if (0 != fstat(run_fd, &run_stat)) {
+			deen_log_error_and_exit("unable to stat the index run %u", (unsigned) i);
+		}
+
+		run_pairs_count = (size_t) (run_stat.st_size / sizeof(deen_index_pair));
+		from = deen_index_pairs_lower_bound(NULL, run_fd, 0, run_pairs_count, first_byte_min);
+		to = deen_index_pairs_lower_bound(NULL, run_fd, from, run_pairs_count, first_byte_max + 1);
+
+		source->run_fd = run_fd;
+		source->run_offset = (off_t) (from * sizeof(deen_index_pair));
+		source->run_end = (off_t) (to * sizeof(deen_index_pair));
+		source->buffer = (deen_index_pair *) deen_emalloc(sizeof(deen_index_pair) * DEEN_INDEX_MERGE_BUFFER_PAIRS);
+	}
+
+	{
+		deen_index_merge_source *source = &(shard->sources[context->runs_count]);
+		size_t from = deen_index_pairs_lower_bound(context->pairs, -1, 0, context->pairs_count, first_byte_min);
+		size_t to = deen_index_pairs_lower_bound(context->pairs, -1, from, context->pairs_count, first_byte_max + 1);
+
+		source->run_fd = -1;
+		source->pairs = &(context->pairs[from]);
+		source->pairs_count = to - from;
+	}
+}
+
+
+static void deen_index_shard_free(deen_index_shard *shard) {
+	size_t i;
+
+	for (i = 0; i < shard->sources_count; i++) {
+		if (NULL != shard->sources[i].buffer) {
+			free((void *) shard->sources[i].buffer);
+		}
+	}
+
+	free((void *) shard->sources);
+
+	if (NULL != shard->prefix_refs) {
+		free((void *) shard->prefix_refs);
+	}
+
+	if (NULL != shard->encoded) {
+		free((void *) shard->encoded);
+	}
+
+	if (NULL != shard->output) {
+		free((void *) shard->output);
+	}
+}
+
+
+void deen_index_add_finish(deen_index_add_context *context) {
+	deen_index_shard shards[DEEN_INDEX_SHARDS_MAX];
+	uint8_t range_ends[DEEN_INDEX_SHARDS_MAX];
+	size_t shards_count;
+	sqlite3_stmt *prefix_stmt = NULL;
+	sqlite3_stmt *ref_stmt;
+	uint32_t prefix_id = 0;
+	size_t i;
+
+	deen_index_sort_pairs(context);
+
+	deen_millis start_ms = deen_millis_since_epoc();
+
+	// the shards each merge a range of the prefixes so that, taken in order,
+	// their outputs are in the order of the prefixes.
+
+	shards_count = deen_index_plan_shards(context->first_byte_counts, context->shards_count, range_ends);
+
+	for (i = 0; i < shards_count; i++) {
+		deen_index_shard_init(context, &shards[i], 0 == i ? 0 : range_ends[i - 1] + 1, range_ends[i]);
+	}
+
+	deen_index_run_tasks(&deen_index_shard_merge, shards, sizeof(deen_index_shard), shards_count);
+
+	deen_millis after_merge_ms = deen_millis_since_epoc();
+	context->merge_millis += (after_merge_ms - start_ms);
+
+	// a delta segment has no table of prefixes; the refs are stored against
+	// the prefix itself.
+
+	if (0 == context->segment_id) {
+		prefix_stmt = deen_index_prepare(context->db, SQL_PREFIX_INSERT);
+		ref_stmt = deen_index_prepare(context->db, SQL_PREFIX_REF_INSERT);
+	}
+	else {
+		ref_stmt = deen_index_prepare(context->db, SQL_SEGMENT_REF_INSERT);
+	}
+
+	for (i = 0; i < shards_count; i++) {
+		size_t upto = 0;
+
+		while (upto < shards[i].output_len) {
+			const uint8_t *record = &(shards[i].output[upto]);
+			uint64_t refs_count;
+			uint64_t encoded_len;
+
+			memcpy(&refs_count, &record[DEEN_INDEX_PREFIX_WIDTH], sizeof(uint64_t));
+			memcpy(&encoded_len, &record[DEEN_INDEX_PREFIX_WIDTH + sizeof(uint64_t)], sizeof(uint64_t));
+			prefix_id++;
+
+			if (NULL != prefix_stmt) {
+				deen_index_load_prefix(context, prefix_stmt, prefix_id, record);
+			}
+
+			deen_index_load_refs(
+				context, ref_stmt, prefix_id, record, refs_count,
+				&record[DEEN_INDEX_SHARD_RECORD_HEADER_LEN], (size_t) encoded_len);
+			deen_index_load_map_index(
+				context, record, refs_count,
+				&record[DEEN_INDEX_SHARD_RECORD_HEADER_LEN], (size_t) encoded_len);
+
+			upto += DEEN_INDEX_SHARD_RECORD_HEADER_LEN + (size_t) encoded_len;
+		}
+
+		deen_index_shard_free(&shards[i]);
+	}
+
+	if (NULL != prefix_stmt) {
+		deen_index_finalize(context->db, prefix_stmt, SQL_PREFIX_INSERT);
+	}
+
+	deen_index_finalize(context->db, ref_stmt, 0 == context->segment_id ? SQL_PREFIX_REF_INSERT : SQL_SEGMENT_REF_INSERT);
+	context->prefixes_loaded_count += prefix_id;
+
+	DEEN_LOG_TRACE3("loaded %u prefixes from %u runs in %u shards",
+		prefix_id, context->runs_count + 1, (unsigned) shards_count);
+
+	deen_millis after_load_ms = deen_millis_since_epoc();
+	context->load_millis += (after_load_ms - after_merge_ms);
+
+	if (0 == context->segment_id) {
+		deen_index_run_sql(context->db, SQL_TABLE_PREFIX_INDEX_CREATE);
+	}
+
+	context->create_indexes_millis += (deen_millis_since_epoc() - after_load_ms);
+
+	// the pairs are now in the database so the memory and runs can go.
+
+	for (i = 0; i < context->runs_count; i++) {
+		fclose(context->runs[i]);
+	}
+
+	if (NULL != context->runs_dir) {
+		deen_index_remove_runs(context->runs_dir, 0);
+	}
+
+	context->runs_count = 0;
+	context->runs_synced_count = 0;
+	context->pairs_count = 0;
+	memset(context->first_byte_counts, 0, sizeof(context->first_byte_counts));
+}
+
+
+static void deen_index_write_metadata_value(
+	sqlite3 *db,
+	sqlite3_stmt *stmt,
+	const char *name,
+	uint64_t value) {
+
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC)
+		|| SQLITE_OK != sqlite3_bind_int64(stmt, 2, (sqlite3_int64) value)) {
+		deen_log_error_and_exit("sqllite error binding into [%s]; %s", SQL_META_INSERT, sqlite3_errmsg(db));
+	}
+
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		deen_log_error_and_exit("sqllite error executing [%s]; %s", SQL_META_INSERT, sqlite3_errmsg(db));
+	}
+
+	if (SQLITE_OK != sqlite3_reset(stmt)) {
+		deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", SQL_META_INSERT, sqlite3_errmsg(db));
+	}
+}
+
+
+void deen_index_write_metadata(sqlite3 *db, const deen_index_metadata *metadata) {
+	sqlite3_stmt *stmt = deen_index_prepare(db, SQL_META_INSERT);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_SOURCE_HASH, metadata->source_hash);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_SOURCE_SIZE, metadata->source_size);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_INDEXING_DEPTH, metadata->indexing_depth);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_FORMAT_VERSION, metadata->format_version);
+	deen_index_finalize(db, stmt, SQL_META_INSERT);
+}
+
+
+/*
+Reads the values with the names from the metadata.  Returns false if any of the
+values are missing.  The values are stored as signed integers because that is
+what sqlite stores; the bits are the same on the way back out.
+*/
+
+static deen_bool deen_index_read_metadata_values(
+	sqlite3 *db,
+	const char **names,
+	uint64_t *values,
+	size_t names_count) {
+
+	sqlite3_stmt *stmt = NULL;
+	uint32_t found = 0;
+	int step_result;
+	size_t i;
+
+	memset(values, 0, sizeof(uint64_t) * names_count);
+
+	// an index from before the metadata was recorded has no table for it.
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_META_LOOKUP, -1, &stmt, NULL)) {
+		DEEN_LOG_INFO1("unable to read the index metadata; %s", sqlite3_errmsg(db));
+		return DEEN_FALSE;
+	}
+
+	while (SQLITE_ROW == (step_result = sqlite3_step(stmt))) {
+		const char *name = (const char *) sqlite3_column_text(stmt, 0);
+
+		for (i = 0; NULL != name && i < names_count; i++) {
+			if (0 == strcmp(name, names[i])) {
+				values[i] = (uint64_t) sqlite3_column_int64(stmt, 1);
+				found |= (1 << i);
+			}
+		}
+	}
+
+	if (SQLITE_DONE != step_result) {
+		DEEN_LOG_INFO1("unable to read the index metadata; %s", sqlite3_errmsg(db));
+		found = 0;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return ((1 << names_count) - 1) == found;
+}
+
+
+deen_bool deen_index_read_metadata(sqlite3 *db, deen_index_metadata *metadata) {
+	const char *names[] = {
+		DEEN_META_SOURCE_HASH,
+		DEEN_META_SOURCE_SIZE,
+		DEEN_META_INDEXING_DEPTH,
+		DEEN_META_FORMAT_VERSION
+	};
+	uint64_t values[4];
+	deen_bool result = deen_index_read_metadata_values(db, names, values, 4);
+
+	metadata->source_hash = values[0];
+	metadata->source_size = values[1];
+	metadata->indexing_depth = (uint32_t) values[2];
+	metadata->format_version = (uint32_t) values[3];
+
+	return result;
+}
+
+
+deen_bool deen_index_metadata_is_current(const deen_index_metadata *metadata) {
+	return DEEN_INDEXING_DEPTH == metadata->indexing_depth
+		&& DEEN_INDEX_FORMAT_VERSION == metadata->format_version;
+}
+
+
+void deen_index_write_checkpoint(sqlite3 *db, const deen_index_checkpoint *checkpoint) {
+	sqlite3_stmt *stmt = deen_index_prepare(db, SQL_META_INSERT);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_CHECKPOINT_REF, checkpoint->ref);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_CHECKPOINT_SOURCE_HASH, checkpoint->source_hash);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_CHECKPOINT_RUNS_COUNT, checkpoint->runs_count);
+	deen_index_write_metadata_value(db, stmt, DEEN_META_CHECKPOINT_FORMAT_VERSION, checkpoint->format_version);
+	deen_index_finalize(db, stmt, SQL_META_INSERT);
+}
+
+
+deen_bool deen_index_read_checkpoint(sqlite3 *db, deen_index_checkpoint *checkpoint) {
+	const char *names[] = {
+		DEEN_META_CHECKPOINT_REF,
+		DEEN_META_CHECKPOINT_SOURCE_HASH,
+		DEEN_META_CHECKPOINT_RUNS_COUNT,
+		DEEN_META_CHECKPOINT_FORMAT_VERSION
+	};
+	uint64_t values[4];
+	deen_bool result = deen_index_read_metadata_values(db, names, values, 4);
+
+	checkpoint->ref = values[0];
+	checkpoint->source_hash = values[1];
+	checkpoint->runs_count = (uint32_t) values[2];
+	checkpoint->format_version = (uint32_t) values[3];
+
+	return result;
+}
+
+
+void deen_index_delete_checkpoint(sqlite3 *db) {
+	deen_index_run_sql(db, SQL_META_CHECKPOINT_DELETE);
+}
+
+
+uint32_t deen_index_add_segment(
+	sqlite3 *db,
+	deen_segment_kind kind,
+	off_t ref_start,
+	off_t ref_end) {
+
+	sqlite3_stmt *stmt = deen_index_prepare(db, SQL_SEGMENT_INSERT);
+
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 1, (int) kind)
+		|| SQLITE_OK != sqlite3_bind_int64(stmt, 2, (sqlite3_int64) ref_start)
+		|| SQLITE_OK != sqlite3_bind_int64(stmt, 3, (sqlite3_int64) ref_end)) {
+		deen_log_error_and_exit("sqllite error binding into [%s]; %s", SQL_SEGMENT_INSERT, sqlite3_errmsg(db));
+	}
+
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		deen_log_error_and_exit("sqllite error executing [%s]; %s", SQL_SEGMENT_INSERT, sqlite3_errmsg(db));
+	}
+
+	deen_index_finalize(db, stmt, SQL_SEGMENT_INSERT);
+
+	return (uint32_t) sqlite3_last_insert_rowid(db);
+}
+
+
+void deen_index_add_tombstones(sqlite3 *db, const off_t *refs, size_t refs_count) {
+	sqlite3_stmt *stmt = deen_index_prepare(db, SQL_TOMBSTONE_INSERT);
+	size_t i;
+
+	for (i = 0; i < refs_count; i++) {
+		if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, (sqlite3_int64) refs[i])) {
+			deen_log_error_and_exit("sqllite error binding into [%s]; %s", SQL_TOMBSTONE_INSERT, sqlite3_errmsg(db));
+		}
+
+		if (SQLITE_DONE != sqlite3_step(stmt)) {
+			deen_log_error_and_exit("sqllite error executing [%s]; %s", SQL_TOMBSTONE_INSERT, sqlite3_errmsg(db));
+		}
+
+		if (SQLITE_OK != sqlite3_reset(stmt)) {
+			deen_log_error_and_exit("sqllite error resetting stmt [%s]; %s", SQL_TOMBSTONE_INSERT, sqlite3_errmsg(db));
+		}
+	}
+
+	deen_index_finalize(db, stmt, SQL_TOMBSTONE_INSERT);
+}
+
+
+deen_index_segments *deen_index_segments_read(sqlite3 *db) {
+	deen_index_segments *segments = (deen_index_segments *) deen_emalloc(sizeof(deen_index_segments));
+	size_t allocated = 0;
+	sqlite3_stmt *stmt = NULL;
+	int step_result;
+
+	memset(segments, 0, sizeof(deen_index_segments));
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_SEGMENT_LOOKUP, -1, &stmt, NULL)) {
+		DEEN_LOG_ERROR1("unable to read the index segments; %s", sqlite3_errmsg(db));
+		deen_index_segments_free(segments);
+		return NULL;
+	}
+
+	while (SQLITE_ROW == (step_result = sqlite3_step(stmt))) {
+		deen_index_segment *segment;
+
+		if (segments->segments_count == allocated) {
+			allocated = 0 == allocated ? 8 : allocated * 2;
+			segments->segments = (deen_index_segment *) deen_erealloc(
+				segments->segments, sizeof(deen_index_segment) * allocated);
+		}
+
+		segment = &(segments->segments[segments->segments_count]);
+		segment->id = (uint32_t) sqlite3_column_int(stmt, 0);
+		segment->kind = (deen_segment_kind) sqlite3_column_int(stmt, 1);
+		segment->ref_start = (off_t) sqlite3_column_int64(stmt, 2);
+		segment->ref_end = (off_t) sqlite3_column_int64(stmt, 3);
+		segments->segments_count++;
+
+		if (0 != sqlite3_column_int(stmt, 4)) {
+			segments->segments_with_refs_count++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (SQLITE_DONE != step_result
+		|| SQLITE_OK != sqlite3_prepare_v2(db, SQL_TOMBSTONE_LOOKUP, -1, &stmt, NULL)) {
+		DEEN_LOG_ERROR1("unable to read the index segments; %s", sqlite3_errmsg(db));
+		deen_index_segments_free(segments);
+		return NULL;
+	}
+
+	allocated = 0;
+
+	while (SQLITE_ROW == (step_result = sqlite3_step(stmt))) {
+		if (segments->tombstones_count == allocated) {
+			allocated = 0 == allocated ? 1024 : allocated * 2;
+			segments->tombstones = (off_t *) deen_erealloc(
+				segments->tombstones, sizeof(off_t) * allocated);
+		}
+
+		segments->tombstones[segments->tombstones_count] = (off_t) sqlite3_column_int64(stmt, 0);
+		segments->tombstones_count++;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (SQLITE_DONE != step_result) {
+		DEEN_LOG_ERROR1("unable to read the index tombstones; %s", sqlite3_errmsg(db));
+		deen_index_segments_free(segments);
+		return NULL;
+	}
+
+	return segments;
+}
+
+
+void deen_index_segments_free(deen_index_segments *segments) {
+	if (NULL != segments) {
+		if (NULL != segments->segments) {
+			free((void *) segments->segments);
+		}
+
+		if (NULL != segments->tombstones) {
+			free((void *) segments->tombstones);
+		}
+
+		free((void *) segments);
+	}
+}
+
+
+deen_bool deen_index_segments_is_tombstone(
+	const deen_index_segments *segments,
+	off_t ref) {
+
+	size_t low = 0;
+	size_t high = segments->tombstones_count;
+
+	while (low < high) {
+		size_t mid = low + ((high - low) / 2);
+
+		if (segments->tombstones[mid] < ref) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	return low < segments->tombstones_count && segments->tombstones[low] == ref;
+}
+
+
+/*
+Appends the refs that are not tombstones to the end of the refs.
+*/
+
+static void deen_index_append_live_refs(
+	const deen_index_segments *segments,
+	off_t *refs,
+	uint32_t *refs_count,
+	const off_t *from,
+	size_t from_count) {
+
+	size_t i;
+
+	for (i = 0; i < from_count; i++) {
+		if (0 == segments->tombstones_count || !deen_index_segments_is_tombstone(segments, from[i])) {
+			refs[*refs_count] = from[i];
+			(*refs_count)++;
+		}
+	}
+}
+
+
+/*
+Each segment adds lines to the end of the data so the refs of a segment are
+all after the refs of the base and of any earlier segment.  This means that the
+refs stay ordered if the segments are appended in turn.
+*/
+
+void deen_index_lookup_segments(
+	deen_index_reader *reader,
+	const deen_index_segments *segments,
+	const uint8_t *prefix,
+	deen_index_lookup_result *result) {
+
+	sqlite3 *db = reader->db;
+	sqlite3_stmt *stmt = reader->segment_ref_stmt;
+	off_t *refs;
+	uint32_t refs_count = 0;
+	size_t refs_allocated = result->refs_count + 1;
+	off_t *segment_refs = NULL;
+	size_t segment_refs_allocated = 0;
+
+	if (0 == segments->segments_with_refs_count && 0 == segments->tombstones_count) {
+		return;
+	}
+
+	refs = (off_t *) deen_emalloc(sizeof(off_t) * refs_allocated);
+	deen_index_append_live_refs(segments, refs, &refs_count, result->refs, result->refs_count);
+
+	if (0 != segments->segments_with_refs_count) {
+		if (SQLITE_OK != sqlite3_bind_text(stmt, 1, (const char *) prefix, -1, SQLITE_TRANSIENT)) {
+			deen_log_error_and_exit("sqllite error setting parameter in [%s]; %s", SQL_SEGMENT_REF_LOOKUP, sqlite3_errmsg(db));
+		}
+
+		while (SQLITE_ROW == sqlite3_step(stmt)) {
+			sqlite3_int64 segment_refs_count = sqlite3_column_int64(stmt, 0);
+			const uint8_t *block = (const uint8_t *) sqlite3_column_blob(stmt, 1);
+			int block_len = sqlite3_column_bytes(stmt, 1);
+
+			if (segment_refs_count < 0 || refs_count + segment_refs_count > UINT32_MAX) {
+				deen_log_error_and_exit("bad segment ref count %lld for prefix [%s]", (long long) segment_refs_count, prefix);
+			}
+
+			if (segment_refs_allocated < (size_t) segment_refs_count + 1) {
+				segment_refs_allocated = (size_t) segment_refs_count + 1;
+				segment_refs = (off_t *) deen_erealloc(segment_refs, sizeof(off_t) * segment_refs_allocated);
+			}
+
+			if (!deen_posting_decode(block, (size_t) block_len, segment_refs, (size_t) segment_refs_count)) {
+				deen_log_error_and_exit("corrupt segment refs stored for prefix [%s]", prefix);
+			}
+
+			if (refs_allocated < refs_count + (size_t) segment_refs_count) {
+				refs_allocated = refs_count + (size_t) segment_refs_count;
+				refs = (off_t *) deen_erealloc(refs, sizeof(off_t) * refs_allocated);
+			}
+
+			deen_index_append_live_refs(segments, refs, &refs_count, segment_refs, (size_t) segment_refs_count);
+		}
+
+		deen_index_reset(db, stmt, SQL_SEGMENT_REF_LOOKUP);
+	}
+
+	if (NULL != segment_refs) {
+		free((void *) segment_refs);
+	}
+
+	if (result->refs_owned) {
 		free((void *) result->refs);
+	}
+
+	result->refs = refs;
+	result->refs_count = refs_count;
+	result->refs_owned = DEEN_TRUE;
+}
+
+
+/*
+Finds the slot for the prefix in the table of prefixes or the empty slot where
+it would go.
+*/
+
+static deen_index_reader_prefix *deen_index_reader_slot(
+	deen_index_reader_prefix *slots,
+	size_t slots_size,
+	const uint8_t *key) {
+
+	size_t i = (size_t) deen_hash(DEEN_HASH_INITIAL, key, DEEN_INDEX_PREFIX_WIDTH) & (slots_size - 1);
+
+	while (0 != slots[i].id && 0 != memcmp(slots[i].prefix, key, DEEN_INDEX_PREFIX_WIDTH)) {
+		i = (i + 1) & (slots_size - 1);
+	}
+
+	return &slots[i];
+}
+
+
+/*
+Returns the slot of the prefix or NULL if the prefix is not in the base of the
+index.
+*/
+
+static const deen_index_reader_prefix *deen_index_reader_find(
+	const deen_index_reader *reader,
+	const uint8_t *prefix) {
+
+	uint8_t key[DEEN_INDEX_PREFIX_WIDTH];
+	size_t prefix_len = strlen((const char *) prefix);
+	const deen_index_reader_prefix *slot;
+
+	if (!reader->is_prefixes_read) {
+		deen_log_error_and_exit("the prefixes of the index were not read for the lookup of [%s]", prefix);
+	}
+
+	if (0 == prefix_len || prefix_len > DEEN_INDEX_PREFIX_WIDTH) {
+		return NULL;
+	}
+
+	memset(key, 0, DEEN_INDEX_PREFIX_WIDTH);
+	memcpy(key, prefix, prefix_len);
+	slot = deen_index_reader_slot(reader->prefix_slots, reader->prefix_slots_size, key);
+
+	return 0 == slot->id ? NULL : slot;
+}
+
+
+/*
+The table of prefixes is kept at most half full.  Returns false if the prefixes
+could not be read.
+*/
+
+static deen_bool deen_index_reader_read_prefixes(deen_index_reader *reader) {
+	sqlite3 *db = reader->db;
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_int64 prefixes_count = 0;
+	int step_result;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_PREFIX_COUNT, -1, &stmt, NULL)) {
+		DEEN_LOG_ERROR1("unable to read the index prefixes; %s", sqlite3_errmsg(db));
+		return DEEN_FALSE;
+	}
+
+	if (SQLITE_ROW == sqlite3_step(stmt)) {
+		prefixes_count = sqlite3_column_int64(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+
+	reader->prefix_slots_size = 16;
+
+	while (reader->prefix_slots_size < (size_t) prefixes_count * 2) {
+		reader->prefix_slots_size *= 2;
+	}
+
+	reader->prefix_slots = (deen_index_reader_prefix *) deen_emalloc(
+		sizeof(deen_index_reader_prefix) * reader->prefix_slots_size);
+	memset(reader->prefix_slots, 0, sizeof(deen_index_reader_prefix) * reader->prefix_slots_size);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_PREFIX_LOOKUP, -1, &stmt, NULL)) {
+		DEEN_LOG_ERROR1("unable to read the index prefixes; %s", sqlite3_errmsg(db));
+		return DEEN_FALSE;
+	}
+
+	while (SQLITE_ROW == (step_result = sqlite3_step(stmt))) {
+		const uint8_t *prefix = sqlite3_column_text(stmt, 0);
+		int prefix_len = sqlite3_column_bytes(stmt, 0);
+		sqlite3_int64 id = sqlite3_column_int64(stmt, 1);
+		sqlite3_int64 refs_count = sqlite3_column_int64(stmt, 2);
+		uint8_t key[DEEN_INDEX_PREFIX_WIDTH];
+		deen_index_reader_prefix *slot;
+
+		if (NULL == prefix || 0 == prefix_len || prefix_len > DEEN_INDEX_PREFIX_WIDTH
+			|| id <= 0 || id > UINT32_MAX || refs_count < 0 || refs_count > UINT32_MAX
+			|| (reader->prefixes_count + 1) * 2 > reader->prefix_slots_size) {
+			DEEN_LOG_ERROR0("the index prefixes are corrupt");
+			sqlite3_finalize(stmt);
+			return DEEN_FALSE;
+		}
+
+		memset(key, 0, DEEN_INDEX_PREFIX_WIDTH);
+		memcpy(key, prefix, (size_t) prefix_len);
+		slot = deen_index_reader_slot(reader->prefix_slots, reader->prefix_slots_size, key);
+
+		if (0 == slot->id) {
+			memcpy(slot->prefix, key, DEEN_INDEX_PREFIX_WIDTH);
+			slot->id = (uint32_t) id;
+			slot->refs_count = (uint32_t) refs_count;
+			reader->prefixes_count++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (SQLITE_DONE != step_result) {
+		DEEN_LOG_ERROR1("unable to read the index prefixes; %s", sqlite3_errmsg(db));
+		return DEEN_FALSE;
+	}
+
+	reader->is_prefixes_read = DEEN_TRUE;
+
+	return DEEN_TRUE;
+}
+
+
+deen_index_reader *deen_index_reader_open(sqlite3 *db, deen_bool is_prefixes_read) {
+	deen_index_reader *reader = (deen_index_reader *) deen_emalloc(sizeof(deen_index_reader));
+
+	memset(reader, 0, sizeof(deen_index_reader));
+	reader->db = db;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, SQL_REF_LOOKUP, -1, &(reader->ref_stmt), NULL)
+		|| SQLITE_OK != sqlite3_prepare_v2(db, SQL_SEGMENT_REF_LOOKUP, -1, &(reader->segment_ref_stmt), NULL)
+		|| SQLITE_OK != sqlite3_prepare_v2(db, SQL_SEGMENT_REF_COUNT_LOOKUP, -1, &(reader->segment_ref_count_stmt), NULL)) {
+		DEEN_LOG_ERROR1("unable to prepare to read the index; %s", sqlite3_errmsg(db));
+		deen_index_reader_free(reader);
+		return NULL;
+	}
+
+	if (is_prefixes_read && !deen_index_reader_read_prefixes(reader)) {
+		deen_index_reader_free(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
+
+void deen_index_reader_free(deen_index_reader *reader) {
+	if (NULL != reader) {
+		sqlite3_finalize(reader->ref_stmt);
+		sqlite3_finalize(reader->segment_ref_stmt);
+		sqlite3_finalize(reader->segment_ref_count_stmt);
+
+		if (NULL != reader->prefix_slots) {
+			free((void *) reader->prefix_slots);
+		}
+
+		free((void *) reader);
+	}
+}
+
+
+deen_index_lookup_result *deen_index_lookup(
+	deen_index_reader *reader,
+	const uint8_t *prefix) {
+
+	sqlite3 *db = reader->db;
+	sqlite3_stmt *stmt = reader->ref_stmt;
+	const deen_index_reader_prefix *slot = deen_index_reader_find(reader, prefix);
+	deen_index_lookup_result *result = (deen_index_lookup_result *) deen_emalloc(sizeof(deen_index_lookup_result));
+
+	result->refs = NULL;
+	result->refs_count = 0;
+	result->refs_owned = DEEN_TRUE;
+	result->refs_sorted = DEEN_TRUE;
+
+	// the row of refs is read by the id of the prefix and the refs in the row
+	// are decoded straight into the result in order.
+
+	if (NULL != slot) {
+		if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, (sqlite3_int64) slot->id)) {
+			deen_log_error_and_exit("sqllite error setting parameter in [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+		}
+
+		switch (sqlite3_step(stmt)) {
+
+			case SQLITE_ROW:
+				{
+					const uint8_t *block = (const uint8_t *) sqlite3_column_blob(stmt, 0);
+					int block_len = sqlite3_column_bytes(stmt, 0);
+
+					result->refs = (off_t *) deen_emalloc(sizeof(off_t) * ((size_t) slot->refs_count + 1));
+					result->refs_count = slot->refs_count;
+
+					if (!deen_posting_decode(block, (size_t) block_len, result->refs, (size_t) slot->refs_count)) {
+						deen_log_error_and_exit("corrupt refs stored for prefix [%s]", prefix);
+					}
+				}
+				break;
+
+			case SQLITE_DONE:
+				break;
+
+			default:
+				deen_log_error_and_exit("sqllite error getting row from [%s]; %s", SQL_REF_LOOKUP, sqlite3_errmsg(db));
+				break;
+
+		}
+
+		deen_index_reset(db, stmt, SQL_REF_LOOKUP);
+	}
+
+	if (NULL == result->refs) {
+		result->refs = (off_t *) deen_emalloc(sizeof(off_t));
+	}
+
+	return result;
+}
+
+
+uint32_t deen_index_lookup_count(
+	deen_index_reader *reader,
+	const uint8_t *prefix) {
+
+	const deen_index_reader_prefix *slot = deen_index_reader_find(reader, prefix);
+	return NULL == slot ? 0 : slot->refs_count;
+}
+
+
+uint32_t deen_index_lookup_segments_count(
+	deen_index_reader *reader,
+	const deen_index_segments *segments,
+	const uint8_t *prefix) {
+
+	sqlite3 *db = reader->db;
+	sqlite3_stmt *stmt = reader->segment_ref_count_stmt;
+	sqlite3_int64 refs_count = 0;
+
+	if (0 == segments->segments_with_refs_count) {
+		return 0;
+	}
+
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, (const char *) prefix, -1, SQLITE_TRANSIENT)) {
+		deen_log_error_and_exit("sqllite error setting parameter in [%s]; %s", SQL_SEGMENT_REF_COUNT_LOOKUP, sqlite3_errmsg(db));
+	}
+
+	switch (sqlite3_step(stmt)) {
+
+		case SQLITE_ROW:
+			refs_count = sqlite3_column_int64(stmt, 0);
+			break;
+
+		case SQLITE_DONE:
+			break;
+
+		default:
+			deen_log_error_and_exit("sqllite error getting row from [%s]; %s", SQL_SEGMENT_REF_COUNT_LOOKUP, sqlite3_errmsg(db));
+			break;
+
+	}
+
+	deen_index_reset(db, stmt, SQL_SEGMENT_REF_COUNT_LOOKUP);
+
+	if (refs_count < 0 || refs_count > UINT32_MAX) {
+		deen_log_error_and_exit("bad ref count %lld for prefix [%s]", (long long) refs_count, prefix);
+	}
+
+	return (uint32_t) refs_count;
+}
+
+
+void deen_index_lookup_result_free(deen_index_lookup_result *result) {
+	if (NULL != result) {
+		if (result->refs_owned) {
+			free((void *) result->refs);
+		}
+
 		free((void *) result);
 	}
 }
@@ -15,7 +15,9 @@
 #include "types.h"
 
 /*
-This function will populate the table structures into the database.
+This function will populate the table structures into the database.  The
+secondary indexes on the tables are created by deen_index_add_finish once the
+data has been loaded.
 */
 
 void deen_index_init(sqlite3 *db);
@@ -25,8 +27,8 @@ void deen_transaction_commit(sqlite3 *db);
 
 /*
 Creates a context that can then be used with indexing functions.  The context
-is used to cache statements such that they can be re-used instead of being
-continuously parsed from SQL.
+gathers the prefixes and references in memory (spilling sorted runs to disk as
+necessary) so that the database can be loaded in key order at the end.
 */
 
 deen_index_add_context *deen_index_add_context_create(sqlite3 *db);
@@ -40,8 +42,9 @@ this aspect themselves.
 void deen_index_add_context_free(deen_index_add_context *context);
 
 /*
-This function will load the reference into the prefixes specified.  This
-assumes that no prior call was made with the same reference.
+This function will gather the reference against the prefixes specified.  This
+assumes that no prior call was made with the same reference.  Nothing is
+written to the database until deen_index_add_finish is called.
 */
 
 void deen_index_add(
@@ -50,14 +53,204 @@ void deen_index_add(
 	uint8_t **prefixes,
 	uint32_t prefix_count);
 
+/*
+If a map index writer is supplied then the merged pairs will also be written
+to the map index by deen_index_add_finish.  The caller retains ownership of the
+writer and should finish it afterwards.
+*/
+
+void deen_index_add_set_map_index_writer(
+	deen_index_add_context *context,
+	deen_map_index_writer *map_index_writer);
+
+/*
+Once all of the references have been added, this function will merge them,
+assign the prefix identifiers and load the tables in key order before creating
+the secondary indexes.  The caller should wrap this in a transaction.
+*/
+
+void deen_index_add_finish(deen_index_add_context *index_add_context);
+
+/*
+Delta segments are loaded with the same context as the base of the index.  If
+a segment is set then deen_index_add_finish loads the refs into that segment
+and not into the base of the index.  The segment is created first with
+deen_index_add_segment.
+*/
+
+void deen_index_add_set_segment(
+	deen_index_add_context *context,
+	uint32_t segment_id);
+
+/*
+The pairs are sorted and merged in a number of shards, each on its own thread,
+so that the work is spread over the processors.  Each shard covers a range of
+the prefixes and the shards are loaded into the index in order so that the
+result is the same as if there were only one shard.  There is one shard unless
+another number is set.
+*/
+
+void deen_index_add_set_shards(
+	deen_index_add_context *context,
+	size_t shards_count);
+
+/*
+If a directory is set then the runs that the pairs are spilled to are kept as
+files in that directory so that they outlive the context.  This allows a build
+of the index to be resumed.
+*/
+
+void deen_index_add_set_runs_dir(
+	deen_index_add_context *context,
+	const char *runs_dir);
+
+/*
+Spills any pairs that are in memory to a run and makes sure that all of the
+runs are written to storage.  Returns the number of runs that hold all of the
+pairs added so far.
+*/
+
+uint32_t deen_index_add_checkpoint(deen_index_add_context *context);
+
+/*
+Takes up the first 'runs_count' runs from the runs directory as if the pairs in
+them had just been added.  Any later runs are deleted.  Returns false if the
+runs were not able to be opened.
+*/
+
+deen_bool deen_index_add_resume(
+	deen_index_add_context *context,
+	uint32_t runs_count);
+
+/*
+Deletes the run files in the directory from the run 'runs_from' onwards.
+*/
+
+void deen_index_remove_runs(const char *runs_dir, uint32_t runs_from);
+
+/*
+Records a delta segment that adds the lines in the data from 'ref_start' up to
+'ref_end'.  Returns the identifier of the segment.
+*/
+
+uint32_t deen_index_add_segment(
+	sqlite3 *db,
+	deen_segment_kind kind,
+	off_t ref_start,
+	off_t ref_end);
+
+/*
+Records that the lines at the refs have been deleted so that they will no
+longer be found.
+*/
+
+void deen_index_add_tombstones(sqlite3 *db, const off_t *refs, size_t refs_count);
+
+/*
+Reads the segments and the tombstones of the index.  Returns NULL if they could
+not be read.
+*/
+
+deen_index_segments *deen_index_segments_read(sqlite3 *db);
+
+void deen_index_segments_free(deen_index_segments *segments);
+
+deen_bool deen_index_segments_is_tombstone(
+	const deen_index_segments *segments,
+	off_t ref);
+
+/*
+Stores the metadata for the index.  The caller should wrap this in a
+transaction; usually the same one as deen_index_add_finish.
+*/
+
+void deen_index_write_metadata(sqlite3 *db, const deen_index_metadata *metadata);
+
+/*
+Reads the metadata that was stored for the index.  Returns false if the index
+has no metadata; for example because it was created before metadata was
+recorded.
+*/
+
+deen_bool deen_index_read_metadata(sqlite3 *db, deen_index_metadata *metadata);
+
+/*
+Returns true if the index described by the metadata was built with the same
+indexing depth and format as this software would build it.
+*/
+
+deen_bool deen_index_metadata_is_current(const deen_index_metadata *metadata);
+
+/*
+Stores the checkpoint of a build of the index that has not yet finished.  The
+caller should wrap this in a transaction.
+*/
+
+void deen_index_write_checkpoint(sqlite3 *db, const deen_index_checkpoint *checkpoint);
+
+/*
+Reads the checkpoint that was stored.  Returns false if there is none.
+*/
+
+deen_bool deen_index_read_checkpoint(sqlite3 *db, deen_index_checkpoint *checkpoint);
+
+/*
+Removes the checkpoint once the build of the index has finished.
+*/
+
+void deen_index_delete_checkpoint(sqlite3 *db);
+
+/*
+Opens a reader of the index in the database for a series of lookups.  The
+prefixes of the base of the index are only read if the lookups are going to use
+the base of the index rather than the map index.  Returns NULL if the index
+could not be read.  The reader must be freed before the database is closed.
+*/
+
+deen_index_reader *deen_index_reader_open(sqlite3 *db, deen_bool is_prefixes_read);
+
+void deen_index_reader_free(deen_index_reader *reader);
+
 /*
 This function will lookup the prefix to resolve it into some references.
 The result is dynamically allocated and must be freed by the caller.
 */
 
 deen_index_lookup_result *deen_index_lookup(
-	sqlite3 *db,
-	uint8_t *prefix);
+	deen_index_reader *reader,
+	const uint8_t *prefix);
+
+/*
+Completes a lookup of the prefix in the base of the index with the refs from
+the delta segments and removes any refs that are tombstones.  This works with
+the result of a lookup in either the sqlite index or the map index.
+*/
+
+void deen_index_lookup_segments(
+	deen_index_reader *reader,
+	const deen_index_segments *segments,
+	const uint8_t *prefix,
+	deen_index_lookup_result *result);
+
+/*
+Returns the number of refs that are stored for the prefix in the base of the
+index without reading the refs.
+*/
+
+uint32_t deen_index_lookup_count(
+	deen_index_reader *reader,
+	const uint8_t *prefix);
+
+/*
+Returns the number of refs that are stored for the prefix in the delta
+segments.  Some of these may be tombstones so this may be more than the number
+of refs that a lookup would find.
+*/
+
+uint32_t deen_index_lookup_segments_count(
+	deen_index_reader *reader,
+	const deen_index_segments *segments,
+	const uint8_t *prefix);
 
 void deen_index_lookup_result_free(deen_index_lookup_result *result);
 
@@ -19,12 +19,26 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __MINGW32__
+#include <io.h>
+#include <sys/locking.h>
+#else
+#include <sys/file.h>
+#include <sys/resource.h>
+#endif
 #include <sqlite3.h>
 #include <unistd.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 #include "common.h"
 #include "constants.h"
+#include "delta.h"
 #include "index.h"
+#include "mapindex.h"
 
 /*
 This method will open the supplied file and will try to
@@ -36,25 +50,167 @@ an install.
 #define DEEN_SIZE_CHECK_DING_BUFFER 4 * 1024
 
 /*
- * This is the size of the buffer that will be used when
- * copying the source "ding" data over into the final
- * location for use by the application.
- */
+When the data is compressed, this is the size of the buffer that zlib uses to
+read the compressed data.
+*/
+
+#define DEEN_SIZE_INFLATE_BUFFER (128 * 1024)
+
+/*
+The data file is split into chunks of about this size for indexing.  Each
+chunk ends on a newline so that the lines can be tokenized independently.
+*/
+
+#define DEEN_SIZE_INSTALL_CHUNK (1024 * 1024)
+
+/*
+This is the most threads that will be used to tokenize chunks of the data.
+*/
+
+#define DEEN_INSTALL_WORKERS_MAX 16
+
+/*
+This is the size of the buffer used to copy files that are already installed
+when the operating system is not able to share the data between the files.
+*/
+
+#define DEEN_SIZE_COPY_BUFFER (128 * 1024)
+
+/*
+A new version of the data is installed as a delta segment if no more than this
+percentage of its lines have been added or deleted; otherwise the index is
+built again from the start.
+*/
+
+#define DEEN_INSTALL_DELTA_MAX_PERCENT 20
+
+/*
+Once there are this many delta segments with refs, a new version of the data is
+indexed from the start and adding local entries will merge the segments into
+the base of the index so that searches do not need to look in too many places.
+*/
 
-#define DEEN_SIZE_FILE_COPY_BUFFER 4 * 1024
+#define DEEN_INSTALL_SEGMENTS_MAX 8
 
 /*
-This is the initial size of a buffer used to uppercase text.
+When the data is indexed from the start, a checkpoint is taken after about
+this much data so that the indexing is able to carry on from there if it
+stops.  Each checkpoint spills a run of pairs so this should not be too small.
 */
 
-#define DEEN_SIZE_UPPER_BUFFER 32
+#define DEEN_INSTALL_CHECKPOINT_INTERVAL (8 * 1024 * 1024)
+
+#ifdef __MINGW32__
+#define DEEN_INSTALL_O_BINARY O_BINARY
+#define DEEN_INSTALL_DATA_MODE S_IRUSR
+#define DEEN_INSTALL_INDEX_MODE (S_IRUSR|S_IWUSR)
+#else
+#define DEEN_INSTALL_O_BINARY 0
+#define DEEN_INSTALL_DATA_MODE (S_IRUSR|S_IRGRP|S_IROTH)
+#define DEEN_INSTALL_INDEX_MODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)
+#endif
 
 
 // ---------------------------------------------------------------
 
 /*
-This data structure maintains state over the index test and is used
-in the callback to point to the tree and the prior progress.
+A chunk of the data file moves through the indexing pipeline; it is read from
+the file, then tokenized into the prefixes for each line and finally written
+into the index.
+*/
+
+enum deen_install_chunk_state {
+	DEEN_INSTALL_CHUNK_EMPTY,
+	DEEN_INSTALL_CHUNK_READ,
+	DEEN_INSTALL_CHUNK_TOKENIZING,
+	DEEN_INSTALL_CHUNK_TOKENIZED
+};
+
+typedef struct deen_install_chunk deen_install_chunk;
+struct deen_install_chunk {
+
+	enum deen_install_chunk_state state;
+	deen_bool is_error;
+
+	// the data from the file and the offset in the file at which it starts.
+	// The text either points to the data that was read into the chunk or
+	// into the mapped file.
+	const uint8_t *text;
+	uint8_t *data;
+	size_t data_len;
+	size_t data_allocated;
+	off_t ref;
+
+	// how far through the source file reading had got once this chunk was
+	// read; this differs from the end of the chunk if the source is
+	// compressed.
+	off_t source_end;
+
+	// the hash of the content of the data up to the end of this chunk.
+	uint64_t content_hash;
+
+	// the lines found in the data and the prefixes for each line.  The
+	// prefixes are stored in slots of a fixed width.
+	size_t line_count;
+	size_t line_allocated;
+	off_t *line_refs;
+	size_t *line_prefix_counts;
+	size_t prefix_count;
+	size_t prefix_allocated;
+	uint8_t *prefixes;
+
+	// how long it took to tokenize the chunk.
+	deen_millis tokenize_millis;
+
+};
+
+/*
+Prefixes are held in slots of a fixed width; enough for the longest prefix and
+a terminating NUL.
+*/
+
+#define DEEN_INSTALL_CHUNK_PREFIX_SLOT (DEEN_INDEX_PREFIX_WIDTH + 1)
+
+/*
+This is the initial number of buckets in the hash set used to find duplicate
+prefixes in a line.  It must be a power of two.
+*/
+
+#define DEEN_INSTALL_PREFIX_HASH_SIZE 64
+
+/*
+This data structure maintains state while a worker tokenizes the lines of a
+chunk.  It accumulates the prefixes for the current line.
+*/
+
+typedef struct deen_index_line_context deen_index_line_context;
+struct deen_index_line_context {
+
+	deen_install_chunk *chunk;
+
+	// tracking the file offset and also the prefixes which are included
+	// on that file offset.  The file offset is termed a 'ref'.  The
+	// prefixes are stored in a pool of slots that is re-used for each line.
+	off_t current_ref;
+	size_t prefix_count;
+	size_t prefix_allocated;
+	uint8_t *prefix_pool;
+
+	// an open-addressing hash set over the slots in the pool for finding
+	// duplicate prefixes.  A bucket holds the slot index and is only in use
+	// if its generation matches the current generation so that the set can
+	// be emptied for each line without clearing the buckets.
+	uint32_t *prefix_hash_slots;
+	uint32_t *prefix_hash_generations;
+	size_t prefix_hash_size;
+	uint32_t prefix_hash_generation;
+
+};
+
+/*
+This data structure maintains state over the writing of the chunks into the
+index and the prior progress.  It is only used from the thread that called to
+install the data so the callbacks are also only invoked from that thread.
 */
 
 typedef struct deen_index_context deen_index_context;
@@ -71,16 +227,143 @@ struct deen_index_context {
 	void *progress_cb_context;
 	deen_install_progress_cb progress_cb;
 
-	// buffer re-used between calls in order to convert text to upper case.
-	uint8_t *c_buffer_upper;
-	size_t c_buffer_upper_len;
+	// buffer re-used between lines to hold pointers to the prefixes.
+	uint8_t **line_prefixes;
+	size_t line_prefixes_allocated;
 
-	// tracking the file offset and also the prefixes which are included
-	// on that file offset.  The file offset is termed a 'ref'.
-	off_t current_ref;
-	size_t prefix_count;
-	size_t prefix_count_allocated;
-	uint8_t **prefixes;
+	// if the indexing is able to be resumed then a checkpoint is taken every
+	// so often.  The copy of the data is written to storage with each one.
+	deen_bool is_checkpointed;
+	off_t checkpoint_ref;
+	int fd_checkpoint_data;
+
+	// measurements of the indexing.
+	deen_install_stats stats;
+
+};
+
+/*
+This is what is already installed.  The data is held in memory so that its
+lines can be compared with a new version of the data or carried over into a new
+install.
+*/
+
+typedef struct deen_install_installed deen_install_installed;
+struct deen_install_installed {
+	const uint8_t *data;
+	size_t data_len;
+	deen_bool is_data_mapped;
+	deen_index_metadata metadata;
+	deen_index_segments *segments;
+};
+
+
+/*
+This is the outcome of matching the lines of a new version of the data with the
+lines that are installed.
+*/
+
+typedef struct deen_install_delta_plan deen_install_delta_plan;
+struct deen_install_delta_plan {
+
+	// the lines that were added; each one ends with a newline.
+	FILE *added;
+	off_t added_len;
+	size_t added_count;
+
+	// the refs of the installed lines that were deleted.
+	off_t *deleted_refs;
+	size_t deleted_count;
+
+	size_t line_count;
+	uint64_t source_hash;
+	uint64_t source_size;
+
+};
+
+
+/*
+A new install is built in a directory of its own alongside what is already
+installed and is then moved into place.  The data is kept open so that lines
+can be added to the end of it.
+*/
+
+typedef struct deen_install_shadow deen_install_shadow;
+struct deen_install_shadow {
+	char *dir;
+	char *data_path;
+	char *index_path;
+	char *map_index_path;
+	int fd_data;
+	sqlite3 *db;
+
+	// if true then the directory is kept when the install stops before it is
+	// complete so that a later install is able to carry on with it.
+	deen_bool is_resumable;
+
+	// if present then the measurements of the indexing into the new install
+	// are added to these.
+	deen_install_stats *stats;
+};
+
+
+/*
+This data structure is shared between the reader, the workers and the writer.
+The chunks are used as a ring; the sequence numbers of the chunks that have
+been read, taken for tokenizing and written only ever increase.
+*/
+
+typedef struct deen_install_pipeline deen_install_pipeline;
+struct deen_install_pipeline {
+
+	int fd_data;
+	off_t file_len;
+
+	// the ref of the start of the data file.  This is zero unless the data
+	// is being added to the end of data that is already installed.
+	off_t ref_base;
+
+	// if the data is compressed then it is inflated as it is read.
+	gzFile gz_data;
+
+	// if this is not -1 then each chunk is written to this file as it is
+	// read so that the data is copied in the same pass as it is indexed.
+	int fd_tee;
+	off_t tee_len;
+
+	// if the file could be mapped then the chunks are taken from the mapping
+	// rather than being read.
+	const uint8_t *mapped;
+	size_t mapped_len;
+
+	deen_install_chunk *chunks;
+	size_t chunks_count;
+
+	uint64_t read_seq;
+	uint64_t tokenize_seq;
+	uint64_t write_seq;
+	deen_bool read_finished;
+	deen_bool is_aborted;
+	deen_bool is_error;
+
+#ifndef __MINGW32__
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+#endif
+
+	// used only by the reader to hold the partial line at the end of the
+	// last read.
+	uint8_t *carry;
+	size_t carry_len;
+	size_t carry_allocated;
+	off_t next_ref;
+
+	// the content of the data is hashed by the reader as it goes so that the
+	// hash can be recorded in the index.
+	uint64_t content_hash;
+
+	// how long the reader spent reading chunks.
+	deen_millis read_millis;
 
 };
 
@@ -116,30 +399,22 @@ void deen_log_install_progress(enum deen_install_state state, float progress) {
 enum deen_install_check_ding_format_check_result deen_install_check_for_ding_format(const char *filename) {
 
 	enum deen_install_check_ding_format_check_result result = DEEN_INSTALL_CHECK_OK;
-	int fd = -1;
-
-// see if we have a gzip file; if so then we need to warn the user
-// that they need to decompress the file first.
-
-	if (
-		DEEN_INSTALL_CHECK_OK == result &&
-		strlen(filename) > 3 &&
-		0 == strncmp(".gz", &filename[strlen(filename) - 3], 3)) {
-		result = DEEN_INSTALL_CHECK_IS_COMPRESSED;
-	} else {
-		DEEN_LOG_INFO0("candidate file does not appear to be gzip compressed");
-	}
 
-// first open the file to be checked.
+// first open the file to be checked.  If the file is gzip compressed then the
+// data is inflated as it is read; otherwise it is read as it is.
 
-	if (DEEN_INSTALL_CHECK_OK == result) {
-		fd = open(filename, O_RDONLY);
-	}
+	gzFile gz = gzopen(filename, "rb");
 
-	if (DEEN_INSTALL_CHECK_OK == result && fd < 0) {
+	if (NULL == gz) {
 		result = DEEN_INSTALL_CHECK_IO_PROBLEM;
 	} else {
 		DEEN_LOG_INFO0("candidate file was opened successfully");
+
+		if (gzdirect(gz)) {
+			DEEN_LOG_INFO0("candidate file does not appear to be gzip compressed");
+		} else {
+			DEEN_LOG_INFO0("candidate file is gzip compressed");
+		}
 	}
 
 	// load in some 4k of the file to inspect.
@@ -147,7 +422,7 @@ enum deen_install_check_ding_format_check_result deen_install_check_for_ding_for
 	if (DEEN_INSTALL_CHECK_OK == result) {
 		char buffer[DEEN_SIZE_CHECK_DING_BUFFER];
 
-		if (DEEN_SIZE_CHECK_DING_BUFFER != read(fd, buffer, DEEN_SIZE_CHECK_DING_BUFFER)) {
+		if (DEEN_SIZE_CHECK_DING_BUFFER != gzread(gz, buffer, DEEN_SIZE_CHECK_DING_BUFFER)) {
 			result = DEEN_INSTALL_CHECK_TOO_SMALL;
 		} else {
 			DEEN_LOG_INFO1("candidate file; read %d bytes ok", DEEN_SIZE_CHECK_DING_BUFFER);
@@ -197,14 +472,27 @@ enum deen_install_check_ding_format_check_result deen_install_check_for_ding_for
 
 	// close the temporary file handle.
 
-	if (fd >= 0) {
-		close(fd);
+	if (NULL != gz) {
+		gzclose(gz);
 	}
 
 	return result;
 }
 
 
+/*
+Returns true if the file starts with the magic number of gzip compressed data.
+The file is left positioned at its start.
+*/
+
+static deen_bool deen_install_is_compressed(int fd) {
+	uint8_t magic[2];
+	deen_bool result = 2 == read(fd, magic, 2) && 0x1f == magic[0] && 0x8b == magic[1];
+	lseek(fd, 0, SEEK_SET);
+	return result;
+}
+
+
 static deen_bool deen_exists_fileobject(const char *filename) {
 	struct stat s;
 
@@ -242,12 +530,12 @@ static deen_bool deen_remove_fileobject(const char *filename) {
 }
 
 
-static deen_bool deen_remove_fileobject_in_root_dir(const char *deen_root_dir, const char *leafname) {
-	char *buffer = (char *) deen_emalloc(strlen(deen_root_dir) + strlen(leafname) + 2);
-	uint8_t result;
-	sprintf(buffer,"%s%s%s", deen_root_dir, DEEN_FILE_SEP, leafname);
-	result = deen_remove_fileobject(buffer);
-	return result;
+static int deen_install_mkdir(const char *dir) {
+#ifdef __MINGW32__
+	return mkdir(dir);
+#else
+	return mkdir(dir, 0777);
+#endif
 }
 
 
@@ -256,16 +544,9 @@ static deen_bool deen_remove_fileobject_in_root_dir(const char *deen_root_dir, c
  folder or in the shared location if there is one.
  */
 
-static deen_bool deen_install_init(const char *deen_root_dir) {
-
+static deen_bool deen_install_init_root_dir(const char *deen_root_dir) {
 	if (!deen_exists_fileobject(deen_root_dir)) {
-		if (0 == 
-#ifdef __MINGW32__
-					mkdir(deen_root_dir)
-#else
-					mkdir(deen_root_dir, 0777)
-#endif
-				) {
+		if (0 == deen_install_mkdir(deen_root_dir)) {
 			DEEN_LOG_INFO1("did create the deen data directory; %s", deen_root_dir);
 		}
 		else {
@@ -274,208 +555,2400 @@ static deen_bool deen_install_init(const char *deen_root_dir) {
 		}
 	}
 
-	if (!deen_remove_fileobject_in_root_dir(deen_root_dir, DEEN_LEAF_INDEX)) {
-		DEEN_LOG_ERROR0("failed to delete the existing index object");
-		return DEEN_FALSE;
+	return DEEN_TRUE;
+}
+
+
+/*
+ An install builds from what is installed and then replaces it, and a full
+ install carries on in the directory that an earlier install left behind; so
+ only one install, addition of local entries or merge is able to work on the
+ data at a time.  This takes a lock on a file in the deen data directory that
+ is let go of when the returned file is closed or when the process stops.
+ Returns -1 if another install holds the lock or if it was not able to be
+ taken.
+ */
+
+static int deen_install_lock(const char *deen_root_dir) {
+	char *lock_path = (char *) deen_emalloc(strlen(deen_root_dir) + strlen(DEEN_LEAF_INSTALL_LOCK) + 2);
+	int fd_lock;
+
+	sprintf(lock_path, "%s%s%s", deen_root_dir, DEEN_FILE_SEP, DEEN_LEAF_INSTALL_LOCK);
+	fd_lock = open(lock_path, O_RDWR|O_CREAT|DEEN_INSTALL_O_BINARY, S_IRUSR|S_IWUSR);
+
+	if (-1 == fd_lock) {
+		DEEN_LOG_ERROR1("unable to open the install lock; %s", lock_path);
 	}
+	else {
+#ifdef __MINGW32__
+		if (0 != _locking(fd_lock, _LK_NBLCK, 1)) {
+			if (EACCES == errno) {
+#else
+		if (0 != flock(fd_lock, LOCK_EX|LOCK_NB)) {
+			if (EWOULDBLOCK == errno) {
+#endif
+				DEEN_LOG_ERROR1("another install is already running on %s; try again once it is done", deen_root_dir);
+			}
+			else {
+				DEEN_LOG_ERROR1("unable to take the install lock; %s", lock_path);
+			}
 
-	if (!deen_remove_fileobject_in_root_dir(deen_root_dir, DEEN_LEAF_DING_DATA)) {
-			DEEN_LOG_ERROR0("failed to delete the existing data object");
-		return DEEN_FALSE;
+			close(fd_lock);
+			fd_lock = -1;
+		}
 	}
 
-	return DEEN_TRUE;
+	free((void *) lock_path);
+
+	return fd_lock;
 }
 
 
-// ---------------------------------------------------------------
+static void deen_install_unlock(int fd_lock) {
+	if (-1 != fd_lock) {
+		close(fd_lock);
+	}
+}
+
 
 /*
-Used in order to compare two prefixes in order to be able to sort
-them.
-*/
+ Within the deen data directory, this function creates a temporary directory in
+ which the new install is built and returns the path to it.  The existing
+ install is left in place so that it can still be searched.  Returns NULL if
+ there was a problem.
+ */
+
+static char *deen_install_init(const char *deen_root_dir) {
+	char *shadow_dir;
 
-static int deen_index_prefix_compare(const void *a, const void *b) {
-	uint8_t **a_ptr = (uint8_t **) a;
-	uint8_t **b_ptr = (uint8_t **) b;
-	return strcmp((const char *) (a_ptr[0]), (const char *) (b_ptr[0]));
+	if (!deen_install_init_root_dir(deen_root_dir)) {
+		return NULL;
+	}
+
+	shadow_dir = (char *) deen_emalloc(strlen(deen_root_dir) + strlen(DEEN_LEAF_TMPINDEX) + 2);
+	sprintf(shadow_dir, "%s%s%s", deen_root_dir, DEEN_FILE_SEP, DEEN_LEAF_TMPINDEX);
+
+#ifdef __MINGW32__
+	if (NULL == mktemp(shadow_dir) || 0 != mkdir(shadow_dir)) {
+#else
+	if (NULL == mkdtemp(shadow_dir)) {
+#endif
+		DEEN_LOG_ERROR1("failed to create the directory for the new install; %s", shadow_dir);
+		free((void *) shadow_dir);
+		return NULL;
+	}
+
+	DEEN_LOG_INFO1("did create the directory for the new install; %s", shadow_dir);
+
+	return shadow_dir;
 }
 
+
 /*
-Adds the prefix to the context even if it is already present.  This function
-will add memory to the context if necessary and will ensure that the list of
-prefixes is sorted.
+Ensures that the file or directory at the path is written to storage.
 */
 
-static void deen_index_add_prefix_to_context(
-	deen_index_context *context,
-	uint8_t *s,
-	size_t len) {
+static deen_bool deen_install_sync_path(const char *path) {
+#ifdef __MINGW32__
+	return DEEN_TRUE;
+#else
+	int fd = open(path, O_RDONLY);
+	deen_bool result;
 
-	if (context->prefix_count == context->prefix_count_allocated) {
-		context->prefix_count_allocated++;
-		context->prefixes = (uint8_t **) deen_erealloc(
-			context->prefixes,
-			sizeof(uint8_t **) * context->prefix_count_allocated);
-		context->prefixes[context->prefix_count_allocated-1] = (uint8_t *) deen_emalloc(
-			sizeof(uint8_t) * (DEEN_INDEXING_DEPTH * 4 + 1));
+	if (-1 == fd) {
+		return DEEN_FALSE;
 	}
 
-	memcpy(context->prefixes[context->prefix_count], s, len);
-	(context->prefixes[context->prefix_count])[len] = 0;
-	context->prefix_count++;
+	result = 0 == fsync(fd);
+	close(fd);
+
+	return result;
+#endif
+}
+
 
-	// sorting
-	qsort(
-		context->prefixes, context->prefix_count,
-		sizeof(uint8_t *), &deen_index_prefix_compare);
+static deen_bool deen_install_sync_fd(int fd) {
+#ifdef __MINGW32__
+	return DEEN_TRUE;
+#else
+	return 0 == fsync(fd);
+#endif
 }
 
+
 /*
-Checks to see if the prefix is already in place.  If it is in place,
-then it will carry on.  If it is not already in place then it will
-add it in.
+Moves the files of the new install into place.  Each is written to storage
+first so that a crash cannot leave a partially written file in place.  The
+data is moved first and the sqlite index last because searches check the
+sqlite index to see if a new install has been put in place.
 */
 
-static void deen_index_add_prefix_to_context_if_not_present(
-	deen_index_context *context,
-	uint8_t *s,
-	size_t len) {
+static deen_bool deen_install_swap_in(const char *shadow_dir, const char *deen_root_dir) {
+	char *(*path_fns[])(const char *) = {
+		&deen_data_path,
+		&deen_map_index_path,
+		&deen_index_path
+	};
+	deen_bool result = DEEN_TRUE;
+	size_t i;
+
+	for (i = 0; result && i < sizeof(path_fns) / sizeof(path_fns[0]); i++) {
+		char *shadow_path = path_fns[i](shadow_dir);
+		char *path = path_fns[i](deen_root_dir);
+
+		// a delta added to an install without a map index has no map index
+		// either.
+
+		if (deen_exists_fileobject(shadow_path)) {
+			if (!deen_install_sync_path(shadow_path)) {
+				DEEN_LOG_ERROR1("unable to write to storage; %s", shadow_path);
+				result = DEEN_FALSE;
+			}
+
+#ifdef __MINGW32__
+			// renaming onto an existing file is not possible on windows.
+			if (result) {
+				result = deen_remove_fileobject(path);
+			}
+#endif
+
+			if (result && 0 != rename(shadow_path, path)) {
+				DEEN_LOG_ERROR2("unable to move %s --> %s", shadow_path, path);
+				result = DEEN_FALSE;
+			}
+		}
 
-	if (0 == context->prefix_count || NULL == bsearch(
-		&s,
-		context->prefixes,
-		context->prefix_count,
-		sizeof(uint8_t *),
-		&deen_index_prefix_compare)) {
+		free((void *) shadow_path);
+		free((void *) path);
+	}
 
-		deen_index_add_prefix_to_context(context,s,len);
+	if (result && !deen_install_sync_path(deen_root_dir)) {
+		DEEN_LOG_ERROR1("unable to write to storage; %s", deen_root_dir);
+		result = DEEN_FALSE;
 	}
+
+	return result;
 }
 
 
 /*
-This is by-passing the regular logging system in order to more efficiently
-output this data.
+Reads from the data file; inflating the data if it is compressed.
 */
 
-static void deen_index_flush_context_prefixes_to_index_trace_log(deen_index_context *context) {
-
-	if (deen_is_trace_enabled()) {
-		size_t i;
+static ssize_t deen_install_read_source(
+	int fd_data,
+	gzFile gz_data,
+	uint8_t *buffer,
+	size_t len) {
 
-		fputs(DEEN_PREFIX_TRACE, stdout);
-		fprintf(stdout, " %8lu <-- { ", (unsigned long) context->current_ref);
+	if (NULL != gz_data) {
+		int actuallyread = gzread(gz_data, buffer, (unsigned) len);
+		int errnum = Z_OK;
+		const char *errmsg = gzerror(gz_data, &errnum);
 
-		for (i = 0; i < context->prefix_count; i++) {
-			if (0!=i) {
-				fputs(", ",stdout);
-			}
+		// a truncated file is only noticed at the end of the data.
 
-			fputs((char *) context->prefixes[i], stdout);
+		if (actuallyread < 0 || (0 == actuallyread && Z_OK != errnum)) {
+			DEEN_LOG_ERROR1("unable to inflate the data file; %s", errmsg);
+			return -1;
 		}
 
-		fputs(" }\n", stdout);
+		return (ssize_t) actuallyread;
 	}
+
+	return read(fd_data, buffer, len);
 }
 
 
-static void deen_index_flush_context_prefixes_to_index(
-	deen_index_context *context) {
+/*
+Starts inflating the data file.  The file is left open when the inflating is
+finished.  Returns NULL if there was a problem.
+*/
 
-	if (0 != context->prefix_count) {
-		deen_index_flush_context_prefixes_to_index_trace_log(context);
+static gzFile deen_install_open_source_gz(int fd_data) {
+	gzFile gz_data = NULL;
+	int fd_gz = dup(fd_data);
 
-		deen_index_add(
-			context->index_add_context,
-			context->current_ref,
-			context->prefixes,
-			context->prefix_count);
+	if (-1 != fd_gz) {
+		gz_data = gzdopen(fd_gz, "rb");
+
+		if (NULL == gz_data) {
+			close(fd_gz);
+		}
+	}
 
-		context->prefix_count = 0;
+	if (NULL == gz_data) {
+		DEEN_LOG_ERROR0("unable to start inflating the data file");
+	}
+	else {
+		gzbuffer(gz_data, DEEN_SIZE_INFLATE_BUFFER);
 	}
 
+	return gz_data;
 }
 
 
 /*
-This call-back method is hit each time a word is found to be indexed
-It keeps track of the tree into which the index is being written and
-the last percentage of the progress through a struct.
+Hashes the content of the data file in the same way as the indexing does; a
+compressed file is inflated first.  No more than 'max_size' bytes of the
+content are hashed.  Returns false if the file was not able to be read.  The
+file is left positioned at its start.
 */
 
-static deen_bool deen_index_callback(
-	const uint8_t *s,
-	size_t len,
-	off_t ref,
-	float progress,
-	void *context) {
+static deen_bool deen_install_hash_data(
+	int fd_data,
+	deen_bool is_compressed,
+	uint64_t max_size,
+	uint64_t *hash,
+	uint64_t *size) {
 
-	deen_bool result = DEEN_TRUE;
+	uint8_t *buffer;
+	gzFile gz_data = NULL;
+	ssize_t actuallyread;
 
-	deen_index_context *context2 = (deen_index_context *) context;
+	*hash = DEEN_HASH_INITIAL;
+	*size = 0;
 
-	if (context2->current_ref != ref) {
-		deen_index_flush_context_prefixes_to_index(context2);
-		context2->current_ref = ref;
+	if (is_compressed && NULL == (gz_data = deen_install_open_source_gz(fd_data))) {
+		return DEEN_FALSE;
+	}
 
-		// handle the progress callback.
+	buffer = (uint8_t *) deen_emalloc(DEEN_SIZE_INFLATE_BUFFER);
 
-		{
-			uint8_t last_percent = (uint8_t) (context2->lastprogress * 100.0);
-			uint8_t percent = (uint8_t) (progress * 100.0);
+	do {
+		size_t len = DEEN_SIZE_INFLATE_BUFFER;
 
-			if (percent != last_percent) {
-				context2->progress_cb(context2->progress_cb_context,
-					DEEN_INSTALL_STATE_INDEXING, progress);
-				context2->lastprogress = progress;
-			}
+		if (max_size - *size < (uint64_t) len) {
+			len = (size_t) (max_size - *size);
 		}
 
-	}
+		actuallyread = 0 == len ? 0 : deen_install_read_source(fd_data, gz_data, buffer, len);
 
-	if (len >= DEEN_INDEXING_MIN) {
-		if (context2->is_cancelled_cb(context2->progress_cb_context)) {
-			result = DEEN_FALSE; // stop processing
+		if (actuallyread > 0) {
+			*hash = deen_hash(*hash, buffer, (size_t) actuallyread);
+			*size += (uint64_t) actuallyread;
 		}
-		else {
+	} while (actuallyread > 0);
+
+	if (NULL != gz_data) {
+		gzclose(gz_data);
+	}
 
-			// ensure the upper-casing buffer is actually large enough.
+	free((void *) buffer);
+	lseek(fd_data, 0, SEEK_SET);
 
-			if (0==context2->c_buffer_upper_len) {
-				context2->c_buffer_upper_len = DEEN_SIZE_UPPER_BUFFER;
-				context2->c_buffer_upper = (uint8_t *) deen_emalloc(sizeof(uint8_t) * context2->c_buffer_upper_len);
-			}
+	return -1 != actuallyread;
+}
 
-			if (context2->c_buffer_upper_len <= len) {
-				context2->c_buffer_upper_len = len + 1;
-				context2->c_buffer_upper = (uint8_t *) deen_emalloc(sizeof(uint8_t) * context2->c_buffer_upper_len);
-			}
 
-			memcpy(context2->c_buffer_upper, s, len);
-			context2->c_buffer_upper[len] = 0;
+/*
+Returns true if the data and the index that are already installed were built
+from the same content as the data file and in the same way as an install would
+build them now.  In this case there is no need to install again.
+*/
+
+static deen_bool deen_install_is_unchanged(
+	const char *deen_root_dir,
+	int fd_data,
+	deen_bool is_compressed) {
 
-			deen_to_upper(context2->c_buffer_upper);
+	char *data_path = deen_data_path(deen_root_dir);
+	char *index_path = deen_index_path(deen_root_dir);
+	deen_index_metadata installed;
+	deen_bool result = DEEN_FALSE;
+	struct stat fd_stat;
+	sqlite3 *db = NULL;
 
-			if (!deen_is_common_upper_word(context2->c_buffer_upper, len)) {
+	if (deen_exists_fileobject(data_path)
+		&& deen_exists_fileobject(index_path)
+		&& SQLITE_OK == sqlite3_open_v2(index_path, &db, SQLITE_OPEN_READONLY, NULL)
+		&& deen_index_read_metadata(db, &installed)
+		&& deen_index_metadata_is_current(&installed)) {
 
-				// create the prefix at the right length.
+		uint64_t hash;
+		uint64_t size;
 
-				size_t unicode_length = deen_utf8_crop_to_unicode_len(context2->c_buffer_upper, len, DEEN_INDEXING_DEPTH);
+		// if the data file is not compressed then a change of size shows that
+		// the content has changed without having to read it.
 
-				if (unicode_length >= DEEN_INDEXING_MIN) {
-					deen_index_add_prefix_to_context_if_not_present(
-						context2,
-						context2->c_buffer_upper,
-						strlen((char *) context2->c_buffer_upper));
-				}
-			}
+		if (is_compressed || (
+			0 == fstat(fd_data, &fd_stat)
+			&& (uint64_t) fd_stat.st_size == installed.source_size)) {
+			result = deen_install_hash_data(fd_data, is_compressed, UINT64_MAX, &hash, &size)
+				&& size == installed.source_size
+				&& hash == installed.source_hash;
 		}
 	}
 
-	return result;
-}
+	if (NULL != db) {
+		sqlite3_close_v2(db);
+	}
+
+	free((void *) data_path);
+	free((void *) index_path);
+
+	return result;
+}
+
+
+// ---------------------------------------------------------------
+// COPYING
+// ---------------------------------------------------------------
+
+static deen_bool deen_install_write_fully(int fd, const uint8_t *c, size_t len) {
+	size_t written = 0;
+
+	while (written < len) {
+		ssize_t actually_written = write(fd, &c[written], len - written);
+
+		if (actually_written <= 0) {
+			return DEEN_FALSE;
+		}
+
+		written += (size_t) actually_written;
+	}
+
+	return DEEN_TRUE;
+}
+
+
+/*
+Where possible the operating system is asked to share the data between the
+source and the install location (a "reflink") so that no data need be copied
+at all.  Returns false if this was not possible; in which case the data is
+copied as it is indexed.
+*/
+
+static deen_bool deen_install_clone_data(int fd_src, int fd_dest) {
+#if defined(__linux__) && defined(FICLONE)
+	if (0 == ioctl(fd_dest, FICLONE, fd_src)) {
+		return DEEN_TRUE;
+	}
+#endif
+
+	return DEEN_FALSE;
+}
+
+
+/*
+Writes the chunk that has just been read to the install location.  The chunks
+are read in order so the install location is written from start to end and the
+refs of the lines in the chunk are the same in both files.
+*/
+
+static deen_bool deen_install_tee_chunk(
+	deen_install_pipeline *pipeline,
+	deen_install_chunk *chunk) {
+
+	if (chunk->ref != pipeline->tee_len) {
+		DEEN_LOG_ERROR2("copy of data is at %llu but chunk is at %llu",
+			(unsigned long long) pipeline->tee_len, (unsigned long long) chunk->ref);
+		return DEEN_FALSE;
+	}
+
+	if (!deen_install_write_fully(pipeline->fd_tee, chunk->text, chunk->data_len)) {
+		DEEN_LOG_ERROR1("unable to copy the data at %llu", (unsigned long long) chunk->ref);
+		return DEEN_FALSE;
+	}
+
+	pipeline->tee_len += (off_t) chunk->data_len;
+
+	return DEEN_TRUE;
+}
+
+
+// ---------------------------------------------------------------
+// TOKENIZING
+// ---------------------------------------------------------------
+
+static uint32_t deen_index_prefix_hash(const uint8_t *s, size_t len) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ s[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+
+static uint8_t *deen_index_prefix_slot(deen_index_line_context *context, size_t slot) {
+	return &(context->prefix_pool[slot * DEEN_INSTALL_CHUNK_PREFIX_SLOT]);
+}
+
+
+/*
+Finds the bucket in the hash set where the prefix is stored or, if the prefix
+is not present, the empty bucket where it should be stored.
+*/
+
+static size_t deen_index_prefix_hash_find(
+	deen_index_line_context *context,
+	const uint8_t *s,
+	size_t len) {
+
+	size_t mask = context->prefix_hash_size - 1;
+	size_t bucket = deen_index_prefix_hash(s, len) & mask;
+
+	while (context->prefix_hash_generations[bucket] == context->prefix_hash_generation) {
+		const uint8_t *slot = deen_index_prefix_slot(context, context->prefix_hash_slots[bucket]);
+
+		if (0 == memcmp(slot, s, len) && 0 == slot[len]) {
+			return bucket;
+		}
+
+		bucket = (bucket + 1) & mask;
+	}
+
+	return bucket;
+}
+
+
+/*
+Doubles the size of the hash set and re-inserts the prefixes of the current
+line.
+*/
+
+static void deen_index_prefix_hash_grow(deen_index_line_context *context) {
+	size_t i;
+
+	context->prefix_hash_size = 0 == context->prefix_hash_size
+		? DEEN_INSTALL_PREFIX_HASH_SIZE : context->prefix_hash_size * 2;
+	context->prefix_hash_slots = (uint32_t *) deen_erealloc(
+		context->prefix_hash_slots,
+		sizeof(uint32_t) * context->prefix_hash_size);
+	context->prefix_hash_generations = (uint32_t *) deen_erealloc(
+		context->prefix_hash_generations,
+		sizeof(uint32_t) * context->prefix_hash_size);
+	memset(context->prefix_hash_generations, 0, sizeof(uint32_t) * context->prefix_hash_size);
+	context->prefix_hash_generation = 1;
+
+	for (i = 0; i < context->prefix_count; i++) {
+		const uint8_t *slot = deen_index_prefix_slot(context, i);
+		size_t bucket = deen_index_prefix_hash_find(context, slot, strlen((const char *) slot));
+		context->prefix_hash_slots[bucket] = (uint32_t) i;
+		context->prefix_hash_generations[bucket] = context->prefix_hash_generation;
+	}
+}
+
+
+/*
+Empties the set of prefixes ready for the next line.
+*/
+
+static void deen_index_prefix_reset(deen_index_line_context *context) {
+	context->prefix_count = 0;
+	context->prefix_hash_generation++;
+
+	// once the generation wraps the buckets need to be cleared.
+
+	if (0 == context->prefix_hash_generation && 0 != context->prefix_hash_size) {
+		memset(context->prefix_hash_generations, 0, sizeof(uint32_t) * context->prefix_hash_size);
+		context->prefix_hash_generation = 1;
+	}
+}
+
+
+/*
+Checks to see if the prefix is already in place.  If it is in place,
+then it will carry on.  If it is not already in place then it will
+add it in.
+*/
+
+static void deen_index_add_prefix_to_context_if_not_present(
+	deen_index_line_context *context,
+	uint8_t *s,
+	size_t len) {
+
+	size_t bucket;
+
+	if ((context->prefix_count + 1) * 2 > context->prefix_hash_size) {
+		deen_index_prefix_hash_grow(context);
+	}
+
+	bucket = deen_index_prefix_hash_find(context, s, len);
+
+	if (context->prefix_hash_generations[bucket] != context->prefix_hash_generation) {
+		uint8_t *slot;
+
+		if (context->prefix_count == context->prefix_allocated) {
+			context->prefix_allocated = 0 == context->prefix_allocated ? 32 : context->prefix_allocated * 2;
+			context->prefix_pool = (uint8_t *) deen_erealloc(
+				context->prefix_pool,
+				DEEN_INSTALL_CHUNK_PREFIX_SLOT * context->prefix_allocated);
+		}
+
+		slot = deen_index_prefix_slot(context, context->prefix_count);
+		memcpy(slot, s, len);
+		slot[len] = 0;
+
+		context->prefix_hash_slots[bucket] = (uint32_t) context->prefix_count;
+		context->prefix_hash_generations[bucket] = context->prefix_hash_generation;
+		context->prefix_count++;
+	}
+}
+
+
+/*
+Copies the prefixes of the current line into the output of the chunk.
+*/
+
+static void deen_index_flush_line_prefixes_to_chunk(deen_index_line_context *context) {
+
+	if (0 != context->prefix_count) {
+		deen_install_chunk *chunk = context->chunk;
+
+		if (chunk->line_count == chunk->line_allocated) {
+			chunk->line_allocated = 0 == chunk->line_allocated ? 256 : chunk->line_allocated * 2;
+			chunk->line_refs = (off_t *) deen_erealloc(
+				chunk->line_refs, sizeof(off_t) * chunk->line_allocated);
+			chunk->line_prefix_counts = (size_t *) deen_erealloc(
+				chunk->line_prefix_counts, sizeof(size_t) * chunk->line_allocated);
+		}
+
+		while (chunk->prefix_count + context->prefix_count > chunk->prefix_allocated) {
+			chunk->prefix_allocated = 0 == chunk->prefix_allocated ? 4096 : chunk->prefix_allocated * 2;
+			chunk->prefixes = (uint8_t *) deen_erealloc(
+				chunk->prefixes, DEEN_INSTALL_CHUNK_PREFIX_SLOT * chunk->prefix_allocated);
+		}
+
+		// the slots in the pool have the same layout as in the chunk.
+
+		memcpy(
+			&(chunk->prefixes[chunk->prefix_count * DEEN_INSTALL_CHUNK_PREFIX_SLOT]),
+			context->prefix_pool,
+			DEEN_INSTALL_CHUNK_PREFIX_SLOT * context->prefix_count);
+
+		chunk->line_refs[chunk->line_count] = context->current_ref;
+		chunk->line_prefix_counts[chunk->line_count] = context->prefix_count;
+		chunk->line_count++;
+		chunk->prefix_count += context->prefix_count;
+
+		deen_index_prefix_reset(context);
+	}
+
+}
+
+
+/*
+Adds the prefix of a word to the prefixes of the current line if the word is
+worth indexing.  Only as much of the word as could be in a prefix is converted
+to upper case; a word that is longer than this is not a common word anyway.
+*/
+
+static void deen_index_add_word_prefix(
+	deen_index_line_context *context,
+	const uint8_t *s,
+	size_t len) {
+
+	uint8_t upper[DEEN_INDEX_PREFIX_WIDTH + 1];
+	size_t upper_len = len < DEEN_INDEX_PREFIX_WIDTH ? len : DEEN_INDEX_PREFIX_WIDTH;
+
+	memcpy(upper, s, upper_len);
+	upper[upper_len] = 0;
+
+	deen_to_upper(upper);
+
+	if (!deen_is_common_upper_word(upper, len)) {
+
+		// create the prefix at the right length.
+
+		size_t unicode_length = deen_utf8_crop_to_unicode_len(upper, upper_len, DEEN_INDEXING_DEPTH);
+
+		if (unicode_length >= DEEN_INDEXING_MIN) {
+			deen_index_add_prefix_to_context_if_not_present(
+				context,
+				upper,
+				strlen((char *) upper));
+		}
+	}
+}
+
+
+static void deen_index_line_context_free(deen_index_line_context *context) {
+	if (NULL != context->prefix_pool) {
+		free((void *) context->prefix_pool);
+	}
+
+	if (NULL != context->prefix_hash_slots) {
+		free((void *) context->prefix_hash_slots);
+	}
+
+	if (NULL != context->prefix_hash_generations) {
+		free((void *) context->prefix_hash_generations);
+	}
+}
+
+
+/*
+Finds the prefixes for each of the lines in the chunk.  The words are found in
+batches and the prefixes for a line are flushed to the chunk when the line
+changes.
+*/
+
+static void deen_install_tokenize_chunk(
+	deen_index_line_context *context,
+	deen_install_chunk *chunk) {
+
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
+	deen_millis start_ms = deen_millis_since_epoc();
+
+	chunk->line_count = 0;
+	chunk->prefix_count = 0;
+
+	context->chunk = chunk;
+	context->current_ref = chunk->ref;
+	deen_index_prefix_reset(context);
+
+	deen_word_scan_init(&scan, chunk->text, chunk->data_len, chunk->ref, DEEN_TRUE);
+
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		size_t i;
+
+		for (i = 0; i < span_count; i++) {
+			if (context->current_ref != spans[i].ref) {
+				deen_index_flush_line_prefixes_to_chunk(context);
+				context->current_ref = spans[i].ref;
+			}
+
+			if (spans[i].len >= DEEN_INDEXING_MIN) {
+				deen_index_add_word_prefix(context, &chunk->text[spans[i].offset], spans[i].len);
+			}
+		}
+	}
+
+	if (DEEN_SEQUENCE_OK != scan.sequence_result) {
+		DEEN_LOG_ERROR1("bad utf8 sequence at %llu", (unsigned long long) (chunk->ref + (off_t) scan.offset));
+		chunk->is_error = DEEN_TRUE;
+	}
+
+	deen_index_flush_line_prefixes_to_chunk(context);
+	context->chunk = NULL;
+	chunk->tokenize_millis = deen_millis_since_epoc() - start_ms;
+}
+
+
+// ---------------------------------------------------------------
+// READING
+// ---------------------------------------------------------------
+
+/*
+Takes the next chunk from the mapped data file.  The chunk is extended to the
+end of the line that it finishes in.  Returns false if there is no more data.
+*/
+
+static deen_bool deen_install_slice_chunk(
+	deen_install_pipeline *pipeline,
+	deen_install_chunk *chunk) {
+
+	size_t start = (size_t) (pipeline->next_ref - pipeline->ref_base);
+	size_t end;
+
+	if (start >= pipeline->mapped_len) {
+		return DEEN_FALSE;
+	}
+
+	end = start + DEEN_SIZE_INSTALL_CHUNK;
+
+	if (end >= pipeline->mapped_len) {
+		end = pipeline->mapped_len;
+	}
+	else {
+		const uint8_t *newline = (const uint8_t *) memchr(
+			&(pipeline->mapped[end]), '\n', pipeline->mapped_len - end);
+		end = NULL == newline ? pipeline->mapped_len : (size_t) (newline - pipeline->mapped) + 1;
+	}
+
+	chunk->text = &(pipeline->mapped[start]);
+	chunk->data_len = end - start;
+	chunk->ref = pipeline->next_ref;
+	pipeline->next_ref = pipeline->ref_base + (off_t) end;
+
+	return DEEN_TRUE;
+}
+
+
+static ssize_t deen_install_read_data(
+	deen_install_pipeline *pipeline,
+	uint8_t *buffer,
+	size_t len) {
+	return deen_install_read_source(pipeline->fd_data, pipeline->gz_data, buffer, len);
+}
+
+
+/*
+Reads the next chunk from the data file.  The chunk will end on a newline
+unless the end of the file has been reached.  Returns false if there is no
+more data to be read.
+*/
+
+static deen_bool deen_install_read_chunk_from_file(
+	deen_install_pipeline *pipeline,
+	deen_install_chunk *chunk) {
+
+	deen_bool is_eof = DEEN_FALSE;
+	size_t scanned_len;
+
+	chunk->is_error = DEEN_FALSE;
+	chunk->data_len = 0;
+
+	if (chunk->data_allocated < pipeline->carry_len + DEEN_SIZE_INSTALL_CHUNK) {
+		chunk->data_allocated = pipeline->carry_len + DEEN_SIZE_INSTALL_CHUNK;
+		chunk->data = (uint8_t *) deen_erealloc(chunk->data, chunk->data_allocated);
+	}
+
+	memcpy(chunk->data, pipeline->carry, pipeline->carry_len);
+	chunk->data_len = pipeline->carry_len;
+	scanned_len = pipeline->carry_len;
+	pipeline->carry_len = 0;
+
+	while (!is_eof) {
+		ssize_t actuallyread;
+		size_t i;
+
+		if (chunk->data_len == chunk->data_allocated) {
+			chunk->data_allocated += DEEN_SIZE_INSTALL_CHUNK;
+			chunk->data = (uint8_t *) deen_erealloc(chunk->data, chunk->data_allocated);
+		}
+
+		actuallyread = deen_install_read_data(
+			pipeline,
+			&(chunk->data[chunk->data_len]),
+			chunk->data_allocated - chunk->data_len);
+
+		if (-1 == actuallyread) {
+			DEEN_LOG_ERROR1("unable to read the data file at %llu", (unsigned long long) pipeline->next_ref);
+			chunk->is_error = DEEN_TRUE;
+			return DEEN_FALSE;
+		}
+
+		if (0 == actuallyread) {
+			is_eof = DEEN_TRUE;
+		}
+		else {
+			chunk->data_len += (size_t) actuallyread;
+
+			// find the last newline in the data; the data after it belongs
+			// with the next chunk.
+
+			for (i = chunk->data_len; i > scanned_len; i--) {
+				if ('\n' == chunk->data[i - 1]) {
+					size_t remainder_len = chunk->data_len - i;
+
+					if (pipeline->carry_allocated < remainder_len) {
+						pipeline->carry_allocated = remainder_len;
+						pipeline->carry = (uint8_t *) deen_erealloc(pipeline->carry, remainder_len);
+					}
+
+					memcpy(pipeline->carry, &(chunk->data[i]), remainder_len);
+					pipeline->carry_len = remainder_len;
+					chunk->data_len = i;
+					chunk->ref = pipeline->next_ref;
+					pipeline->next_ref += (off_t) chunk->data_len;
+					return DEEN_TRUE;
+				}
+			}
+
+			scanned_len = chunk->data_len;
+		}
+	}
+
+	chunk->ref = pipeline->next_ref;
+	pipeline->next_ref += (off_t) chunk->data_len;
+	return 0 != chunk->data_len;
+}
+
+
+static deen_bool deen_install_read_chunk(
+	deen_install_pipeline *pipeline,
+	deen_install_chunk *chunk) {
+
+	deen_bool result;
+	deen_millis start_ms = deen_millis_since_epoc();
+
+	if (NULL != pipeline->mapped) {
+		chunk->is_error = DEEN_FALSE;
+		result = deen_install_slice_chunk(pipeline, chunk);
+	}
+	else {
+		result = deen_install_read_chunk_from_file(pipeline, chunk);
+		chunk->text = chunk->data;
+	}
+
+	chunk->source_end = NULL == pipeline->gz_data
+		? (chunk->ref - pipeline->ref_base) + (off_t) chunk->data_len
+		: (off_t) gzoffset(pipeline->gz_data);
+
+	if (result) {
+		pipeline->content_hash = deen_hash(pipeline->content_hash, chunk->text, chunk->data_len);
+		chunk->content_hash = pipeline->content_hash;
+	}
+
+	if (result && -1 != pipeline->fd_tee && !deen_install_tee_chunk(pipeline, chunk)) {
+		chunk->is_error = DEEN_TRUE;
+		result = DEEN_FALSE;
+	}
+
+	pipeline->read_millis += deen_millis_since_epoc() - start_ms;
+
+	return result;
+}
+
+
+// ---------------------------------------------------------------
+// WRITING
+// ---------------------------------------------------------------
+
+/*
+This is by-passing the regular logging system in order to more efficiently
+output this data.
+*/
+
+static void deen_index_flush_line_prefixes_to_index_trace_log(
+	off_t ref, uint8_t **prefixes, size_t prefix_count) {
+
+	if (deen_is_trace_enabled()) {
+		size_t i;
+
+		fputs(DEEN_PREFIX_TRACE, stdout);
+		fprintf(stdout, " %8lu <-- { ", (unsigned long) ref);
+
+		for (i = 0; i < prefix_count; i++) {
+			if (0!=i) {
+				fputs(", ",stdout);
+			}
+
+			fputs((char *) prefixes[i], stdout);
+		}
+
+		fputs(" }\n", stdout);
+	}
+}
+
+
+/*
+Records that the index has the lines up to the end of the chunk so that the
+indexing is able to carry on from there if it stops.  The runs of pairs and the
+copy of the data are written to storage first so that the checkpoint is never
+ahead of them.
+*/
+
+static void deen_install_checkpoint(
+	deen_index_context *context,
+	deen_install_chunk *chunk) {
+
+	sqlite3 *db = context->index_add_context->db;
+	deen_index_checkpoint checkpoint;
+
+	checkpoint.ref = (uint64_t) (chunk->ref + (off_t) chunk->data_len);
+	checkpoint.source_hash = chunk->content_hash;
+	checkpoint.runs_count = deen_index_add_checkpoint(context->index_add_context);
+	checkpoint.format_version = DEEN_INDEX_FORMAT_VERSION;
+
+	if (!deen_install_sync_fd(context->fd_checkpoint_data)) {
+		DEEN_LOG_ERROR0("unable to write the copy of the data to storage; no checkpoint");
+		return;
+	}
+
+	deen_transaction_begin(db);
+	deen_index_write_checkpoint(db, &checkpoint);
+	deen_transaction_commit(db);
+
+	context->checkpoint_ref = (off_t) checkpoint.ref;
+	DEEN_LOG_TRACE1("did checkpoint at %llu", (unsigned long long) checkpoint.ref);
+}
+
+
+/*
+Adds the prefixes of each line of the chunk into the index and reports the
+progress.
+*/
+
+static void deen_install_write_chunk(
+	deen_index_context *context,
+	deen_install_pipeline *pipeline,
+	deen_install_chunk *chunk) {
+
+	size_t line_i;
+	size_t prefix_i = 0;
+
+	for (line_i = 0; line_i < chunk->line_count; line_i++) {
+		size_t line_prefix_count = chunk->line_prefix_counts[line_i];
+		size_t i;
+
+		if (context->line_prefixes_allocated < line_prefix_count) {
+			context->line_prefixes_allocated = line_prefix_count;
+			context->line_prefixes = (uint8_t **) deen_erealloc(
+				context->line_prefixes,
+				sizeof(uint8_t *) * line_prefix_count);
+		}
+
+		for (i = 0; i < line_prefix_count; i++) {
+			context->line_prefixes[i] = &(chunk->prefixes[(prefix_i + i) * DEEN_INSTALL_CHUNK_PREFIX_SLOT]);
+		}
+
+		deen_index_flush_line_prefixes_to_index_trace_log(
+			chunk->line_refs[line_i], context->line_prefixes, line_prefix_count);
+
+		deen_index_add(
+			context->index_add_context,
+			chunk->line_refs[line_i],
+			context->line_prefixes,
+			(uint32_t) line_prefix_count);
+
+		prefix_i += line_prefix_count;
+	}
+
+	context->stats.bytes_read += (uint64_t) chunk->data_len;
+	context->stats.lines_count += (uint64_t) chunk->line_count;
+	context->stats.prefixes_count += (uint64_t) chunk->prefix_count;
+	context->stats.tokenize_millis += chunk->tokenize_millis;
+
+	// handle the progress callback.
+
+	{
+		float progress = (float) chunk->source_end / (float) pipeline->file_len;
+		uint8_t last_percent = (uint8_t) (context->lastprogress * 100.0);
+		uint8_t percent = (uint8_t) (progress * 100.0);
+
+		if (percent != last_percent) {
+			context->progress_cb(context->progress_cb_context,
+				DEEN_INSTALL_STATE_INDEXING, progress);
+			context->lastprogress = progress;
+		}
+	}
+
+	// a checkpoint is also taken when the indexing is cancelled so that a
+	// later install is able to carry on from exactly here.
+
+	if (context->is_checkpointed
+		&& (chunk->ref + (off_t) chunk->data_len - context->checkpoint_ref >= DEEN_INSTALL_CHECKPOINT_INTERVAL
+			|| context->is_cancelled_cb(context->progress_cb_context))) {
+		deen_install_checkpoint(context, chunk);
+	}
+}
+
+
+// ---------------------------------------------------------------
+// PIPELINE
+// ---------------------------------------------------------------
+
+static void deen_install_chunk_free(deen_install_chunk *chunk) {
+	if (NULL != chunk->data) {
+		free((void *) chunk->data);
+	}
+
+	if (NULL != chunk->line_refs) {
+		free((void *) chunk->line_refs);
+	}
+
+	if (NULL != chunk->line_prefix_counts) {
+		free((void *) chunk->line_prefix_counts);
+	}
+
+	if (NULL != chunk->prefixes) {
+		free((void *) chunk->prefixes);
+	}
+}
+
+
+#ifdef __MINGW32__
+
+/*
+Without threads, each chunk is read, tokenized and written in turn.
+*/
+
+static deen_bool deen_install_pipeline_run(
+	deen_install_pipeline *pipeline,
+	deen_index_context *index_context,
+	size_t workers_count) {
+
+	deen_index_line_context line_context;
+	deen_install_chunk *chunk = &(pipeline->chunks[0]);
+
+	memset(&line_context, 0, sizeof(deen_index_line_context));
+
+	while (!pipeline->is_aborted) {
+		if (!deen_install_read_chunk(pipeline, chunk)) {
+			pipeline->is_error = chunk->is_error;
+			break;
+		}
+
+		deen_install_tokenize_chunk(&line_context, chunk);
+
+		if (chunk->is_error) {
+			pipeline->is_error = DEEN_TRUE;
+		}
+		else {
+			deen_install_write_chunk(index_context, pipeline, chunk);
+		}
+
+		if (pipeline->is_error || index_context->is_cancelled_cb(index_context->progress_cb_context)) {
+			pipeline->is_aborted = DEEN_TRUE;
+		}
+	}
+
+	deen_index_line_context_free(&line_context);
+
+	return !pipeline->is_error;
+}
+
+#else
+
+static void *deen_install_reader_thread(void *data) {
+	deen_install_pipeline *pipeline = (deen_install_pipeline *) data;
+	deen_bool is_finished = DEEN_FALSE;
+
+	while (!is_finished) {
+		deen_install_chunk *chunk;
+		deen_bool has_data;
+
+		pthread_mutex_lock(&pipeline->lock);
+		chunk = &(pipeline->chunks[pipeline->read_seq % pipeline->chunks_count]);
+
+		while (!pipeline->is_aborted && DEEN_INSTALL_CHUNK_EMPTY != chunk->state) {
+			pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+		}
+
+		is_finished = pipeline->is_aborted;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		if (!is_finished) {
+			has_data = deen_install_read_chunk(pipeline, chunk);
+
+			pthread_mutex_lock(&pipeline->lock);
+
+			if (chunk->is_error) {
+				pipeline->is_error = DEEN_TRUE;
+				pipeline->is_aborted = DEEN_TRUE;
+				is_finished = DEEN_TRUE;
+			}
+			else {
+				if (has_data) {
+					chunk->state = DEEN_INSTALL_CHUNK_READ;
+					pipeline->read_seq++;
+				}
+				else {
+					pipeline->read_finished = DEEN_TRUE;
+					is_finished = DEEN_TRUE;
+				}
+			}
+
+			pthread_cond_broadcast(&pipeline->changed);
+			pthread_mutex_unlock(&pipeline->lock);
+		}
+	}
+
+	return NULL;
+}
+
+
+static void *deen_install_worker_thread(void *data) {
+	deen_install_pipeline *pipeline = (deen_install_pipeline *) data;
+	deen_index_line_context line_context;
+
+	memset(&line_context, 0, sizeof(deen_index_line_context));
+
+	pthread_mutex_lock(&pipeline->lock);
+
+	while (DEEN_TRUE) {
+		deen_install_chunk *chunk;
+
+		while (
+			!pipeline->is_aborted &&
+			!pipeline->read_finished &&
+			pipeline->tokenize_seq == pipeline->read_seq) {
+			pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+		}
+
+		if (pipeline->is_aborted || pipeline->tokenize_seq == pipeline->read_seq) {
+			break;
+		}
+
+		chunk = &(pipeline->chunks[pipeline->tokenize_seq % pipeline->chunks_count]);
+		chunk->state = DEEN_INSTALL_CHUNK_TOKENIZING;
+		pipeline->tokenize_seq++;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		deen_install_tokenize_chunk(&line_context, chunk);
+
+		pthread_mutex_lock(&pipeline->lock);
+		chunk->state = DEEN_INSTALL_CHUNK_TOKENIZED;
+		pthread_cond_broadcast(&pipeline->changed);
+	}
+
+	pthread_mutex_unlock(&pipeline->lock);
+
+	deen_index_line_context_free(&line_context);
+
+	return NULL;
+}
+
+
+/*
+The reader and the workers run on their own threads.  The calling thread is
+the writer and it takes the tokenized chunks in the order that they were read.
+*/
+
+static deen_bool deen_install_pipeline_run(
+	deen_install_pipeline *pipeline,
+	deen_index_context *index_context,
+	size_t workers_count) {
+
+	pthread_t reader_thread;
+	pthread_t *worker_threads = (pthread_t *) deen_emalloc(sizeof(pthread_t) * workers_count);
+	size_t workers_started = 0;
+	deen_bool is_reader_started;
+
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->changed, NULL);
+
+	is_reader_started = 0 == pthread_create(&reader_thread, NULL, &deen_install_reader_thread, pipeline);
+
+	if (!is_reader_started) {
+		DEEN_LOG_ERROR0("unable to start the thread for reading the data");
+		pipeline->is_error = DEEN_TRUE;
+		pipeline->is_aborted = DEEN_TRUE;
+	}
+
+	while (!pipeline->is_aborted && workers_started < workers_count) {
+		if (0 != pthread_create(&worker_threads[workers_started], NULL, &deen_install_worker_thread, pipeline)) {
+			DEEN_LOG_ERROR0("unable to start a thread for tokenizing the data");
+			pthread_mutex_lock(&pipeline->lock);
+			pipeline->is_error = DEEN_TRUE;
+			pipeline->is_aborted = DEEN_TRUE;
+			pthread_cond_broadcast(&pipeline->changed);
+			pthread_mutex_unlock(&pipeline->lock);
+		}
+		else {
+			workers_started++;
+		}
+	}
+
+	pthread_mutex_lock(&pipeline->lock);
+
+	while (DEEN_TRUE) {
+		deen_install_chunk *chunk = &(pipeline->chunks[pipeline->write_seq % pipeline->chunks_count]);
+
+		while (
+			!pipeline->is_aborted &&
+			!(pipeline->read_finished && pipeline->write_seq == pipeline->read_seq) &&
+			!(pipeline->write_seq < pipeline->read_seq && DEEN_INSTALL_CHUNK_TOKENIZED == chunk->state)) {
+			pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+		}
+
+		if (pipeline->is_aborted || pipeline->write_seq == pipeline->read_seq) {
+			break;
+		}
+
+		pthread_mutex_unlock(&pipeline->lock);
+
+		if (!chunk->is_error) {
+			deen_install_write_chunk(index_context, pipeline, chunk);
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+
+		if (chunk->is_error) {
+			pipeline->is_error = DEEN_TRUE;
+			pipeline->is_aborted = DEEN_TRUE;
+		}
+		else {
+			if (index_context->is_cancelled_cb(index_context->progress_cb_context)) {
+				pipeline->is_aborted = DEEN_TRUE;
+			}
+		}
+
+		chunk->state = DEEN_INSTALL_CHUNK_EMPTY;
+		pipeline->write_seq++;
+		pthread_cond_broadcast(&pipeline->changed);
+	}
+
+	pthread_mutex_unlock(&pipeline->lock);
+
+	if (is_reader_started) {
+		pthread_join(reader_thread, NULL);
+	}
+
+	while (workers_started > 0) {
+		workers_started--;
+		pthread_join(worker_threads[workers_started], NULL);
+	}
+
+	free((void *) worker_threads);
+	pthread_cond_destroy(&pipeline->changed);
+	pthread_mutex_destroy(&pipeline->lock);
+
+	return !pipeline->is_error;
+}
+
+#endif
+
+
+static size_t deen_install_workers_count() {
+	long processors = 1;
+
+#if !defined(__MINGW32__) && defined(_SC_NPROCESSORS_ONLN)
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if (processors < 1) {
+		return 1;
+	}
+
+	if (processors > DEEN_INSTALL_WORKERS_MAX) {
+		return DEEN_INSTALL_WORKERS_MAX;
+	}
+
+	return (size_t) processors;
+}
+
+
+/*
+Moves past the start of the data that was indexed before the indexing stopped.
+*/
+
+static deen_bool deen_install_skip_data(deen_install_pipeline *pipeline, off_t len) {
+	uint8_t *buffer;
+	deen_bool result = DEEN_TRUE;
+
+	if (NULL != pipeline->mapped) {
+		return len <= (off_t) pipeline->mapped_len;
+	}
+
+	if (NULL == pipeline->gz_data) {
+		return len == lseek(pipeline->fd_data, len, SEEK_SET);
+	}
+
+	buffer = (uint8_t *) deen_emalloc(DEEN_SIZE_INFLATE_BUFFER);
+
+	while (result && len > 0) {
+		ssize_t actuallyread = deen_install_read_data(
+			pipeline, buffer, len < DEEN_SIZE_INFLATE_BUFFER ? (size_t) len : DEEN_SIZE_INFLATE_BUFFER);
+
+		if (actuallyread <= 0) {
+			result = DEEN_FALSE;
+		}
+		else {
+			len -= (off_t) actuallyread;
+		}
+	}
+
+	free((void *) buffer);
+
+	return result;
+}
+
+
+/*
+Indexes the data in the file into the index.  If the file is compressed then it
+is inflated as it is read.  If 'fd_tee' is not -1 then the data is also copied
+into that file as it is read.  The refs of the lines start from 'ref_base' so
+that the data can be added to the end of data that is already installed.  If
+there is a checkpoint to 'resume' from then the data before the checkpoint is
+skipped.  Returns false if there was a problem.  If the indexing was cancelled
+then it will return true, but the index will not be complete.
+*/
+
+static deen_bool deen_install_index_data(
+	int fd_data,
+	deen_bool is_compressed,
+	int fd_tee,
+	off_t ref_base,
+	const deen_index_checkpoint *resume,
+	deen_index_context *index_context,
+	deen_index_metadata *metadata) {
+
+	deen_install_pipeline pipeline;
+	size_t workers_count = deen_install_workers_count();
+	deen_bool result = DEEN_TRUE;
+	size_t i;
+
+	memset(&pipeline, 0, sizeof(deen_install_pipeline));
+	pipeline.fd_data = fd_data;
+	pipeline.fd_tee = fd_tee;
+	pipeline.ref_base = ref_base;
+	pipeline.next_ref = ref_base;
+	pipeline.tee_len = ref_base;
+	pipeline.content_hash = DEEN_HASH_INITIAL;
+	pipeline.file_len = lseek(fd_data, 0, SEEK_END);
+
+	if (-1 == pipeline.file_len || -1 == lseek(fd_data, 0, SEEK_SET)) {
+		DEEN_LOG_ERROR0("unable to obtain the length of the file to be processed");
+		return DEEN_FALSE;
+	}
+
+	if (is_compressed) {
+		pipeline.gz_data = deen_install_open_source_gz(fd_data);
+
+		if (NULL == pipeline.gz_data) {
+			return DEEN_FALSE;
+		}
+	}
+	else {
+		pipeline.mapped = deen_map_file(fd_data, &(pipeline.mapped_len), DEEN_TRUE);
+	}
+
+	if (NULL != resume) {
+		if (!deen_install_skip_data(&pipeline, (off_t) resume->ref)) {
+			DEEN_LOG_ERROR1("unable to skip to the checkpoint at %llu", (unsigned long long) resume->ref);
+			result = DEEN_FALSE;
+		}
+		else {
+			pipeline.next_ref += (off_t) resume->ref;
+			pipeline.tee_len = pipeline.next_ref;
+			pipeline.content_hash = resume->source_hash;
+		}
+	}
+
+	// enough chunks that the reader and the writer can work while each of the
+	// workers is busy.
+
+	pipeline.chunks_count = workers_count * 2 + 2;
+	pipeline.chunks = (deen_install_chunk *) deen_emalloc(sizeof(deen_install_chunk) * pipeline.chunks_count);
+	memset(pipeline.chunks, 0, sizeof(deen_install_chunk) * pipeline.chunks_count);
+
+	if (result) {
+		DEEN_LOG_INFO1("indexing with %u workers", (unsigned) workers_count);
+		result = deen_install_pipeline_run(&pipeline, index_context, workers_count);
+	}
+
+	if (result && -1 != fd_tee && !pipeline.is_aborted && pipeline.tee_len != pipeline.next_ref) {
+		DEEN_LOG_ERROR0("the copy of the data is incomplete");
+		result = DEEN_FALSE;
+	}
+
+	index_context->stats.read_millis += pipeline.read_millis;
+	metadata->source_hash = pipeline.content_hash;
+	metadata->source_size = (uint64_t) (pipeline.next_ref - ref_base);
+	metadata->indexing_depth = DEEN_INDEXING_DEPTH;
+	metadata->format_version = DEEN_INDEX_FORMAT_VERSION;
+
+	for (i = 0; i < pipeline.chunks_count; i++) {
+		deen_install_chunk_free(&(pipeline.chunks[i]));
+	}
+
+	free((void *) pipeline.chunks);
+	deen_unmap_file(pipeline.mapped, pipeline.mapped_len);
+
+	if (NULL != pipeline.gz_data) {
+		gzclose(pipeline.gz_data);
+	}
+
+	if (NULL != pipeline.carry) {
+		free((void *) pipeline.carry);
+	}
+
+	return result;
+}
+
+
+// ---------------------------------------------------------------
+// STATS
+// ---------------------------------------------------------------
+
+/*
+Adds the measurements of indexing into one part of an install to those of the
+whole install.
+*/
+
+static void deen_install_stats_add(
+	deen_install_stats *stats,
+	const deen_install_stats *index_stats,
+	const deen_index_add_context *index_add_context) {
+
+	stats->read_millis += index_stats->read_millis;
+	stats->tokenize_millis += index_stats->tokenize_millis;
+	stats->bytes_read += index_stats->bytes_read;
+	stats->lines_count += index_stats->lines_count;
+	stats->prefixes_count += index_stats->prefixes_count;
+
+	stats->sort_millis += index_add_context->sort_millis;
+	stats->spill_millis += index_add_context->spill_millis;
+	stats->merge_millis += index_add_context->merge_millis;
+	stats->load_millis += index_add_context->load_millis;
+	stats->create_indexes_millis += index_add_context->create_indexes_millis;
+	stats->index_rows_count += (uint64_t) index_add_context->prefixes_loaded_count;
+}
+
+
+static uint64_t deen_install_file_size(const char *path) {
+	struct stat s;
+
+	if (0 != stat(path, &s)) {
+		return 0;
+	}
+
+	return (uint64_t) s.st_size;
+}
+
+
+/*
+Measures what is installed once an install has finished.  The peak resident
+memory is in bytes.
+*/
+
+static void deen_install_stats_finish(
+	deen_install_stats *stats,
+	const char *deen_root_dir,
+	deen_millis start_ms) {
+
+	char *path;
+
+	stats->elapsed_millis = deen_millis_since_epoc() - start_ms;
+
+	path = deen_data_path(deen_root_dir);
+	stats->data_size = deen_install_file_size(path);
+	free((void *) path);
+
+	path = deen_index_path(deen_root_dir);
+	stats->index_size = deen_install_file_size(path);
+	free((void *) path);
+
+	path = deen_map_index_path(deen_root_dir);
+	stats->map_index_size = deen_install_file_size(path);
+	free((void *) path);
+
+#ifndef __MINGW32__
+	{
+		struct rusage usage;
+
+		if (0 == getrusage(RUSAGE_SELF, &usage)) {
+#ifdef __APPLE__
+			stats->peak_rss = (uint64_t) usage.ru_maxrss;
+#else
+			stats->peak_rss = (uint64_t) usage.ru_maxrss * 1024;
+#endif
+		}
+	}
+#endif
+}
+
+
+// ---------------------------------------------------------------
+// INSTALLED DATA
+// ---------------------------------------------------------------
+
+static void deen_install_installed_close(deen_install_installed *installed) {
+	if (NULL != installed->data) {
+		if (installed->is_data_mapped) {
+			deen_unmap_file(installed->data, installed->data_len);
+		}
+		else {
+			free((void *) installed->data);
+		}
+	}
+
+	if (NULL != installed->segments) {
+		deen_index_segments_free(installed->segments);
+	}
+
+	memset(installed, 0, sizeof(deen_install_installed));
+}
+
+
+/*
+Reads the whole of the file into memory for where it is not able to be mapped.
+Returns NULL if there was a problem.
+*/
+
+static uint8_t *deen_install_read_file(int fd, size_t *len) {
+	struct stat fd_stat;
+	uint8_t *c;
+	size_t c_len = 0;
+
+	if (0 != fstat(fd, &fd_stat)) {
+		return NULL;
+	}
+
+	c = (uint8_t *) deen_emalloc((size_t) fd_stat.st_size + 1);
+
+	while (c_len < (size_t) fd_stat.st_size) {
+		ssize_t actuallyread = read(fd, &c[c_len], (size_t) fd_stat.st_size - c_len);
+
+		if (actuallyread <= 0) {
+			free((void *) c);
+			return NULL;
+		}
+
+		c_len += (size_t) actuallyread;
+	}
+
+	*len = c_len;
+	return c;
+}
+
+
+/*
+Opens what is installed so that a new install is able to build on it.  Returns
+false if nothing is installed or if the install was built differently to how it
+would be built now; in either case the new install has to start from nothing.
+*/
+
+static deen_bool deen_install_installed_open(
+	const char *deen_root_dir,
+	deen_install_installed *installed) {
+
+	char *data_path = deen_data_path(deen_root_dir);
+	char *index_path = deen_index_path(deen_root_dir);
+	deen_bool result = DEEN_FALSE;
+	sqlite3 *db = NULL;
+
+	memset(installed, 0, sizeof(deen_install_installed));
+
+	if (deen_exists_fileobject(data_path)
+		&& deen_exists_fileobject(index_path)
+		&& SQLITE_OK == sqlite3_open_v2(index_path, &db, SQLITE_OPEN_READONLY, NULL)
+		&& deen_index_read_metadata(db, &(installed->metadata))
+		&& deen_index_metadata_is_current(&(installed->metadata))
+		&& NULL != (installed->segments = deen_index_segments_read(db))) {
+
+		int fd = open(data_path, O_RDONLY|DEEN_INSTALL_O_BINARY);
+
+		if (-1 != fd) {
+			installed->data = deen_map_file(fd, &(installed->data_len), DEEN_TRUE);
+			installed->is_data_mapped = NULL != installed->data;
+
+			if (!installed->is_data_mapped) {
+				installed->data = deen_install_read_file(fd, &(installed->data_len));
+			}
+
+			result = NULL != installed->data;
+			close(fd);
+		}
+	}
+
+	if (NULL != db) {
+		sqlite3_close_v2(db);
+	}
+
+	if (!result) {
+		deen_install_installed_close(installed);
+	}
+
+	free((void *) data_path);
+	free((void *) index_path);
+
+	return result;
+}
+
+
+static deen_segment_kind deen_install_installed_line_kind(
+	const deen_install_installed *installed,
+	off_t ref) {
+
+	size_t i;
+
+	for (i = 0; i < installed->segments->segments_count; i++) {
+		const deen_index_segment *segment = &(installed->segments->segments[i]);
+
+		if (DEEN_SEGMENT_KIND_LOCAL == segment->kind
+			&& ref >= segment->ref_start
+			&& ref < segment->ref_end) {
+			return DEEN_SEGMENT_KIND_LOCAL;
+		}
+	}
+
+	return DEEN_SEGMENT_KIND_SOURCE;
+}
+
+
+/*
+Calls back with each of the installed lines of the kind that has not been
+deleted.  The length of the line does not include the newline.  Returns false
+if the callback returned false.
+*/
+
+static deen_bool deen_install_installed_for_each_live_line(
+	const deen_install_installed *installed,
+	deen_segment_kind kind,
+	deen_bool (*line_callback)(const uint8_t *line, size_t len, off_t ref, void *context),
+	void *context) {
+
+	size_t offset = 0;
+
+	while (offset < installed->data_len) {
+		const uint8_t *newline = (const uint8_t *) memchr(
+			&(installed->data[offset]), '\n', installed->data_len - offset);
+		size_t end = NULL == newline ? installed->data_len : (size_t) (newline - installed->data);
+		off_t ref = (off_t) offset;
+
+		if (end > offset
+			&& kind == deen_install_installed_line_kind(installed, ref)
+			&& !deen_index_segments_is_tombstone(installed->segments, ref)
+			&& !line_callback(&(installed->data[offset]), end - offset, ref, context)) {
+			return DEEN_FALSE;
+		}
+
+		offset = end + 1;
+	}
+
+	return DEEN_TRUE;
+}
+
+
+static deen_bool deen_install_add_line_to_delta(
+	const uint8_t *line, size_t len, off_t ref, void *context) {
+	deen_delta_add_installed_line((deen_delta *) context, ref, len);
+	return DEEN_TRUE;
+}
+
+
+static deen_bool deen_install_write_line(
+	const uint8_t *line, size_t len, off_t ref, void *context) {
+	FILE *file = (FILE *) context;
+	return len == fwrite(line, 1, len, file) && EOF != fputc('\n', file);
+}
+
+
+/*
+Writes the installed lines that the user added to a temporary file so that they
+can be carried over into a new install.  Returns NULL if there was a problem.
+*/
+
+static FILE *deen_install_installed_local_lines(
+	const deen_install_installed *installed,
+	off_t *lines_len) {
+
+	FILE *lines = tmpfile();
+	long len = -1;
+
+	if (NULL != lines
+		&& deen_install_installed_for_each_live_line(
+			installed, DEEN_SEGMENT_KIND_LOCAL, &deen_install_write_line, lines)) {
+		len = ftell(lines);
+	}
+
+	if (-1 == len) {
+		DEEN_LOG_ERROR0("unable to write out the lines that were added to the data");
+
+		if (NULL != lines) {
+			fclose(lines);
+		}
+
+		return NULL;
+	}
+
+	*lines_len = (off_t) len;
+	return lines;
+}
+
+
+/*
+Copies the lines from the file into a temporary file; making sure that the last
+line ends with a newline.  Returns NULL if there was a problem.
+*/
+
+static FILE *deen_install_read_lines(const char *filename, off_t *lines_len) {
+	int fd = open(filename, O_RDONLY|DEEN_INSTALL_O_BINARY);
+	FILE *lines = NULL;
+	uint8_t *buffer;
+	ssize_t actuallyread = 0;
+	uint8_t last = '\n';
+	deen_bool result;
+
+	*lines_len = 0;
+
+	if (-1 == fd) {
+		DEEN_LOG_ERROR1("unable to open the file of entries %s", filename);
+		return NULL;
+	}
+
+	buffer = (uint8_t *) deen_emalloc(DEEN_SIZE_COPY_BUFFER);
+	result = NULL != (lines = tmpfile());
+
+	while (result && 0 < (actuallyread = read(fd, buffer, DEEN_SIZE_COPY_BUFFER))) {
+		result = (size_t) actuallyread == fwrite(buffer, 1, (size_t) actuallyread, lines);
+		last = buffer[actuallyread - 1];
+		*lines_len += (off_t) actuallyread;
+	}
+
+	if (-1 == actuallyread) {
+		result = DEEN_FALSE;
+	}
+
+	if (result && '\n' != last) {
+		result = EOF != fputc('\n', lines);
+		(*lines_len)++;
+	}
+
+	free((void *) buffer);
+	close(fd);
+
+	if (!result) {
+		DEEN_LOG_ERROR1("unable to read the entries from %s", filename);
+
+		if (NULL != lines) {
+			fclose(lines);
+		}
+
+		return NULL;
+	}
+
+	return lines;
+}
+
+// ---------------------------------------------------------------
+// DELTA
+// ---------------------------------------------------------------
+
+static void deen_install_delta_plan_free(deen_install_delta_plan *plan) {
+	if (NULL != plan->added) {
+		fclose(plan->added);
+	}
+
+	if (NULL != plan->deleted_refs) {
+		free((void *) plan->deleted_refs);
+	}
+
+	memset(plan, 0, sizeof(deen_install_delta_plan));
+}
+
+
+static deen_bool deen_install_plan_delta_line(
+	deen_delta *delta,
+	deen_install_delta_plan *plan,
+	const uint8_t *line,
+	size_t len) {
+
+	if (0 == len) {
+		return DEEN_TRUE;
+	}
+
+	plan->line_count++;
+
+	if (deen_delta_match_line(delta, line, len)) {
+		return DEEN_TRUE;
+	}
+
+	plan->added_count++;
+	plan->added_len += (off_t) (len + 1);
+
+	return len == fwrite(line, 1, len, plan->added) && EOF != fputc('\n', plan->added);
+}
+
+
+/*
+Reads the new version of the data a line at a time and matches each line with
+a line that is installed.  The lines that do not match are written to a
+temporary file and the installed lines that were not matched are deleted.  The
+data is hashed on the way through in the same way as the indexing would.
+Returns false if there was a problem.
+*/
+
+static deen_bool deen_install_plan_delta(
+	const deen_install_installed *installed,
+	int fd_data,
+	deen_bool is_compressed,
+	deen_install_delta_plan *plan) {
+
+	deen_delta *delta = deen_delta_create(installed->data, installed->data_len);
+	size_t buffer_allocated = DEEN_SIZE_COPY_BUFFER;
+	uint8_t *buffer = (uint8_t *) deen_emalloc(buffer_allocated);
+	size_t buffer_len = 0;
+	ssize_t actuallyread = 1;
+	gzFile gz_data = NULL;
+	deen_bool result = DEEN_TRUE;
+
+	memset(plan, 0, sizeof(deen_install_delta_plan));
+	plan->source_hash = DEEN_HASH_INITIAL;
+
+	deen_install_installed_for_each_live_line(
+		installed, DEEN_SEGMENT_KIND_SOURCE, &deen_install_add_line_to_delta, delta);
+
+	if (NULL == (plan->added = tmpfile())) {
+		DEEN_LOG_ERROR0("unable to create a file for the lines that were added");
+		result = DEEN_FALSE;
+	}
+
+	if (result && -1 == lseek(fd_data, 0, SEEK_SET)) {
+		result = DEEN_FALSE;
+	}
+
+	if (result && is_compressed && NULL == (gz_data = deen_install_open_source_gz(fd_data))) {
+		result = DEEN_FALSE;
+	}
+
+	while (result && 0 != actuallyread) {
+		const uint8_t *newline;
+		size_t line_start = 0;
+
+		if (buffer_len == buffer_allocated) {
+			buffer_allocated *= 2;
+			buffer = (uint8_t *) deen_erealloc(buffer, buffer_allocated);
+		}
+
+		actuallyread = deen_install_read_source(
+			fd_data, gz_data, &buffer[buffer_len], buffer_allocated - buffer_len);
+
+		if (-1 == actuallyread) {
+			result = DEEN_FALSE;
+		}
+		else if (0 == actuallyread) {
+			// the last line may not have a newline.
+			result = deen_install_plan_delta_line(delta, plan, buffer, buffer_len);
+		}
+		else {
+			plan->source_hash = deen_hash(plan->source_hash, &buffer[buffer_len], (size_t) actuallyread);
+			plan->source_size += (uint64_t) actuallyread;
+			buffer_len += (size_t) actuallyread;
+
+			while (result && NULL != (newline = (const uint8_t *) memchr(
+				&buffer[line_start], '\n', buffer_len - line_start))) {
+				size_t line_end = (size_t) (newline - buffer);
+				result = deen_install_plan_delta_line(delta, plan, &buffer[line_start], line_end - line_start);
+				line_start = line_end + 1;
+			}
+
+			memmove(buffer, &buffer[line_start], buffer_len - line_start);
+			buffer_len -= line_start;
+		}
+	}
+
+	if (result && (0 != fflush(plan->added) || 0 != fseek(plan->added, 0, SEEK_SET))) {
+		result = DEEN_FALSE;
+	}
+
+	if (result) {
+		plan->deleted_refs = deen_delta_unmatched_refs(delta, &(plan->deleted_count));
+	}
+	else {
+		DEEN_LOG_ERROR0("unable to compare the data with the installed data");
+	}
+
+	if (NULL != gz_data) {
+		gzclose(gz_data);
+	}
+
+	free((void *) buffer);
+	deen_delta_free(delta);
+
+	return result;
+}
+
+
+/*
+A delta is only worth adding if a small part of the data has changed; otherwise
+the index is better built again from the start.
+*/
+
+static deen_bool deen_install_delta_plan_is_small(const deen_install_delta_plan *plan) {
+	return (plan->added_count + plan->deleted_count) * 100
+		<= plan->line_count * DEEN_INSTALL_DELTA_MAX_PERCENT;
+}
+
+// ---------------------------------------------------------------
+// SHADOW INSTALL
+// ---------------------------------------------------------------
+
+/*
+Creates the directory in which the new install is built.  Returns false if
+there was a problem.
+*/
+
+static deen_bool deen_install_shadow_create(
+	const char *deen_root_dir,
+	deen_install_shadow *shadow) {
+
+	memset(shadow, 0, sizeof(deen_install_shadow));
+	shadow->fd_data = -1;
+	shadow->dir = deen_install_init(deen_root_dir);
+
+	if (NULL == shadow->dir) {
+		return DEEN_FALSE;
+	}
+
+	shadow->data_path = deen_data_path(shadow->dir);
+	shadow->index_path = deen_index_path(shadow->dir);
+	shadow->map_index_path = deen_map_index_path(shadow->dir);
+
+	return DEEN_TRUE;
+}
+
+
+/*
+Opens the directory in which a new install that is able to be resumed is built.
+The directory has a fixed name so that an install that stopped before it was
+complete is found again.  Returns false if there was a problem.
+*/
+
+static deen_bool deen_install_shadow_create_resumable(
+	const char *deen_root_dir,
+	deen_install_shadow *shadow) {
+
+	memset(shadow, 0, sizeof(deen_install_shadow));
+	shadow->fd_data = -1;
+	shadow->is_resumable = DEEN_TRUE;
+
+	if (!deen_install_init_root_dir(deen_root_dir)) {
+		return DEEN_FALSE;
+	}
+
+	shadow->dir = (char *) deen_emalloc(strlen(deen_root_dir) + strlen(DEEN_LEAF_RESUME_INDEX) + 2);
+	sprintf(shadow->dir, "%s%s%s", deen_root_dir, DEEN_FILE_SEP, DEEN_LEAF_RESUME_INDEX);
+
+	if (!deen_exists_fileobject(shadow->dir) && 0 != deen_install_mkdir(shadow->dir)) {
+		DEEN_LOG_ERROR1("failed to create the directory for the new install; %s", shadow->dir);
+		free((void *) shadow->dir);
+		shadow->dir = NULL;
+		return DEEN_FALSE;
+	}
+
+	shadow->data_path = deen_data_path(shadow->dir);
+	shadow->index_path = deen_index_path(shadow->dir);
+	shadow->map_index_path = deen_map_index_path(shadow->dir);
+
+	return DEEN_TRUE;
+}
+
+
+/*
+Looks for a checkpoint left by an earlier install that stopped.  It is only
+used if the data up to the checkpoint is the same as the data that is being
+installed now.  Returns true if the install is able to carry on from the
+checkpoint; the data of the new install is then open at the checkpoint.
+Otherwise anything that was left behind is deleted.
+*/
+
+static deen_bool deen_install_shadow_resume(
+	deen_install_shadow *shadow,
+	int fd_data,
+	deen_bool is_compressed,
+	deen_index_checkpoint *checkpoint) {
+
+	deen_bool result = DEEN_FALSE;
+
+	if (deen_exists_fileobject(shadow->data_path)
+		&& deen_exists_fileobject(shadow->index_path)
+		&& SQLITE_OK == sqlite3_open_v2(shadow->index_path, &(shadow->db), SQLITE_OPEN_READWRITE, NULL)
+		&& deen_index_read_checkpoint(shadow->db, checkpoint)
+		&& DEEN_INDEX_FORMAT_VERSION == checkpoint->format_version) {
+
+		uint64_t hash;
+		uint64_t size;
+
+		if (!deen_install_hash_data(fd_data, is_compressed, checkpoint->ref, &hash, &size)
+			|| size != checkpoint->ref
+			|| hash != checkpoint->source_hash) {
+			DEEN_LOG_INFO0("the data differs from that of the install that stopped; will start again");
+		}
+		else {
+
+			// the data is only readable once it is installed so it has to be
+			// made writable again to carry on adding to it.
+
+			chmod(shadow->data_path, DEEN_INSTALL_DATA_MODE|S_IWUSR);
+			shadow->fd_data = open(shadow->data_path, O_RDWR|DEEN_INSTALL_O_BINARY);
+			result = -1 != shadow->fd_data
+				&& 0 == ftruncate(shadow->fd_data, (off_t) checkpoint->ref)
+				&& (off_t) checkpoint->ref == lseek(shadow->fd_data, 0, SEEK_END);
+			chmod(shadow->data_path, DEEN_INSTALL_DATA_MODE);
+		}
+	}
+
+	if (result) {
+		DEEN_LOG_INFO1("will carry on from the checkpoint at %llu", (unsigned long long) checkpoint->ref);
+	}
+	else {
+		if (-1 != shadow->fd_data) {
+			close(shadow->fd_data);
+			shadow->fd_data = -1;
+		}
+
+		if (NULL != shadow->db) {
+			sqlite3_close_v2(shadow->db);
+			shadow->db = NULL;
+		}
+
+		deen_remove_fileobject(shadow->data_path);
+		deen_remove_fileobject(shadow->index_path);
+		deen_remove_fileobject(shadow->map_index_path);
+		deen_index_remove_runs(shadow->dir, 0);
+	}
+
+	return result;
+}
+
+
+/*
+Creates an empty data file and index database for a new install that is built
+from the start.
+*/
+
+static deen_bool deen_install_shadow_create_files(deen_install_shadow *shadow) {
+	shadow->fd_data = open(
+		shadow->data_path,
+		O_RDWR|O_CREAT|O_TRUNC|DEEN_INSTALL_O_BINARY,
+		DEEN_INSTALL_DATA_MODE);
+
+	if (-1 == shadow->fd_data) {
+		DEEN_LOG_ERROR1("unable to open the output data file %s", shadow->data_path);
+		return DEEN_FALSE;
+	}
+
+	DEEN_LOG_INFO1("destination opened for copy to install location; %s", shadow->data_path);
+
+	if (SQLITE_OK != sqlite3_open_v2(
+		shadow->index_path,
+		&(shadow->db),
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+		NULL)) {
+
+		DEEN_LOG_ERROR2("unable to open the sqllite3 database; %s (%s)", shadow->index_path, sqlite3_errmsg(shadow->db));
+		return DEEN_FALSE;
+	}
+
+	deen_index_init(shadow->db);
+	DEEN_LOG_TRACE0("did initialize the index database");
+
+	return DEEN_TRUE;
+}
+
+
+/*
+Copies an installed file into the new install.  The copy shares the storage
+with the installed file where the file system allows for it.  Returns the file
+descriptor of the copy positioned at its end or -1 if there was a problem.
+*/
+
+static int deen_install_copy_file(const char *from_path, const char *to_path, mode_t mode) {
+	int fd_from = open(from_path, O_RDONLY|DEEN_INSTALL_O_BINARY);
+	int fd_to = -1;
+	deen_bool result = -1 != fd_from;
+
+	if (result) {
+		fd_to = open(to_path, O_RDWR|O_CREAT|O_TRUNC|DEEN_INSTALL_O_BINARY, mode);
+		result = -1 != fd_to;
+	}
+
+	if (result && !deen_install_clone_data(fd_from, fd_to)) {
+		uint8_t *buffer = (uint8_t *) deen_emalloc(DEEN_SIZE_COPY_BUFFER);
+		ssize_t actuallyread = 0;
+
+		while (result && 0 < (actuallyread = read(fd_from, buffer, DEEN_SIZE_COPY_BUFFER))) {
+			result = deen_install_write_fully(fd_to, buffer, (size_t) actuallyread);
+		}
+
+		if (-1 == actuallyread) {
+			result = DEEN_FALSE;
+		}
+
+		free((void *) buffer);
+	}
+
+	if (-1 != fd_from) {
+		close(fd_from);
+	}
+
+	if (result && -1 == lseek(fd_to, 0, SEEK_END)) {
+		result = DEEN_FALSE;
+	}
+
+	if (!result) {
+		DEEN_LOG_ERROR2("unable to copy %s --> %s", from_path, to_path);
+
+		if (-1 != fd_to) {
+			close(fd_to);
+		}
+
+		return -1;
+	}
+
+	return fd_to;
+}
+
+
+/*
+Copies what is installed into the new install so that delta segments can be
+added to it.
+*/
+
+static deen_bool deen_install_shadow_copy_installed(
+	const char *deen_root_dir,
+	deen_install_shadow *shadow) {
+
+	char *data_path = deen_data_path(deen_root_dir);
+	char *index_path = deen_index_path(deen_root_dir);
+	char *map_index_path = deen_map_index_path(deen_root_dir);
+	deen_bool result;
+	int fd;
+
+	shadow->fd_data = deen_install_copy_file(data_path, shadow->data_path, DEEN_INSTALL_DATA_MODE);
+	result = -1 != shadow->fd_data;
+
+	if (result) {
+		fd = deen_install_copy_file(index_path, shadow->index_path, DEEN_INSTALL_INDEX_MODE);
+		result = -1 != fd;
+
+		if (result) {
+			close(fd);
+		}
+	}
+
+	// the map index covers the base of the index which a delta does not
+	// change.  It is copied rather than linked so that moving the new install
+	// into place works in the same way for each of the files.
+
+	if (result && deen_exists_fileobject(map_index_path)) {
+		fd = deen_install_copy_file(map_index_path, shadow->map_index_path, DEEN_INSTALL_INDEX_MODE);
+		result = -1 != fd;
+
+		if (result) {
+			close(fd);
+		}
+	}
+
+	if (result && SQLITE_OK != sqlite3_open_v2(
+		shadow->index_path,
+		&(shadow->db),
+		SQLITE_OPEN_READWRITE,
+		NULL)) {
+
+		DEEN_LOG_ERROR2("unable to open the sqllite3 database; %s (%s)", shadow->index_path, sqlite3_errmsg(shadow->db));
+		result = DEEN_FALSE;
+	}
+
+	free((void *) data_path);
+	free((void *) index_path);
+	free((void *) map_index_path);
+
+	return result;
+}
+
+
+/*
+Indexes the data into the new install.  If the 'segment_id' is zero then the
+data is indexed as the base of the index along with the map index; otherwise
+the data is indexed into that delta segment.  If 'is_tee' then the data is
+also added to the end of the data of the new install as it is indexed.  The
+indexing of the base of a new install that is able to be resumed takes
+checkpoints and carries on from the checkpoint to 'resume' from if there is
+one.  Returns false if there was a problem.
+*/
+
+static deen_bool deen_install_load(
+	deen_install_shadow *shadow,
+	uint32_t segment_id,
+	int fd_source,
+	deen_bool is_compressed,
+	deen_bool is_tee,
+	off_t ref_base,
+	const deen_index_checkpoint *resume,
+	deen_index_metadata *metadata,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb) {
+
+	time_t secs_before = deen_seconds_since_epoc();
+	deen_bool is_error = DEEN_FALSE;
+	deen_index_context index_context;
+	deen_map_index_writer *map_index_writer = NULL;
+
+	if (0 == segment_id) {
+		map_index_writer = deen_map_index_writer_create(shadow->map_index_path);
+
+		if (NULL == map_index_writer) {
+			return DEEN_FALSE;
+		}
+	}
+
+	index_context.index_add_context = deen_index_add_context_create(shadow->db);
+	deen_index_add_set_map_index_writer(index_context.index_add_context, map_index_writer);
+	deen_index_add_set_segment(index_context.index_add_context, segment_id);
+	deen_index_add_set_shards(index_context.index_add_context, deen_install_workers_count());
+	index_context.lastprogress = -1.0f;
+	index_context.progress_cb_context = process_cb_context;
+	index_context.progress_cb = progress_cb;
+	index_context.is_cancelled_cb = is_cancelled_cb;
+	index_context.line_prefixes = NULL;
+	index_context.line_prefixes_allocated = 0;
+	index_context.is_checkpointed = shadow->is_resumable && 0 == segment_id;
+	index_context.checkpoint_ref = NULL == resume ? 0 : (off_t) resume->ref;
+	index_context.fd_checkpoint_data = shadow->fd_data;
+	memset(&(index_context.stats), 0, sizeof(deen_install_stats));
+
+	if (index_context.is_checkpointed) {
+		deen_index_add_set_runs_dir(index_context.index_add_context, shadow->dir);
+
+		if (NULL != resume && !deen_index_add_resume(index_context.index_add_context, resume->runs_count)) {
+			is_error = DEEN_TRUE;
+		}
+	}
+
+	if (!is_error && !deen_install_index_data(
+		fd_source,
+		is_compressed,
+		is_tee ? shadow->fd_data : -1,
+		ref_base,
+		resume,
+		&index_context,
+		metadata)) {
+		DEEN_LOG_ERROR0("failure to process the data");
+		is_error = DEEN_TRUE;
+	}
+
+	// load everything that was gathered into the database in one go.
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		deen_transaction_begin(shadow->db);
+		deen_index_add_finish(index_context.index_add_context);
+		deen_transaction_commit(shadow->db);
+
+		if (NULL != map_index_writer && !deen_map_index_writer_finish(map_index_writer)) {
+			is_error = DEEN_TRUE;
+		}
+	}
+
+	deen_map_index_writer_free(map_index_writer);
+
+	if (!is_error && NULL != shadow->stats) {
+		deen_install_stats_add(shadow->stats, &(index_context.stats), index_context.index_add_context);
+	}
+
+	if (!is_error) {
+		DEEN_LOG_INFO1("indexed in %u seconds", deen_seconds_since_epoc() - secs_before);
+	}
+
+	deen_index_add_context_free(index_context.index_add_context);
+
+	if (NULL != index_context.line_prefixes) {
+		free((void *) index_context.line_prefixes);
+	}
+
+	return !is_error;
+}
+
+
+/*
+Adds the lines to the end of the data of the new install and indexes them as a
+delta segment of the kind.  Returns false if there was a problem.
+*/
+
+static deen_bool deen_install_load_segment(
+	deen_install_shadow *shadow,
+	deen_segment_kind kind,
+	FILE *lines,
+	off_t lines_len,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb) {
+
+	deen_index_metadata segment_metadata;
+	uint32_t segment_id;
+	uint8_t last = '\n';
+	off_t ref_base;
+
+	if (0 == lines_len) {
+		return DEEN_TRUE;
+	}
+
+	// the lines have to start on a line of their own.
+
+	ref_base = lseek(shadow->fd_data, 0, SEEK_END);
+
+	if (ref_base > 0
+		&& (-1 == lseek(shadow->fd_data, -1, SEEK_END) || 1 != read(shadow->fd_data, &last, 1))) {
+		ref_base = -1;
+	}
+
+	if (-1 != ref_base && '\n' != last) {
+		if (deen_install_write_fully(shadow->fd_data, (const uint8_t *) "\n", 1)) {
+			ref_base++;
+		}
+		else {
+			ref_base = -1;
+		}
+	}
+
+	if (-1 == ref_base || 0 != fflush(lines) || 0 != fseek(lines, 0, SEEK_SET)) {
+		DEEN_LOG_ERROR0("unable to add the lines to the end of the data");
+		return DEEN_FALSE;
+	}
+
+	segment_id = deen_index_add_segment(shadow->db, kind, ref_base, ref_base + lines_len);
+	DEEN_LOG_INFO2("will index %lld bytes of lines into delta segment %u", (long long) lines_len, segment_id);
+
+	return deen_install_load(
+		shadow, segment_id, fileno(lines), DEEN_FALSE, DEEN_TRUE, ref_base, NULL, &segment_metadata,
+		process_cb_context, progress_cb, is_cancelled_cb);
+}
+
+
+/*
+If the new install is complete then it is moved into place; otherwise its files
+are deleted and what was installed remains.  The files of a new install that
+is able to be resumed are kept if it was stopped without an error.  Returns
+false if a complete new install was not able to be moved into place.
+*/
+
+static deen_bool deen_install_shadow_finish(
+	const char *deen_root_dir,
+	deen_install_shadow *shadow,
+	deen_bool is_error,
+	deen_bool is_cancelled) {
+
+	deen_bool is_complete = !is_error && !is_cancelled;
+	deen_bool is_kept = DEEN_FALSE;
+	deen_bool result = DEEN_TRUE;
+
+	if (-1 != shadow->fd_data) {
+		if (0 != close(shadow->fd_data)) {
+			DEEN_LOG_ERROR1("unable to write the data; %s", shadow->data_path);
+			result = DEEN_FALSE;
+		}
+	}
+
+	if (NULL != shadow->db) {
+		sqlite3_close_v2(shadow->db);
+		DEEN_LOG_INFO1("closed index database; %s", shadow->index_path);
+	}
+
+	if (NULL != shadow->dir) {
+		if (is_complete && result) {
+			if (!deen_install_swap_in(shadow->dir, deen_root_dir)) {
+				result = DEEN_FALSE;
+			}
+			else {
+				DEEN_LOG_INFO1("moved the new install into place; %s", deen_root_dir);
+			}
+		}
+
+		if (!is_complete || !result) {
+			if (shadow->is_resumable && !is_error && result) {
+				DEEN_LOG_INFO1("indexing not completed -> keep files to carry on from later; %s", shadow->dir);
+				is_kept = DEEN_TRUE;
+			}
+			else {
+				DEEN_LOG_ERROR0("indexing not completed -> clean up files");
+				deen_remove_fileobject(shadow->data_path);
+				deen_remove_fileobject(shadow->index_path);
+				deen_remove_fileobject(shadow->map_index_path);
+				deen_index_remove_runs(shadow->dir, 0);
+			}
+		}
+
+		if (!is_kept && 0 != rmdir(shadow->dir)) {
+			DEEN_LOG_ERROR1("failed to remove the directory for the new install; %s", shadow->dir);
+		}
+
+		free((void *) shadow->dir);
+	}
+
+	free((void *) shadow->data_path);
+	free((void *) shadow->index_path);
+	free((void *) shadow->map_index_path);
+	memset(shadow, 0, sizeof(deen_install_shadow));
+	shadow->fd_data = -1;
 
+	return result;
+}
+
+// ---------------------------------------------------------------
+// INSTALL
+// ---------------------------------------------------------------
 
 deen_bool deen_noop_is_cancelled_cb(void *context) {
 	return DEEN_FALSE;
@@ -490,12 +2963,75 @@ deen_bool deen_noop_install_progress_cb(
 #define DEEN_INSTALL_RAISE_ERROR progress_cb(process_cb_context, DEEN_INSTALL_STATE_ERROR, 0.0f); is_error=DEEN_TRUE;
 
 
+/*
+Indexes the source data from the start into the new install.  The lines that
+the user added to what was installed are carried over as a delta segment.
+*/
+
+static deen_bool deen_install_build(
+	deen_install_shadow *shadow,
+	int fd_data,
+	deen_bool is_compressed,
+	const deen_install_installed *installed,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb) {
+
+	deen_index_metadata metadata;
+	deen_index_checkpoint checkpoint;
+	deen_bool is_cloned = DEEN_FALSE;
+	deen_bool is_resumed = shadow->is_resumable
+		&& deen_install_shadow_resume(shadow, fd_data, is_compressed, &checkpoint);
+	deen_bool result = is_resumed || deen_install_shadow_create_files(shadow);
+
+	// the source file is read once; as it is indexed, it is also copied to
+	// the install location.  The copy has the same content so the refs are
+	// the same.  A compressed source is inflated on the way through so that
+	// the install location has the uncompressed data.
+
+	if (result) {
+		is_cloned = !is_compressed && deen_install_clone_data(fd_data, shadow->fd_data);
+
+		if (is_cloned) {
+			DEEN_LOG_INFO0("copied data with a reflink");
+		}
+
+		result = deen_install_load(
+			shadow, 0, fd_data, is_compressed, !is_cloned, 0, is_resumed ? &checkpoint : NULL, &metadata,
+			process_cb_context, progress_cb, is_cancelled_cb);
+	}
+
+	if (result && !is_cancelled_cb(process_cb_context)) {
+		deen_transaction_begin(shadow->db);
+		deen_index_delete_checkpoint(shadow->db);
+		deen_index_write_metadata(shadow->db, &metadata);
+		deen_transaction_commit(shadow->db);
+
+		if (NULL != installed) {
+			off_t lines_len = 0;
+			FILE *lines = deen_install_installed_local_lines(installed, &lines_len);
+
+			result = NULL != lines && deen_install_load_segment(
+				shadow, DEEN_SEGMENT_KIND_LOCAL, lines, lines_len,
+				process_cb_context, progress_cb, is_cancelled_cb);
+
+			if (NULL != lines) {
+				fclose(lines);
+			}
+		}
+	}
+
+	return result;
+}
+
+
 deen_bool deen_install_from_path(
 	const char *deen_root_dir,
 	const char *ding_filename,
 	void *process_cb_context,
 	deen_install_progress_cb progress_cb,
-	deen_is_cancelled_cb is_cancelled_cb) {
+	deen_is_cancelled_cb is_cancelled_cb,
+	deen_install_stats *stats) {
 
 	if (NULL == progress_cb) {
 		progress_cb = deen_noop_install_progress_cb;
@@ -505,206 +3041,378 @@ deen_bool deen_install_from_path(
 		is_cancelled_cb = deen_noop_is_cancelled_cb;
 	}
 
-	int fd_data;
-	sqlite3 *db = NULL;
+	int fd_data = -1;
+	deen_bool is_compressed = DEEN_FALSE;
 	deen_bool is_error = DEEN_FALSE;
-	char *data_path = deen_data_path(deen_root_dir);
-	char *index_path = deen_index_path(deen_root_dir);
+	deen_bool is_installed = DEEN_FALSE;
+	deen_bool is_delta = DEEN_FALSE;
+	deen_install_installed installed;
+	deen_install_delta_plan plan;
+	deen_install_shadow shadow;
+	deen_millis start_ms = deen_millis_since_epoc();
+	int fd_lock = -1;
+
+	memset(&installed, 0, sizeof(deen_install_installed));
+	memset(&plan, 0, sizeof(deen_install_delta_plan));
+	memset(&shadow, 0, sizeof(deen_install_shadow));
+	shadow.fd_data = -1;
+
+	if (NULL != stats) {
+		memset(stats, 0, sizeof(deen_install_stats));
+	}
 
 	progress_cb(process_cb_context, DEEN_INSTALL_STATE_STARTING, 0.0f);
 
-	deen_install_init(deen_root_dir);
+	// only one install works on the data at a time; the lock is held until
+	// the new install has been moved into place.
 
-	// first thing is to copy the file over to the new location.
+	if (!deen_install_init_root_dir(deen_root_dir)
+		|| -1 == (fd_lock = deen_install_lock(deen_root_dir))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
 
 	if (!is_error && !is_cancelled_cb(process_cb_context)) {
-		int fd_src_data = open(ding_filename,O_RDONLY
-#ifdef __MINGW32__
-			|O_BINARY
-#endif
-		);
+		fd_data = open(ding_filename, O_RDONLY|DEEN_INSTALL_O_BINARY);
 
-		if (-1 == fd_src_data) {
-			DEEN_LOG_INFO1("unable to open the input data file %s",ding_filename);
+		if ((-1==fd_data) || DEEN_CAUSE_ERROR_IN_INSTALL) {
+			DEEN_LOG_ERROR1("unable to open the input data file %s",ding_filename);
 			DEEN_INSTALL_RAISE_ERROR
 		}
 		else {
-			int fd_dest_data;
+			DEEN_LOG_INFO1("opened input data file %s",ding_filename);
+			is_compressed = deen_install_is_compressed(fd_data);
 
-			DEEN_LOG_INFO1("source opened for copy to install location; %s",ding_filename);
+			if (is_compressed) {
+				DEEN_LOG_INFO0("input data file is gzip compressed; will inflate");
+			}
+		}
+	}
 
-			fd_dest_data = open(
-				data_path,
-				O_RDWR|O_CREAT|O_TRUNC
-#ifdef __MINGW32__
-				|O_BINARY
-#endif
-				,
-				S_IRUSR
-#ifndef __MINGW32__
-				|S_IRGRP|S_IROTH
-#endif
-							);
+	// if the install is of the same data as is already installed then there
+	// is nothing to do.
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)
+		&& deen_install_is_unchanged(deen_root_dir, fd_data, is_compressed)) {
+		DEEN_LOG_INFO1("the data installed is the same as %s; will not install again", ding_filename);
+		close(fd_data);
+		deen_install_unlock(fd_lock);
+
+		if (NULL != stats) {
+			deen_install_stats_finish(stats, deen_root_dir, start_ms);
+		}
+
+		progress_cb(process_cb_context, DEEN_INSTALL_STATE_COMPLETED, 1.0f);
+		return DEEN_TRUE;
+	}
+
+	// if an earlier version of the data is installed and only a few lines
+	// have changed then only those lines are indexed into a delta segment.
+	// Once there are too many segments, the index is built from the start.
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		is_installed = deen_install_installed_open(deen_root_dir, &installed);
 
-			if (-1==fd_dest_data) {
-				DEEN_LOG_INFO1("unable to open the output data file %s",data_path);
+		if (is_installed
+			&& installed.segments->segments_with_refs_count < DEEN_INSTALL_SEGMENTS_MAX) {
+			if (!deen_install_plan_delta(&installed, fd_data, is_compressed, &plan)) {
 				DEEN_INSTALL_RAISE_ERROR
 			}
 			else {
-				void *buffer;
-				ssize_t bytes_read;
+				is_delta = deen_install_delta_plan_is_small(&plan);
+				DEEN_LOG_INFO3("compared with the installed data; %u lines added, %u deleted of %u lines",
+					(unsigned) plan.added_count, (unsigned) plan.deleted_count, (unsigned) plan.line_count);
+			}
+		}
+	}
 
-				DEEN_LOG_INFO1("destination opened for copy to install location; %s",data_path);
+	// the new install is built in a directory of its own and is then moved
+	// into place.  If the data is indexed from the start then this is able to
+	// carry on from where an earlier install that stopped got to.
 
-				buffer = (void *) deen_emalloc(DEEN_SIZE_FILE_COPY_BUFFER);
+	if (!is_error && !is_cancelled_cb(process_cb_context)
+		&& !(is_delta
+			? deen_install_shadow_create(deen_root_dir, &shadow)
+			: deen_install_shadow_create_resumable(deen_root_dir, &shadow))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
 
-				while (!is_error && (bytes_read = read(fd_src_data,buffer,DEEN_SIZE_FILE_COPY_BUFFER)) > 0) {
-					if (write(fd_dest_data, buffer, bytes_read) < bytes_read) {
-						DEEN_LOG_ERROR2("unable to copy the data from %s --> %s", ding_filename, data_path);
-						DEEN_INSTALL_RAISE_ERROR
-					}
+	shadow.stats = stats;
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		if (is_delta) {
+			DEEN_LOG_INFO0("will index the changed lines as a delta segment");
+
+			if (!deen_install_shadow_copy_installed(deen_root_dir, &shadow)
+				|| !deen_install_load_segment(
+					&shadow, DEEN_SEGMENT_KIND_SOURCE, plan.added, plan.added_len,
+					process_cb_context, progress_cb, is_cancelled_cb)) {
+				DEEN_LOG_ERROR1("failure to process the file %s", ding_filename);
+				DEEN_INSTALL_RAISE_ERROR
+			}
+			else {
+				if (!is_cancelled_cb(process_cb_context)) {
+					deen_index_metadata metadata = installed.metadata;
+					metadata.source_hash = plan.source_hash;
+					metadata.source_size = plan.source_size;
+
+					deen_transaction_begin(shadow.db);
+					deen_index_add_tombstones(shadow.db, plan.deleted_refs, plan.deleted_count);
+					deen_index_write_metadata(shadow.db, &metadata);
+					deen_transaction_commit(shadow.db);
 				}
+			}
+		}
+		else {
+			if (!deen_install_build(
+				&shadow, fd_data, is_compressed, is_installed ? &installed : NULL,
+				process_cb_context, progress_cb, is_cancelled_cb)) {
+				DEEN_LOG_ERROR1("failure to process the file %s", ding_filename);
+				DEEN_INSTALL_RAISE_ERROR
+			}
+		}
+	}
+
+	if (-1 != fd_data) {
+		close(fd_data);
+		DEEN_LOG_INFO1("closed input file; %s",ding_filename);
+	}
 
-				DEEN_LOG_INFO0("completed copy");
+	// if the install process worked out then the new files replace those of
+	// any prior install.  Otherwise the stored data as well as any partially
+	// written index are deleted and the prior install remains.
 
-				free(buffer);
+	if (!deen_install_shadow_finish(
+		deen_root_dir, &shadow, is_error, is_cancelled_cb(process_cb_context))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
 
-				close(fd_dest_data);
-			}
+	deen_install_delta_plan_free(&plan);
+	deen_install_installed_close(&installed);
+	deen_install_unlock(fd_lock);
 
-			close(fd_src_data);
+	if (!is_error && NULL != stats) {
+		deen_install_stats_finish(stats, deen_root_dir, start_ms);
+	}
+
+	if (!is_error) {
+		progress_cb(process_cb_context, DEEN_INSTALL_STATE_COMPLETED, 1.0f);
+	} else {
+		if (is_cancelled_cb(process_cb_context)) {
+			progress_cb(process_cb_context, DEEN_INSTALL_STATE_IDLE, 0.0f);
 		}
 	}
 
-	// create the target sqllite database.
+	return !is_error;
+}
 
-	if (!is_error && !is_cancelled_cb(process_cb_context)) {
-		if (SQLITE_OK != sqlite3_open_v2(
-			index_path,
-			&db,
-			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
-			NULL)) {
 
-			DEEN_LOG_ERROR2("unable to open the sqllite3 database; %s (%s)", index_path, sqlite3_errmsg(db));
-			DEEN_INSTALL_RAISE_ERROR
-		}
+deen_bool deen_install_local_from_path(
+	const char *deen_root_dir,
+	const char *filename,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb) {
+
+	if (NULL == progress_cb) {
+		progress_cb = deen_noop_install_progress_cb;
 	}
 
-	if (!is_error && !is_cancelled_cb(process_cb_context)) {
-		deen_index_init(db);
-		DEEN_LOG_TRACE0("did initialize the index database");
+	if (NULL == is_cancelled_cb) {
+		is_cancelled_cb = deen_noop_is_cancelled_cb;
 	}
 
-	fd_data = -1;
+	deen_bool is_error = DEEN_FALSE;
+	deen_bool is_merge_needed = DEEN_FALSE;
+	deen_install_installed installed;
+	deen_install_shadow shadow;
+	FILE *lines = NULL;
+	off_t lines_len = 0;
+	int fd_lock = -1;
 
-	if (!is_error && !is_cancelled_cb(process_cb_context)) {
-		fd_data = open(data_path, O_RDONLY);
+	memset(&installed, 0, sizeof(deen_install_installed));
+	memset(&shadow, 0, sizeof(deen_install_shadow));
+	shadow.fd_data = -1;
 
-		if ((-1==fd_data) || DEEN_CAUSE_ERROR_IN_INSTALL) {
-			DEEN_LOG_ERROR1("unable to open the input data file %s",data_path);
+	progress_cb(process_cb_context, DEEN_INSTALL_STATE_STARTING, 0.0f);
+
+	// only one install works on the data at a time; the lock is held until
+	// the new install has been moved into place.
+
+	if (!deen_install_init_root_dir(deen_root_dir)
+		|| -1 == (fd_lock = deen_install_lock(deen_root_dir))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
+
+	if (!is_error) {
+		if (!deen_install_installed_open(deen_root_dir, &installed)) {
+			DEEN_LOG_ERROR0("the data has to be installed before entries are able to be added to it");
 			DEEN_INSTALL_RAISE_ERROR
 		}
 		else {
-			DEEN_LOG_INFO1("opened input data file %s",data_path);
+			is_merge_needed = installed.segments->segments_with_refs_count + 1 >= DEEN_INSTALL_SEGMENTS_MAX;
 		}
 	}
 
+	if (!is_error && NULL == (lines = deen_install_read_lines(filename, &lines_len))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)
+		&& !deen_install_shadow_create(deen_root_dir, &shadow)) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
+
 	if (!is_error && !is_cancelled_cb(process_cb_context)) {
-		time_t secs_before;
-		deen_index_context index_context;
-
-		index_context.index_add_context = deen_index_add_context_create(db);
-		index_context.lastprogress = -1.0f;
-		index_context.progress_cb_context = process_cb_context;
-		index_context.progress_cb = progress_cb;
-		index_context.is_cancelled_cb = is_cancelled_cb;
-		index_context.c_buffer_upper = NULL;
-		index_context.c_buffer_upper_len = 0;
-		index_context.current_ref = 0;
-		index_context.prefix_count = 0;
-		index_context.prefix_count_allocated = 0;
-		index_context.prefixes = NULL;
-
-		secs_before = deen_seconds_since_epoc();
-
-		deen_transaction_begin(db);
-
-		if (!deen_for_each_word_from_file(
-			DEEN_BUFFER_SIZE_EACH_WORD_FROM_FILE,
-			fd_data,
-			&deen_index_callback,
-			&index_context)) {
-			DEEN_LOG_ERROR1("failure to process the file %s", data_path);
+		if (!deen_install_shadow_copy_installed(deen_root_dir, &shadow)
+			|| !deen_install_load_segment(
+				&shadow, DEEN_SEGMENT_KIND_LOCAL, lines, lines_len,
+				process_cb_context, progress_cb, is_cancelled_cb)) {
+			DEEN_LOG_ERROR1("failure to process the file %s", filename);
 			DEEN_INSTALL_RAISE_ERROR
 		}
+	}
+
+	if (!deen_install_shadow_finish(
+		deen_root_dir, &shadow, is_error, is_cancelled_cb(process_cb_context))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
+
+	if (NULL != lines) {
+		fclose(lines);
+	}
 
-		deen_transaction_commit(db);
+	deen_install_installed_close(&installed);
+	deen_install_unlock(fd_lock);
 
-		// print out the performance of the indexing with respect to database
-		// activity
+	if (!is_error && !is_cancelled_cb(process_cb_context) && is_merge_needed) {
+		DEEN_LOG_INFO0("there are too many delta segments; will merge them");
+		return deen_install_merge(deen_root_dir, process_cb_context, progress_cb, is_cancelled_cb);
+	}
 
-#ifdef DEBUG
-		if (!is_error) {
-			DEEN_LOG_INFO1("db activity; find existing prefixes = %llu ms", index_context.index_add_context->find_existing_prefixes_millis);
-			DEEN_LOG_INFO1("db activity; add missing prefixes = %llu ms", index_context.index_add_context->add_missing_prefixes_millis);
-			DEEN_LOG_INFO1("db activity; add refs = %llu ms", index_context.index_add_context->add_refs_millis);
+	if (!is_error) {
+		progress_cb(process_cb_context, DEEN_INSTALL_STATE_COMPLETED, 1.0f);
+	} else {
+		if (is_cancelled_cb(process_cb_context)) {
+			progress_cb(process_cb_context, DEEN_INSTALL_STATE_IDLE, 0.0f);
 		}
-#endif
+	}
 
-		// flush any indexes to the database.
+	return !is_error;
+}
 
-		deen_index_flush_context_prefixes_to_index(&index_context);
 
-		if (!is_error) {
-			DEEN_LOG_INFO1("indexed in %u seconds", deen_seconds_since_epoc() - secs_before);
-		}
+deen_bool deen_install_merge(
+	const char *deen_root_dir,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb) {
 
-		if (NULL != index_context.index_add_context) {
-			deen_index_add_context_free(index_context.index_add_context);
-		}
+	if (NULL == progress_cb) {
+		progress_cb = deen_noop_install_progress_cb;
+	}
 
-		// release memory that might have been used in the indexing process
-		// as stored in the context.
+	if (NULL == is_cancelled_cb) {
+		is_cancelled_cb = deen_noop_is_cancelled_cb;
+	}
 
-		if (NULL != index_context.c_buffer_upper) {
-			free((void *) index_context.c_buffer_upper);
-		}
+	deen_bool is_error = DEEN_FALSE;
+	deen_install_installed installed;
+	deen_install_shadow shadow;
+	long local_start = 0;
+	long local_end = 0;
+	int fd_lock = -1;
 
-		if (NULL != index_context.prefixes) {
-			size_t i;
+	memset(&installed, 0, sizeof(deen_install_installed));
+	memset(&shadow, 0, sizeof(deen_install_shadow));
+	shadow.fd_data = -1;
 
-			for (i=0;i<index_context.prefix_count_allocated;i++) {
-				free((void *) index_context.prefixes[i]);
-			}
+	progress_cb(process_cb_context, DEEN_INSTALL_STATE_STARTING, 0.0f);
 
-			free((void *) index_context.prefixes);
-		}
+	// only one install works on the data at a time; the lock is held until
+	// the new install has been moved into place.
+
+	if (!deen_install_init_root_dir(deen_root_dir)
+		|| -1 == (fd_lock = deen_install_lock(deen_root_dir))) {
+		DEEN_INSTALL_RAISE_ERROR
 	}
 
-	if (-1 != fd_data) {
-		close(fd_data);
-		DEEN_LOG_INFO1("closed input file; %s",data_path);
+	if (!is_error && !deen_install_installed_open(deen_root_dir, &installed)) {
+		DEEN_LOG_ERROR0("the data has to be installed before it is able to be merged");
+		DEEN_INSTALL_RAISE_ERROR
 	}
 
-	if (NULL != db) {
-		sqlite3_close_v2(db);
-		DEEN_LOG_INFO1("closed index database; %s",index_path);
+	if (!is_error && !is_cancelled_cb(process_cb_context)
+		&& (!deen_install_shadow_create(deen_root_dir, &shadow)
+			|| !deen_install_shadow_create_files(&shadow))) {
+		DEEN_INSTALL_RAISE_ERROR
 	}
 
-	// if the install process did not work out then we need to
-	// delete the stored data as well as any partially written
-	// index.
+	// the live lines from the source go first and then those that the user
+	// added so that the user's lines are still known as such after the merge.
 
-	if (is_error || is_cancelled_cb(process_cb_context)) {
-		DEEN_LOG_ERROR0("indexing not completed -> clean up files");
-		deen_remove_fileobject(data_path);
-		deen_remove_fileobject(index_path);
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		FILE *data = fdopen(dup(shadow.fd_data), "wb");
+
+		if (NULL == data
+			|| !deen_install_installed_for_each_live_line(
+				&installed, DEEN_SEGMENT_KIND_SOURCE, &deen_install_write_line, data)
+			|| -1 == (local_start = ftell(data))
+			|| !deen_install_installed_for_each_live_line(
+				&installed, DEEN_SEGMENT_KIND_LOCAL, &deen_install_write_line, data)
+			|| -1 == (local_end = ftell(data))) {
+			DEEN_LOG_ERROR1("unable to write the merged data; %s", shadow.data_path);
+			DEEN_INSTALL_RAISE_ERROR
+		}
+
+		if (NULL != data && 0 != fclose(data) && !is_error) {
+			DEEN_LOG_ERROR1("unable to write the merged data; %s", shadow.data_path);
+			DEEN_INSTALL_RAISE_ERROR
+		}
 	}
 
-	free((void *) data_path);
-	free((void *) index_path);
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		deen_index_metadata metadata;
+		int fd_merged = open(shadow.data_path, O_RDONLY|DEEN_INSTALL_O_BINARY);
+
+		if (-1 == fd_merged
+			|| !deen_install_load(
+				&shadow, 0, fd_merged, DEEN_FALSE, DEEN_FALSE, 0, NULL, &metadata,
+				process_cb_context, progress_cb, is_cancelled_cb)) {
+			DEEN_LOG_ERROR1("failure to index the merged data; %s", shadow.data_path);
+			DEEN_INSTALL_RAISE_ERROR
+		}
+
+		if (-1 != fd_merged) {
+			close(fd_merged);
+		}
+	}
+
+	// the refs of the user's lines are in the base of the index now; the
+	// segment is kept as a record of which lines they are.  The metadata
+	// remains that of the source data.
+
+	if (!is_error && !is_cancelled_cb(process_cb_context)) {
+		deen_transaction_begin(shadow.db);
+
+		if (local_end > local_start) {
+			deen_index_add_segment(
+				shadow.db, DEEN_SEGMENT_KIND_LOCAL, (off_t) local_start, (off_t) local_end);
+		}
+
+		deen_index_write_metadata(shadow.db, &(installed.metadata));
+		deen_transaction_commit(shadow.db);
+	}
+
+	if (!deen_install_shadow_finish(
+		deen_root_dir, &shadow, is_error, is_cancelled_cb(process_cb_context))) {
+		DEEN_INSTALL_RAISE_ERROR
+	}
+
+	deen_install_installed_close(&installed);
+	deen_install_unlock(fd_lock);
 
 	if (!is_error) {
+		DEEN_LOG_INFO1("merged the delta segments; %s", deen_root_dir);
 		progress_cb(process_cb_context, DEEN_INSTALL_STATE_COMPLETED, 1.0f);
 	} else {
 		if (is_cancelled_cb(process_cb_context)) {
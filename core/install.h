@@ -17,7 +17,6 @@
 
 enum deen_install_check_ding_format_check_result {
     DEEN_INSTALL_CHECK_OK,
-    DEEN_INSTALL_CHECK_IS_COMPRESSED,
     DEEN_INSTALL_CHECK_IO_PROBLEM,
     DEEN_INSTALL_CHECK_TOO_SMALL,
     DEEN_INSTALL_CHECK_BAD_FORMAT
@@ -37,6 +36,10 @@ enum deen_install_state {
 	DEEN_INSTALL_STATE_ERROR,
 };
 
+/*
+Checks that the file looks like DING data.  The file may be gzip compressed.
+*/
+
 enum deen_install_check_ding_format_check_result deen_install_check_for_ding_format(const char *filename);
 
 void deen_log_install_progress(enum deen_install_state state, float progress);
@@ -56,11 +59,45 @@ typedef deen_bool (*deen_is_cancelled_cb)(void *context);
 typedef deen_bool (*deen_install_progress_cb)(
 	void *context, enum deen_install_state state, float progress);
 
+/*
+Installs the Ding data in the file.  If the same data is already installed then
+nothing is done.  If an earlier version of the data is installed and only a
+small part of it has changed then just the lines that have changed are indexed
+into a delta segment; otherwise the index is built from the start.  Entries that
+were added with deen_install_local_from_path are carried over.  If 'stats' is
+not NULL then it is filled with measurements of the install.
+*/
+
 deen_bool deen_install_from_path(
 	const char *deen_root_dir,
 	const char *filename,
 	void *process_cb_context,
 	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb,
+	deen_install_stats *stats);
+
+/*
+Adds the entries in the file, which are in the same format as the Ding data, to
+what is installed.  The entries are indexed into a delta segment of their own.
+*/
+
+deen_bool deen_install_local_from_path(
+	const char *deen_root_dir,
+	const char *filename,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
+	deen_is_cancelled_cb is_cancelled_cb);
+
+/*
+Merges the delta segments into the base of the index and drops the lines that
+have since been deleted from the data.  This happens as part of adding entries
+once there are too many segments, but it can also be asked for.
+*/
+
+deen_bool deen_install_merge(
+	const char *deen_root_dir,
+	void *process_cb_context,
+	deen_install_progress_cb progress_cb,
 	deen_is_cancelled_cb is_cancelled_cb);
 
 /*
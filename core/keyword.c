@@ -64,6 +64,7 @@ deen_keywords *deen_keywords_create() {
 	deen_keywords *keywords = (deen_keywords *) deen_emalloc(sizeof(deen_keywords));
 	keywords->count = 0;
 	keywords->keywords = NULL;
+	keywords->keyword_lens = NULL;
 	return keywords;
 }
 
@@ -78,6 +79,10 @@ void deen_keywords_free(deen_keywords *keywords) {
 		free((void *) keywords->keywords);
 	}
 
+	if (NULL != keywords->keyword_lens) {
+		free((void *) keywords->keyword_lens);
+	}
+
 	free((void *) keywords);
 }
 
@@ -104,10 +109,13 @@ static deen_bool deen_keywords_has_prefix(
 }
 
 
-static deen_bool add_keywords_add_from_string_callback(
-	const uint8_t *s, size_t offset, size_t len, void *context) {
+/*
+Adds the word to the keywords unless it is a common word or is already covered
+by a keyword.
+*/
 
-	deen_keywords *keywords = (deen_keywords *) context;
+static void deen_keywords_add_word(
+	deen_keywords *keywords, const uint8_t *s, size_t offset, size_t len) {
 
 	if(
 		!deen_is_common_upper_word(&s[offset], len) &&
@@ -131,16 +139,23 @@ static deen_bool add_keywords_add_from_string_callback(
 		keywords->keywords[keywords->count-1][len] = 0;
 		memcpy(keywords->keywords[keywords->count-1], &s[offset], len);
 	}
-
-	return DEEN_TRUE;
 }
 
 void deen_keywords_add_from_string(deen_keywords *keywords, const uint8_t *input) {
 
-	deen_for_each_word(
-		input, 0,
-		&add_keywords_add_from_string_callback,
-		(void *) keywords);
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
+
+	deen_word_scan_init(&scan, input, strlen((const char *) input), 0, DEEN_FALSE);
+
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		size_t i;
+
+		for (i = 0; i < span_count; i++) {
+			deen_keywords_add_word(keywords, input, spans[i].offset, spans[i].len);
+		}
+	}
 
 	// we need to go through the keywords now and sort them by size;
 	// doing this makes some latter algorithms more easy and more
@@ -151,6 +166,21 @@ void deen_keywords_add_from_string(deen_keywords *keywords, const uint8_t *input
 	    keywords->count,
 	    sizeof(uint8_t *),
 	    &deen_keywords_compare_length);
+
+	// the lengths are kept so that they need not be worked out again each
+	// time that a keyword is matched against a word.
+
+	if (0 != keywords->count) {
+		uint32_t i;
+
+		keywords->keyword_lens = (size_t *) deen_erealloc(
+			keywords->keyword_lens,
+			sizeof(size_t) * keywords->count);
+
+		for (i = 0; i < keywords->count; i++) {
+			keywords->keyword_lens[i] = strlen((const char *) keywords->keywords[i]);
+		}
+	}
 }
 
 size_t deen_keywords_longest_keyword(deen_keywords *keywords) {
@@ -158,7 +188,7 @@ size_t deen_keywords_longest_keyword(deen_keywords *keywords) {
 	uint32_t i;
 
 	for (i=0;i<keywords->count;i++) {
-		size_t len = strlen((const char *) keywords->keywords[i]);
+		size_t len = keywords->keyword_lens[i];
 
 		if (len > longest) {
 			longest = len;
@@ -169,29 +199,28 @@ size_t deen_keywords_longest_keyword(deen_keywords *keywords) {
 }
 
 
-typedef struct deen_keywords_one_present_context deen_keywords_one_present_context;
-struct deen_keywords_one_present_context {
-	deen_bool found;
-	const uint8_t *keyword;
-	size_t keyword_len;
-};
-
+/*
+Returns true if the keyword is at the start of one of the words in the spans.
+*/
 
-static deen_bool deen_keywords_one_present_callback(
-	const uint8_t *s, size_t offset, size_t len,
-	void *context) {
+static deen_bool deen_keywords_one_present_in_spans(
+	const uint8_t *keyword,
+	size_t keyword_len,
+	const uint8_t *input,
+	const deen_word_span *spans,
+	size_t span_count) {
 
-	deen_keywords_one_present_context *context2 = (deen_keywords_one_present_context *) context;
+	size_t i;
 
-	if (context2->keyword_len <= len) {
-		if(DEEN_TRUE == deen_imatches_at(s, context2->keyword, offset)) {
-			DEEN_LOG_TRACE3("found [%s] at %llu in [%s]", context2->keyword, offset, s);
-			context2->found = DEEN_TRUE;
-			return DEEN_FALSE;
+	for (i = 0; i < span_count; i++) {
+		if (keyword_len <= spans[i].len
+			&& DEEN_TRUE == deen_imatches_at_len(input, keyword, keyword_len, spans[i].offset)) {
+			DEEN_LOG_TRACE2("found [%s] at %llu", keyword, (unsigned long long) spans[i].offset);
+			return DEEN_TRUE;
 		}
 	}
 
-	return DEEN_TRUE;
+	return DEEN_FALSE;
 }
 
 
@@ -200,22 +229,65 @@ Returns true if the supplied keyword exists at the start of a word in the
 input.
 */
 
-static deen_bool deen_keywords_one_present(const uint8_t *keyword, const uint8_t *input) {
-	deen_keywords_one_present_context context;
-	context.found = DEEN_FALSE;
-	context.keyword = keyword;
-	context.keyword_len = strlen((char *) keyword);
-	deen_for_each_word(input, 0, &deen_keywords_one_present_callback, &context);
-	return context.found;
+static deen_bool deen_keywords_one_present(
+	const uint8_t *keyword,
+	size_t keyword_len,
+	const uint8_t *input,
+	size_t input_len) {
+
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
+
+	deen_word_scan_init(&scan, input, input_len, 0, DEEN_FALSE);
+
+	while (0 != (span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH))) {
+		if (deen_keywords_one_present_in_spans(keyword, keyword_len, input, spans, span_count)) {
+			return DEEN_TRUE;
+		}
+	}
+
+	return DEEN_FALSE;
 }
 
 
 deen_bool deen_keywords_all_present(deen_keywords *keywords, const uint8_t *input) {
+	return deen_keywords_all_present_len(keywords, input, strlen((const char *) input));
+}
+
+
+/*
+The words in the input are found once and then each of the keywords is checked
+against them.  Only if the input has more words than fit into a batch is it
+necessary to find the words again for each keyword.
+*/
+
+deen_bool deen_keywords_all_present_len(
+	deen_keywords *keywords,
+	const uint8_t *input,
+	size_t input_len) {
+
+	deen_word_span spans[DEEN_WORD_SPANS_BATCH];
+	deen_word_scan scan;
+	size_t span_count;
 	uint32_t i;
 
+	deen_word_scan_init(&scan, input, input_len, 0, DEEN_FALSE);
+	span_count = deen_word_scan_spans(&scan, spans, DEEN_WORD_SPANS_BATCH);
+
 	for (i=0;i < keywords->count; i++) {
-		if (DEEN_FALSE == deen_keywords_one_present(keywords->keywords[i], input)) {
-		    return DEEN_FALSE;
+		const uint8_t *keyword = keywords->keywords[i];
+		size_t keyword_len = keywords->keyword_lens[i];
+
+		if (span_count < DEEN_WORD_SPANS_BATCH) {
+			if (!deen_keywords_one_present_in_spans(keyword, keyword_len, input, spans, span_count)) {
+				return DEEN_FALSE;
+			}
+		}
+		else {
+			if (!deen_keywords_one_present(keyword, keyword_len, input, input_len)) {
+				return DEEN_FALSE;
+			}
 		}
 	}
 
@@ -38,6 +38,16 @@ at the *start* of words rather than anywhere in the string.
 
 deen_bool deen_keywords_all_present(deen_keywords *keywords, const uint8_t *input);
 
+/*
+As deen_keywords_all_present, but only the first 'input_len' bytes of the input
+are looked at so the input need not be terminated.
+*/
+
+deen_bool deen_keywords_all_present_len(
+	deen_keywords *keywords,
+	const uint8_t *input,
+	size_t input_len);
+
 /*
 In some cases, the keywords can contain abbreviations and so on that make
 searches difficult in the data.  For example, the string "oe" can be an
@@ -0,0 +1,384 @@
+/*
+ * Copyright 2016-2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#include "mapindex.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
+#include <unistd.h>
+
+#include "common.h"
+
+#define DEEN_MAP_INDEX_MAGIC "DEENMIDX"
+#define DEEN_MAP_INDEX_VERSION 1
+
+/*
+This value is written into the header so that a file written on a machine with
+a different byte order can be detected.
+*/
+
+#define DEEN_MAP_INDEX_BYTE_ORDER 0x01020304
+
+/*
+Each entry in the prefix table is the prefix padded with zeros followed by the
+offset of the first ref for the prefix and the number of refs.
+*/
+
+#define DEEN_MAP_INDEX_ENTRY_SIZE (DEEN_INDEX_PREFIX_WIDTH + 8 + 8)
+
+typedef struct deen_map_index_header deen_map_index_header;
+struct deen_map_index_header {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t indexing_depth;
+	uint32_t prefix_width;
+	uint64_t prefix_count;
+	uint64_t ref_count;
+	uint64_t prefixes_offset;
+};
+
+/*
+The refs follow straight after the header so the header size needs to keep the
+refs aligned.
+*/
+
+#define DEEN_MAP_INDEX_HEADER_SIZE (sizeof(deen_map_index_header))
+
+
+// ---------------------------------------------------------------
+// WRITING
+// ---------------------------------------------------------------
+
+deen_map_index_writer *deen_map_index_writer_create(const char *path) {
+	deen_map_index_header header;
+	deen_map_index_writer *writer;
+	FILE *file = fopen(path, "wb");
+
+	if (NULL == file) {
+		DEEN_LOG_ERROR1("unable to create the map index; %s", path);
+		return NULL;
+	}
+
+	// the header is written properly once the counts are known.
+
+	memset(&header, 0, sizeof(deen_map_index_header));
+
+	if (1 != fwrite(&header, DEEN_MAP_INDEX_HEADER_SIZE, 1, file)) {
+		DEEN_LOG_ERROR1("unable to write to the map index; %s", path);
+		fclose(file);
+		return NULL;
+	}
+
+	writer = (deen_map_index_writer *) deen_emalloc(sizeof(deen_map_index_writer));
+	memset(writer, 0, sizeof(deen_map_index_writer));
+	writer->file = file;
+
+	return writer;
+}
+
+
+void deen_map_index_writer_add(
+	deen_map_index_writer *writer,
+	const uint8_t *prefix,
+	off_t ref) {
+
+	uint8_t *entry = NULL;
+	int64_t ref64 = (int64_t) ref;
+	uint64_t entry_ref_count;
+
+	if (0 != writer->prefix_count) {
+		entry = &(writer->prefixes[(writer->prefix_count - 1) * DEEN_MAP_INDEX_ENTRY_SIZE]);
+
+		if (0 != memcmp(entry, prefix, DEEN_INDEX_PREFIX_WIDTH)) {
+			entry = NULL;
+		}
+	}
+
+	if (NULL == entry) {
+		if (writer->prefix_count == writer->prefix_allocated) {
+			writer->prefix_allocated = 0 == writer->prefix_allocated ? 1024 : writer->prefix_allocated * 2;
+			writer->prefixes = (uint8_t *) deen_erealloc(
+				writer->prefixes,
+				DEEN_MAP_INDEX_ENTRY_SIZE * writer->prefix_allocated);
+		}
+
+		entry = &(writer->prefixes[writer->prefix_count * DEEN_MAP_INDEX_ENTRY_SIZE]);
+		memcpy(entry, prefix, DEEN_INDEX_PREFIX_WIDTH);
+		memcpy(&entry[DEEN_INDEX_PREFIX_WIDTH], &(writer->ref_count), 8);
+		memset(&entry[DEEN_INDEX_PREFIX_WIDTH + 8], 0, 8);
+		writer->prefix_count++;
+	}
+
+	memcpy(&entry_ref_count, &entry[DEEN_INDEX_PREFIX_WIDTH + 8], 8);
+	entry_ref_count++;
+	memcpy(&entry[DEEN_INDEX_PREFIX_WIDTH + 8], &entry_ref_count, 8);
+
+	if (1 != fwrite(&ref64, sizeof(int64_t), 1, writer->file)) {
+		writer->is_error = DEEN_TRUE;
+	}
+
+	writer->ref_count++;
+}
+
+
+deen_bool deen_map_index_writer_finish(deen_map_index_writer *writer) {
+	deen_map_index_header header;
+
+	memset(&header, 0, sizeof(deen_map_index_header));
+	memcpy(header.magic, DEEN_MAP_INDEX_MAGIC, 8);
+	header.version = DEEN_MAP_INDEX_VERSION;
+	header.byte_order = DEEN_MAP_INDEX_BYTE_ORDER;
+	header.indexing_depth = DEEN_INDEXING_DEPTH;
+	header.prefix_width = DEEN_INDEX_PREFIX_WIDTH;
+	header.prefix_count = writer->prefix_count;
+	header.ref_count = writer->ref_count;
+	header.prefixes_offset = DEEN_MAP_INDEX_HEADER_SIZE + (writer->ref_count * sizeof(int64_t));
+
+	if (!writer->is_error && writer->prefix_count != fwrite(
+		writer->prefixes, DEEN_MAP_INDEX_ENTRY_SIZE, writer->prefix_count, writer->file)) {
+		writer->is_error = DEEN_TRUE;
+	}
+
+	if (!writer->is_error && (
+		0 != fseek(writer->file, 0, SEEK_SET) ||
+		1 != fwrite(&header, DEEN_MAP_INDEX_HEADER_SIZE, 1, writer->file))) {
+		writer->is_error = DEEN_TRUE;
+	}
+
+	if (0 != fclose(writer->file)) {
+		writer->is_error = DEEN_TRUE;
+	}
+
+	writer->file = NULL;
+
+	if (writer->is_error) {
+		DEEN_LOG_ERROR0("unable to write the map index");
+		return DEEN_FALSE;
+	}
+
+	DEEN_LOG_INFO2("wrote map index with %llu prefixes and %llu refs",
+		(unsigned long long) writer->prefix_count,
+		(unsigned long long) writer->ref_count);
+
+	return DEEN_TRUE;
+}
+
+
+void deen_map_index_writer_free(deen_map_index_writer *writer) {
+	if (NULL != writer) {
+		if (NULL != writer->file) {
+			fclose(writer->file);
+		}
+
+		if (NULL != writer->prefixes) {
+			free((void *) writer->prefixes);
+		}
+
+		free((void *) writer);
+	}
+}
+
+
+// ---------------------------------------------------------------
+// READING
+// ---------------------------------------------------------------
+
+static deen_bool deen_map_index_is_header_valid(
+	const deen_map_index_header *header,
+	size_t data_len) {
+
+	if (0 != memcmp(header->magic, DEEN_MAP_INDEX_MAGIC, 8)) {
+		DEEN_LOG_INFO0("the map index has the wrong magic");
+		return DEEN_FALSE;
+	}
+
+	if (DEEN_MAP_INDEX_VERSION != header->version ||
+		DEEN_MAP_INDEX_BYTE_ORDER != header->byte_order) {
+		DEEN_LOG_INFO0("the map index has an unsupported version or byte order");
+		return DEEN_FALSE;
+	}
+
+	if (DEEN_INDEXING_DEPTH != header->indexing_depth ||
+		DEEN_INDEX_PREFIX_WIDTH != header->prefix_width) {
+		DEEN_LOG_INFO0("the map index was created with a different indexing depth");
+		return DEEN_FALSE;
+	}
+
+	if (header->prefixes_offset != DEEN_MAP_INDEX_HEADER_SIZE + (header->ref_count * sizeof(int64_t)) ||
+		(uint64_t) data_len != header->prefixes_offset + (header->prefix_count * DEEN_MAP_INDEX_ENTRY_SIZE)) {
+		DEEN_LOG_INFO0("the map index has an unexpected length");
+		return DEEN_FALSE;
+	}
+
+	return DEEN_TRUE;
+}
+
+
+deen_map_index *deen_map_index_open(const char *path) {
+#ifdef __MINGW32__
+	DEEN_LOG_INFO0("the map index is not supported on this platform");
+	return NULL;
+#else
+	struct stat fd_stat;
+	deen_map_index_header header;
+	deen_map_index *map_index;
+	void *data;
+	int fd = open(path, O_RDONLY);
+
+	if (-1 == fd) {
+		return NULL;
+	}
+
+	if (0 != fstat(fd, &fd_stat) || fd_stat.st_size < (off_t) DEEN_MAP_INDEX_HEADER_SIZE) {
+		DEEN_LOG_INFO1("the map index is not valid; %s", path);
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, (size_t) fd_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == data) {
+		DEEN_LOG_ERROR1("unable to map the map index; %s", path);
+		return NULL;
+	}
+
+	memcpy(&header, data, DEEN_MAP_INDEX_HEADER_SIZE);
+
+	if (!deen_map_index_is_header_valid(&header, (size_t) fd_stat.st_size)) {
+		munmap(data, (size_t) fd_stat.st_size);
+		return NULL;
+	}
+
+	map_index = (deen_map_index *) deen_emalloc(sizeof(deen_map_index));
+	map_index->data = (uint8_t *) data;
+	map_index->data_len = (size_t) fd_stat.st_size;
+	map_index->refs = (const int64_t *) &(map_index->data[DEEN_MAP_INDEX_HEADER_SIZE]);
+	map_index->ref_count = header.ref_count;
+	map_index->prefixes = &(map_index->data[header.prefixes_offset]);
+	map_index->prefix_count = header.prefix_count;
+
+	return map_index;
+#endif
+}
+
+
+void deen_map_index_close(deen_map_index *map_index) {
+	if (NULL != map_index) {
+#ifndef __MINGW32__
+		munmap((void *) map_index->data, map_index->data_len);
+#endif
+		free((void *) map_index);
+	}
+}
+
+
+/*
+Finds the entry for the prefix with a binary search of the prefix table.  The
+start and the count of the refs are left as zero if the prefix is not found.
+*/
+
+static void deen_map_index_find(
+	const deen_map_index *map_index,
+	const uint8_t *prefix,
+	uint64_t *refs_start,
+	uint64_t *refs_count) {
+
+	uint8_t key[DEEN_INDEX_PREFIX_WIDTH];
+	size_t prefix_len = strlen((const char *) prefix);
+
+	*refs_start = 0;
+	*refs_count = 0;
+
+	if (prefix_len <= DEEN_INDEX_PREFIX_WIDTH) {
+		uint64_t lower = 0;
+		uint64_t upper = map_index->prefix_count;
+
+		memset(key, 0, DEEN_INDEX_PREFIX_WIDTH);
+		memcpy(key, prefix, prefix_len);
+
+		while (lower < upper) {
+			uint64_t middle = lower + ((upper - lower) / 2);
+			const uint8_t *entry = &(map_index->prefixes[middle * DEEN_MAP_INDEX_ENTRY_SIZE]);
+			int compare = memcmp(key, entry, DEEN_INDEX_PREFIX_WIDTH);
+
+			if (0 == compare) {
+				memcpy(refs_start, &entry[DEEN_INDEX_PREFIX_WIDTH], 8);
+				memcpy(refs_count, &entry[DEEN_INDEX_PREFIX_WIDTH + 8], 8);
+				break;
+			}
+
+			if (compare < 0) {
+				upper = middle;
+			}
+			else {
+				lower = middle + 1;
+			}
+		}
+	}
+
+	if (*refs_start > map_index->ref_count || *refs_count > map_index->ref_count - *refs_start) {
+		deen_log_error_and_exit("the map index is corrupt for the prefix [%s]", prefix);
+	}
+}
+
+
+uint32_t deen_map_index_lookup_count(
+	deen_map_index *map_index,
+	const uint8_t *prefix) {
+
+	uint64_t refs_start;
+	uint64_t refs_count;
+
+	deen_map_index_find(map_index, prefix, &refs_start, &refs_count);
+
+	return (uint32_t) refs_count;
+}
+
+
+deen_index_lookup_result *deen_map_index_lookup(
+	deen_map_index *map_index,
+	const uint8_t *prefix) {
+
+	uint64_t refs_start;
+	uint64_t refs_count;
+	deen_index_lookup_result *result = (deen_index_lookup_result *) deen_emalloc(sizeof(deen_index_lookup_result));
+
+	deen_map_index_find(map_index, prefix, &refs_start, &refs_count);
+
+	result->refs_count = (uint32_t) refs_count;
+	result->refs_sorted = DEEN_TRUE;
+
+	// if the refs are stored in the same form as an off_t then the result
+	// is able to point straight into the mapped memory.
+
+	if (sizeof(off_t) == sizeof(int64_t)) {
+		result->refs = (off_t *) &(map_index->refs[refs_start]);
+		result->refs_owned = DEEN_FALSE;
+	}
+	else {
+		uint64_t i;
+
+		result->refs = (off_t *) deen_emalloc(sizeof(off_t) * (refs_count + 1));
+		result->refs_owned = DEEN_TRUE;
+
+		for (i = 0; i < refs_count; i++) {
+			result->refs[i] = (off_t) map_index->refs[refs_start + i];
+		}
+	}
+
+	return result;
+}
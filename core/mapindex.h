@@ -0,0 +1,89 @@
+/*
+ * Copyright 2016-2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#ifndef __MAPINDEX_H
+#define __MAPINDEX_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+The map index is a read-only alternative to the sqlite index that can be
+memory-mapped by a search.  It is written once when the data is installed and
+consists of;
+
+- a header
+- the refs for all of the prefixes, each a 64 bit integer, grouped by prefix
+  and ordered by ref within each prefix
+- the prefix table; ordered, fixed-width prefixes each with the range of refs
+  that belong to the prefix
+
+The integers are stored in the byte order of the machine that installed the
+data.  A file with a different byte order or version is rejected on open and
+the search will fall back to the sqlite index.
+*/
+
+/*
+Creates a writer that will write the map index to the supplied path.  Returns
+NULL if the file could not be created.
+*/
+
+deen_map_index_writer *deen_map_index_writer_create(const char *path);
+
+/*
+Adds a ref against a prefix.  The prefix is DEEN_INDEX_PREFIX_WIDTH bytes long
+and padded with zeros.  The calls must be made ordered by prefix and then by
+ref and without duplicates; this is the order in which the pairs come out of
+the merge in deen_index_add_finish.
+*/
+
+void deen_map_index_writer_add(
+	deen_map_index_writer *writer,
+	const uint8_t *prefix,
+	off_t ref);
+
+/*
+Writes out the prefix table and the header.  Returns false if there was a
+problem writing the file.
+*/
+
+deen_bool deen_map_index_writer_finish(deen_map_index_writer *writer);
+
+void deen_map_index_writer_free(deen_map_index_writer *writer);
+
+/*
+Maps the map index at the supplied path into memory.  Returns NULL if the file
+does not exist, cannot be mapped or is not valid.
+*/
+
+deen_map_index *deen_map_index_open(const char *path);
+
+void deen_map_index_close(deen_map_index *map_index);
+
+/*
+Finds the refs for the prefix with a binary search of the prefix table.  Where
+possible the refs in the result point directly into the mapped memory and the
+refs are always ordered.  The result must be freed with
+deen_index_lookup_result_free.
+*/
+
+deen_index_lookup_result *deen_map_index_lookup(
+	deen_map_index *map_index,
+	const uint8_t *prefix);
+
+/*
+Returns the number of refs that are stored for the prefix without reading the
+refs.
+*/
+
+uint32_t deen_map_index_lookup_count(
+	deen_map_index *map_index,
+	const uint8_t *prefix);
+
+#endif /* __MAPINDEX_H */
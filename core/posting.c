@@ -0,0 +1,325 @@
+/*
+ * Copyright 2016-2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#include "posting.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+A 64 bit value takes at most ten bytes as a variable length integer.
+*/
+
+#define DEEN_POSTING_VARINT_MAX 10
+
+
+static size_t deen_posting_varint_len(uint64_t value) {
+	size_t len = 1;
+
+	while (value >= 0x80) {
+		value >>= 7;
+		len++;
+	}
+
+	return len;
+}
+
+
+static size_t deen_posting_varint_write(uint8_t *c, uint64_t value) {
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		c[len++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+
+	c[len++] = (uint8_t) value;
+	return len;
+}
+
+
+/*
+Reads a variable length integer from the block.  Returns the number of bytes
+consumed or zero if the block ends before the integer does.
+*/
+
+static size_t deen_posting_varint_read(const uint8_t *c, size_t c_len, uint64_t *value) {
+	size_t i;
+	uint64_t result = 0;
+
+	for (i = 0; i < c_len && i < DEEN_POSTING_VARINT_MAX; i++) {
+		result |= ((uint64_t) (c[i] & 0x7f)) << (7 * i);
+
+		if (0 == (c[i] & 0x80)) {
+			*value = result;
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static void deen_posting_ensure_buffer(uint8_t **buffer, size_t *buffer_allocated, size_t len) {
+	if (*buffer_allocated < len) {
+		*buffer_allocated = len;
+		*buffer = (uint8_t *) deen_erealloc(*buffer, len);
+	}
+}
+
+
+size_t deen_posting_encode(
+	const off_t *refs,
+	size_t refs_count,
+	uint8_t **buffer,
+	size_t *buffer_allocated) {
+
+	size_t delta_len = 1;
+	size_t bitmap_len = SIZE_MAX;
+	size_t len = 0;
+	size_t i;
+
+	if (0 == refs_count) {
+		deen_posting_ensure_buffer(buffer, buffer_allocated, 1);
+		(*buffer)[0] = DEEN_POSTING_ENCODING_DELTA;
+		return 1;
+	}
+
+	// work out how large each of the encodings would be.
+
+	delta_len += deen_posting_varint_len((uint64_t) refs[0]);
+
+	for (i = 1; i < refs_count; i++) {
+		delta_len += deen_posting_varint_len((uint64_t) (refs[i] - refs[i - 1]));
+	}
+
+	{
+		uint64_t span = (uint64_t) (refs[refs_count - 1] - refs[0]);
+
+		if (span / 8 < delta_len) {
+			size_t bitmap_bytes = (size_t) (span / 8) + 1;
+			bitmap_len = 1
+				+ deen_posting_varint_len((uint64_t) refs[0])
+				+ deen_posting_varint_len((uint64_t) bitmap_bytes)
+				+ bitmap_bytes;
+		}
+	}
+
+	if (bitmap_len < delta_len) {
+		size_t bitmap_bytes = (size_t) ((uint64_t) (refs[refs_count - 1] - refs[0]) / 8) + 1;
+		uint8_t *bitmap;
+
+		deen_posting_ensure_buffer(buffer, buffer_allocated, bitmap_len);
+		(*buffer)[len++] = DEEN_POSTING_ENCODING_BITMAP;
+		len += deen_posting_varint_write(&((*buffer)[len]), (uint64_t) refs[0]);
+		len += deen_posting_varint_write(&((*buffer)[len]), (uint64_t) bitmap_bytes);
+		bitmap = &((*buffer)[len]);
+		memset(bitmap, 0, bitmap_bytes);
+
+		for (i = 0; i < refs_count; i++) {
+			uint64_t bit = (uint64_t) (refs[i] - refs[0]);
+			bitmap[bit / 8] |= (uint8_t) (1 << (bit % 8));
+		}
+
+		return len + bitmap_bytes;
+	}
+
+	deen_posting_ensure_buffer(buffer, buffer_allocated, delta_len);
+	(*buffer)[len++] = DEEN_POSTING_ENCODING_DELTA;
+	len += deen_posting_varint_write(&((*buffer)[len]), (uint64_t) refs[0]);
+
+	for (i = 1; i < refs_count; i++) {
+		len += deen_posting_varint_write(&((*buffer)[len]), (uint64_t) (refs[i] - refs[i - 1]));
+	}
+
+	return len;
+}
+
+
+static deen_bool deen_posting_decode_delta(
+	const uint8_t *c,
+	size_t c_len,
+	off_t *refs,
+	size_t refs_count) {
+
+	size_t upto = 0;
+	size_t i;
+	uint64_t ref = 0;
+
+	for (i = 0; i < refs_count; i++) {
+		uint64_t value;
+		size_t value_len = deen_posting_varint_read(&c[upto], c_len - upto, &value);
+
+		if (0 == value_len) {
+			return DEEN_FALSE;
+		}
+
+		upto += value_len;
+		ref += value;
+		refs[i] = (off_t) ref;
+	}
+
+	return upto == c_len;
+}
+
+
+static deen_bool deen_posting_decode_bitmap(
+	const uint8_t *c,
+	size_t c_len,
+	off_t *refs,
+	size_t refs_count) {
+
+	uint64_t base;
+	uint64_t bitmap_bytes;
+	size_t upto = 0;
+	size_t value_len;
+	size_t found = 0;
+	size_t i;
+
+	if (0 == (value_len = deen_posting_varint_read(c, c_len, &base))) {
+		return DEEN_FALSE;
+	}
+
+	upto += value_len;
+
+	if (0 == (value_len = deen_posting_varint_read(&c[upto], c_len - upto, &bitmap_bytes))) {
+		return DEEN_FALSE;
+	}
+
+	upto += value_len;
+
+	if (bitmap_bytes != (uint64_t) (c_len - upto)) {
+		return DEEN_FALSE;
+	}
+
+	for (i = 0; i < (size_t) bitmap_bytes; i++) {
+		uint8_t bits = c[upto + i];
+
+		// most of the bytes are expected to be empty.
+
+		while (0 != bits) {
+			uint8_t bit = 0;
+
+			while (0 == (bits & (1 << bit))) {
+				bit++;
+			}
+
+			if (found == refs_count) {
+				return DEEN_FALSE;
+			}
+
+			refs[found++] = (off_t) (base + (i * 8) + bit);
+			bits &= (uint8_t) ~(1 << bit);
+		}
+	}
+
+	return found == refs_count;
+}
+
+
+deen_bool deen_posting_decode(
+	const uint8_t *block,
+	size_t block_len,
+	off_t *refs,
+	size_t refs_count) {
+
+	if (0 == block_len) {
+		return DEEN_FALSE;
+	}
+
+	switch (block[0]) {
+		case DEEN_POSTING_ENCODING_DELTA:
+			return deen_posting_decode_delta(&block[1], block_len - 1, refs, refs_count);
+		case DEEN_POSTING_ENCODING_BITMAP:
+			return deen_posting_decode_bitmap(&block[1], block_len - 1, refs, refs_count);
+		default:
+			return DEEN_FALSE;
+	}
+}
+
+
+/*
+Finds the first of the refs at or after 'from' that is not less than 'ref'.
+The search steps forward in steps that double in size until it passes the ref
+and then it searches back over the last step.
+*/
+
+static size_t deen_posting_gallop(
+	const off_t *refs,
+	size_t from,
+	size_t refs_count,
+	off_t ref) {
+
+	size_t step = 1;
+	size_t lo;
+	size_t hi;
+
+	if (from >= refs_count || refs[from] >= ref) {
+		return from;
+	}
+
+	while (step < refs_count - from && refs[from + step] < ref) {
+		step *= 2;
+	}
+
+	lo = from + (step / 2) + 1;
+	hi = step < refs_count - from ? from + step : refs_count;
+
+	while (lo < hi) {
+		size_t mid = lo + ((hi - lo) / 2);
+
+		if (refs[mid] < ref) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+
+size_t deen_posting_intersect(
+	off_t *refs,
+	size_t refs_count,
+	const off_t *other_refs,
+	size_t other_refs_count) {
+
+	size_t found = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	// a ref is only ever written back at or before where it was read from so
+	// the intersection is able to be written in place.
+
+	if (refs_count <= other_refs_count) {
+		for (i = 0; i < refs_count && j < other_refs_count; i++) {
+			j = deen_posting_gallop(other_refs, j, other_refs_count, refs[i]);
+
+			if (j < other_refs_count && other_refs[j] == refs[i]) {
+				refs[found++] = refs[i];
+				j++;
+			}
+		}
+	}
+	else {
+		for (j = 0; j < other_refs_count && i < refs_count; j++) {
+			i = deen_posting_gallop(refs, i, refs_count, other_refs[j]);
+
+			if (i < refs_count && refs[i] == other_refs[j]) {
+				refs[found++] = refs[i];
+				i++;
+			}
+		}
+	}
+
+	return found;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2016-2019, Andrew Lindesay. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ * Authors:
+ *		Andrew Lindesay, apl@lindesay.co.nz
+ */
+
+#ifndef __POSTING_H
+#define __POSTING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+
+/*
+The refs for a prefix (its "posting list") are stored in the index as a single
+compressed block.  The first byte of the block identifies how the refs have
+been encoded;
+
+- DEEN_POSTING_ENCODING_DELTA; the first ref and then the difference to each
+  subsequent ref are stored as variable length integers.
+- DEEN_POSTING_ENCODING_BITMAP; the first ref and then a bitmap covering the
+  range of the refs with a bit set for each ref that is present.
+
+The encoding that produces the smaller block is chosen automatically.
+*/
+
+#define DEEN_POSTING_ENCODING_DELTA 1
+#define DEEN_POSTING_ENCODING_BITMAP 2
+
+/*
+Encodes the refs which must be ordered and unique.  The encoded block is
+written into the buffer which will be grown as necessary; the caller owns the
+buffer and can re-use it between calls.  Returns the length of the block.
+*/
+
+size_t deen_posting_encode(
+	const off_t *refs,
+	size_t refs_count,
+	uint8_t **buffer,
+	size_t *buffer_allocated);
+
+/*
+Decodes the block into the refs which must have space for refs_count values.
+The refs come out ordered.  Returns false if the block is corrupt or does not
+hold refs_count refs.
+*/
+
+deen_bool deen_posting_decode(
+	const uint8_t *block,
+	size_t block_len,
+	off_t *refs,
+	size_t refs_count);
+
+/*
+Intersects the ordered and unique refs with the other refs.  The refs that are
+in both are written back into the start of 'refs' and their number is
+returned.  The shorter of the two lists is walked and each of its refs is
+looked for in the longer list by stepping forward in ever larger steps from
+where the last ref was found.  This takes time in proportion to the length of
+the shorter list multiplied by the log of the ratio of the lengths so it is
+quick both when the lists are of about the same length and when one is much
+shorter than the other.
+*/
+
+size_t deen_posting_intersect(
+	off_t *refs,
+	size_t refs_count,
+	const off_t *other_refs,
+	size_t other_refs_count);
+
+#endif /* __POSTING_H */
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "common.h"
@@ -23,23 +24,117 @@
 #include "entry.h"
 #include "index.h"
 #include "keyword.h"
+#include "mapindex.h"
+#include "posting.h"
 
 #define SIZE_BUFFER_LINE_DEFAULT 196
 
+/*
+The lines at the refs of a search are asked for ahead of being checked; this
+many refs at a time.  A line is taken to be no longer than the line length and
+lines that are closer than the gap are asked for in one range so that the
+reads are of fewer, larger blocks.
+*/
+
+#define DEEN_SEARCH_PREFETCH_REFS 256
+#define DEEN_SEARCH_PREFETCH_LINE_LEN 256
+#define DEEN_SEARCH_PREFETCH_GAP 16384
+
+/*
+The german and the english text of a line as they lie in the line.
+*/
+
+typedef struct deen_search_line_parts deen_search_line_parts;
+struct deen_search_line_parts {
+	const uint8_t *german;
+	size_t german_len;
+	const uint8_t *english;
+	size_t english_len;
+};
+
+
+/*
+A line that has all of the keywords with what it needs to be ranked.
+*/
+
+typedef struct deen_search_candidate deen_search_candidate;
+struct deen_search_candidate {
+	off_t ref;
+	uint32_t distance_from_keywords;
+	uint32_t german_sub_count;
+};
+
 void deen_search_free(deen_search_context *context) {
+	deen_entry_parser_free(&(context->entry_parser));
+	deen_unmap_file(context->data, context->data_len);
+
 	if (-1 != context->fd_data) {
 		close(context->fd_data);
 	}
 
+	if (NULL != context->index_reader) {
+		deen_index_reader_free(context->index_reader);
+	}
+
 	if (NULL != context->db) {
 		sqlite3_close_v2(context->db);
 	}
 
+	if (NULL != context->map_index) {
+		deen_map_index_close(context->map_index);
+	}
+
+	if (NULL != context->segments) {
+		deen_index_segments_free(context->segments);
+	}
+
+	if (NULL != context->deen_root_dir) {
+		free((void *) context->deen_root_dir);
+	}
+
 	free((void *) context);
 }
 
 
+/*
+Finds the generation of the file at the path.  Returns false if there is no
+file at the path.
+*/
+
+static deen_bool deen_search_file_generation(const char *path, deen_file_generation *generation) {
+	struct stat path_stat;
+
+	if (0 != stat(path, &path_stat)) {
+		return DEEN_FALSE;
+	}
+
+	generation->dev = path_stat.st_dev;
+	generation->ino = path_stat.st_ino;
+	generation->size = path_stat.st_size;
+	generation->mtime = path_stat.st_mtime;
+
+	return DEEN_TRUE;
+}
+
+
+static deen_bool deen_search_file_generation_equals(
+	const deen_file_generation *generation1,
+	const deen_file_generation *generation2) {
+	return generation1->dev == generation2->dev
+		&& generation1->ino == generation2->ino
+		&& generation1->size == generation2->size
+		&& generation1->mtime == generation2->mtime;
+}
+
+
 deen_search_context *deen_search_init(char *deen_root_dir) {
+	return deen_search_init_with_index_format(deen_root_dir, DEEN_INDEX_FORMAT_AUTOMATIC);
+}
+
+
+deen_search_context *deen_search_init_with_index_format(
+	char *deen_root_dir,
+	deen_index_format index_format) {
 
 	deen_search_context *context = (deen_search_context *) deen_emalloc(sizeof(deen_search_context));
 
@@ -47,6 +142,25 @@ deen_search_context *deen_search_init(char *deen_root_dir) {
 	char *data_path = deen_data_path(deen_root_dir);
 	char *index_path = deen_index_path(deen_root_dir);
 
+	context->db = NULL;
+	context->map_index = NULL;
+	context->index_reader = NULL;
+	context->segments = NULL;
+	context->data = NULL;
+	context->data_len = 0;
+	deen_entry_parser_init(&(context->entry_parser));
+	context->deen_root_dir = (char *) deen_emalloc(strlen(deen_root_dir) + 1);
+	strcpy(context->deen_root_dir, deen_root_dir);
+	context->index_format = index_format;
+	memset(&(context->generation), 0, sizeof(deen_file_generation));
+
+	// the sqlite index is the last file to be moved into place by an install.
+	// Its generation is found before anything is opened so that if a newer
+	// install is moved into place in between then that will be noticed on
+	// the next search.
+
+	deen_search_file_generation(index_path, &(context->generation));
+
 	context->fd_data = open(data_path, O_RDONLY
 #ifdef __MINGW32__
 		|O_BINARY
@@ -57,13 +171,73 @@ deen_search_context *deen_search_init(char *deen_root_dir) {
 		is_error = DEEN_TRUE;
 		DEEN_LOG_ERROR1("unable to open data file; %s", data_path);
 	} else {
+		context->data = deen_map_file(context->fd_data, &(context->data_len), DEEN_FALSE);
 #ifdef DEBUG
 		DEEN_LOG_INFO1("opened data file; %s", data_path);
 #endif
 	}
 
-	if (SQLITE_OK != sqlite3_open_v2(index_path, &(context->db), SQLITE_OPEN_READONLY, NULL)) {
-		DEEN_LOG_ERROR1("unable to open the sqllite3 database; %s", index_path);
+	if (DEEN_INDEX_FORMAT_SQLITE != index_format) {
+		char *map_index_path = deen_map_index_path(deen_root_dir);
+
+		context->map_index = deen_map_index_open(map_index_path);
+
+		if (NULL == context->map_index) {
+			if (DEEN_INDEX_FORMAT_MAP == index_format) {
+				is_error = DEEN_TRUE;
+				DEEN_LOG_ERROR1("unable to open the map index; %s", map_index_path);
+			}
+		} else {
+#ifdef DEBUG
+			DEEN_LOG_INFO1("opened map index; %s", map_index_path);
+#endif
+		}
+
+		free((void *) map_index_path);
+	}
+
+	// the sqlite index is opened even if the map index is used because it has
+	// the metadata as well as the delta segments and the tombstones.
+
+	if (!is_error) {
+		if (SQLITE_OK != sqlite3_open_v2(index_path, &(context->db), SQLITE_OPEN_READONLY, NULL)) {
+			is_error = DEEN_TRUE;
+			DEEN_LOG_ERROR1("unable to open the sqllite3 database; %s", index_path);
+		}
+		else {
+			deen_index_metadata metadata;
+
+			if (!deen_index_read_metadata(context->db, &metadata)) {
+				is_error = DEEN_TRUE;
+				DEEN_LOG_ERROR1("the index has no metadata; the data should be installed again; %s", index_path);
+			}
+			else {
+				if (!deen_index_metadata_is_current(&metadata)) {
+					is_error = DEEN_TRUE;
+					DEEN_LOG_ERROR3("the index was built with indexing depth %u and format %u; the data should be installed again; %s",
+						metadata.indexing_depth, metadata.format_version, index_path);
+				}
+			}
+		}
+	}
+
+	// the prefixes of the sqlite index are only needed if there is no map
+	// index.
+
+	if (!is_error) {
+		context->index_reader = deen_index_reader_open(context->db, NULL == context->map_index);
+
+		if (NULL == context->index_reader) {
+			is_error = DEEN_TRUE;
+		}
+	}
+
+	if (!is_error) {
+		context->segments = deen_index_segments_read(context->db);
+
+		if (NULL == context->segments) {
+			is_error = DEEN_TRUE;
+		}
 	}
 
 	free((void *) data_path);
@@ -78,6 +252,38 @@ deen_search_context *deen_search_init(char *deen_root_dir) {
 }
 
 
+/*
+If a newer install has been moved into place since the context was opened then
+the context is re-opened on the newer install.  The files that the context has
+open stay usable while the install happens so if the newer install is not able
+to be opened then the context carries on with what it has.
+*/
+
+static void deen_search_refresh(deen_search_context *context) {
+	char *path = deen_index_path(context->deen_root_dir);
+	deen_file_generation generation;
+	deen_bool is_changed =
+		deen_search_file_generation(path, &generation)
+		&& !deen_search_file_generation_equals(&generation, &(context->generation));
+
+	free((void *) path);
+
+	if (is_changed) {
+		deen_search_context *newer_context = deen_search_init_with_index_format(
+			context->deen_root_dir,
+			context->index_format);
+
+		if (NULL != newer_context) {
+			deen_search_context older_context = *context;
+			*context = *newer_context;
+			*newer_context = older_context;
+			deen_search_free(newer_context);
+			DEEN_LOG_INFO0("re-opened the search on a newer install");
+		}
+	}
+}
+
+
 /*
 This function is used with quick sort to order the
 references into the data.
@@ -92,264 +298,492 @@ static int deen_compare_refs(const void *item1, const void *item2) {
 }
 
 
-/**
- * This function will find the intersection of the "refs_combined" and the
- * "refs".  It will return the new length of the "refs_combined".  The length
- * will be the same or smaller than the "refs_length" value.
- */
+/*
+Reads the line at the ref into the buffer when the data is not mapped.  The
+buffer is grown if the line does not fit.  Returns false if the line could not
+be read.
+*/
 
-static int deen_search_intersect_refs(
-	off_t *refs_combined,
-	off_t *refs,
-	size_t refs_combined_length,
-	size_t refs_length) {
+static deen_bool deen_search_read_line(
+	deen_search_context *context,
+	off_t ref,
+	uint8_t **buffer,
+	size_t *buffer_size,
+	size_t *line_len) {
 
-	size_t i;
+	ssize_t bufferread_size = 0;
+	uint8_t *newline_c = NULL;
+
+	// move to the point in the file where the line starts.
+
+	if (-1 == lseek(context->fd_data, ref, SEEK_SET)) {
+		DEEN_LOG_ERROR1("unable to seek in data to; %d", (int) ref);
+		return DEEN_FALSE;
+	}
+
+	// read in a line of data; this should fairly quickly right-size the
+	// buffer and therefore will be fairly optimal.
+
+	do {
+		ssize_t actuallyread;
+
+	// if the buffer is too small then resize it to make it
+	// larger.
 
-	for (i=0;i<refs_combined_length;) {
-		if (NULL == bsearch(
-			&refs_combined[i], // what to find
-			refs,
-			refs_length,
-			sizeof(off_t),
-			&deen_compare_refs)) {
-			if (i<refs_combined_length-1)
-				memmove(
-					&refs_combined[i],
-					&refs_combined[i+1],
-					sizeof(size_t) * ((refs_combined_length-i)-1)
-				);
-			refs_combined_length--;
+		if (bufferread_size == *buffer_size) {
+			*buffer_size *= 2;
+			*buffer = (uint8_t *) deen_erealloc(*buffer, *buffer_size);
 		}
-		else {
-			i++;
+
+		actuallyread = read(context->fd_data, &((*buffer)[bufferread_size]), (*buffer_size - bufferread_size));
+
+		switch (actuallyread) {
+			case 0:
+				(*buffer)[bufferread_size] = '\n';
+				bufferread_size++;
+				break;
+
+			case -1:
+				DEEN_LOG_ERROR1("an error has arisen accessing the data at; %u", ref);
+				return DEEN_FALSE;
+
+			default:
+				bufferread_size += actuallyread;
+				break;
 		}
 	}
+	while (NULL == (newline_c = deen_strnchr(*buffer, '\n', bufferread_size)));
+
+	*line_len = newline_c - *buffer;
 
-	return refs_combined_length;
+	return DEEN_TRUE;
 }
 
-/**
- * This function will take the refs and will return the results, unsorted.
- */
 
+/*
+Finds the "::" that separates the german from the english in the line.
+Returns DEEN_NOT_FOUND if there is no separator.
+*/
 
-static deen_search_result *deen_search_refs_to_result(
-	deen_search_context *context,
-	deen_keywords *keywords,
-	off_t *refs,
-	size_t refs_length) {
+static size_t deen_search_find_separator(const uint8_t *line, size_t line_len) {
+	const uint8_t *c = line;
+	const uint8_t *end = &line[line_len];
 
-	size_t i;
-	deen_bool is_error = DEEN_FALSE;
-	uint8_t *buffer = (uint8_t *) deen_emalloc(sizeof(uint8_t) * SIZE_BUFFER_LINE_DEFAULT);
-	size_t buffer_size = SIZE_BUFFER_LINE_DEFAULT;
+	while (NULL != (c = (const uint8_t *) memchr(c, ':', end - c))) {
+		if (c + 1 < end && ':' == c[1]) {
+			return c - line;
+		}
 
-	deen_search_result *result = (deen_search_result *) deen_emalloc(sizeof(deen_search_result));
-	result->entries = NULL;
-	result->total_count = 0;
-	result->entry_count = 0;
+		c++;
+	}
 
-	for (i=0;!is_error && i<refs_length;i++) {
+	return DEEN_NOT_FOUND;
+}
 
-		ssize_t bufferread_size;
-		uint8_t *newline_c;
 
-	// move to the point in the file where the line starts.
+/*
+Asks for the lines at the refs, which are in order, to be read in.  This does
+not wait for them so if the data is not in memory already then the reads of all
+of the ranges can happen at the same time rather than one after another as each
+line is checked.
+*/
 
-		if (-1 == lseek(context->fd_data, refs[i], SEEK_SET)) {
-			DEEN_LOG_ERROR1("unable to seek in data to; %d", (int) refs[i]);
-			is_error = DEEN_TRUE;
+static void deen_search_prefetch_lines(
+	deen_search_context *context,
+	const off_t *refs,
+	size_t refs_count) {
+
+	size_t i = 0;
+	size_t ranges_count = 0;
+
+	while (i < refs_count) {
+		off_t start = refs[i];
+		off_t end = refs[i] + DEEN_SEARCH_PREFETCH_LINE_LEN;
+
+		for (i++; i < refs_count && refs[i] <= end + DEEN_SEARCH_PREFETCH_GAP; i++) {
+			end = refs[i] + DEEN_SEARCH_PREFETCH_LINE_LEN;
 		}
 
-	// now read the line containing the data.
+		if (NULL != context->data && start >= 0 && (size_t) start < context->data_len) {
+			deen_map_file_will_need(context->data, context->data_len, (size_t) start, (size_t) (end - start));
+		}
+		else {
+			deen_file_will_need(context->fd_data, start, (size_t) (end - start));
+		}
 
-		bufferread_size = 0;
-		newline_c = NULL;
+		ranges_count++;
+	}
 
-	// read in a line of data; this should fairly quickly right-size the
-	// buffer and therefore will be fairly optimal.
+	DEEN_LOG_TRACE2("prefetch %u refs in %u ranges", (unsigned) refs_count, (unsigned) ranges_count);
+}
 
-		do {
-			ssize_t actuallyread;
 
-	// if the buffer is too small then resize it to make it
-	// larger.
+/*
+Finds the line at the ref.  If the data is mapped then the line is where it
+lies in the data and otherwise it is read into the buffer.  Lines that were
+appended to the data after it was mapped are read as well.  Returns false if the
+line could not be read.
+*/
 
-			if (bufferread_size == buffer_size) {
-				buffer_size *= 2;
-				buffer = (uint8_t *) deen_erealloc(buffer, buffer_size);
-			}
+static deen_bool deen_search_line(
+	deen_search_context *context,
+	off_t ref,
+	uint8_t **buffer,
+	size_t *buffer_size,
+	const uint8_t **line,
+	size_t *line_len) {
+
+	if (NULL != context->data && ref >= 0 && (size_t) ref < context->data_len) {
+		const uint8_t *newline_c;
+
+		*line = &(context->data[ref]);
+		newline_c = (const uint8_t *) memchr(*line, '\n', context->data_len - (size_t) ref);
+		*line_len = NULL == newline_c ? context->data_len - (size_t) ref : (size_t) (newline_c - *line);
+		return DEEN_TRUE;
+	}
 
-			actuallyread = read(context->fd_data, &buffer[bufferread_size], (buffer_size-bufferread_size));
+	if (deen_search_read_line(context, ref, buffer, buffer_size, line_len)) {
+		*line = *buffer;
+		return DEEN_TRUE;
+	}
 
-			switch (actuallyread) {
-				case 0:
-					buffer[bufferread_size] = '\n';
-					bufferread_size++;
-					break;
+	return DEEN_FALSE;
+}
 
-				case -1:
-					DEEN_LOG_ERROR1("an error has arisen accessing the data at; %u", refs[i]);
-					is_error = DEEN_TRUE;
-					break;
 
-				default:
-					bufferread_size += actuallyread;
-					break;
-			}
-		}
-		while (!is_error && NULL == (newline_c = deen_strnchr(buffer,'\n',bufferread_size)));
+/*
+Splits the line into the german and the english text on either side of the
+"::" with the whitespace trimmed from the inner ends.  Returns false if the
+line is a comment or is not able to be split.
+*/
 
-	// if the line starts with '#' then it is a comment and we do not
-	// wish to process comments.
+static deen_bool deen_search_split_line(
+	off_t ref,
+	const uint8_t *line,
+	size_t line_len,
+	deen_search_line_parts *parts) {
 
-		if (!is_error && 0 != buffer[0] && '#' != buffer[0]) {
-			uint8_t *separator_c;
+	size_t separator_i;
 
-			newline_c[0] = 0;
+	// if the line starts with '#' then it is a comment and we do not
+	// wish to process comments.
 
-	// need to make sure that all of the keywords are able to be found
-	// in the line.
+	if (0 == line_len || 0 == line[0] || '#' == line[0]) {
+		return DEEN_FALSE;
+	}
 
-			separator_c = (uint8_t *) strstr((const char *)buffer, "::");
+	separator_i = deen_search_find_separator(line, line_len);
 
-			if (NULL == separator_c) {
+	if (DEEN_NOT_FOUND == separator_i) {
 #ifdef DEBUG
-				DEEN_LOG_ERROR2("corrupted line missing '::' separator at offset %d \"%s\n",
-				(int) refs[i], buffer);
+		DEEN_LOG_ERROR3("corrupted line missing '::' separator at offset %d \"%.*s\n",
+		(int) ref, (int) line_len, line);
 #else
-				DEEN_LOG_ERROR1("corrupted line missing '::' separator at offset %d",(int) refs[i]);
+		DEEN_LOG_ERROR1("corrupted line missing '::' separator at offset %d",(int) ref);
 #endif
+		return DEEN_FALSE;
+	}
+
+	parts->german = line;
+	parts->german_len = separator_i;
+	parts->english = &line[separator_i + 2];
+	parts->english_len = line_len - (separator_i + 2);
+
+	// now remove whitespace from the end of the german data.
+
+	while (parts->german_len > 1 && isspace(parts->german[parts->german_len - 1])) {
+		parts->german_len--;
+	}
+
+	// now remove whitespace from the start of the english data.
+
+	while (0 != parts->english_len && isspace(parts->english[0])) {
+		parts->english++;
+		parts->english_len--;
+	}
+
+	return DEEN_TRUE;
+}
+
+
+// ---------------------------------------------------------------
+// RANKING
+// ---------------------------------------------------------------
+
+/*
+Candidates are ordered by how far they are from the keywords and then, if they
+are the same distance, the less complex one first.  The ref is the last resort
+so that the order is always the same.
+*/
+
+static int deen_search_compare_candidates(
+	const deen_search_candidate *candidate1,
+	const deen_search_candidate *candidate2) {
+
+	if (candidate1->distance_from_keywords != candidate2->distance_from_keywords) {
+		return candidate1->distance_from_keywords < candidate2->distance_from_keywords ? -1 : 1;
+	}
+
+	if (candidate1->german_sub_count != candidate2->german_sub_count) {
+		return candidate1->german_sub_count < candidate2->german_sub_count ? -1 : 1;
+	}
+
+	if (candidate1->ref == candidate2->ref) {
+		return 0;
+	}
+
+	return candidate1->ref < candidate2->ref ? -1 : 1;
+}
+
+
+static int deen_search_sort_callback(const void *a, const void *b) {
+	return deen_search_compare_candidates(
+		(const deen_search_candidate *) a,
+		(const deen_search_candidate *) b);
+}
+
+
+/*
+The candidates are kept in a heap with the worst of them at the top so that it
+is quick to find out if a new candidate is better than any of them.
+*/
+
+static void deen_search_candidates_sift_down(
+	deen_search_candidate *candidates,
+	size_t candidates_count,
+	size_t i) {
+
+	for (;;) {
+		size_t worst = i;
+		size_t left = (i * 2) + 1;
+		size_t right = left + 1;
+		deen_search_candidate swap;
+
+		if (left < candidates_count
+			&& deen_search_compare_candidates(&candidates[left], &candidates[worst]) > 0) {
+			worst = left;
+		}
+
+		if (right < candidates_count
+			&& deen_search_compare_candidates(&candidates[right], &candidates[worst]) > 0) {
+			worst = right;
+		}
+
+		if (worst == i) {
+			return;
+		}
+
+		swap = candidates[i];
+		candidates[i] = candidates[worst];
+		candidates[worst] = swap;
+		i = worst;
+	}
+}
+
+
+static void deen_search_candidates_add(
+	deen_search_candidate *candidates,
+	size_t *candidates_count,
+	size_t candidates_max,
+	const deen_search_candidate *candidate) {
+
+	if (*candidates_count < candidates_max) {
+		size_t i = *candidates_count;
+
+		candidates[i] = *candidate;
+		(*candidates_count)++;
+
+		while (0 != i) {
+			size_t parent = (i - 1) / 2;
+			deen_search_candidate swap;
+
+			if (deen_search_compare_candidates(&candidates[i], &candidates[parent]) <= 0) {
+				break;
 			}
-			else {
 
-				uint8_t *german_c = buffer;
-				uint8_t *english_c = &separator_c[2];
+			swap = candidates[i];
+			candidates[i] = candidates[parent];
+			candidates[parent] = swap;
+			i = parent;
+		}
+	}
+	else {
+		if (0 != candidates_max && deen_search_compare_candidates(candidate, &candidates[0]) < 0) {
+			candidates[0] = *candidate;
+			deen_search_candidates_sift_down(candidates, candidates_max, 0);
+		}
+	}
+}
 
-				// now remove whitespace from the end of the german data.
 
-				{
-					uint8_t *german_end_c = separator_c;
+/**
+ * This function will take the refs and will return the results in order.
+ * Each line is checked for the keywords and scored where it lies in the data;
+ * only the best lines, up to the maximum count, are parsed into entries.
+ */
 
-					do {
-						german_end_c[0] = 0;
-						german_end_c--;
-					}
-					while(german_end_c > german_c && isspace(german_end_c[0]));
-				}
 
-// now remove whitespace from the start of the english data.
+static deen_search_result *deen_search_refs_to_result(
+	deen_search_context *context,
+	deen_keywords *keywords,
+	off_t *refs,
+	size_t refs_length,
+	size_t max_result_count) {
 
-				while(0 != english_c[0] && isspace(english_c[0])) {
-					english_c++;
-				}
+	size_t i;
+	deen_bool is_error = DEEN_FALSE;
+	uint8_t *buffer = (uint8_t *) deen_emalloc(sizeof(uint8_t) * SIZE_BUFFER_LINE_DEFAULT);
+	size_t buffer_size = SIZE_BUFFER_LINE_DEFAULT;
+	size_t prefetched_count = 0;
+	size_t candidates_max = max_result_count < refs_length ? max_result_count : refs_length;
+	size_t candidates_count = 0;
+	deen_search_candidate *candidates = (deen_search_candidate *) deen_emalloc(
+		sizeof(deen_search_candidate) * (candidates_max + 1));
 
-// check that all of the keywords appear in either the english
-// or the german text.
+	// allocated once to avoid continuously allocating memory.
+	deen_bool *keyword_use_map = (deen_bool *) deen_emalloc(sizeof(deen_bool) * (keywords->count + 1));
 
-				if (deen_keywords_all_present(keywords, german_c) ||
-					deen_keywords_all_present(keywords, english_c)) {
+	deen_search_result *result = (deen_search_result *) deen_emalloc(sizeof(deen_search_result));
+	result->entries = NULL;
+	deen_arena_init(&(result->arena));
+	result->total_count = 0;
+	result->entry_count = 0;
 
-// this entry looks like a viable one so build it.
+	for (i=0;!is_error && i<refs_length;i++) {
 
-					deen_entry entry = deen_entry_create(german_c, english_c);
+		const uint8_t *line = NULL;
+		size_t line_len = 0;
+		deen_search_line_parts parts;
 
-					if (
-						(0 != entry.english_sub_count) &&
-						(0 != entry.german_sub_count) ) {
+	// keep the lines of the next batch of refs being read in while the
+	// lines of this batch are checked.
 
-						if (0==result->entry_count) {
-							result->entries = (deen_entry *) deen_emalloc(sizeof(deen_entry));
-						}
-						else {
-							result->entries = (deen_entry *) deen_erealloc(
-								result->entries,
-								(result->entry_count + 1) * sizeof(deen_entry)
-							);
-						}
+		if (prefetched_count < refs_length && prefetched_count <= i + DEEN_SEARCH_PREFETCH_REFS) {
+			size_t prefetch_count = refs_length - prefetched_count;
 
-						memcpy(
-							&(result->entries[result->entry_count]),
-							&entry,
-							sizeof(deen_entry));
+			if (prefetch_count > DEEN_SEARCH_PREFETCH_REFS) {
+				prefetch_count = DEEN_SEARCH_PREFETCH_REFS;
+			}
 
-						DEEN_LOG_TRACE1("added entry; total now at %d",result->entry_count);
+			deen_search_prefetch_lines(context, &refs[prefetched_count], prefetch_count);
+			prefetched_count += prefetch_count;
+		}
 
-						result->total_count++;
-						result->entry_count++;
-					}
+		if (!deen_search_line(context, refs[i], &buffer, &buffer_size, &line, &line_len)) {
+			is_error = DEEN_TRUE;
+		}
+		else {
 
+	// need to make sure that all of the keywords are able to be found
+	// in either the english or the german text.
+
+			if (deen_search_split_line(refs[i], line, line_len, &parts)) {
+				if (deen_keywords_all_present_len(keywords, parts.german, parts.german_len) ||
+					deen_keywords_all_present_len(keywords, parts.english, parts.english_len)) {
+
+					deen_search_candidate candidate;
+
+					candidate.ref = refs[i];
+					candidate.distance_from_keywords = deen_entry_calculate_line_distance_from_keywords(
+						parts.german, parts.german_len,
+						parts.english, parts.english_len,
+						keywords, keyword_use_map,
+						&(candidate.german_sub_count));
+
+					deen_search_candidates_add(candidates, &candidates_count, candidates_max, &candidate);
+					result->total_count++;
 				}
 				else {
-					DEEN_LOG_TRACE2("keywords not found in; %s :: %s", german_c, english_c);
+					DEEN_LOG_TRACE3("keywords not found at %d; %.*s", (int) refs[i], (int) line_len, line);
 				}
 			}
 		}
 	}
 
-	if (is_error) {
-		deen_search_result_free(result);
-		return NULL;
-	}
+	// only the lines of the best candidates are parsed into entries; they
+	// are parsed where they lie and only the text of the atoms is copied.
 
-	return result;
-}
+	if (!is_error && 0 != candidates_count) {
+		qsort(candidates, candidates_count, sizeof(deen_search_candidate), deen_search_sort_callback);
+		result->entries = (deen_entry *) deen_arena_alloc(&(result->arena), sizeof(deen_entry) * candidates_count);
 
+		for (i = 0; !is_error && i < candidates_count; i++) {
+			const uint8_t *line = NULL;
+			size_t line_len = 0;
+			deen_search_line_parts parts;
 
-static int deen_search_sort_callback(const void *a, const void *b) {
-	deen_entry *entry_a = (deen_entry *) a;
-	deen_entry *entry_b = (deen_entry *) b;
+			if (!deen_search_line(context, candidates[i].ref, &buffer, &buffer_size, &line, &line_len)
+				|| !deen_search_split_line(candidates[i].ref, line, line_len, &parts)) {
+				DEEN_LOG_ERROR1("unable to read the line again at; %d", (int) candidates[i].ref);
+				is_error = DEEN_TRUE;
+			}
+			else {
+				deen_entry *entry = &(result->entries[result->entry_count]);
 
-	// if they are the same distance from the keywords, perhaps choose the
-	// less complex one first.
+				deen_entry_parser_parse(
+					&(context->entry_parser),
+					parts.german, parts.german_len,
+					parts.english, parts.english_len);
+				*entry = deen_entry_parser_create_entry(&(context->entry_parser), &(result->arena));
+				entry->distance_from_keywords = candidates[i].distance_from_keywords;
+				result->entry_count++;
 
-	if (entry_a->distance_from_keywords == entry_b->distance_from_keywords) {
-		int sub_count_a = entry_a->german_sub_count;
-		int sub_count_b = entry_b->german_sub_count;
-		return sub_count_a - sub_count_b;
+				DEEN_LOG_TRACE1("added entry; total now at %d",result->entry_count);
+			}
+		}
+	}
 
-		// TODO; some more complex comparisons?
+	free((void *) keyword_use_map);
+	free((void *) candidates);
+	free((void *) buffer);
+
+	if (is_error) {
+		deen_search_result_free(result);
+		return NULL;
 	}
 
-	return (int) (entry_a->distance_from_keywords - entry_b->distance_from_keywords);
+	return result;
 }
 
 
-static void deen_search_sort(deen_search_result *search_result, deen_keywords *keywords) {
-	if (search_result->entry_count > 0) {
-		uint32_t i;
-
-		// allocated once to avoid continuously allocating memory.
-		deen_bool *keyword_use_map = (deen_bool *) deen_emalloc(sizeof(deen_bool) * keywords->count);
+/*
+Returns about how many refs a lookup of the prefix would find from the counts
+that are stored in the index.  This does not read the refs themselves.
+*/
 
-		for (i=0;i<search_result->entry_count;i++) {
-			search_result->entries[i].distance_from_keywords = deen_entry_calculate_distance_from_keywords(
-				&(search_result->entries[i]), keywords, keyword_use_map);
-		}
+static uint32_t deen_search_prefix_count(
+	deen_search_context *context,
+	const uint8_t *prefix) {
 
-		qsort(
-			search_result->entries, search_result->entry_count,
-			sizeof(deen_entry), deen_search_sort_callback);
+	uint64_t count;
 
+	if (NULL != context->map_index) {
+		count = deen_map_index_lookup_count(context->map_index, prefix);
+	}
+	else {
+		count = deen_index_lookup_count(context->index_reader, prefix);
 	}
-}
 
+	count += deen_index_lookup_segments_count(context->index_reader, context->segments, prefix);
 
-static void deen_search_crop(deen_search_result *search_result, size_t max_result_count) {
-	if (max_result_count < search_result->entry_count) {
-		uint32_t i;
+	return count > UINT32_MAX ? UINT32_MAX : (uint32_t) count;
+}
 
-		for (i=max_result_count;i<search_result->entry_count;i++) {
-			deen_entry_free(&search_result->entries[i]);
-		}
 
-		search_result->entries = (deen_entry *) deen_erealloc(
-			search_result->entries,
-			sizeof(deen_entry) * max_result_count);
+typedef struct deen_search_keyword_cost deen_search_keyword_cost;
+struct deen_search_keyword_cost {
+	uint8_t *prefix;
+	uint32_t count;
+	size_t keyword_i;
+};
 
-		search_result->entry_count = max_result_count;
-	}
+
+static int deen_search_compare_keyword_costs(const void *item1, const void *item2) {
+	const deen_search_keyword_cost *cost1 = (const deen_search_keyword_cost *) item1;
+	const deen_search_keyword_cost *cost2 = (const deen_search_keyword_cost *) item2;
+	if (cost1->count != cost2->count) return cost1->count < cost2->count ? -1 : 1;
+	if (cost1->keyword_i == cost2->keyword_i) return 0;
+	return cost1->keyword_i < cost2->keyword_i ? -1 : 1;
 }
 
 
@@ -358,59 +792,103 @@ deen_search_result *deen_search(
 	deen_keywords *keywords,
 	size_t max_result_count) {
 
-	size_t keywords_longest_len = deen_keywords_longest_keyword(keywords);
-	uint8_t *keyword_prefix_buffer = (uint8_t *) deen_emalloc(sizeof(uint8_t) * keywords_longest_len);
-
+	deen_search_keyword_cost *costs = (deen_search_keyword_cost *) deen_emalloc(
+		sizeof(deen_search_keyword_cost) * (keywords->count + 1));
 	off_t *refs_combined = NULL;
 	size_t refs_combined_length = 0;
+	deen_bool is_empty = DEEN_FALSE;
 	size_t i;
 
 	deen_search_result *search_result;
 
-	for (i=0;i<keywords->count;i++) {
-		deen_index_lookup_result *lookup_result;
+	deen_search_refresh(context);
+
+	// the prefix of each keyword is looked up for the number of refs that it
+	// has.  If any keyword has no refs then there can be no results.
 
-		// copy the keyword into a buffer and then cut it off
-		// to make the prefix to search on.
+	for (i = 0; i < keywords->count; i++) {
+		size_t keyword_len = keywords->keyword_lens[i];
+		uint8_t *prefix = (uint8_t *) deen_emalloc(sizeof(uint8_t) * (keyword_len + 1));
 
-		size_t keyword_len = strlen((char *) keywords->keywords[i]);
-		memcpy(keyword_prefix_buffer, keywords->keywords[i], keyword_len);
-		deen_utf8_crop_to_unicode_len(keyword_prefix_buffer, keyword_len, DEEN_INDEXING_DEPTH);
+		memcpy(prefix, keywords->keywords[i], keyword_len);
+		prefix[keyword_len] = 0;
+		deen_utf8_crop_to_unicode_len(prefix, keyword_len, DEEN_INDEXING_DEPTH);
 
-// now actually find all of the references for the keyword and
-// then we can put the references into a set.  For the first
-// keyword, all of the references are added to the set and for
-// the remaining keywords, references which were in the set are
-// removed if they are not found for the keyword; essentially an
-// intersection of all of the refs for all of the keywords
-// supplied.
+		costs[i].prefix = prefix;
+		costs[i].keyword_i = i;
+		costs[i].count = is_empty ? 0 : deen_search_prefix_count(context, prefix);
 
-		lookup_result = deen_index_lookup(
-			context->db,
-			keyword_prefix_buffer);
+		if (0 == costs[i].count) {
+			is_empty = DEEN_TRUE;
+		}
+	}
+
+	// the keywords with the fewest refs are taken first so that the refs for
+	// the keywords with many refs are intersected with as few refs as
+	// possible.  Once the intersection is empty there can be no results so
+	// the remaining keywords are not looked up at all.
+
+	qsort(costs, keywords->count, sizeof(deen_search_keyword_cost), &deen_search_compare_keyword_costs);
+
+	for (i = 0; !is_empty && i < keywords->count; i++) {
+		deen_index_lookup_result *lookup_result;
+		const uint8_t *prefix = costs[i].prefix;
+
+		DEEN_LOG_TRACE2("lookup prefix [%s] with about %u refs", prefix, costs[i].count);
+
+		if (NULL != context->map_index) {
+			lookup_result = deen_map_index_lookup(
+				context->map_index,
+				prefix);
+		}
+		else {
+			lookup_result = deen_index_lookup(
+				context->index_reader,
+				prefix);
+		}
 
-		qsort(
-			lookup_result->refs,
-			lookup_result->refs_count,
-			sizeof(off_t),deen_compare_refs);
+		deen_index_lookup_segments(
+			context->index_reader,
+			context->segments,
+			prefix,
+			lookup_result);
+
+		if (!lookup_result->refs_sorted) {
+			qsort(
+				lookup_result->refs,
+				lookup_result->refs_count,
+				sizeof(off_t),deen_compare_refs);
+		}
 
 		if (NULL==refs_combined) {
-			refs_combined = (off_t *) deen_emalloc(sizeof(off_t) * lookup_result->refs_count);
+			refs_combined = (off_t *) deen_emalloc(sizeof(off_t) * (lookup_result->refs_count + 1));
 			refs_combined_length = lookup_result->refs_count;
 			memcpy(refs_combined,lookup_result->refs,sizeof(off_t) * lookup_result->refs_count);
 		}
 		else {
-			refs_combined_length = deen_search_intersect_refs(
+			refs_combined_length = deen_posting_intersect(
 				refs_combined,
-				lookup_result->refs,
 				refs_combined_length,
+				lookup_result->refs,
 				lookup_result->refs_count);
 		}
 
 		deen_index_lookup_result_free(lookup_result);
+
+		if (0 == refs_combined_length) {
+			is_empty = DEEN_TRUE;
+		}
+	}
+
+	for (i = 0; i < keywords->count; i++) {
+		free((void *) costs[i].prefix);
 	}
 
-	free((void *) keyword_prefix_buffer);
+	free((void *) costs);
+
+	if (is_empty) {
+		refs_combined_length = 0;
+	}
 
 	// now take the references and load-up those lines that are
 	// at those references.  Then check that, for each line that
@@ -424,22 +902,23 @@ deen_search_result *deen_search(
 	search_result = deen_search_refs_to_result(
 		context, keywords,
 		refs_combined,
-		refs_combined_length);
+		refs_combined_length,
+		max_result_count);
 
-	deen_search_sort(search_result, keywords);
-	deen_search_crop(search_result, max_result_count);
+	if (NULL != refs_combined) {
+		free((void *) refs_combined);
+	}
 
 	return search_result;
 }
 
+/*
+The entries are all held in the result's arena and so they are freed with it.
+*/
+
 void deen_search_result_free(deen_search_result *result) {
 	if (NULL != result) {
-		uint32_t i;
-
-		for (i=0;i<result->entry_count;i++) {
-			deen_entry_free(&(result->entries[i]));
-		}
-
+		deen_arena_free(&(result->arena));
 		free((void *) result);
 	}
 }
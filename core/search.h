@@ -19,9 +19,23 @@
 
 deen_search_context *deen_search_init(char *deen_root_dir);
 
+/**
+ * As deen_search_init, but the caller is able to choose which form of the
+ * index is used.  With DEEN_INDEX_FORMAT_AUTOMATIC the map index is used if it
+ * is present and valid; otherwise the sqlite index is used.
+ */
+
+deen_search_context *deen_search_init_with_index_format(
+	char *deen_root_dir,
+	deen_index_format index_format);
+
 
 void deen_search_free(deen_search_context *context);
 
+/**
+ * If a newer install has been swapped in since the context was created then
+ * the context will be re-opened on it before the search is run.
+ */
 
 deen_search_result *deen_search(
 	deen_search_context *context,
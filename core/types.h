@@ -10,6 +10,7 @@
 #define __TYPES_H
 
 #include <sqlite3.h>
+#include <stdio.h>
 #include <sys/types.h>
 
 #include "constants.h"
@@ -38,6 +39,35 @@ enum deen_utf8_sequence_result {
 	DEEN_INCOMPLETE_SEQUENCE // UTF-8 sequence ran out of characters to consume
 };
 
+/*
+A word that was found in some text.  The offset is from the start of the text
+and the ref is the offset in the file of the start of the word's line.
+*/
+
+typedef struct deen_word_span deen_word_span;
+struct deen_word_span {
+	size_t offset;
+	size_t len;
+	off_t ref;
+};
+
+/*
+This maintains the position while the words in some text are found in batches
+of spans.  If the UTF-8 is checked and a bad sequence is found then the scan
+stops and the sequence result is set.
+*/
+
+typedef struct deen_word_scan deen_word_scan;
+struct deen_word_scan {
+	const uint8_t *c;
+	size_t c_len;
+	off_t ref; // offset in the file of the start of the text
+	size_t offset;
+	size_t line_start;
+	deen_bool is_utf8_checked;
+	deen_utf8_sequence_result sequence_result;
+};
+
 /*
 This is used to identify the first found keyword from a list of
 keywords within a string.  It is returned as the result of a
@@ -80,6 +110,12 @@ struct deen_entry_sub {
 };
 
 
+/*
+The subs, the sub subs, the atoms and the text of the atoms of an entry are all
+held in one block of memory.  The block is owned by the entry unless the entry
+was created in an arena; in which case the block is NULL.
+*/
+
 typedef struct deen_entry deen_entry;
 struct deen_entry {
     deen_entry_sub *german_subs;
@@ -87,49 +123,389 @@ struct deen_entry {
     uint32_t english_sub_count;
     uint32_t german_sub_count;
 	uint32_t distance_from_keywords;
+	void *block;
 };
 
 
+/*
+An arena hands out memory from large chunks so that many small pieces can be
+allocated quickly and then all freed together.
+*/
+
+typedef struct deen_arena_chunk deen_arena_chunk;
+struct deen_arena_chunk {
+	deen_arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+
+typedef struct deen_arena deen_arena;
+struct deen_arena {
+	deen_arena_chunk *chunks;
+};
+
+
+/*
+The entries of a result and everything that they hold are in the arena of the
+result so that the result is freed in one go.
+*/
+
 typedef struct deen_search_result deen_search_result;
 struct deen_search_result {
     uint32_t total_count;
     uint32_t entry_count;
     deen_entry *entries;
+    deen_arena arena;
+};
+
+
+/*
+An entry parser splits the german and the english text of a line into subs, sub
+subs and atoms without copying any of the text; each atom is a span of the text
+that it came from.  The sub and the sub sub arrays hold the index of the first
+sub sub or atom that each has.  The subs from 'english_first_sub' onwards and
+the atoms from 'english_first_atom' onwards are of the english text.  A parser
+is reused from one line to the next so that its arrays are not allocated again.
+*/
+
+typedef struct deen_entry_span deen_entry_span;
+struct deen_entry_span {
+	enum deen_entry_atom_type type;
+	size_t offset;
+	size_t len;
+};
+
+
+typedef struct deen_entry_parser deen_entry_parser;
+struct deen_entry_parser {
+	const uint8_t *german;
+	const uint8_t *english;
+	size_t english_first_sub;
+	size_t english_first_atom;
+	uint32_t *sub_firsts;
+	size_t subs_count;
+	size_t subs_allocated;
+	uint32_t *sub_sub_firsts;
+	size_t sub_subs_count;
+	size_t sub_subs_allocated;
+	deen_entry_span *spans;
+	size_t spans_count;
+	size_t spans_allocated;
+	size_t text_len; // of all of the atoms; each with a terminator.
+};
+
+
+/*
+The index may be stored in the sqlite database or in the memory-mapped map
+index.  A search may be asked to use either or to choose for itself; in which
+case the map index is preferred if it is present.
+*/
+
+typedef enum deen_index_format deen_index_format;
+enum deen_index_format {
+	DEEN_INDEX_FORMAT_AUTOMATIC,
+	DEEN_INDEX_FORMAT_SQLITE,
+	DEEN_INDEX_FORMAT_MAP
+};
+
+
+/*
+This is a map index that has been mapped into memory for searching.
+*/
+
+typedef struct deen_map_index deen_map_index;
+struct deen_map_index {
+	uint8_t *data;
+	size_t data_len;
+	const uint8_t *prefixes;
+	uint64_t prefix_count;
+	const int64_t *refs;
+	uint64_t ref_count;
+};
+
+
+/*
+This describes the data that an index was built from and how it was built.  It
+is stored in the index so that an install of the same data can be skipped and
+so that an index that was built differently is not used.
+*/
+
+typedef struct deen_index_metadata deen_index_metadata;
+struct deen_index_metadata {
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint32_t indexing_depth;
+	uint32_t format_version;
+};
+
+
+/*
+A checkpoint records how far a build of the index had got so that the build is
+able to carry on from there if it stops.  The pairs for the lines up to 'ref'
+are in the first 'runs_count' runs and the data up to 'ref' has been copied.
+The hash is of the data up to 'ref' so that it is possible to check that the
+same data is being installed when the build carries on.
+*/
+
+typedef struct deen_index_checkpoint deen_index_checkpoint;
+struct deen_index_checkpoint {
+	uint64_t ref;
+	uint64_t source_hash;
+	uint32_t runs_count;
+	uint32_t format_version;
+};
+
+
+/*
+Measurements of an install so that the performance of installs is able to be
+compared between machines and between releases.  The time spent tokenizing is
+added up over all of the workers so it may be more than the elapsed time.
+Sorting, spilling and merging the pairs is where the duplicate prefixes are
+removed.  Loading the tables and creating the indexes are the writes to the
+database.  The sizes are of the files that are installed.
+*/
+
+typedef struct deen_install_stats deen_install_stats;
+struct deen_install_stats {
+	deen_millis elapsed_millis;
+	deen_millis read_millis;
+	deen_millis tokenize_millis;
+	deen_millis sort_millis;
+	deen_millis spill_millis;
+	deen_millis merge_millis;
+	deen_millis load_millis;
+	deen_millis create_indexes_millis;
+
+	uint64_t bytes_read;
+	uint64_t lines_count;
+	uint64_t prefixes_count;
+	uint64_t index_rows_count;
+
+	uint64_t data_size;
+	uint64_t index_size;
+	uint64_t map_index_size;
+	uint64_t peak_rss;
+};
+
+
+/*
+This identifies a version of a file.  An install moves new files into place
+rather than writing over the existing ones so a changed file has a different
+identity.
+*/
+
+typedef struct deen_file_generation deen_file_generation;
+struct deen_file_generation {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+};
+
+
+/*
+The data file only ever grows between full installs.  Lines that are added
+after the base of the index was built are appended to the data and are indexed
+in a delta segment.  A segment records the range of the data that it added and
+where the lines came from.  Lines that are deleted stay in the data but their
+refs are recorded as tombstones so that they are no longer found.
+*/
+
+typedef enum deen_segment_kind deen_segment_kind;
+enum deen_segment_kind {
+	DEEN_SEGMENT_KIND_SOURCE = 1, // lines from the Ding data
+	DEEN_SEGMENT_KIND_LOCAL = 2 // lines added by the user
+};
+
+
+typedef struct deen_index_segment deen_index_segment;
+struct deen_index_segment {
+	uint32_t id;
+	deen_segment_kind kind;
+	off_t ref_start;
+	off_t ref_end;
+};
+
+
+/*
+The segments of an index and the tombstones, ordered, as they are read from the
+index.  If there are delta segments with refs then the refs for a prefix need
+to be gathered from them as well as from the base.
+*/
+
+typedef struct deen_index_segments deen_index_segments;
+struct deen_index_segments {
+	deen_index_segment *segments;
+	size_t segments_count;
+	size_t segments_with_refs_count;
+	off_t *tombstones;
+	size_t tombstones_count;
+};
+
+
+/*
+A slot in the table of the prefixes of the base of the index that a reader
+holds in memory.  A slot with a zero id is empty.
+*/
+
+typedef struct deen_index_reader_prefix deen_index_reader_prefix;
+struct deen_index_reader_prefix {
+	uint8_t prefix[DEEN_INDEX_PREFIX_WIDTH];
+	uint32_t id;
+	uint32_t refs_count;
+};
+
+
+/*
+Reads the index for the searches of a long-lived context.  The statements are
+prepared once and the prefixes of the base are held in a hash table so that a
+lookup reads the row of refs by its id without searching for the prefix.
+*/
+
+typedef struct deen_index_reader deen_index_reader;
+struct deen_index_reader {
+	sqlite3 *db;
+	sqlite3_stmt *ref_stmt;
+	sqlite3_stmt *segment_ref_stmt;
+	sqlite3_stmt *segment_ref_count_stmt;
+	deen_index_reader_prefix *prefix_slots;
+	size_t prefix_slots_size; // a power of two
+	size_t prefixes_count;
+	deen_bool is_prefixes_read;
 };
 
 
 typedef struct deen_search_context deen_search_context;
 struct deen_search_context {
     sqlite3 *db;
+    deen_map_index *map_index;
+    deen_index_reader *index_reader;
+    deen_index_segments *segments;
     int fd_data;
+
+    // the data is mapped if possible so that the lines can be checked where
+    // they are; otherwise they are read from the file.
+    const uint8_t *data;
+    size_t data_len;
+
+    // reused to parse the lines of the results into entries.
+    deen_entry_parser entry_parser;
+
+    // what was opened so that a newer install can be noticed and opened.
+    char *deen_root_dir;
+    deen_index_format index_format;
+    deen_file_generation generation;
+};
+
+
+/*
+The bulk index builder gathers (prefix, ref) pairs rather than writing each
+line to the database as it is encountered.  The prefix is held at a fixed width
+and is padded with zeros so that pairs can be ordered with a simple memcmp.
+*/
+
+typedef struct deen_index_pair deen_index_pair;
+struct deen_index_pair {
+	uint8_t prefix[DEEN_INDEX_PREFIX_WIDTH];
+	off_t ref;
 };
 
 
 /*
-This struct maintains state around the database connection as well as any
-statements that can be re-used as part of the indexing process.  This
-avoids repeated parsing the SQL statements.
+This struct maintains state around the database connection as well as the
+pairs that are gathered in memory during the indexing process.  When the
+memory budget is used up, the pairs are sorted and spilled to a temporary file
+as a "run".  Once all of the pairs are gathered, the runs are merged so that
+the tables can be loaded in key order.
+*/
+
+/*
+This is used to write out the map index as the pairs are loaded.  The prefix
+table is gathered in memory and written after the refs.
 */
 
+typedef struct deen_map_index_writer deen_map_index_writer;
+struct deen_map_index_writer {
+	FILE *file;
+	deen_bool is_error;
+	uint8_t *prefixes;
+	uint64_t prefix_count;
+	uint64_t prefix_allocated;
+	uint64_t ref_count;
+};
+
+
 typedef struct deen_index_add_context deen_index_add_context;
 struct deen_index_add_context {
 
 	sqlite3 *db;
 
-	sqlite3_stmt *prefix_insert_stmt;
+	deen_index_pair *pairs;
+	size_t pairs_count;
+	size_t pairs_allocated;
+	size_t pairs_budget;
+
+	FILE **runs;
+	size_t runs_count;
+
+	// if present then the runs are kept in files in this directory rather
+	// than in temporary files so that they are there if the indexing is
+	// resumed.  The runs up to the synced count are in storage.
+	char *runs_dir;
+	size_t runs_synced_count;
+
+	// the pairs are sorted and merged in this many shards, each of which
+	// covers a range of the first bytes of the prefixes.  The number of
+	// pairs with each first byte is used to balance the shards.
+	size_t shards_count;
+	size_t first_byte_counts[256];
+
+	// the refs for the prefix being written to the map index.
+	off_t *prefix_refs;
+	size_t prefix_refs_allocated;
+
+	// if present, the merged pairs are also written to the map index.
+	deen_map_index_writer *map_index_writer;
+
+	// if not zero then the pairs are loaded into this delta segment rather
+	// than into the base of the index.
+	uint32_t segment_id;
+
+	// measurements of how long the stages of the build took and of the
+	// number of prefixes that were loaded.
+	deen_millis sort_millis;
+	deen_millis spill_millis;
+	deen_millis merge_millis;
+	deen_millis load_millis;
+	deen_millis create_indexes_millis;
+	size_t prefixes_loaded_count;
+
+};
 
-	sqlite3_stmt **find_existing_prefixes_stmts;
-	size_t find_existing_prefixes_stmts_count;
 
-	sqlite3_stmt **ref_insert_stmts;
-	size_t ref_insert_stmts_count;
+/*
+This is used to work out which lines have changed between the installed data
+and a new version of the data.  The installed lines are held in an
+open-addressing hash table; a bucket with a zero length is empty.
+*/
+
+typedef struct deen_delta_line deen_delta_line;
+struct deen_delta_line {
+	uint64_t hash;
+	off_t ref;
+	size_t len;
+	deen_bool is_matched;
+};
 
-#ifdef DEBUG
-	deen_millis find_existing_prefixes_millis;
-	deen_millis add_missing_prefixes_millis;
-	deen_millis add_refs_millis;
-#endif
 
+typedef struct deen_delta deen_delta;
+struct deen_delta {
+	const uint8_t *installed;
+	size_t installed_len;
+	deen_delta_line *lines;
+	size_t lines_size;
+	size_t lines_count;
 };
 
 
@@ -138,6 +514,7 @@ struct deen_keywords
 {
 	uint32_t count;
 	uint8_t **keywords;
+	size_t *keyword_lens; // bytes in each keyword
 };
 
 
@@ -145,6 +522,9 @@ typedef struct deen_index_lookup_result deen_index_lookup_result;
 struct deen_index_lookup_result {
 	off_t *refs;
 	uint32_t refs_count;
+	// false if the refs point into memory that the result does not own.
+	deen_bool refs_owned;
+	deen_bool refs_sorted;
 };
 
 
@@ -110,10 +110,6 @@ deen_bool deen_ggtk_check_input_file_ding_format() {
 	switch (deen_install_check_for_ding_format(path)) {
 		case DEEN_INSTALL_CHECK_OK:
 			return DEEN_TRUE;
-		case DEEN_INSTALL_CHECK_IS_COMPRESSED:
-			msg = "The input file appears to be compressed.  Decompress the "
-				"input file before using it.";
-			break;
 		case DEEN_INSTALL_CHECK_IO_PROBLEM:
 			msg = "The input file was unable to be read.";
 			break;
@@ -211,7 +207,9 @@ void *deen_ggtk_run_install_thread(void *data) {
 		filename,
 		NULL,
 		deen_ggtk_install_progress_cb,
-		deen_ggtk_is_cancelled_cb);
+		deen_ggtk_is_cancelled_cb,
+		NULL // no stats
+	);
 
 	free(root_dir);
 	g_free(filename);
@@ -9,6 +9,7 @@
 #include "ggtkrendertextbuffer.h"
 
 #include "ggtkgeneral.h"
+#include "core/common.h"
 #include "core/keyword.h"
 
 #define NUMBER_PREFIX_BUFFER_LEN 32
@@ -87,8 +88,7 @@ static void deen_ggtk_render_plain_text_highlights(
 
 			is_valid_keyword_found =
 				0 == first_keyword.offset ||
-				isspace(text[first_keyword.offset-1]) ||
-				ispunct(text[first_keyword.offset-1]);
+				!DEEN_IS_WORD_BYTE(text[first_keyword.offset-1]);
 
 			if(is_valid_keyword_found) {
 				deen_ggtk_append_to_textbuffer_with_tag(